@@ -0,0 +1,104 @@
+/*
+ * Example handler module:
+ *
+ *     make hello_module.so && ./httpd -m ./hello_module.so:hi
+ *
+ *   GET /hello        -> a constant body sent in place
+ *   GET /hello/:name  -> "<greeting>, <name>", with the number of requests
+ *                        this worker has served so far in X-Worker-Served
+ *
+ * Built against httpd_module.h alone.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "httpd_module.h"
+
+typedef struct {
+    const httpd_host_api_t *host;
+    char greeting[64];
+} hello_state_t;
+
+/* Per-worker; only ever touched by its own worker thread. */
+typedef struct {
+    int worker_id;
+    unsigned long long served;
+} hello_worker_t;
+
+static int hello_index(const httpd_request_t *req, httpd_response_t *resp, void *worker_ctx, void *route_data) {
+    static const char body[] = "hello module\n";
+    const hello_state_t *state = route_data;
+    hello_worker_t *worker = worker_ctx;
+    (void)req;
+    if (worker == NULL) {
+        return -1;
+    }
+    ++worker->served;
+    return state->host->respond_static(resp, 200, "text/plain", body, sizeof(body) - 1);
+}
+
+static int hello_name(const httpd_request_t *req, httpd_response_t *resp, void *worker_ctx, void *route_data) {
+    const hello_state_t *state = route_data;
+    hello_worker_t *worker = worker_ctx;
+    const httpd_str_t *name = &req->params[0];
+    if (worker == NULL) {
+        return -1;
+    }
+
+    char served[32];
+    snprintf(served, sizeof(served), "%llu", ++worker->served);
+    if (state->host->add_header(resp, "X-Worker-Served", served) != 0) {
+        return -1;
+    }
+    char body[512];
+    int n = snprintf(body, sizeof(body), "%s, %.*s\n", state->greeting, (int)name->len, name->ptr);
+    if (n < 0 || (size_t)n >= sizeof(body)) {
+        return state->host->respond(resp, 414, "text/plain", "name too long\n", 14);
+    }
+    return state->host->respond(resp, 200, "text/plain", body, (size_t)n);
+}
+
+static int hello_init(const httpd_host_api_t *host, httpd_registrar_t *reg, const char *arg, void **module_state) {
+    hello_state_t *state = calloc(1, sizeof(*state));
+    if (state == NULL) {
+        return -1;
+    }
+    state->host = host;
+    snprintf(state->greeting, sizeof(state->greeting), "%s", arg[0] != '\0' ? arg : "hello");
+    if (host->route(reg, HTTPD_METHOD_BIT(HTTPD_METHOD_GET), "/hello", hello_index, state) != 0 ||
+        host->route(reg, HTTPD_METHOD_BIT(HTTPD_METHOD_GET), "/hello/:name", hello_name, state) != 0) {
+        free(state);
+        return -1;
+    }
+    *module_state = state;
+    return 0;
+}
+
+static void *hello_worker_init(void *module_state, int worker_id) {
+    (void)module_state;
+    hello_worker_t *worker = calloc(1, sizeof(*worker));
+    if (worker != NULL) {
+        worker->worker_id = worker_id;
+    }
+    return worker;
+}
+
+static void hello_worker_destroy(void *module_state, void *worker_ctx) {
+    (void)module_state;
+    free(worker_ctx);
+}
+
+static void hello_destroy(void *module_state) {
+    free(module_state);
+}
+
+const httpd_module_t httpd_module = {
+    .abi_version = HTTPD_MODULE_ABI_VERSION,
+    .name = "hello",
+    .init = hello_init,
+    .worker_init = hello_worker_init,
+    .worker_destroy = hello_worker_destroy,
+    .destroy = hello_destroy,
+};
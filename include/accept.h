@@ -0,0 +1,38 @@
+#ifndef ACCEPT_H
+#define ACCEPT_H
+
+#include "server.h"
+#include "worker.h"
+
+/*
+ * How new connections reach the workers (--accept-mode):
+ *
+ *   reuseport-hash  every worker has its own SO_REUSEPORT listener and the
+ *                   kernel hashes each connection's 4-tuple to one of them.
+ *   reuseport-cpu   the same listeners, with a classic BPF program on the
+ *                   group that picks the listener of the CPU that received
+ *                   the SYN; worker i is pinned to a CPU the program maps to
+ *                   i, so a connection is served where its packets land.
+ *   exclusive       one listener shared by every worker, registered with
+ *                   EPOLLEXCLUSIVE so a new connection wakes one waiting
+ *                   worker, which takes one connection per readiness report.
+ *   acceptor        one listener drained by a dedicated thread that hands
+ *                   each socket to the worker with the fewest connections,
+ *                   through the worker's handoff queue (see rebalance.h).
+ *
+ * Listeners are opened before the workers start, so the reuseport group's
+ * order matches worker ids.
+ */
+
+const char *accept_mode_name(server_accept_mode_t mode);
+
+/* Open the listeners for cfg.accept_mode and set each worker's listen_fd (-1 when the acceptor feeds it). */
+int accept_open(worker_ctx_t *ctxs, int count);
+/* On a worker's own thread before its loop: pin it to its CPU under reuseport-cpu. */
+void accept_worker_enter(worker_ctx_t *ctx);
+/* Start the acceptor thread in acceptor mode; nothing to do otherwise. */
+int accept_start(worker_ctx_t *ctxs, int count);
+/* Once the workers have stopped: join the acceptor and close the listeners. */
+void accept_close(worker_ctx_t *ctxs, int count);
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef H2_H
+#define H2_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "http_parser.h"
+#include "http_router.h"
+#include "pool.h"
+#include "server.h"
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN 24
+#define H2_MAX_CONCURRENT_STREAMS 100
+
+struct worker_ctx;
+struct h2_session;
+
+/* A worker's HTTP/2 session and stream state. */
+typedef struct {
+    slab_pool_t sessions;
+    slab_pool_t streams;
+} h2_pool_t;
+
+/*
+ * HTTP/2 over cleartext TCP (RFC 9113), entered with prior knowledge (the
+ * connection opens with the client preface) or from an HTTP/1.1 request
+ * carrying "Upgrade: h2c". Each stream's request is rebuilt as HTTP/1.1
+ * text and goes through the same parser and router as any other; its
+ * response keeps its usual windows and segments, and the session frames it.
+ *
+ * Output leaves through one response of the session's own, the wire, which
+ * the engines send like any other: a batch of control, HEADERS and DATA
+ * frames copied into its memory window, optionally followed by a file range
+ * that a DATA frame header at the end of the batch announces, so static
+ * files still go out with sendfile() or splice. The wire sits in the
+ * connection's queue only while a batch is in flight; each time one drains
+ * the next is built, round-robin across streams within the flow-control
+ * windows.
+ */
+
+int h2_pool_init(h2_pool_t *pool);
+void h2_pool_destroy(h2_pool_t *pool);
+
+/* 1 when buf[0, len) holds the client preface, 0 while it could still be one, -1 when it is not. */
+int h2_preface_match(const char *buf, size_t len);
+/* Whether req asks to switch to h2c and carries the settings to do it. */
+bool h2_upgrade_requested(const http_request_t *req);
+/* Interim "101 Switching Protocols" to h2c; counted by neither the response nor the latency metrics. */
+int h2_build_upgrade_response(http_response_t *resp);
+
+/* Turn a fresh connection whose input starts with the preface into an HTTP/2 one. */
+int h2_session_start(struct worker_ctx *ctx, connection_t *conn);
+/*
+ * Switch to HTTP/2 after the 101 for req has been queued: req, whose bytes
+ * are raw[0, raw_len), becomes stream 1. Returns -1, leaving the connection
+ * untouched, if its HTTP2-Settings are invalid.
+ */
+int h2_session_upgrade(
+    struct worker_ctx *ctx,
+    connection_t *conn,
+    const http_request_t *req,
+    const char *raw,
+    size_t raw_len
+);
+void h2_session_destroy(struct worker_ctx *ctx, connection_t *conn);
+
+/*
+ * Process every complete frame in the input buffer, then queue the wire if
+ * there is something to send. Returns -1 if the connection must be dropped
+ * at once.
+ */
+int h2_session_input(struct worker_ctx *ctx, connection_t *conn);
+/* Whether resp is the session's wire. */
+bool h2_session_is_wire(const struct h2_session *s, const http_response_t *resp);
+/*
+ * The wire has drained: retire the streams it finished and load the next
+ * batch, or take the wire out of the queue. Returns true once the session
+ * has sent its GOAWAY and the connection should close.
+ */
+bool h2_session_sent(struct worker_ctx *ctx, connection_t *conn);
+/* Whether streams are open, waiting for request data or window updates. */
+bool h2_session_active(const struct h2_session *s);
+
+#endif
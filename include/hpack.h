@@ -0,0 +1,71 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Dynamic table limit we advertise (the SETTINGS_HEADER_TABLE_SIZE default). */
+#define HPACK_TABLE_SIZE 4096
+/* Every entry costs at least 32 bytes, so this many fit at most. */
+#define HPACK_ENTRIES_MAX (HPACK_TABLE_SIZE / 32)
+/* Longest name or value a header block may decode to. */
+#define HPACK_STRING_MAX (8 * 1024)
+
+typedef struct {
+    uint32_t off;
+    uint32_t name_len;
+    uint32_t value_len;
+} hpack_entry_t;
+
+/*
+ * Decoding state of one connection (RFC 7541). Entry bytes are appended to
+ * data and evicted from its front; when an entry no longer fits at the end,
+ * the live bytes are moved down once so every name and value stays
+ * contiguous. entries is a ring, newest at next - 1.
+ */
+typedef struct {
+    size_t max_size;
+    size_t size;
+    unsigned next;
+    unsigned count;
+    size_t data_start;
+    size_t data_end;
+    hpack_entry_t entries[HPACK_ENTRIES_MAX];
+    char data[HPACK_TABLE_SIZE];
+} hpack_decoder_t;
+
+/*
+ * Receives each decoded field in order. The strings are valid only for the
+ * duration of the call and are not NUL-terminated.
+ */
+typedef void (*hpack_emit_fn)(void *arg, const char *name, size_t name_len, const char *value, size_t value_len);
+
+/* Build the Huffman decoding tables. Call once before any decoding. */
+void hpack_init(void);
+
+void hpack_decoder_init(hpack_decoder_t *dec);
+/*
+ * Decode one complete header block. Returns -1 on a compression error, after
+ * which the decoder state is unusable and the connection must be dropped.
+ */
+int hpack_decode(hpack_decoder_t *dec, const uint8_t *block, size_t len, hpack_emit_fn emit, void *arg);
+
+/*
+ * Encoders for response heads. Fields go out as literals that are never
+ * added to the peer's dynamic table, so no encoder state is kept; names are
+ * lowercased and use a static table index where there is one. Each returns
+ * the bytes written, or -1 if they do not fit in cap.
+ */
+ssize_t hpack_encode_status(int status, uint8_t *out, size_t cap);
+ssize_t hpack_encode_field(
+    const char *name,
+    size_t name_len,
+    const char *value,
+    size_t value_len,
+    uint8_t *out,
+    size_t cap
+);
+
+#endif
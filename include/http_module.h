@@ -0,0 +1,52 @@
+#ifndef HTTP_MODULE_H
+#define HTTP_MODULE_H
+
+#include <stdbool.h>
+
+#include "http_parser.h"
+#include "http_route_table.h"
+#include "httpd_module.h"
+
+#define HTTP_MODULES_MAX 8
+#define HTTP_MODULE_PATH_CAP 1024
+#define HTTP_MODULE_ARG_CAP 256
+
+struct http_response;
+
+/* One -m path[:arg] option. */
+typedef struct {
+    char path[HTTP_MODULE_PATH_CAP];
+    char arg[HTTP_MODULE_ARG_CAP];
+} http_module_spec_t;
+
+/* A route registered by a module; the route table points at it. */
+typedef struct http_module_route {
+    unsigned module;
+    httpd_handler_fn handler;
+    void *route_data;
+} http_module_route_t;
+
+/*
+ * Load every module and let it register its routes with the router, which
+ * must already be initialised. Call before workers start; on failure the
+ * modules loaded so far are unloaded again.
+ */
+int http_modules_load(const http_module_spec_t *specs, size_t count);
+/* Destroy and dlclose every module; call after workers have stopped and the router is gone. */
+void http_modules_unload(void);
+
+/* Per-worker contexts, created and destroyed on the worker thread. */
+void http_modules_worker_init(void *ctx[HTTP_MODULES_MAX], int worker_id);
+void http_modules_worker_destroy(void *ctx[HTTP_MODULES_MAX]);
+
+/* Run a module route for req; -1 when it failed or did not respond. */
+int http_module_handle(
+    const http_module_route_t *route,
+    const http_request_t *req,
+    const http_route_match_t *match,
+    struct http_response *resp,
+    void *const module_ctx[HTTP_MODULES_MAX],
+    bool close_after_send
+);
+
+#endif
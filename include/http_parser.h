@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 #define HTTP_MAX_METHOD_LEN 15
 #define HTTP_MAX_PATH_LEN 2047
@@ -11,29 +13,257 @@
 #define HTTP_MAX_HEADER_VALUE_LEN 1023
 #define HTTP_MAX_HEADERS 64
 #define HTTP_MAX_CONTENT_LENGTH (128 * 1024)
+#define HTTP_MAX_REQUEST_LINE_LEN 4095
+#define HTTP_MAX_HEADER_LINE_LEN (HTTP_MAX_HEADER_NAME_LEN + 1 + HTTP_MAX_HEADER_VALUE_LEN)
 
+/* Non-owning (pointer, length) slice; not NUL-terminated. */
 typedef struct {
-    char method[HTTP_MAX_METHOD_LEN + 1];
-    char path[HTTP_MAX_PATH_LEN + 1];
-    char version[HTTP_MAX_VERSION_LEN + 1];
+    const char *ptr;
+    size_t len;
+} http_view_t;
+
+/* Request methods the parser recognises (case-insensitively); everything else is HTTP_METHOD_OTHER. */
+typedef enum {
+    HTTP_METHOD_OTHER = 0,
+    HTTP_METHOD_GET,
+    HTTP_METHOD_HEAD,
+    HTTP_METHOD_POST,
+    HTTP_METHOD_PUT,
+    HTTP_METHOD_DELETE,
+    HTTP_METHOD_OPTIONS,
+    HTTP_METHOD_PATCH,
+    HTTP_METHOD_COUNT
+} http_method_t;
+
+/* Headers the parser recognises by name; everything else is HTTP_HDR_OTHER. */
+typedef enum {
+    HTTP_HDR_HOST = 0,
+    HTTP_HDR_CONNECTION,
+    HTTP_HDR_CONTENT_LENGTH,
+    HTTP_HDR_CONTENT_TYPE,
+    HTTP_HDR_TRANSFER_ENCODING,
+    HTTP_HDR_ACCEPT,
+    HTTP_HDR_ACCEPT_ENCODING,
+    HTTP_HDR_IF_NONE_MATCH,
+    HTTP_HDR_IF_MODIFIED_SINCE,
+    HTTP_HDR_RANGE,
+    HTTP_HDR_IF_RANGE,
+    HTTP_HDR_EXPECT,
+    HTTP_HDR_UPGRADE,
+    HTTP_HDR_HTTP2_SETTINGS,
+    HTTP_HDR_COOKIE,
+    HTTP_HDR_USER_AGENT,
+    HTTP_HDR_AUTHORIZATION,
+    HTTP_HDR_KNOWN_COUNT,
+    HTTP_HDR_OTHER = HTTP_HDR_KNOWN_COUNT
+} http_header_id_t;
+
+typedef struct {
+    http_view_t name;
+    http_view_t value;
+    http_header_id_t id;
+} http_header_t;
+
+/* Content codings the server can serve, in ascending order of preference. */
+typedef enum {
+    HTTP_ENCODING_IDENTITY = 0,
+    HTTP_ENCODING_GZIP,
+    HTTP_ENCODING_ZSTD,
+    HTTP_ENCODING_BR,
+    HTTP_ENCODING_COUNT
+} http_encoding_t;
+
+#define HTTP_QVALUE_MAX 1000
+#define HTTP_RANGES_MAX 8
+
+/* A satisfiable byte range, clipped to the representation. */
+typedef struct {
+    off_t start;
+    off_t length;
+} http_byte_range_t;
+
+typedef enum {
+    HTTP_RANGE_NONE = 0,        /* absent, malformed or too many ranges: serve the whole body */
+    HTTP_RANGE_OK,
+    HTTP_RANGE_UNSATISFIABLE
+} http_range_result_t;
+
+/*
+ * Parsed request. All views point into the buffer passed to the parser and
+ * are valid until that buffer is modified. known[id] holds 1 + the index of
+ * the first header with that id, or 0 when absent.
+ */
+typedef struct {
+    http_view_t method;
+    http_method_t method_id;
+    http_view_t path;
+    http_view_t version;
+    http_header_t headers[HTTP_MAX_HEADERS];
+    size_t header_count;
+    uint8_t known[HTTP_HDR_KNOWN_COUNT];
     size_t content_length;
     bool connection_close;
+    bool chunked;
+    bool expect_continue;
     const char *body;
     size_t body_len;
 } http_request_t;
 
+/* Header position recorded by the parser; offsets are relative to the request start. */
+typedef struct {
+    uint32_t name_off;
+    uint32_t value_off;
+    uint16_t name_len;
+    uint16_t value_len;
+    uint8_t id;
+} http_header_span_t;
+
 typedef enum {
     HTTP_PARSE_INCOMPLETE = 0,
     HTTP_PARSE_OK = 1,
-    HTTP_PARSE_ERROR = 2
+    HTTP_PARSE_ERROR = 2,
+    HTTP_PARSE_HEADERS = 3      /* head of a request with a body is complete (report_headers) */
 } http_parse_result_t;
 
+typedef enum {
+    HTTP_PARSER_REQUEST_LINE = 0,
+    HTTP_PARSER_HEADERS,
+    HTTP_PARSER_BODY,
+    HTTP_PARSER_DONE
+} http_parser_state_t;
+
+/* Position inside a chunked body. */
+typedef enum {
+    HTTP_CHUNK_SIZE = 0,
+    HTTP_CHUNK_EXT,
+    HTTP_CHUNK_SIZE_LF,
+    HTTP_CHUNK_DATA,
+    HTTP_CHUNK_DATA_CR,
+    HTTP_CHUNK_DATA_LF,
+    HTTP_CHUNK_TRAILER_START,
+    HTTP_CHUNK_TRAILER_LINE,
+    HTTP_CHUNK_TRAILER_LF,
+    HTTP_CHUNK_TRAILER_END_LF,
+    HTTP_CHUNK_DONE
+} http_chunk_state_t;
+
+/*
+ * Resumable request parser. Every byte is examined once across calls; all
+ * positions are offsets from the start of the request so the caller may move
+ * or grow its buffer between calls as long as the bytes are preserved.
+ *
+ * A chunked body is decoded in place: chunk data is moved down to follow the
+ * header block as it arrives, so the decoded body ends up contiguous in the
+ * caller's buffer without a second copy. Only bytes the parser has already
+ * consumed are overwritten.
+ *
+ * With report_headers set, a request that carries a body is first returned
+ * as HTTP_PARSE_HEADERS (body empty) once its head is complete, so the caller
+ * can decide how the body is read: call http_parser_execute() again to
+ * buffer it whole, subject to body_limit, or drop the head and pull it piece
+ * by piece with http_parser_read_body().
+ */
+typedef struct {
+    http_parser_state_t state;
+    size_t scan_pos;
+    size_t line_start;
+    size_t header_block_len;
+    size_t header_count;
+
+    size_t method_off;
+    size_t method_len;
+    http_method_t method_id;
+    size_t path_off;
+    size_t path_len;
+    size_t version_off;
+    size_t version_len;
+
+    http_header_span_t headers[HTTP_MAX_HEADERS];
+    uint8_t known[HTTP_HDR_KNOWN_COUNT];
+
+    size_t content_length;
+    bool saw_content_length;
+    bool connection_close;
+    bool expect_continue;
+    bool report_headers;
+    bool headers_reported;
+    size_t body_limit;          /* largest buffered body; HTTP_MAX_CONTENT_LENGTH by default */
+
+    bool chunked;
+    http_chunk_state_t chunk_state;
+    size_t chunk_remaining;     /* data bytes left in the current chunk, or the size being parsed */
+    size_t chunk_digits;
+    size_t chunk_line_len;      /* bytes of the current extension or trailer line */
+    size_t raw_pos;             /* next undecoded byte */
+    size_t body_len;            /* decoded bytes, stored from header_block_len */
+    size_t body_total;          /* body bytes decoded or handed out so far */
+} http_parser_t;
+
+void http_parser_init(http_parser_t *parser);
+http_parse_result_t http_parser_execute(
+    http_parser_t *parser,
+    char *buf,
+    size_t len,
+    http_request_t *out,
+    size_t *consumed,
+    int *error_status
+);
+/*
+ * Drop chunk framing already decoded from an incomplete request in buf[0, len)
+ * by moving the undecoded tail down to the end of the decoded body. Returns
+ * the new length; the framing overhead then never counts against the buffer.
+ */
+size_t http_parser_compact(http_parser_t *parser, char *buf, size_t len);
+/*
+ * Streamed body, after HTTP_PARSE_HEADERS: buf[0, len) holds the bytes that
+ * follow what was consumed so far (the head first, then earlier calls). The
+ * next *data_len body bytes are left at the start of buf (chunked framing is
+ * decoded in place) and *consumed input bytes may be dropped afterwards.
+ * Returns HTTP_PARSE_OK after the last piece; there is no size limit.
+ */
+http_parse_result_t http_parser_read_body(
+    http_parser_t *parser,
+    char *buf,
+    size_t len,
+    size_t *data_len,
+    size_t *consumed,
+    int *error_status
+);
+
 http_parse_result_t http_parse_request(
-    const char *buf,
+    char *buf,
     size_t len,
     http_request_t *out,
     size_t *consumed,
     int *error_status
 );
 
+const http_view_t *http_request_header(const http_request_t *req, http_header_id_t id);
+const http_view_t *http_request_find_header(const http_request_t *req, const char *name);
+/*
+ * Fill q[] with the quality (0..HTTP_QVALUE_MAX) the client assigned to each
+ * coding in an Accept-Encoding value; value == NULL means identity only.
+ */
+void http_accept_encoding(const http_view_t *value, uint16_t q[HTTP_ENCODING_COUNT]);
+const char *http_encoding_name(http_encoding_t encoding);
+/* File name suffix of a precompressed sidecar, e.g. ".gz"; "" for identity. */
+const char *http_encoding_suffix(http_encoding_t encoding);
+/* If-None-Match: whether the entity-tag list value matches etag ("*" matches anything). */
+bool http_etag_list_match(const http_view_t *value, const char *etag);
+/*
+ * Parse a Range value against a body of size bytes. Up to cap ranges are
+ * stored in request order; unsatisfiable specs are dropped, and if none is
+ * left the result is HTTP_RANGE_UNSATISFIABLE.
+ */
+http_range_result_t http_parse_range(
+    const http_view_t *value,
+    off_t size,
+    http_byte_range_t *ranges,
+    size_t cap,
+    size_t *count
+);
+
+bool http_view_eq(const http_view_t *view, const char *s);
+bool http_view_case_eq(const http_view_t *view, const char *s);
+
 #endif
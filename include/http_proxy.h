@@ -0,0 +1,95 @@
+#ifndef HTTP_PROXY_H
+#define HTTP_PROXY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "http_parser.h"
+
+#define HTTP_PROXIES_MAX 8
+#define HTTP_PROXY_PREFIX_CAP 128
+#define HTTP_PROXY_UPSTREAM_CAP 256
+/* Largest upstream response head accepted; bigger ones get a 502. */
+#define HTTP_PROXY_HEAD_CAP (16 * 1024)
+
+/*
+ * One -P prefix=upstream option. upstream is "host:port" or "unix:/path",
+ * optionally followed by a base path ("host:port/v1", "unix:/path:/v1") that
+ * then replaces the prefix in forwarded paths; without one they go as is.
+ */
+typedef struct {
+    char prefix[HTTP_PROXY_PREFIX_CAP];
+    char upstream[HTTP_PROXY_UPSTREAM_CAP];
+} http_proxy_spec_t;
+
+/* How the body of an upstream response ends. */
+typedef enum {
+    HTTP_FRAMING_NONE = 0,      /* no body: HEAD, 1xx, 204, 304 */
+    HTTP_FRAMING_LENGTH,        /* content_length bytes */
+    HTTP_FRAMING_CHUNKED,       /* chunked, relayed without decoding */
+    HTTP_FRAMING_CLOSE          /* until the upstream closes */
+} http_framing_t;
+
+typedef struct {
+    int status;
+    size_t head_len;            /* through the blank line */
+    http_framing_t framing;
+    uint64_t content_length;
+    bool keep_alive;            /* the connection may carry another request afterwards */
+} http_upstream_head_t;
+
+/* Where a relayed chunked body stands; only framing is tracked, nothing is copied. */
+typedef struct {
+    http_chunk_state_t state;
+    uint64_t remaining;
+    size_t digits;
+    size_t line_len;
+} http_chunk_scan_t;
+
+/*
+ * Write the request to forward upstream into out: a request line for path
+ * (which includes the query), the end-to-end headers of req, a Host if it
+ * had none, a Content-Length for the (already de-chunked) body,
+ * "Connection: keep-alive" and the body. Returns the length, or -1 if it
+ * does not fit in cap.
+ */
+ssize_t http_proxy_format_request(
+    const http_request_t *req,
+    http_view_t path,
+    const char *host,
+    char *out,
+    size_t cap
+);
+
+/*
+ * Parse the response head at the start of buf. head_request says the
+ * response answers a HEAD, so it has no body whatever its headers say.
+ * Returns HTTP_PARSE_INCOMPLETE until the blank line has arrived and
+ * HTTP_PARSE_ERROR for a malformed head or one over HTTP_PROXY_HEAD_CAP.
+ */
+http_parse_result_t http_proxy_parse_head(const char *buf, size_t len, bool head_request, http_upstream_head_t *head);
+
+/*
+ * The head to send the client for a parsed upstream head: its status line as
+ * HTTP/1.1, its end-to-end headers including the body framing, and our own
+ * Connection. Returns the length, or -1 if it does not fit in cap.
+ */
+ssize_t http_proxy_format_head(
+    const char *buf,
+    const http_upstream_head_t *head,
+    bool close_after_send,
+    char *out,
+    size_t cap
+);
+
+void http_chunk_scan_init(http_chunk_scan_t *scan);
+/*
+ * Follow a chunked body over the next len bytes. Returns how many of them
+ * belong to the body, setting *done once its last byte has been seen, or -1
+ * if the framing is malformed.
+ */
+ssize_t http_chunk_scan(http_chunk_scan_t *scan, const char *buf, size_t len, bool *done);
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef HTTP_ROUTE_TABLE_H
+#define HTTP_ROUTE_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "http_parser.h"
+
+#define HTTP_ROUTE_MAX_PARAMS 8
+#define HTTP_METHOD_BIT(m) (1u << (m))
+#define HTTP_METHODS_ANY ((1u << HTTP_METHOD_COUNT) - 1u)
+
+typedef enum {
+    HTTP_LOOKUP_NOT_FOUND = 0,
+    HTTP_LOOKUP_FOUND,
+    HTTP_LOOKUP_BAD_METHOD          /* the path matched; target is one of its routes */
+} http_route_lookup_t;
+
+typedef struct {
+    const void *target;
+    http_view_t params[HTTP_ROUTE_MAX_PARAMS];
+    size_t param_count;
+    http_view_t rest;               /* what a prefix route matched below its prefix */
+} http_route_match_t;
+
+typedef struct {
+    int32_t exact[HTTP_METHOD_COUNT];
+    int32_t prefix[HTTP_METHOD_COUNT];
+    int32_t exact_any;
+    int32_t prefix_any;
+    uint32_t param_child;           /* 0: none (the root is never a child) */
+} http_route_node_t;
+
+typedef struct {
+    uint64_t hash;
+    uint32_t parent;
+    uint32_t child;                 /* 0: empty slot */
+    uint32_t seg_len;
+    char *seg;
+} http_route_edge_t;
+
+/*
+ * Segment trie of routes, built before workers start and read-only after.
+ * A pattern is a '/'-separated list of segments: a literal segment matches
+ * itself, ":name" matches any one non-empty segment (captured in order into
+ * params) and a final "*" matches anything below the prefix, including
+ * nothing ("/static/" + rest). Literal children of every node share a single
+ * hash table keyed by (parent, segment), so a lookup costs one probe per
+ * path segment whatever the number of routes.
+ *
+ * A lookup walks down without backtracking: a literal child wins over the
+ * parameter child, and when the walk ends without an exact route the
+ * deepest prefix route passed on the way is used. Each route lists the
+ * methods it serves; a path served for other methods only is reported as
+ * HTTP_LOOKUP_BAD_METHOD.
+ */
+typedef struct {
+    http_route_node_t *nodes;
+    size_t node_count;
+    size_t node_cap;
+    http_route_edge_t *edges;
+    size_t edge_count;
+    size_t edge_mask;
+    const void **targets;
+    size_t route_count;
+    size_t route_cap;
+} http_route_table_t;
+
+int http_route_table_init(http_route_table_t *table);
+void http_route_table_destroy(http_route_table_t *table);
+
+/*
+ * Register target for the methods in the mask (HTTP_METHOD_BIT()). Returns
+ * -1 on a malformed pattern, on allocation failure or if one of the methods
+ * is already routed for the same pattern.
+ */
+int http_route_table_add(http_route_table_t *table, unsigned methods, const char *pattern, const void *target);
+
+http_route_lookup_t http_route_table_lookup(
+    const http_route_table_t *table,
+    http_method_t method,
+    const char *path,
+    size_t path_len,
+    http_route_match_t *match
+);
+
+#endif
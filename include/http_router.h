@@ -3,37 +3,216 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
 
+#include "http_module.h"
 #include "http_parser.h"
+#include "http_proxy.h"
+#include "pool.h"
 
 #define HTTP_RESPONSE_HEAD_CAP 2048
 #define HTTP_RESPONSE_BODY_CAP (128 * 1024)
+#define HTTP_RESPONSE_INLINE_SEGMENTS 2
+#define HTTP_RESPONSE_PRODUCE_CAP (16 * 1024)
+/* content_length of a response whose length is not known up front: sent chunked. */
+#define HTTP_LENGTH_CHUNKED SIZE_MAX
+#define HTTP_CACHE_RULES_MAX 16
+#define HTTP_CACHE_RULE_PREFIX_CAP 128
+
+/* Route identifiers used to label per-route metrics. */
+typedef enum {
+    HTTP_ROUTE_OTHER = 0,
+    HTTP_ROUTE_HEALTHZ,
+    HTTP_ROUTE_METRICS,
+    HTTP_ROUTE_ECHO,
+    HTTP_ROUTE_STATIC,
+    HTTP_ROUTE_UPLOAD,
+    HTTP_ROUTE_BYTES,
+    HTTP_ROUTE_MODULE,
+    HTTP_ROUTE_PROXY,
+    HTTP_ROUTE_COUNT
+} http_route_id_t;
+
+struct static_cache_entry;
+
+/* Where the bytes of one body segment come from. */
+typedef enum {
+    HTTP_SEGMENT_MEMORY = 0,    /* len bytes at data, kept alive by the response */
+    HTTP_SEGMENT_FILE,          /* length bytes of file_fd from offset */
+    HTTP_SEGMENT_PRODUCER       /* generated by resp->producer as the socket drains */
+} http_segment_kind_t;
 
 typedef struct {
+    http_segment_kind_t kind;
+    const char *data;
+    size_t len;
+    off_t offset;
+    off_t length;
+} http_response_segment_t;
+
+struct http_response;
+
+/*
+ * Write up to cap more body bytes into buf. Returns the count, 0 once the
+ * body is complete, or -1 on failure (the connection is then closed with the
+ * body cut short). producer_state is the producer's own.
+ */
+typedef ssize_t (*http_body_producer_fn)(struct http_response *resp, char *buf, size_t cap);
+
+/*
+ * Head and body storage is borrowed from the owning worker's buffer pool when
+ * a response is prepared and handed back by http_response_reset(). A file
+ * payload either owns file_fd or borrows it from a static cache entry held
+ * through file_ref; a pre-rendered cached response is borrowed as the head
+ * (head_borrowed) with no body or fd at all.
+ *
+ * The engines send the head, then a memory window (mem, or the body buffer
+ * when mem is NULL, from body_sent to body_len), then a file window. Longer
+ * bodies are a queue of segments: http_response_next_segment() loads the
+ * next one into the windows once they are drained, so nothing is produced or
+ * copied ahead of what the socket accepts. segs points at seg_inline or at a
+ * table kept in the body buffer. A producer segment fills the body buffer
+ * one piece at a time, framed as chunks when the length was not known.
+ *
+ * A proxied response starts out empty: the router leaves the request to
+ * forward in the body buffer (upstream_request bytes) and names the
+ * upstream; the worker hands both to an upstream connection, which fills in
+ * the head once the reply arrives and, as relay, moves the rest of the body
+ * straight to the client. relay is cleared once the upstream is done.
+ */
+typedef struct http_response {
     bool active;
     bool close_after_send;
+    buf_pool_t *pool;
 
-    char head[HTTP_RESPONSE_HEAD_CAP];
+    int status;
+    http_route_id_t route;
+    uint64_t start_ns;
+
+    char *head;
+    bool head_borrowed;
+    size_t head_cap;
     size_t head_len;
     size_t head_sent;
 
-    char body[HTTP_RESPONSE_BODY_CAP];
+    char *body;
+    size_t body_cap;
+    const char *mem;
     size_t body_len;
     size_t body_sent;
 
     int file_fd;
     off_t file_offset;
     off_t file_remaining;
+    struct static_cache_entry *file_ref;
+
+    const http_response_segment_t *segs;
+    unsigned seg_count;
+    unsigned seg_next;
+    http_response_segment_t seg_inline[HTTP_RESPONSE_INLINE_SEGMENTS];
+
+    http_body_producer_fn producer;
+    bool producing;
+    bool chunked;
+    uint64_t producer_state[2];
+
+    int upstream;
+    size_t upstream_request;
+    bool head_only;
+    void *relay;
 } http_response_t;
 
+/* How a request body is read, decided from the request head alone. */
+typedef enum {
+    HTTP_BODY_BUFFERED = 0,     /* whole body in memory, then http_route_request() */
+    HTTP_BODY_STREAMED,         /* fed to http_body_stream_data() as it arrives */
+    HTTP_BODY_REJECTED          /* answer with the error status now and drop the body */
+} http_body_mode_t;
+
+/* State of a route consuming a streamed body; lives in the connection. */
+typedef struct {
+    http_route_id_t route;
+    bool close_after_send;
+    uint64_t bytes;
+    uint64_t hash;
+} http_body_stream_t;
+
+/* Cache-Control max-age for static paths starting with prefix (relative to /static/). */
+typedef struct {
+    char prefix[HTTP_CACHE_RULE_PREFIX_CAP];
+    int max_age;
+} http_cache_rule_t;
+
+const char *http_route_name(http_route_id_t route);
+/* Build the route table. Call before workers start. */
+int http_router_init(void);
+void http_router_destroy(void);
+/* Add a route served by a loaded module. Call before workers start. */
+int http_router_add_module_route(unsigned methods, const char *pattern, const http_module_route_t *route);
+/*
+ * Forward every method for prefix and the paths below it to upstream number
+ * upstream. host is the Host sent for requests that had none; base, unless
+ * NULL, replaces the prefix in the forwarded path. The strings must outlive
+ * the router. Call before workers start.
+ */
+int http_router_add_proxy_route(const char *prefix, unsigned upstream, const char *host, const char *base);
+/* Longest prefix wins; max_age 0 sends no-cache. Call before workers start. */
+void http_router_set_cache_rules(const http_cache_rule_t *rules, size_t count);
+void http_response_init(http_response_t *resp, buf_pool_t *pool);
 void http_response_reset(http_response_t *resp);
+/* Load the next body segment once the current windows are drained; false if there is nothing to load. */
+bool http_response_next_segment(http_response_t *resp);
+/* Whether body bytes remain beyond the current windows. */
+bool http_response_has_more(const http_response_t *resp);
+/* module_ctx holds the calling worker's module contexts (http_modules_worker_init()). */
 int http_route_request(
     const http_request_t *req,
     http_response_t *resp,
     const char *static_root,
+    void *const module_ctx[HTTP_MODULES_MAX],
     bool force_close
 );
+/*
+ * A complete response with a body in memory: copied into the response (at
+ * most HTTP_RESPONSE_BODY_CAP bytes) or, when borrowed, sent in place.
+ * extra_headers is zero or more "Name: value\r\n" lines.
+ */
+int http_response_prepare(
+    http_response_t *resp,
+    int status,
+    const char *content_type,
+    const char *extra_headers,
+    const char *body,
+    size_t body_len,
+    bool borrowed,
+    bool close_after_send
+);
 int http_build_error_response(http_response_t *resp, int status, bool close_after_send);
 
+/*
+ * Decide how the body of req is read once its head is complete. Streaming
+ * routes initialise stream; a rejection sets *status. A request expecting
+ * 100-continue is also rejected when the route would refuse it anyway.
+ */
+http_body_mode_t http_route_body(const http_request_t *req, http_body_stream_t *stream, int *status);
+int http_body_stream_data(http_body_stream_t *stream, const char *data, size_t len);
+/* Build the final response of a streamed request once its body has ended. */
+int http_body_stream_finish(http_body_stream_t *stream, http_response_t *resp, bool force_close);
+/* Interim "100 Continue"; counted by neither the response nor the latency metrics. */
+int http_build_continue_response(http_response_t *resp);
+
+struct stat;
+
+/* static_compress_publish_fn that adds a generated variant to the static cache. */
+void http_static_publish_compressed(
+    const char *path,
+    size_t path_len,
+    http_encoding_t encoding,
+    int fd,
+    off_t size,
+    const struct stat *source,
+    unsigned long long generation
+);
+
 #endif
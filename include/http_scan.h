@@ -0,0 +1,35 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    HTTP_SCAN_SCALAR = 0,
+    HTTP_SCAN_SSE42 = 1,
+    HTTP_SCAN_AVX2 = 2
+} http_scan_impl_t;
+
+/*
+ * Byte-scanning kernels used by the request parser. http_scan_init() picks the
+ * widest implementation the CPU supports; until it is called (or when built
+ * for a non-x86 target) the portable scalar kernels are used.
+ */
+void http_scan_init(void);
+int http_scan_select(http_scan_impl_t impl);
+http_scan_impl_t http_scan_active(void);
+const char *http_scan_impl_name(http_scan_impl_t impl);
+
+/* Offset of the first byte equal to c, or len if there is none. */
+size_t http_scan_find_char(const char *p, size_t len, char c);
+
+/* Length of the leading run of RFC 9110 tchar bytes. */
+size_t http_scan_token_len(const char *p, size_t len);
+
+/* Offset of the first byte not allowed in a field value (CTL except HTAB), or len. */
+size_t http_scan_value_invalid(const char *p, size_t len);
+
+/* ASCII case-insensitive compare of p against an already-lowercase name of the same length. */
+bool http_scan_name_eq(const char *p, const char *lower, size_t len);
+
+#endif
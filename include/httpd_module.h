@@ -0,0 +1,115 @@
+#ifndef HTTPD_MODULE_H
+#define HTTPD_MODULE_H
+
+/*
+ * Native handler modules. A module is a shared object loaded with dlopen()
+ * at startup (-m path[:arg]) that exports
+ *
+ *     const httpd_module_t httpd_module = { HTTPD_MODULE_ABI_VERSION, ... };
+ *
+ * This header is the whole ABI: it includes nothing from the server and
+ * modules link against nothing from it; every call into the server goes
+ * through the httpd_host_api_t table handed to init(). Structures only ever
+ * grow at the end; abi_version changes when that is not enough.
+ *
+ * Routes registered by a module share the server's route table and pattern
+ * syntax: "/exact", "/items/:id", or a prefix ending in a "*" segment. A
+ * handler runs on the worker thread that parsed the request, with the
+ * context that worker_init() returned on that thread, so per-worker state
+ * needs no locking.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HTTPD_MODULE_ABI_VERSION 1
+#define HTTPD_MODULE_SYMBOL "httpd_module"
+#define HTTPD_MAX_PARAMS 8
+/* Largest body respond() copies; respond_static() has no limit. */
+#define HTTPD_RESPONSE_COPY_MAX (128 * 1024)
+
+/* Request method tokens. */
+enum {
+    HTTPD_METHOD_OTHER = 0,
+    HTTPD_METHOD_GET,
+    HTTPD_METHOD_HEAD,
+    HTTPD_METHOD_POST,
+    HTTPD_METHOD_PUT,
+    HTTPD_METHOD_DELETE,
+    HTTPD_METHOD_OPTIONS,
+    HTTPD_METHOD_PATCH
+};
+
+#define HTTPD_METHOD_BIT(m) (1u << (m))
+
+/* Non-owning (pointer, length) slice; not NUL-terminated. */
+typedef struct {
+    const char *ptr;
+    size_t len;
+} httpd_str_t;
+
+/*
+ * A parsed request. Every slice points into the connection's input buffer
+ * and is valid only until the handler returns.
+ */
+typedef struct {
+    uint32_t size;                  /* sizeof(httpd_request_t) as built by the server */
+    int method;                     /* HTTPD_METHOD_* */
+    httpd_str_t method_name;
+    httpd_str_t path;               /* without the query */
+    httpd_str_t query;              /* after '?'; empty when there is none */
+    httpd_str_t body;               /* the whole (de-chunked) body */
+    const httpd_str_t *params;      /* ":name" segments of the pattern, in order */
+    size_t param_count;
+    httpd_str_t rest;               /* what a prefix route matched below its prefix */
+    size_t header_count;
+    const void *server;             /* opaque */
+} httpd_request_t;
+
+typedef struct httpd_response httpd_response_t;
+typedef struct httpd_registrar httpd_registrar_t;
+
+/*
+ * Answer req through the host API. Returns 0, or -1 to have the server send
+ * 500 instead; returning 0 without responding also sends 500.
+ */
+typedef int (*httpd_handler_fn)(const httpd_request_t *req, httpd_response_t *resp, void *worker_ctx, void *route_data);
+
+typedef struct {
+    uint32_t abi_version;
+
+    /* Add a route for the methods in mask (HTTPD_METHOD_BIT()); only valid during init(). */
+    int (*route)(
+        httpd_registrar_t *reg,
+        unsigned methods,
+        const char *pattern,
+        httpd_handler_fn handler,
+        void *route_data
+    );
+
+    /* First header named name (case-insensitive); 0 if found, -1 if absent. */
+    int (*header)(const httpd_request_t *req, const char *name, httpd_str_t *value);
+    /* Header number index in request order; -1 past the last one. */
+    int (*header_at)(const httpd_request_t *req, size_t index, httpd_str_t *name, httpd_str_t *value);
+
+    /* Add a response header; call before respond(). */
+    int (*add_header)(httpd_response_t *resp, const char *name, const char *value);
+    /* Send status with a copy of body (at most HTTPD_RESPONSE_COPY_MAX bytes). */
+    int (*respond)(httpd_response_t *resp, int status, const char *content_type, const void *body, size_t len);
+    /* Like respond(), but body is sent in place and must stay valid until the module is unloaded. */
+    int (*respond_static)(httpd_response_t *resp, int status, const char *content_type, const void *body, size_t len);
+} httpd_host_api_t;
+
+typedef struct {
+    uint32_t abi_version;           /* HTTPD_MODULE_ABI_VERSION */
+    const char *name;
+    /* Register routes and set up shared state; arg is the text after ':' in -m, or "". Required. */
+    int (*init)(const httpd_host_api_t *host, httpd_registrar_t *reg, const char *arg, void **module_state);
+    /* Called on each worker thread before it serves requests; the result is that worker's worker_ctx. */
+    void *(*worker_init)(void *module_state, int worker_id);
+    /* Called on the same thread for every non-NULL worker_ctx when the worker exits. */
+    void (*worker_destroy)(void *module_state, void *worker_ctx);
+    void (*destroy)(void *module_state);
+} httpd_module_t;
+
+#endif
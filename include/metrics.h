@@ -1,14 +1,49 @@
 #ifndef METRICS_H
 #define METRICS_H
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
+#define METRICS_MAX_SHARDS 256
+#define METRICS_MAX_ROUTES 16
+#define METRICS_LATENCY_BUCKETS 16
+#define METRICS_STATUS_MIN 100
+#define METRICS_STATUS_MAX 599
+
+/*
+ * Counters live in cache-line aligned per-thread shards. A thread that calls
+ * metrics_register_thread() owns its shard and updates it with plain relaxed
+ * stores; other threads fall back to a shared shard updated atomically.
+ * Shards are summed only when metrics are read or rendered.
+ */
 void metrics_init(void);
+/* worker labels the thread's per-worker counters (connections_accepted_total). */
+void metrics_register_thread(int worker);
+void metrics_set_route_name(unsigned route, const char *name);
+
 void metrics_inc_requests(void);
 void metrics_add_bytes_in(size_t n);
 void metrics_add_bytes_out(size_t n);
 void metrics_inc_connections(void);
 void metrics_dec_connections(void);
+/* A connection handed over from another worker was adopted. */
+void metrics_inc_rebalanced_connections(void);
+/* accept() failed for a reason other than an empty queue (EMFILE, ENFILE, ENOMEM...). */
+void metrics_inc_accept_errors(void);
+void metrics_add_tx(
+    unsigned long long responses,
+    unsigned long long syscalls,
+    unsigned long long packets,
+    unsigned long long closed_responses
+);
+
+/* Count a completed TLS handshake, whether it resumed a session and whether the kernel took over its records. */
+void metrics_observe_tls_handshake(bool resumed, bool kernel_tx);
+
+/* Count a completed response and record its first-byte-to-last-byte latency. */
+void metrics_observe_response(unsigned route, int status, uint64_t latency_ns);
+
 unsigned long long metrics_requests_total(void);
 unsigned long long metrics_connections_current(void);
 unsigned long long metrics_bytes_in(void);
@@ -0,0 +1,30 @@
+#ifndef MPSC_H
+#define MPSC_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+/* Intrusive queue link; embed it in the queued object. */
+typedef struct mpsc_node {
+    struct mpsc_node *next;
+} mpsc_node_t;
+
+/*
+ * Lock-free multi-producer, single-consumer queue. Producers push onto a
+ * shared stack with one compare-and-swap; the consumer detaches the whole
+ * stack with one exchange and reverses it, so nodes come out in push order
+ * per producer and no node is ever popped alone (there is no ABA).
+ */
+typedef struct {
+    _Atomic(mpsc_node_t *) head;
+} mpsc_queue_t;
+
+void mpsc_init(mpsc_queue_t *q);
+
+/* Returns true when the queue was empty, i.e. the consumer needs a wakeup. */
+bool mpsc_push(mpsc_queue_t *q, mpsc_node_t *node);
+
+/* Consumer only: detach every queued node, oldest first; NULL when empty. */
+mpsc_node_t *mpsc_take_all(mpsc_queue_t *q);
+
+#endif
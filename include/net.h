@@ -1,7 +1,21 @@
 #ifndef NET_H
 #define NET_H
 
+#include <stdint.h>
+#include <sys/socket.h>
+
 int net_set_nonblocking(int fd);
 int net_create_listener(int port, int backlog, int reuse_port);
+/*
+ * Steer new connections in fd's SO_REUSEPORT group to the listener whose
+ * index (the order the group's sockets started listening) is the receiving
+ * CPU modulo group_size.
+ */
+int net_steer_by_cpu(int fd, unsigned group_size);
+int net_tcp_data_segs_out(int fd, uint64_t *out);
+/* Resolve "host:port" (first address found), "[v6]:port" or "unix:/path"; blocks on DNS. */
+int net_resolve_address(const char *spec, struct sockaddr_storage *addr, socklen_t *addr_len);
+/* Non-blocking, close-on-exec stream socket with a connect to addr started; it may still be in progress. */
+int net_connect_nonblocking(const struct sockaddr_storage *addr, socklen_t addr_len);
 
 #endif
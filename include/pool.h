@@ -0,0 +1,82 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define POOL_NAME_CAP 31
+#define POOL_STATS_MAX 32
+
+#define BUF_POOL_MIN_SHIFT 11
+#define BUF_POOL_MAX_SHIFT 18
+#define BUF_POOL_CLASSES (BUF_POOL_MAX_SHIFT - BUF_POOL_MIN_SHIFT + 1)
+#define BUF_POOL_MIN_SIZE ((size_t)1 << BUF_POOL_MIN_SHIFT)
+#define BUF_POOL_MAX_SIZE ((size_t)1 << BUF_POOL_MAX_SHIFT)
+#define BUF_POOL_CACHE_BYTES (4 * 1024 * 1024)
+
+/*
+ * Occupancy of one pool in one worker. Only the owning worker writes it, with
+ * plain relaxed stores; pool_stats_snapshot() sums the counters of every live
+ * pool with the same name when metrics are rendered.
+ */
+typedef struct pool_counter {
+    char name[POOL_NAME_CAP + 1];
+    atomic_size_t in_use;
+    atomic_size_t high_water;
+    struct pool_counter *prev;
+    struct pool_counter *next;
+} pool_counter_t;
+
+/*
+ * Fixed-size object allocator. Objects are carved out of slabs and recycled
+ * through an intrusive free list; slabs are only returned on destroy.
+ * A slab pool is owned by a single worker and is not thread-safe.
+ */
+typedef struct {
+    size_t obj_size;
+    size_t objs_per_slab;
+    void *free_list;
+    void **slabs;
+    size_t slabs_len;
+    size_t slabs_cap;
+    pool_counter_t stat;
+} slab_pool_t;
+
+typedef struct {
+    void *free_list;
+    size_t cached;
+    size_t cached_max;
+    pool_counter_t stat;
+} buf_class_t;
+
+/*
+ * Power-of-two size-classed buffer cache (2 KB .. 256 KB). Released buffers
+ * are kept on a per-class free list up to BUF_POOL_CACHE_BYTES per class.
+ * Owned by a single worker and not thread-safe.
+ */
+typedef struct buf_pool {
+    buf_class_t classes[BUF_POOL_CLASSES];
+} buf_pool_t;
+
+/* high_water is the sum of each worker's own peak. */
+typedef struct {
+    char name[POOL_NAME_CAP + 1];
+    unsigned long long in_use;
+    unsigned long long high_water;
+} pool_stat_t;
+
+int slab_pool_init(slab_pool_t *pool, const char *name, size_t obj_size, size_t objs_per_slab);
+void *slab_pool_alloc(slab_pool_t *pool);
+void slab_pool_free(slab_pool_t *pool, void *obj);
+void slab_pool_destroy(slab_pool_t *pool);
+/* Stop reporting a pool whose objects must outlive it (still referenced by the kernel); its slabs leak. */
+void slab_pool_abandon(slab_pool_t *pool);
+
+int buf_pool_init(buf_pool_t *pool);
+char *buf_pool_acquire(buf_pool_t *pool, size_t min_size, size_t *out_cap);
+void buf_pool_release(buf_pool_t *pool, char *buf, size_t cap);
+void buf_pool_destroy(buf_pool_t *pool);
+
+size_t pool_stats_snapshot(pool_stat_t *out, size_t cap);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef REBALANCE_H
+#define REBALANCE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "worker.h"
+
+#define REBALANCE_WINDOW_NS (100ULL * 1000 * 1000)
+/* At most 1/REBALANCE_BUDGET_DIV of a worker's connections (and at least one) leave per window. */
+#define REBALANCE_BUDGET_DIV 8
+
+/* Engine hook: take conn's socket out of the worker's event set, or add an adopted one. 0 on success. */
+typedef int (*rebalance_io_fn)(worker_ctx_t *ctx, connection_t *conn);
+
+/*
+ * Cross-worker connection rebalancing (-b). SO_REUSEPORT hashes each
+ * connection to a worker for good, so a few heavy keep-alive clients can
+ * saturate one worker while others idle. Each worker measures the share of
+ * wall time it spends handling events and its ready events per loop, and
+ * publishes them with its connection count once per window. A worker whose
+ * busy share exceeds the least loaded peer's by the threshold hands
+ * connections to that peer as they fall idle between requests: nothing
+ * buffered, nothing queued, no HTTP/2 session. The connection's state is
+ * queued on the target's lock-free MPSC queue and an eventfd wakes it; the
+ * target re-registers the socket in its own event set, where a request that
+ * arrived meanwhile is reported at once.
+ */
+
+/* Before the workers start: set up the queue and its eventfd. */
+int rebalance_init(worker_ctx_t *ctx);
+/* After every worker has stopped: close connections still queued to ctx. */
+void rebalance_destroy(worker_ctx_t *ctx);
+
+/* Once per event-loop iteration: events handled and time spent handling them. */
+void rebalance_account(worker_ctx_t *ctx, uint64_t now_ns, int events, uint64_t busy_ns);
+
+/*
+ * Hand conn to the current target if this worker is overloaded and conn is
+ * idle between requests. detach removes its socket from the engine first.
+ * Returns true when conn is gone from this worker.
+ */
+bool rebalance_try_hand_off(worker_ctx_t *ctx, connection_t *conn, rebalance_io_fn detach);
+
+/*
+ * From the acceptor thread: queue a socket it just accepted to target, which
+ * adopts it like a handed-off connection but counts it as its own accept.
+ */
+int rebalance_deliver(worker_ctx_t *target, int fd);
+
+/* handoff_fd is readable: adopt every queued connection through attach. */
+void rebalance_adopt(worker_ctx_t *ctx, rebalance_io_fn attach);
+
+#endif
@@ -5,24 +5,105 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "http_module.h"
+#include "http_parser.h"
+#include "http_proxy.h"
 #include "http_router.h"
+#include "static_watch.h"
+#include "timer_wheel.h"
 
 #define CONN_INBUF_CAP (256 * 1024)
+#define CONN_INBUF_INITIAL (4 * 1024)
+#define CONN_SLAB_OBJS 64
+#define CONN_PIPELINE_DEPTH 16
 
+struct h2_session;
+struct tls_conn;
+
+typedef enum {
+    CONN_PHASE_IDLE = 0,
+    CONN_PHASE_HEADER,
+    CONN_PHASE_BODY,
+    CONN_PHASE_WRITE
+} conn_phase_t;
+
+/*
+ * Connection state is allocated from a per-worker slab. The input buffer is
+ * borrowed from the worker's buffer pool only while bytes are buffered and
+ * grows by size class up to CONN_INBUF_CAP. Pipelined requests are parsed
+ * up front into out_q, a ring of pooled responses flushed in request order.
+ * A single wheel timer tracks the deadline of the current phase.
+ *
+ * While a streamed request body is being read (streaming), in_buf holds only
+ * body bytes that have not been handed to the route yet and does not grow.
+ * Once the connection speaks HTTP/2, h2 holds the session and its input goes
+ * there instead. On a TLS listener, tls holds the session: input is read
+ * through it, and output too unless the kernel seals records (kTLS).
+ */
 typedef struct connection {
     int fd;
-    char in_buf[CONN_INBUF_CAP];
+    char *in_buf;
+    size_t in_cap;
     size_t in_len;
+    http_parser_t parser;
     uint64_t last_active_ms;
-    http_response_t resp;
+    uint64_t phase_start_ms;
+    uint64_t request_start_ns;
+    uint64_t rx_last_ns;
+    conn_phase_t phase;
+    timer_node_t timer;
+    bool closing;
+    bool read_paused;
+    bool streaming;
+    http_body_stream_t stream;
+    unsigned long long responses_sent;
+    unsigned out_head;
+    unsigned out_count;
+    http_response_t *out_q[CONN_PIPELINE_DEPTH];
+    struct h2_session *h2;
+    struct tls_conn *tls;
+    void *engine_conn;
 } connection_t;
 
+typedef enum {
+    SERVER_ENGINE_EPOLL = 0,
+    SERVER_ENGINE_URING
+} server_engine_t;
+
+/* How accepted connections reach the workers (--accept-mode). */
+typedef enum {
+    SERVER_ACCEPT_REUSEPORT_HASH = 0,
+    SERVER_ACCEPT_REUSEPORT_CPU,
+    SERVER_ACCEPT_EXCLUSIVE,
+    SERVER_ACCEPT_ACCEPTOR
+} server_accept_mode_t;
+
 typedef struct {
     int port;
     int threads;
     int backlog;
     int idle_timeout_sec;
+    int header_timeout_sec;
+    int body_timeout_sec;
+    int write_timeout_sec;
+    server_engine_t engine;
+    server_accept_mode_t accept_mode;
+    int static_cache_entries;
+    int static_render_budget_kb;
+    static_watch_mode_t static_watch;
+    int static_revalidate_sec;
+    http_cache_rule_t cache_rules[HTTP_CACHE_RULES_MAX];
+    int cache_rule_count;
+    http_module_spec_t modules[HTTP_MODULES_MAX];
+    int module_count;
+    http_proxy_spec_t proxies[HTTP_PROXIES_MAX];
+    int proxy_count;
+    /* Busy-share gap, in percentage points, at which idle connections move to a lighter worker; 0 is off. */
+    int rebalance_threshold;
     char static_root[1024];
+    /* TLS on the listener when both are set. */
+    char tls_cert[1024];
+    char tls_key[1024];
 } server_config_t;
 
 int server_run(const server_config_t *cfg);
@@ -0,0 +1,140 @@
+#ifndef STATIC_CACHE_H
+#define STATIC_CACHE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "http_parser.h"
+
+#define STATIC_CACHE_CTYPE_CAP 63
+#define STATIC_CACHE_ETAG_CAP 80
+#define STATIC_CACHE_DEFAULT_ENTRIES 1024
+#define STATIC_CACHE_MAX_ENTRIES (1u << 20)
+#define STATIC_CACHE_RENDER_MAX_FILE (16 * 1024)
+#define STATIC_CACHE_DEFAULT_RENDER_BUDGET (16u * 1024u * 1024u)
+
+/* Connection header variants of a pre-rendered response. */
+enum {
+    STATIC_CACHE_VARIANT_KEEP_ALIVE = 0,
+    STATIC_CACHE_VARIANT_CLOSE,
+    STATIC_CACHE_VARIANTS
+};
+
+/* Complete 200 responses (head and body) laid out back to back in data. */
+typedef struct {
+    char *data;
+    size_t len[STATIC_CACHE_VARIANTS];
+} static_cache_render_t;
+
+/* Where the bytes of an entry come from. */
+typedef enum {
+    STATIC_CACHE_FILE = 0,      /* the file at path itself */
+    STATIC_CACHE_SIDECAR,       /* a precompressed path + suffix file next to it */
+    STATIC_CACHE_GENERATED,     /* compressed from the file at path by the server */
+    STATIC_CACHE_ABSENT         /* negative entry: no such variant exists */
+} static_cache_source_t;
+
+/* Description of a variant handed to static_cache_insert(). */
+typedef struct {
+    int fd;                         /* -1 for STATIC_CACHE_ABSENT */
+    off_t size;                     /* bytes served */
+    const struct stat *st;          /* identity of the file read; NULL for ABSENT */
+    const char *content_type;
+    static_cache_source_t source;
+    const static_cache_render_t *render;
+} static_cache_file_t;
+
+/*
+ * Open file descriptors for static files, keyed by the path below the static
+ * root and the content coding served. Entries live in a fixed array that is never freed, so a reader may
+ * probe an entry that is being recycled: it takes a reference only while the
+ * count is non-zero and then re-checks the key. Lookups never block; a global
+ * sequence count tells a reader whether a miss raced with a writer.
+ *
+ * A reference pins fd, size, the file identity and content_type. The fd is
+ * shared, so callers must use positional I/O (sendfile/splice with an
+ * explicit offset). Invalidation only unlinks entries: responses already
+ * holding one finish from the file they started with.
+ *
+ * Small files may instead carry pre-rendered responses, charged against a
+ * byte budget; such entries keep no fd open (fd is -1).
+ *
+ * Each entry carries a strong ETag derived from the identity of the file it
+ * was read from and its coding; mtime doubles as Last-Modified.
+ */
+typedef struct static_cache_entry {
+    atomic_uint refs;
+    atomic_uchar referenced;
+    atomic_ullong hash;
+    atomic_uint next;
+    bool linked;
+
+    uint8_t encoding;
+    uint8_t source;
+    int fd;
+    off_t size;
+    dev_t dev;
+    ino_t ino;
+    off_t source_size;
+    struct timespec mtime;
+    char etag[STATIC_CACHE_ETAG_CAP];
+    char content_type[STATIC_CACHE_CTYPE_CAP + 1];
+    static_cache_render_t render;
+    size_t path_len;
+    char path[HTTP_MAX_PATH_LEN + 1];
+} static_cache_entry_t;
+
+/* capacity == 0 disables caching. Not thread-safe; call before workers start. */
+int static_cache_init(size_t capacity, size_t render_budget);
+void static_cache_destroy(void);
+size_t static_cache_capacity(void);
+
+/* Quoted strong ETag for the encoding variant read from the file described by st. */
+void static_cache_format_etag(char *out, size_t cap, const struct stat *st, http_encoding_t encoding);
+
+/* Whether a pre-rendered response of len bytes would currently fit the budget. */
+bool static_cache_render_fits(size_t len);
+
+/* Returns a referenced entry or NULL on a miss. */
+static_cache_entry_t *static_cache_acquire(const char *path, size_t path_len, http_encoding_t encoding);
+
+/*
+ * Bumped by every invalidation. Sample it before opening a file and pass it
+ * to static_cache_insert() so a file opened before a change is not cached.
+ */
+unsigned long long static_cache_generation(void);
+
+/*
+ * Publish a variant of path. On success the cache owns file->fd and
+ * file->render and a referenced entry is returned; an existing entry for the
+ * same key wins and both are released. If the render is accepted the fd is
+ * closed right away; if it no longer fits the budget it is freed and the fd
+ * is kept. Returns NULL when every slot is pinned or an invalidation
+ * happened since generation was sampled; the caller keeps fd and render.
+ */
+static_cache_entry_t *static_cache_insert(
+    const char *path,
+    size_t path_len,
+    http_encoding_t encoding,
+    const static_cache_file_t *file,
+    unsigned long long generation
+);
+
+/* Drop every variant of path, or every entry below dir (all entries if dir_len is 0). */
+void static_cache_invalidate(const char *path, size_t path_len);
+void static_cache_invalidate_prefix(const char *dir, size_t dir_len);
+
+/*
+ * Call still_valid for each cached entry with the writer lock held and drop
+ * those it rejects. Returns the number of entries dropped.
+ */
+size_t static_cache_revalidate(bool (*still_valid)(const static_cache_entry_t *entry, void *arg), void *arg);
+
+void static_cache_release(static_cache_entry_t *entry);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef STATIC_COMPRESS_H
+#define STATIC_COMPRESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "http_parser.h"
+
+#define STATIC_COMPRESS_MIN_SOURCE 256
+#define STATIC_COMPRESS_MAX_SOURCE (8 * 1024 * 1024)
+
+/*
+ * Receives a finished variant on the compressor thread. fd (owned by the
+ * callee) holds size compressed bytes produced from the file described by
+ * source; fd is -1 when compressing was not worthwhile. generation was
+ * sampled before the source was opened.
+ */
+typedef void (*static_compress_publish_fn)(
+    const char *path,
+    size_t path_len,
+    http_encoding_t encoding,
+    int fd,
+    off_t size,
+    const struct stat *source,
+    unsigned long long generation
+);
+
+/*
+ * Background compression of static files that have no precompressed
+ * sidecar. Requests are queued (deduplicated, bounded) and compressed one at
+ * a time into anonymous memory files, so the result can be sent with
+ * sendfile like any other cached file.
+ */
+int static_compress_start(const char *root, static_compress_publish_fn publish);
+void static_compress_stop(void);
+
+/* The coding produced in the background, or HTTP_ENCODING_IDENTITY if none was built in. */
+http_encoding_t static_compress_encoding(void);
+
+/* Queue path for compression; false if unsupported, stopped or the queue is full. */
+bool static_compress_request(const char *path, size_t path_len);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef STATIC_WATCH_H
+#define STATIC_WATCH_H
+
+typedef enum {
+    STATIC_WATCH_OFF = 0,
+    STATIC_WATCH_INOTIFY,
+    STATIC_WATCH_STAT
+} static_watch_mode_t;
+
+/*
+ * Keep the static cache coherent with the files under root from a background
+ * thread, so the request path never stats a cached file. INOTIFY drops the
+ * entries named by change events (falling back to STAT if inotify cannot be
+ * set up); STAT re-checks every cached entry with fstatat() once per
+ * interval_sec. Returns the mode actually started, or -1 on failure.
+ */
+int static_watch_start(const char *root, static_watch_mode_t mode, int interval_sec);
+void static_watch_stop(void);
+const char *static_watch_mode_name(static_watch_mode_t mode);
+
+#endif
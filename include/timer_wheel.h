@@ -0,0 +1,49 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1U << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+/* Intrusive timer; embed it in the owning object. next == NULL when not armed. */
+typedef struct timer_node {
+    struct timer_node *next;
+    struct timer_node *prev;
+    uint64_t expires;
+} timer_node_t;
+
+typedef void (*timer_fire_fn)(timer_node_t *node, void *arg);
+
+/*
+ * Hierarchical timer wheel: TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SLOTS
+ * slots, each level TIMER_WHEEL_SLOTS times coarser than the one below. Arm,
+ * re-arm and cancel are O(1); timers are cascaded down a level when the lower
+ * level wraps and fire at tick granularity, never early. Owned by a single
+ * worker and not thread-safe.
+ */
+typedef struct {
+    timer_node_t slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t now;
+    unsigned tick_ms;
+    size_t armed;
+} timer_wheel_t;
+
+void timer_wheel_init(timer_wheel_t *wheel, unsigned tick_ms, uint64_t now_ms);
+
+/* Arm (or move) node to fire at expires_ms. */
+void timer_wheel_arm(timer_wheel_t *wheel, timer_node_t *node, uint64_t expires_ms);
+void timer_wheel_cancel(timer_wheel_t *wheel, timer_node_t *node);
+bool timer_node_armed(const timer_node_t *node);
+
+/*
+ * Advance the wheel to now_ms and call fire for every timer that expired.
+ * fire may arm or cancel any timer, including the one being fired.
+ * Returns the number of timers fired.
+ */
+size_t timer_wheel_advance(timer_wheel_t *wheel, uint64_t now_ms, timer_fire_fn fire, void *arg);
+
+#endif
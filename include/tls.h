@@ -0,0 +1,60 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* Largest TLS record payload; user-space writes are coalesced up to this. */
+#define TLS_RECORD_MAX 16384
+
+typedef struct tls_conn tls_conn_t;
+
+/*
+ * TLS termination with OpenSSL over the worker's non-blocking sockets. One
+ * server context is shared by every worker. Once a handshake completes the
+ * record keys are handed to the kernel (kTLS) when it supports the cipher,
+ * after which the socket takes plaintext: responses keep leaving through
+ * sendmsg(), sendfile() and splice() and the kernel seals the records.
+ * Otherwise records are sealed in user space and file ranges are read
+ * through a bounce buffer.
+ *
+ * Resumption uses stateless session tickets whose keys live in the shared
+ * context, so a client can resume on any worker and no session cache is
+ * locked. ALPN offers h2 before http/1.1.
+ */
+
+/* Load the certificate chain and key; returns -1 with a message on stderr if they are unusable or TLS was not built in. */
+int tls_server_init(const char *cert_path, const char *key_path);
+void tls_server_destroy(void);
+
+tls_conn_t *tls_conn_new(int fd);
+/* Sends close_notify if the session is still healthy, so call it before the socket is closed. */
+void tls_conn_free(tls_conn_t *tc);
+
+/*
+ * Advance the handshake. Returns 1 once it is complete, 0 while it waits for
+ * the socket (*want_write when for writability) and -1 if it failed.
+ */
+int tls_handshake(tls_conn_t *tc, bool *want_write);
+bool tls_established(const tls_conn_t *tc);
+bool tls_resumed(const tls_conn_t *tc);
+/* Whether the kernel seals outgoing records, so plaintext may go to the socket directly. */
+bool tls_kernel_tx(const tls_conn_t *tc);
+/* Whether input already read from the socket is buffered in the session, where no readiness event reports it. */
+bool tls_pending(const tls_conn_t *tc);
+
+/*
+ * read(), write() and writev() over the session: -1 with errno EAGAIN when
+ * the socket is not ready, 0 from tls_read() at end of stream. A write that
+ * failed with EAGAIN must be retried with the same leading bytes.
+ */
+ssize_t tls_read(tls_conn_t *tc, void *buf, size_t len);
+ssize_t tls_write(tls_conn_t *tc, const void *buf, size_t len);
+/* Gathers up to one record from iov, so small head and body pieces share it. */
+ssize_t tls_writev(tls_conn_t *tc, const struct iovec *iov, int iovcnt);
+/* sendfile() for user-space records: up to one record read from file_fd at *offset. */
+ssize_t tls_sendfile(tls_conn_t *tc, int file_fd, off_t *offset, size_t count);
+
+#endif
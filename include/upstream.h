@@ -0,0 +1,68 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "http_proxy.h"
+#include "http_router.h"
+#include "pool.h"
+#include "server.h"
+
+/* Idle keep-alive connections a worker keeps per upstream. */
+#define UPSTREAM_IDLE_MAX 32
+
+struct worker_ctx;
+struct upstream_conn;
+
+/*
+ * A worker's upstream connections, registered in its epoll set next to the
+ * clients and found by fd. Connections that finished an exchange cleanly
+ * wait on a per-upstream idle list for the next proxied request; one the
+ * upstream closes meanwhile is dropped, and a request that finds its pooled
+ * connection dead before any reply byte is sent again on a fresh one.
+ */
+typedef struct {
+    slab_pool_t slab;
+    struct upstream_conn **by_fd;
+    size_t by_fd_cap;
+    struct upstream_conn *idle[HTTP_PROXIES_MAX];
+    unsigned idle_count[HTTP_PROXIES_MAX];
+} upstream_pool_t;
+
+/* Resolve every -P upstream and route its prefix to it. Call after http_router_init(), before workers start. */
+int upstream_targets_init(const http_proxy_spec_t *specs, size_t count);
+
+int upstream_pool_init(upstream_pool_t *pool);
+/* Close every pooled connection; active ones went with their clients. */
+void upstream_pool_destroy(upstream_pool_t *pool);
+
+/*
+ * Forward the request the router left in resp to its upstream on a pooled or
+ * new connection. The reply arrives asynchronously: until its head is in,
+ * resp has nothing to send, and a failure before then turns it into a 502.
+ * Returns -1 if no connection could be started.
+ */
+int upstream_start(struct worker_ctx *ctx, connection_t *conn, http_response_t *resp);
+
+/*
+ * Handle readiness of fd if it is an upstream connection. Returns the client
+ * connection whose response can now make progress, or NULL.
+ */
+connection_t *upstream_handle_event(struct worker_ctx *ctx, int fd, uint32_t events);
+
+/*
+ * Move more of a relayed body from the upstream to the client socket of conn
+ * once everything queued before it has been sent; resp is the front
+ * response. Returns the bytes written to the client, 0 if the upstream has
+ * nothing yet or just ended the body (resp->relay is then NULL), or -1 with
+ * errno set (EAGAIN when the client socket is full).
+ */
+ssize_t upstream_relay(struct worker_ctx *ctx, connection_t *conn, http_response_t *resp);
+
+/* The response is being dropped before its relay finished: close the upstream connection. */
+void upstream_abort(struct worker_ctx *ctx, http_response_t *resp);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef URING_H
+#define URING_H
+
+#ifdef __linux__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+/*
+ * Minimal io_uring plumbing on top of the raw syscalls (no liburing). A ring
+ * is owned by one worker thread; SQEs are filled in place and published by
+ * uring_submit_and_wait().
+ */
+typedef struct {
+    int fd;
+    unsigned features;
+
+    void *sq_map;
+    size_t sq_map_len;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned sqe_head;
+    unsigned sqe_tail;
+
+    void *cq_map;
+    size_t cq_map_len;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+} uring_t;
+
+/* Provided-buffer ring: the kernel picks a buffer for each buffer-select recv. */
+typedef struct {
+    struct io_uring_buf_ring *ring;
+    size_t ring_len;
+    char *bufs;
+    unsigned entries;
+    unsigned buf_size;
+    unsigned short bgid;
+    unsigned short tail;
+} uring_buf_ring_t;
+
+int uring_init(uring_t *ring, unsigned entries);
+void uring_destroy(uring_t *ring);
+
+/* Free SQE slots, counting ones filled but not yet submitted. */
+unsigned uring_sq_space(uring_t *ring);
+
+/* Zeroed SQE, or NULL when the submission queue is full. */
+struct io_uring_sqe *uring_get_sqe(uring_t *ring);
+
+/*
+ * Submit pending SQEs and wait up to timeout_ms for at least wait_nr
+ * completions. Returns 0 on success or timeout, -1 with errno set otherwise.
+ */
+int uring_submit_and_wait(uring_t *ring, unsigned wait_nr, unsigned timeout_ms);
+
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring);
+void uring_cqe_seen(uring_t *ring);
+
+int uring_buf_ring_init(uring_t *ring, uring_buf_ring_t *br, unsigned short bgid, unsigned entries, unsigned buf_size);
+void uring_buf_ring_destroy(uring_t *ring, uring_buf_ring_t *br);
+char *uring_buf_ring_ptr(const uring_buf_ring_t *br, unsigned short bid);
+void uring_buf_ring_recycle(uring_buf_ring_t *br, unsigned short bid);
+
+#endif
+
+#endif
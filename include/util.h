@@ -4,12 +4,21 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <time.h>
+
+/* Length of an IMF-fixdate such as "Sun, 06 Nov 1994 08:49:37 GMT". */
+#define UTIL_HTTP_DATE_LEN 29
 
 uint64_t util_now_ms(void);
+uint64_t util_now_ns(void);
 int util_ascii_casecmp(const char *a, const char *b);
 int util_ascii_ncasecmp(const char *a, const char *b, size_t n);
 const char *util_trim_left(const char *s);
 void util_trim_right(char *s);
 bool util_static_path_is_safe(const char *path);
+/* out must hold UTIL_HTTP_DATE_LEN + 1 bytes. */
+void util_http_date_format(time_t t, char *out);
+/* Parse an IMF-fixdate; the obsolete RFC 850 and asctime forms are rejected. */
+int util_http_date_parse(const char *s, size_t len, time_t *out);
 
 #endif
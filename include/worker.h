@@ -0,0 +1,179 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "h2.h"
+#include "http_router.h"
+#include "mpsc.h"
+#include "pool.h"
+#include "server.h"
+#include "timer_wheel.h"
+#include "upstream.h"
+
+#define WORKER_TIMER_TICK_MS 10
+
+/*
+ * Transmit-side counters owned by one worker and published to the global
+ * metrics once per event-loop iteration. Packets are the data segments
+ * reported by TCP_INFO, sampled when a connection closes, so packets per
+ * response is computed against responses of closed connections only.
+ */
+typedef struct {
+    unsigned long long responses;
+    unsigned long long syscalls;
+    unsigned long long packets;
+    unsigned long long closed_responses;
+} tx_stats_t;
+
+/*
+ * Load a worker publishes for its peers and the acceptor thread: busy share
+ * and events per loop at the end of each rebalance window, open connections
+ * as they change. Written only by the owning thread and kept on a cache line
+ * of its own, so readers do not bounce the worker's hot state.
+ */
+typedef struct {
+    _Alignas(64) atomic_uint busy_permille;
+    atomic_uint events_per_loop_x16;
+    atomic_uint conns;
+    /* Sockets from the acceptor thread settled so far, whether adopted or dropped. */
+    atomic_uint accepted;
+    /* Whether the worker's engine takes connections handed to it. */
+    atomic_bool adopts;
+} worker_load_t;
+
+struct worker_ctx;
+
+/* Rebalance accounting for the current window; private to the worker. */
+typedef struct {
+    uint64_t window_start_ns;
+    uint64_t busy_ns;
+    unsigned long long loops;
+    unsigned long long events;
+    unsigned busy_permille;
+    /* Where idle connections go during this window, and how many may. */
+    struct worker_ctx *target;
+    unsigned budget;
+} worker_balance_t;
+
+/* Engine hook that tears down a connection (socket, engine state, conn table slot). */
+typedef void (*worker_close_fn)(struct worker_ctx *ctx, connection_t *conn);
+
+/*
+ * Per-thread state shared by the I/O engines. The connection table, pools
+ * and request/response state machine live here; the engine owns readiness or
+ * completion handling and installs close_conn.
+ */
+typedef struct worker_ctx {
+    int id;
+    server_config_t cfg;
+    int epoll_fd;
+    int listen_fd;
+    connection_t **conns;
+    size_t conns_cap;
+    slab_pool_t conn_pool;
+    slab_pool_t resp_pool;
+    buf_pool_t bufs;
+    tx_stats_t tx;
+    tx_stats_t tx_published;
+    timer_wheel_t timers;
+    worker_close_fn close_conn;
+    void *engine;
+    void *module_ctx[HTTP_MODULES_MAX];
+    upstream_pool_t upstreams;
+    h2_pool_t h2;
+    size_t conn_count;
+    /* Every worker, this one included, for cross-worker rebalancing. */
+    struct worker_ctx *peers;
+    int peer_count;
+    worker_balance_t balance;
+    /* Connections handed to this worker; handoff_fd is an eventfd raised when the queue fills. */
+    mpsc_queue_t handoffs;
+    int handoff_fd;
+    worker_load_t load;
+} worker_ctx_t;
+
+bool server_stopping(void);
+void server_request_stop(void);
+
+int worker_state_init(worker_ctx_t *ctx);
+void worker_state_destroy(worker_ctx_t *ctx);
+int worker_ensure_conn_capacity(worker_ctx_t *ctx, int fd);
+void worker_publish_tx_stats(worker_ctx_t *ctx);
+
+/* Fire expired connection timers; each one closes its connection through close_conn. */
+void worker_run_timers(worker_ctx_t *ctx, uint64_t now_ms);
+
+connection_t *conn_create(worker_ctx_t *ctx, int fd);
+void conn_free(worker_ctx_t *ctx, connection_t *conn);
+
+/*
+ * Take an open connection out of the worker: sample its TCP_INFO counters,
+ * cancel its timer and clear its table slot. The engine closes the socket and
+ * frees the state afterwards.
+ */
+void worker_detach_conn(worker_ctx_t *ctx, connection_t *conn);
+
+/*
+ * Re-arm the connection timer for its current phase: write stall while
+ * responses are queued, body read while a body is outstanding, header read
+ * (from the first byte, not extended by progress) while a request head is
+ * partial, otherwise idle.
+ */
+void conn_update_timer(worker_ctx_t *ctx, connection_t *conn);
+
+/* Whether output has to be sealed into TLS records in user space rather than written to the socket as is. */
+bool conn_tls_records(const connection_t *conn);
+
+/* Record that bytes arrived; stamps the start of a new request when none is buffered. */
+void conn_note_rx(connection_t *conn);
+
+/*
+ * Make room for at least one more byte of input. Returns 1 when the buffer is
+ * already at CONN_INBUF_CAP and -1 if no buffer could be borrowed.
+ */
+int conn_reserve_input(worker_ctx_t *ctx, connection_t *conn);
+void conn_release_idle_buffers(worker_ctx_t *ctx, connection_t *conn);
+
+http_response_t *conn_front_response(connection_t *conn);
+
+/*
+ * Queue an error response and stop reading requests from this connection;
+ * whatever is still buffered is discarded. Returns -1 if the queue is full or
+ * no response could be allocated.
+ */
+int conn_queue_error(worker_ctx_t *ctx, connection_t *conn, int status);
+
+/*
+ * Parse and route every complete request in the input buffer, up to the
+ * pipeline depth, then compact the buffer once. Returns -1 if the connection
+ * must be dropped.
+ */
+int conn_parse_requests(worker_ctx_t *ctx, connection_t *conn);
+
+/*
+ * Gather the unsent head and body bytes of queued responses in order, stopping
+ * after the first response that still has a file payload or a body relayed
+ * from an upstream, so that body is sent before anything queued behind it.
+ * *file_follows is set for a file so the caller can hold the partial segment
+ * back for the file bytes.
+ */
+int conn_build_output_iov(connection_t *conn, struct iovec *iov, int iov_cap, bool *file_follows);
+void conn_advance_output(connection_t *conn, size_t n);
+
+/*
+ * Drop fully sent responses from the front of the queue. Returns true when
+ * one of them asked for the connection to be closed.
+ */
+bool conn_complete_sent(worker_ctx_t *ctx, connection_t *conn);
+
+#ifdef __linux__
+/* io_uring engine; returns -1 without serving anything if the ring cannot be set up. */
+int uring_worker_run(worker_ctx_t *ctx);
+#endif
+
+#endif
@@ -0,0 +1,195 @@
+#include "accept.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "net.h"
+#include "rebalance.h"
+
+/* How long the acceptor waits after accept fails for lack of descriptors or memory. */
+#define ACCEPT_BACKOFF_MS 100
+
+/* The listener shared by the workers or drained by the acceptor. */
+static int g_listen_fd = -1;
+
+static struct {
+    worker_ctx_t *ctxs;
+    int count;
+    /* Sockets handed to each worker; the ones it has not settled yet count as its connections. */
+    unsigned *handed;
+    /* Where the next scan starts, so ties go round-robin. */
+    int next;
+    pthread_t thread;
+    bool running;
+} g_acceptor;
+
+const char *accept_mode_name(server_accept_mode_t mode) {
+    switch (mode) {
+        case SERVER_ACCEPT_REUSEPORT_HASH:
+            return "reuseport-hash";
+        case SERVER_ACCEPT_REUSEPORT_CPU:
+            return "reuseport-cpu";
+        case SERVER_ACCEPT_EXCLUSIVE:
+            return "exclusive";
+        case SERVER_ACCEPT_ACCEPTOR:
+            return "acceptor";
+    }
+    return "unknown";
+}
+
+int accept_open(worker_ctx_t *ctxs, int count) {
+    server_accept_mode_t mode = ctxs[0].cfg.accept_mode;
+    int port = ctxs[0].cfg.port;
+    int backlog = ctxs[0].cfg.backlog;
+
+    if (mode == SERVER_ACCEPT_EXCLUSIVE || mode == SERVER_ACCEPT_ACCEPTOR) {
+        g_listen_fd = net_create_listener(port, backlog, 0);
+        if (g_listen_fd < 0) {
+            perror("net_create_listener");
+            return -1;
+        }
+        for (int i = 0; i < count; ++i) {
+            ctxs[i].listen_fd = mode == SERVER_ACCEPT_EXCLUSIVE ? g_listen_fd : -1;
+        }
+        return 0;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        ctxs[i].listen_fd = net_create_listener(port, backlog, 1);
+        if (ctxs[i].listen_fd < 0) {
+            perror("net_create_listener");
+            accept_close(ctxs, i);
+            return -1;
+        }
+    }
+    if (mode == SERVER_ACCEPT_REUSEPORT_CPU && net_steer_by_cpu(ctxs[0].listen_fd, (unsigned)count) != 0) {
+        perror("SO_ATTACH_REUSEPORT_CBPF");
+        accept_close(ctxs, count);
+        return -1;
+    }
+    return 0;
+}
+
+void accept_worker_enter(worker_ctx_t *ctx) {
+    if (ctx->cfg.accept_mode != SERVER_ACCEPT_REUSEPORT_CPU) {
+        return;
+    }
+    /* The lowest allowed CPU whose connections the steering program sends to this worker. */
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return;
+    }
+    for (int cpu = ctx->id; cpu < CPU_SETSIZE; cpu += ctx->peer_count) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            (void)pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+            return;
+        }
+    }
+    fprintf(stderr, "worker %d: no allowed CPU is steered to it, so it accepts nothing\n", ctx->id);
+}
+
+static worker_ctx_t *least_connections(void) {
+    worker_ctx_t *best = NULL;
+    unsigned best_load = 0;
+    for (int k = 0; k < g_acceptor.count; ++k) {
+        int i = (g_acceptor.next + k) % g_acceptor.count;
+        worker_ctx_t *ctx = &g_acceptor.ctxs[i];
+        unsigned settled = atomic_load_explicit(&ctx->load.accepted, memory_order_acquire);
+        unsigned load = atomic_load_explicit(&ctx->load.conns, memory_order_relaxed) + (g_acceptor.handed[i] - settled);
+        if (best == NULL || load < best_load) {
+            best = ctx;
+            best_load = load;
+        }
+    }
+    g_acceptor.next = (g_acceptor.next + 1) % g_acceptor.count;
+    return best;
+}
+
+static void *acceptor_main(void *arg) {
+    (void)arg;
+    struct pollfd pfd = {g_listen_fd, POLLIN, 0};
+    while (!server_stopping()) {
+        if (poll(&pfd, 1, 250) <= 0) {
+            continue;
+        }
+        for (;;) {
+            int client_fd = accept4(g_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client_fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    /* The pending connection keeps the listener readable, so polling again would spin. */
+                    metrics_inc_accept_errors();
+                    (void)poll(NULL, 0, ACCEPT_BACKOFF_MS);
+                }
+                break;
+            }
+            int one = 1;
+            (void)setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+            worker_ctx_t *target = least_connections();
+            if (rebalance_deliver(target, client_fd) != 0) {
+                close(client_fd);
+                continue;
+            }
+            ++g_acceptor.handed[target->id];
+        }
+    }
+    return NULL;
+}
+
+int accept_start(worker_ctx_t *ctxs, int count) {
+    if (ctxs[0].cfg.accept_mode != SERVER_ACCEPT_ACCEPTOR) {
+        return 0;
+    }
+    g_acceptor.ctxs = ctxs;
+    g_acceptor.count = count;
+    g_acceptor.handed = calloc((size_t)count, sizeof(*g_acceptor.handed));
+    if (g_acceptor.handed == NULL) {
+        return -1;
+    }
+    if (pthread_create(&g_acceptor.thread, NULL, acceptor_main, NULL) != 0) {
+        free(g_acceptor.handed);
+        g_acceptor.handed = NULL;
+        return -1;
+    }
+    g_acceptor.running = true;
+    return 0;
+}
+
+void accept_close(worker_ctx_t *ctxs, int count) {
+    if (g_acceptor.running) {
+        pthread_join(g_acceptor.thread, NULL);
+        g_acceptor.running = false;
+    }
+    free(g_acceptor.handed);
+    g_acceptor.handed = NULL;
+
+    for (int i = 0; i < count; ++i) {
+        if (ctxs[i].listen_fd >= 0 && ctxs[i].listen_fd != g_listen_fd) {
+            close(ctxs[i].listen_fd);
+        }
+        ctxs[i].listen_fd = -1;
+    }
+    if (g_listen_fd >= 0) {
+        close(g_listen_fd);
+        g_listen_fd = -1;
+    }
+}
+
+#endif
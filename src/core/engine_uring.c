@@ -0,0 +1,611 @@
+#include "worker.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "uring.h"
+#include "util.h"
+
+#define URING_ENTRIES 1024
+#define URING_BUF_GROUP 0
+#define URING_BUF_COUNT 512
+#define URING_BUF_SIZE (16 * 1024)
+#define URING_PIPE_SIZE (256 * 1024)
+#define URING_DRAIN_ROUNDS 40
+/* How long a failed multishot accept waits before it is re-armed, unless a connection is freed first. */
+#define URING_ACCEPT_BACKOFF_MS 100
+
+/* user_data is a uring_conn_t pointer (16-byte aligned slab object) with the op in the low bits. */
+#define URING_OP_MASK 0x7ULL
+
+enum {
+    URING_OP_ACCEPT = 1,
+    URING_OP_RECV,
+    URING_OP_SEND,
+    URING_OP_SPLICE_IN,
+    URING_OP_SPLICE_OUT
+};
+
+/*
+ * Engine-side connection state. It outlives the socket: a closed connection
+ * stays allocated until every SQE that references it has completed.
+ * Transmit is one chain at a time: an optional SENDMSG of queued heads and
+ * bodies, linked to a file->pipe splice and a pipe->socket splice for the
+ * first file payload. Bytes spliced into the pipe but not yet out are tracked
+ * in pipe_pending and drained before anything else is sent.
+ */
+typedef struct uring_conn {
+    connection_t *conn;
+    int fd;
+    unsigned inflight;
+    unsigned tx_pending;
+    bool closed;
+    bool recv_armed;
+    bool tx_error;
+    bool rx_held;
+    bool starved;
+    unsigned short rx_bid;
+    size_t rx_off;
+    size_t rx_len;
+    struct uring_conn *next_starved;
+
+    bool has_pipe;
+    int pipe_rd;
+    int pipe_wr;
+    size_t pipe_cap;
+    size_t pipe_pending;
+    http_response_t *tx_file;
+
+    struct msghdr msg;
+    struct iovec iov[CONN_PIPELINE_DEPTH * 2];
+} uring_conn_t;
+
+typedef struct {
+    worker_ctx_t *ctx;
+    uring_t ring;
+    uring_buf_ring_t bufs;
+    slab_pool_t uconn_pool;
+    size_t live;
+    bool accept_armed;
+    /* Nonzero after accept failed: the time it may be re-armed. */
+    uint64_t accept_retry_ms;
+    uring_conn_t *starved;
+} uring_engine_t;
+
+static uint64_t op_data(uring_conn_t *uc, unsigned op) {
+    return (uint64_t)(uintptr_t)uc | op;
+}
+
+/* Make sure n SQEs can be queued back to back so a linked chain is never split across submits. */
+static struct io_uring_sqe *engine_sqe(uring_engine_t *eng, unsigned n) {
+    if (uring_sq_space(&eng->ring) < n) {
+        (void)uring_submit_and_wait(&eng->ring, 0, 0);
+        if (uring_sq_space(&eng->ring) < n) {
+            return NULL;
+        }
+    }
+    return uring_get_sqe(&eng->ring);
+}
+
+static void arm_accept(uring_engine_t *eng) {
+    struct io_uring_sqe *sqe = engine_sqe(eng, 1);
+    if (sqe == NULL) {
+        return;
+    }
+    /* Accepted sockets stay blocking so the io-wq splice to the socket waits for room instead of spinning on EAGAIN. */
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = eng->ctx->listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = URING_OP_ACCEPT;
+    eng->accept_armed = true;
+}
+
+static int arm_recv(uring_engine_t *eng, uring_conn_t *uc) {
+    struct io_uring_sqe *sqe = engine_sqe(eng, 1);
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = uc->fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->len = URING_BUF_SIZE;
+    sqe->user_data = op_data(uc, URING_OP_RECV);
+    uc->recv_armed = true;
+    ++uc->inflight;
+    return 0;
+}
+
+static void uconn_maybe_free(uring_engine_t *eng, uring_conn_t *uc) {
+    if (!uc->closed || uc->inflight > 0 || uc->starved) {
+        return;
+    }
+    if (uc->has_pipe) {
+        close(uc->pipe_rd);
+        close(uc->pipe_wr);
+    }
+    conn_free(eng->ctx, uc->conn);
+    slab_pool_free(&eng->uconn_pool, uc);
+    --eng->live;
+    /* The descriptor is back, so a backed-off accept can try again. */
+    eng->accept_retry_ms = 0;
+}
+
+/*
+ * Shut the socket down so in-flight recv/send/splice complete, then drop it
+ * from the connection table. The state itself is freed once the last
+ * completion has been reaped.
+ */
+static void uconn_close(uring_engine_t *eng, uring_conn_t *uc) {
+    if (uc->closed) {
+        return;
+    }
+    worker_ctx_t *ctx = eng->ctx;
+    uc->closed = true;
+    worker_detach_conn(ctx, uc->conn);
+    (void)shutdown(uc->fd, SHUT_RDWR);
+    close(uc->fd);
+    if (uc->rx_held) {
+        uring_buf_ring_recycle(&eng->bufs, uc->rx_bid);
+        uc->rx_held = false;
+    }
+}
+
+static void uring_close_conn(worker_ctx_t *ctx, connection_t *conn) {
+    uring_engine_t *eng = ctx->engine;
+    uring_conn_t *uc = conn->engine_conn;
+    uconn_close(eng, uc);
+    uconn_maybe_free(eng, uc);
+}
+
+static int uconn_ensure_pipe(uring_conn_t *uc) {
+    if (uc->has_pipe) {
+        return 0;
+    }
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        return -1;
+    }
+    (void)fcntl(fds[1], F_SETPIPE_SZ, URING_PIPE_SIZE);
+    int cap = fcntl(fds[1], F_GETPIPE_SZ);
+    uc->pipe_rd = fds[0];
+    uc->pipe_wr = fds[1];
+    uc->pipe_cap = cap > 0 ? (size_t)cap : 65536;
+    uc->has_pipe = true;
+    return 0;
+}
+
+static http_response_t *conn_file_response(connection_t *conn) {
+    for (unsigned i = 0; i < conn->out_count; ++i) {
+        http_response_t *resp = conn->out_q[(conn->out_head + i) % CONN_PIPELINE_DEPTH];
+        if (resp->file_fd >= 0 && resp->file_remaining > 0) {
+            return resp;
+        }
+    }
+    return NULL;
+}
+
+static void prep_splice(struct io_uring_sqe *sqe, int fd_in, int64_t off_in, int fd_out, size_t len) {
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->splice_fd_in = fd_in;
+    sqe->splice_off_in = (uint64_t)off_in;
+    sqe->fd = fd_out;
+    sqe->off = (uint64_t)-1;
+    sqe->len = (unsigned)len;
+    sqe->splice_flags = SPLICE_F_MOVE;
+}
+
+/* Queue the next transmit chain. Returns -1 if the connection must be dropped. */
+static int uconn_submit_send(uring_engine_t *eng, uring_conn_t *uc) {
+    connection_t *conn = uc->conn;
+
+    if (uc->pipe_pending > 0) {
+        struct io_uring_sqe *sqe = engine_sqe(eng, 1);
+        if (sqe == NULL) {
+            return -1;
+        }
+        prep_splice(sqe, uc->pipe_rd, -1, uc->fd, uc->pipe_pending);
+        sqe->user_data = op_data(uc, URING_OP_SPLICE_OUT);
+        uc->tx_pending = 1;
+        uc->inflight += 1;
+        ++eng->ctx->tx.syscalls;
+        return 0;
+    }
+
+    bool file_follows = false;
+    int iovcnt = conn_build_output_iov(conn, uc->iov, (int)(sizeof(uc->iov) / sizeof(uc->iov[0])), &file_follows);
+    http_response_t *file_resp = file_follows ? conn_file_response(conn) : NULL;
+    if (file_resp != NULL && uconn_ensure_pipe(uc) != 0) {
+        return -1;
+    }
+
+    unsigned need = (iovcnt > 0 ? 1U : 0U) + (file_resp != NULL ? 2U : 0U);
+    if (need == 0) {
+        return 0;
+    }
+    if (uring_sq_space(&eng->ring) < need) {
+        (void)uring_submit_and_wait(&eng->ring, 0, 0);
+        if (uring_sq_space(&eng->ring) < need) {
+            return -1;
+        }
+    }
+
+    if (iovcnt > 0) {
+        struct io_uring_sqe *sqe = uring_get_sqe(&eng->ring);
+        memset(&uc->msg, 0, sizeof(uc->msg));
+        uc->msg.msg_iov = uc->iov;
+        uc->msg.msg_iovlen = (size_t)iovcnt;
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = uc->fd;
+        sqe->addr = (uint64_t)(uintptr_t)&uc->msg;
+        sqe->len = 1;
+        /* A short send must fail the link, not let the file bytes overtake the head. */
+        sqe->msg_flags = MSG_NOSIGNAL | (file_resp != NULL ? MSG_MORE | MSG_WAITALL : 0);
+        if (file_resp != NULL) {
+            sqe->flags = IOSQE_IO_LINK;
+        }
+        sqe->user_data = op_data(uc, URING_OP_SEND);
+        ++uc->tx_pending;
+        ++uc->inflight;
+    }
+
+    if (file_resp != NULL) {
+        size_t len = (size_t)file_resp->file_remaining;
+        if (len > uc->pipe_cap) {
+            len = uc->pipe_cap;
+        }
+        struct io_uring_sqe *in = uring_get_sqe(&eng->ring);
+        prep_splice(in, file_resp->file_fd, (int64_t)file_resp->file_offset, uc->pipe_wr, len);
+        in->flags = IOSQE_IO_LINK;
+        in->user_data = op_data(uc, URING_OP_SPLICE_IN);
+
+        struct io_uring_sqe *out = uring_get_sqe(&eng->ring);
+        prep_splice(out, uc->pipe_rd, -1, uc->fd, len);
+        out->user_data = op_data(uc, URING_OP_SPLICE_OUT);
+
+        uc->tx_file = file_resp;
+        uc->tx_pending += 2;
+        uc->inflight += 2;
+    }
+
+    ++eng->ctx->tx.syscalls;
+    return 0;
+}
+
+/*
+ * Copy the held receive buffer into the connection's input buffer. Mirrors
+ * the epoll read path: when the input buffer is full and the response queue
+ * is at depth the buffer stays held (and no recv is armed) until responses
+ * drain; a single request larger than the input buffer gets a 413.
+ * Returns -1 if the connection was closed.
+ */
+static int uconn_ingest(uring_engine_t *eng, uring_conn_t *uc) {
+    worker_ctx_t *ctx = eng->ctx;
+    connection_t *conn = uc->conn;
+    const char *data = uring_buf_ring_ptr(&eng->bufs, uc->rx_bid);
+
+    while (uc->rx_off < uc->rx_len) {
+        if (conn->closing) {
+            uc->rx_off = uc->rx_len;
+            break;
+        }
+        int room = conn_reserve_input(ctx, conn);
+        if (room > 0) {
+            if (conn_parse_requests(ctx, conn) != 0) {
+                uconn_close(eng, uc);
+                return -1;
+            }
+            room = conn_reserve_input(ctx, conn);
+            if (room > 0 && conn->out_count >= CONN_PIPELINE_DEPTH) {
+                return 0;
+            }
+        }
+        if (room < 0) {
+            uconn_close(eng, uc);
+            return -1;
+        }
+        if (room > 0) {
+            if (conn_queue_error(ctx, conn, 413) != 0) {
+                uconn_close(eng, uc);
+                return -1;
+            }
+            uc->rx_off = uc->rx_len;
+            break;
+        }
+
+        size_t take = uc->rx_len - uc->rx_off;
+        if (take > conn->in_cap - conn->in_len) {
+            take = conn->in_cap - conn->in_len;
+        }
+        memcpy(conn->in_buf + conn->in_len, data + uc->rx_off, take);
+        conn->in_len += take;
+        uc->rx_off += take;
+    }
+
+    uring_buf_ring_recycle(&eng->bufs, uc->rx_bid);
+    uc->rx_held = false;
+    return 0;
+}
+
+/* Move the connection forward after any completion: consume input, start the next send, re-arm recv. */
+static void uconn_progress(uring_engine_t *eng, uring_conn_t *uc) {
+    worker_ctx_t *ctx = eng->ctx;
+    connection_t *conn = uc->conn;
+
+    if (uc->closed) {
+        return;
+    }
+    if (uc->rx_held && uconn_ingest(eng, uc) != 0) {
+        return;
+    }
+
+    if (uc->tx_pending == 0) {
+        if (conn_parse_requests(ctx, conn) != 0) {
+            uconn_close(eng, uc);
+            return;
+        }
+        if (uc->pipe_pending > 0 || conn->out_count > 0) {
+            if (uconn_submit_send(eng, uc) != 0) {
+                uconn_close(eng, uc);
+                return;
+            }
+        } else {
+            conn_release_idle_buffers(ctx, conn);
+        }
+    }
+
+    if (!uc->rx_held && !uc->recv_armed && !uc->starved && arm_recv(eng, uc) != 0) {
+        uconn_close(eng, uc);
+        return;
+    }
+    conn_update_timer(ctx, conn);
+}
+
+static void handle_accept_cqe(uring_engine_t *eng, int res, unsigned flags) {
+    worker_ctx_t *ctx = eng->ctx;
+    if (!(flags & IORING_CQE_F_MORE)) {
+        eng->accept_armed = false;
+    }
+    if (res < 0) {
+        /* Out of descriptors or memory: re-arming at once would fail the same way and spin. */
+        metrics_inc_accept_errors();
+        if (!eng->accept_armed) {
+            eng->accept_retry_ms = util_now_ms() + URING_ACCEPT_BACKOFF_MS;
+        }
+        return;
+    }
+
+    int client_fd = res;
+    if (server_stopping()) {
+        close(client_fd);
+        return;
+    }
+
+    int one = 1;
+    (void)setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (worker_ensure_conn_capacity(ctx, client_fd) != 0) {
+        close(client_fd);
+        return;
+    }
+
+    connection_t *conn = conn_create(ctx, client_fd);
+    uring_conn_t *uc = conn == NULL ? NULL : slab_pool_alloc(&eng->uconn_pool);
+    if (uc == NULL) {
+        conn_free(ctx, conn);
+        close(client_fd);
+        return;
+    }
+    uc->conn = conn;
+    uc->fd = client_fd;
+    conn->engine_conn = uc;
+    ctx->conns[client_fd] = conn;
+    ++eng->live;
+    metrics_inc_connections();
+
+    uconn_progress(eng, uc);
+}
+
+static void handle_recv_cqe(uring_engine_t *eng, uring_conn_t *uc, int res, unsigned flags) {
+    uc->recv_armed = false;
+    if (uc->closed) {
+        if (flags & IORING_CQE_F_BUFFER) {
+            uring_buf_ring_recycle(&eng->bufs, (unsigned short)(flags >> IORING_CQE_BUFFER_SHIFT));
+        }
+        return;
+    }
+    if (res == -ENOBUFS) {
+        /* Every provided buffer is held by a paused connection; retry on the next loop turn. */
+        uc->starved = true;
+        uc->next_starved = eng->starved;
+        eng->starved = uc;
+        return;
+    }
+    if (res <= 0) {
+        uconn_close(eng, uc);
+        return;
+    }
+
+    metrics_add_bytes_in((size_t)res);
+    conn_note_rx(uc->conn);
+    uc->rx_bid = (unsigned short)(flags >> IORING_CQE_BUFFER_SHIFT);
+    uc->rx_off = 0;
+    uc->rx_len = (size_t)res;
+    uc->rx_held = true;
+    uconn_progress(eng, uc);
+}
+
+static void handle_tx_cqe(uring_engine_t *eng, uring_conn_t *uc, unsigned op, int res) {
+    worker_ctx_t *ctx = eng->ctx;
+    connection_t *conn = uc->conn;
+    --uc->tx_pending;
+
+    if (!uc->closed) {
+        if (op == URING_OP_SEND) {
+            if (res > 0) {
+                conn_advance_output(conn, (size_t)res);
+                metrics_add_bytes_out((size_t)res);
+                conn->last_active_ms = util_now_ms();
+            } else {
+                uc->tx_error = true;
+            }
+        } else if (op == URING_OP_SPLICE_IN) {
+            if (res > 0) {
+                uc->tx_file->file_offset += res;
+                uc->tx_file->file_remaining -= res;
+                uc->pipe_pending += (size_t)res;
+            } else if (res != -ECANCELED) {
+                uc->tx_error = true;
+            }
+        } else {
+            if (res > 0) {
+                uc->pipe_pending -= (size_t)res;
+                metrics_add_bytes_out((size_t)res);
+                conn->last_active_ms = util_now_ms();
+            } else if (res != -ECANCELED) {
+                uc->tx_error = true;
+            }
+        }
+    }
+
+    if (uc->tx_pending > 0 || uc->closed) {
+        return;
+    }
+    uc->tx_file = NULL;
+    if (uc->tx_error) {
+        uconn_close(eng, uc);
+        return;
+    }
+    if (uc->pipe_pending == 0 && conn_complete_sent(ctx, conn)) {
+        uconn_close(eng, uc);
+        return;
+    }
+    uconn_progress(eng, uc);
+}
+
+static void engine_reap(uring_engine_t *eng) {
+    struct io_uring_cqe *cqe;
+    while ((cqe = uring_peek_cqe(&eng->ring)) != NULL) {
+        uint64_t data = cqe->user_data;
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+        uring_cqe_seen(&eng->ring);
+
+        unsigned op = (unsigned)(data & URING_OP_MASK);
+        if (op == URING_OP_ACCEPT) {
+            handle_accept_cqe(eng, res, flags);
+            continue;
+        }
+
+        uring_conn_t *uc = (uring_conn_t *)(uintptr_t)(data & ~URING_OP_MASK);
+        --uc->inflight;
+        if (op == URING_OP_RECV) {
+            handle_recv_cqe(eng, uc, res, flags);
+        } else {
+            handle_tx_cqe(eng, uc, op, res);
+        }
+        uconn_maybe_free(eng, uc);
+    }
+}
+
+static void engine_retry_starved(uring_engine_t *eng) {
+    uring_conn_t *uc = eng->starved;
+    eng->starved = NULL;
+    while (uc != NULL) {
+        uring_conn_t *next = uc->next_starved;
+        uc->starved = false;
+        uc->next_starved = NULL;
+        uconn_progress(eng, uc);
+        uconn_maybe_free(eng, uc);
+        uc = next;
+    }
+}
+
+/* Close every connection and reap completions until nothing references engine memory. */
+static void engine_shutdown(uring_engine_t *eng) {
+    worker_ctx_t *ctx = eng->ctx;
+    for (size_t i = 0; i < ctx->conns_cap; ++i) {
+        if (ctx->conns[i] != NULL) {
+            uring_close_conn(ctx, ctx->conns[i]);
+        }
+    }
+    engine_retry_starved(eng);
+
+    for (int round = 0; round < URING_DRAIN_ROUNDS && eng->live > 0; ++round) {
+        if (uring_submit_and_wait(&eng->ring, 1, 50) != 0) {
+            break;
+        }
+        engine_reap(eng);
+    }
+}
+
+int uring_worker_run(worker_ctx_t *ctx) {
+    uring_engine_t eng;
+    memset(&eng, 0, sizeof(eng));
+    eng.ctx = ctx;
+
+    if (uring_init(&eng.ring, URING_ENTRIES) != 0) {
+        perror("io_uring_setup");
+        return -1;
+    }
+    if (uring_buf_ring_init(&eng.ring, &eng.bufs, URING_BUF_GROUP, URING_BUF_COUNT, URING_BUF_SIZE) != 0) {
+        perror("io_uring provided buffers");
+        uring_destroy(&eng.ring);
+        return -1;
+    }
+    if (slab_pool_init(&eng.uconn_pool, "uring_conn", sizeof(uring_conn_t), CONN_SLAB_OBJS) != 0) {
+        uring_buf_ring_destroy(&eng.ring, &eng.bufs);
+        uring_destroy(&eng.ring);
+        return -1;
+    }
+
+    ctx->engine = &eng;
+    ctx->close_conn = uring_close_conn;
+    while (!server_stopping()) {
+        if (!eng.accept_armed && (eng.accept_retry_ms == 0 || util_now_ms() >= eng.accept_retry_ms)) {
+            eng.accept_retry_ms = 0;
+            arm_accept(&eng);
+        }
+        engine_retry_starved(&eng);
+
+        if (uring_submit_and_wait(&eng.ring, 1, 250) != 0) {
+            if (errno == EBUSY || errno == EAGAIN) {
+                engine_reap(&eng);
+                continue;
+            }
+            perror("io_uring_enter");
+            server_request_stop();
+            break;
+        }
+        engine_reap(&eng);
+        worker_publish_tx_stats(ctx);
+        worker_run_timers(ctx, util_now_ms());
+    }
+
+    engine_shutdown(&eng);
+    ctx->engine = NULL;
+    ctx->close_conn = NULL;
+
+    /* Connections still referenced by the kernel are leaked rather than freed under it. */
+    if (eng.live == 0) {
+        slab_pool_destroy(&eng.uconn_pool);
+    } else {
+        slab_pool_abandon(&eng.uconn_pool);
+    }
+    uring_buf_ring_destroy(&eng.ring, &eng.bufs);
+    uring_destroy(&eng.ring);
+    return 0;
+}
+
+#endif
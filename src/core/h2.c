@@ -0,0 +1,1655 @@
+#include "h2.h"
+
+#ifdef __linux__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hpack.h"
+#include "http_scan.h"
+#include "metrics.h"
+#include "util.h"
+#include "worker.h"
+
+#define H2_FRAME_HEADER_LEN 9
+/* Largest frame we accept, the protocol default; we never advertise more. */
+#define H2_FRAME_SIZE 16384
+#define H2_FRAME_SIZE_LIMIT 16777215
+#define H2_DEFAULT_WINDOW 65535
+#define H2_WINDOW_MAX 0x7fffffff
+/* Receive window per stream and for the connection; consumed bytes are credited back at half. */
+#define H2_RECV_WINDOW (1024 * 1024)
+#define H2_STREAM_BUCKETS 64
+#define H2_SLAB_OBJS 16
+/* Control frames waiting for the next batch; a peer that makes us queue more is cut off. */
+#define H2_CTRL_CAP 4096
+#define H2_GOAWAY_LEN (H2_FRAME_HEADER_LEN + 8)
+#define H2_WIRE_CAP (64 * 1024)
+#define H2_HEADER_BLOCK_MAX (64 * 1024)
+/* Regular request fields, rebuilt as header lines, and pseudo-header values. */
+#define H2_FIELDS_CAP (16 * 1024)
+#define H2_PSEUDO_CAP (HTTP_MAX_PATH_LEN + 1024)
+/* Room between a buffered request's head and body for its Content-Length line. */
+#define H2_LENGTH_GAP 48
+#define H2_SETTINGS_HEADER_MAX 256
+
+enum {
+    H2_DATA = 0x0,
+    H2_HEADERS = 0x1,
+    H2_PRIORITY = 0x2,
+    H2_RST_STREAM = 0x3,
+    H2_SETTINGS = 0x4,
+    H2_PUSH_PROMISE = 0x5,
+    H2_PING = 0x6,
+    H2_GOAWAY = 0x7,
+    H2_WINDOW_UPDATE = 0x8,
+    H2_CONTINUATION = 0x9
+};
+
+enum {
+    H2_FLAG_END_STREAM = 0x1,
+    H2_FLAG_ACK = 0x1,
+    H2_FLAG_END_HEADERS = 0x4,
+    H2_FLAG_PADDED = 0x8,
+    H2_FLAG_PRIORITY = 0x20
+};
+
+enum {
+    H2_NO_ERROR = 0x0,
+    H2_PROTOCOL_ERROR = 0x1,
+    H2_INTERNAL_ERROR = 0x2,
+    H2_FLOW_CONTROL_ERROR = 0x3,
+    H2_STREAM_CLOSED = 0x5,
+    H2_FRAME_SIZE_ERROR = 0x6,
+    H2_REFUSED_STREAM = 0x7,
+    H2_COMPRESSION_ERROR = 0x9,
+    H2_ENHANCE_YOUR_CALM = 0xb
+};
+
+enum {
+    H2_SETTINGS_ENABLE_PUSH = 0x2,
+    H2_SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+    H2_SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+    H2_SETTINGS_MAX_FRAME_SIZE = 0x5
+};
+
+/*
+ * One request/response exchange. The request is rebuilt as HTTP/1.1 text in
+ * req: the head, then H2_LENGTH_GAP bytes, then a buffered body, so the
+ * Content-Length line can be slotted in once the body has ended. A stream
+ * whose END_STREAM has been sent waits on the done list until the batch
+ * carrying it has drained, since a file range of its response may still be
+ * in flight.
+ */
+typedef struct h2_stream {
+    uint32_t id;
+    struct h2_stream *hash_next;
+    struct h2_stream *ready_next;
+    struct h2_stream *done_next;
+    bool ready;                 /* on the ready list */
+    bool blocked;               /* out of stream window */
+    bool remote_closed;
+    bool local_closed;          /* END_STREAM sent, or the stream was reset */
+    bool reset;
+    bool headers_sent;
+    bool head_only;
+    bool streamed;
+    bool declared;
+    size_t declared_len;
+    size_t received;
+    int64_t send_window;
+    int64_t recv_window;
+    uint32_t recv_unacked;
+    http_body_stream_t body_stream;
+    char *req;
+    size_t req_cap;
+    size_t head_len;
+    size_t body_len;
+    uint64_t start_ns;
+    http_response_t *resp;
+    size_t head_end;            /* end of the response fields, before the blank line */
+    size_t tail_off;            /* body bytes a pre-rendered head carries after the blank line */
+    size_t tail_end;
+} h2_stream_t;
+
+typedef struct h2_session {
+    worker_ctx_t *ctx;
+    connection_t *conn;
+    http_response_t wire;
+    bool wire_queued;
+    char *wbuf;
+    size_t wbuf_cap;
+    h2_stream_t *ready_head;
+    h2_stream_t *ready_tail;
+    unsigned ready_count;
+    h2_stream_t *done;
+    h2_stream_t *buckets[H2_STREAM_BUCKETS];
+    unsigned stream_count;
+    uint32_t last_stream_id;
+    bool preface_done;
+    bool settings_seen;
+    bool closing;               /* GOAWAY queued: input is dropped, the connection closes once it is out */
+    uint32_t peer_max_frame;
+    uint32_t peer_initial_window;
+    int64_t send_window;
+    int64_t recv_window;
+    uint32_t recv_unacked;
+    uint32_t cont_stream;       /* stream whose header block continues in CONTINUATION frames */
+    uint8_t cont_flags;
+    char *hblock;
+    size_t hblock_cap;
+    size_t hblock_len;
+    size_t ctrl_len;
+    uint8_t ctrl[H2_CTRL_CAP + H2_GOAWAY_LEN];
+    hpack_decoder_t hpack;
+} h2_session_t;
+
+typedef enum {
+    H2_EMIT_FRAME = 0,          /* a frame went into the batch */
+    H2_EMIT_BLOCKED,            /* out of stream window; off the ready list until it grows */
+    H2_EMIT_WAIT,               /* out of connection window */
+    H2_EMIT_FULL,               /* the batch has no room left */
+    H2_EMIT_FILE                /* a file range ends the batch */
+} h2_emit_t;
+
+enum {
+    H2_PSEUDO_METHOD = 0,
+    H2_PSEUDO_SCHEME,
+    H2_PSEUDO_PATH,
+    H2_PSEUDO_AUTHORITY,
+    H2_PSEUDO_COUNT
+};
+
+/* Request fields of one header block, as the decoder hands them out. */
+typedef struct {
+    bool trailers;              /* decoded only to keep the table in step */
+    bool malformed;
+    bool too_large;
+    bool regular;
+    bool seen[H2_PSEUDO_COUNT];
+    size_t off[H2_PSEUDO_COUNT];
+    size_t len[H2_PSEUDO_COUNT];
+    bool declared;
+    size_t declared_len;
+    size_t pseudo_len;
+    size_t lines_len;
+    char pseudo[H2_PSEUDO_CAP];
+    char lines[H2_FIELDS_CAP];
+} h2_fields_t;
+
+static const char *const k_pseudo_names[H2_PSEUDO_COUNT] = {":method", ":scheme", ":path", ":authority"};
+
+int h2_pool_init(h2_pool_t *pool) {
+    memset(pool, 0, sizeof(*pool));
+    if (slab_pool_init(&pool->sessions, "h2_session", sizeof(h2_session_t), H2_SLAB_OBJS) != 0 ||
+        slab_pool_init(&pool->streams, "h2_stream", sizeof(h2_stream_t), CONN_SLAB_OBJS) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void h2_pool_destroy(h2_pool_t *pool) {
+    slab_pool_destroy(&pool->sessions);
+    slab_pool_destroy(&pool->streams);
+}
+
+static uint32_t get_u24(const uint8_t *p) {
+    return (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | (uint32_t)p[2];
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static void put_frame_header(uint8_t *p, size_t len, uint8_t type, uint8_t flags, uint32_t id) {
+    p[0] = (uint8_t)(len >> 16);
+    p[1] = (uint8_t)(len >> 8);
+    p[2] = (uint8_t)len;
+    p[3] = type;
+    p[4] = flags;
+    put_u32(p + 5, id);
+}
+
+static bool name_is(const char *name, size_t len, const char *lower) {
+    return len == strlen(lower) && http_scan_name_eq(name, lower, len);
+}
+
+static void trim(const char **p, size_t *len) {
+    while (*len > 0 && (**p == ' ' || **p == '\t')) {
+        ++*p;
+        --*len;
+    }
+    while (*len > 0 && ((*p)[*len - 1] == ' ' || (*p)[*len - 1] == '\t')) {
+        --*len;
+    }
+}
+
+/* Whether a comma-separated list holds token (case-insensitively). */
+static bool list_has(const char *value, size_t len, const char *token) {
+    while (len > 0) {
+        const char *comma = memchr(value, ',', len);
+        size_t item_len = comma != NULL ? (size_t)(comma - value) : len;
+        const char *item = value;
+        size_t n = item_len;
+        trim(&item, &n);
+        if (name_is(item, n, token)) {
+            return true;
+        }
+        if (comma == NULL) {
+            break;
+        }
+        value += item_len + 1;
+        len -= item_len + 1;
+    }
+    return false;
+}
+
+/* Fields that only make sense for one HTTP/1.1 connection (RFC 9113, 8.2.2). */
+static bool connection_specific(const char *name, size_t len) {
+    return name_is(name, len, "connection") ||
+        name_is(name, len, "keep-alive") ||
+        name_is(name, len, "proxy-connection") ||
+        name_is(name, len, "transfer-encoding") ||
+        name_is(name, len, "upgrade");
+}
+
+int h2_preface_match(const char *buf, size_t len) {
+    size_t n = len < H2_PREFACE_LEN ? len : H2_PREFACE_LEN;
+    if (memcmp(buf, H2_PREFACE, n) != 0) {
+        return -1;
+    }
+    return len >= H2_PREFACE_LEN ? 1 : 0;
+}
+
+static ssize_t base64url_decode(const char *in, size_t len, uint8_t *out, size_t cap) {
+    uint32_t acc = 0;
+    int bits = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < len; ++i) {
+        char c = in[i];
+        uint32_t v;
+        if (c >= 'A' && c <= 'Z') {
+            v = (uint32_t)(c - 'A');
+        } else if (c >= 'a' && c <= 'z') {
+            v = (uint32_t)(c - 'a') + 26;
+        } else if (c >= '0' && c <= '9') {
+            v = (uint32_t)(c - '0') + 52;
+        } else if (c == '-') {
+            v = 62;
+        } else if (c == '_') {
+            v = 63;
+        } else if (c == '=') {
+            break;
+        } else {
+            return -1;
+        }
+        acc = (acc << 6 | v) & 0xffffff;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            if (n >= cap) {
+                return -1;
+            }
+            out[n++] = (uint8_t)(acc >> bits);
+        }
+    }
+    return (ssize_t)n;
+}
+
+bool h2_upgrade_requested(const http_request_t *req) {
+    const http_view_t *upgrade = http_request_header(req, HTTP_HDR_UPGRADE);
+    const http_view_t *settings = http_request_header(req, HTTP_HDR_HTTP2_SETTINGS);
+    const http_view_t *connection = http_request_header(req, HTTP_HDR_CONNECTION);
+    return upgrade != NULL && settings != NULL && connection != NULL &&
+        list_has(upgrade->ptr, upgrade->len, "h2c") &&
+        list_has(connection->ptr, connection->len, "upgrade") &&
+        req->content_length == 0 &&
+        !req->chunked;
+}
+
+int h2_build_upgrade_response(http_response_t *resp) {
+    static const char head[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+    resp->active = true;
+    resp->status = 101;
+    resp->head = (char *)head;
+    resp->head_borrowed = true;
+    resp->head_len = sizeof(head) - 1;
+    return 0;
+}
+
+static void session_error(h2_session_t *s, uint32_t code);
+
+static int ctrl_frame(h2_session_t *s, uint8_t type, uint8_t flags, uint32_t id, const uint8_t *payload, size_t len) {
+    if (s->ctrl_len + H2_FRAME_HEADER_LEN + len > H2_CTRL_CAP) {
+        session_error(s, H2_ENHANCE_YOUR_CALM);
+        return -1;
+    }
+    put_frame_header(s->ctrl + s->ctrl_len, len, type, flags, id);
+    if (len > 0) {
+        memcpy(s->ctrl + s->ctrl_len + H2_FRAME_HEADER_LEN, payload, len);
+    }
+    s->ctrl_len += H2_FRAME_HEADER_LEN + len;
+    return 0;
+}
+
+static void queue_rst(h2_session_t *s, uint32_t id, uint32_t code) {
+    uint8_t payload[4];
+    put_u32(payload, code);
+    (void)ctrl_frame(s, H2_RST_STREAM, 0, id, payload, sizeof(payload));
+}
+
+static void queue_window_update(h2_session_t *s, uint32_t id, uint32_t increment) {
+    uint8_t payload[4];
+    put_u32(payload, increment);
+    (void)ctrl_frame(s, H2_WINDOW_UPDATE, 0, id, payload, sizeof(payload));
+}
+
+/* A connection error: GOAWAY goes out in the next batch, then the connection closes. */
+static void session_error(h2_session_t *s, uint32_t code) {
+    if (s->closing) {
+        return;
+    }
+    uint8_t *p = s->ctrl + s->ctrl_len;
+    put_frame_header(p, 8, H2_GOAWAY, 0, 0);
+    put_u32(p + H2_FRAME_HEADER_LEN, s->last_stream_id);
+    put_u32(p + H2_FRAME_HEADER_LEN + 4, code);
+    s->ctrl_len += H2_GOAWAY_LEN;
+    s->closing = true;
+    s->conn->closing = true;
+}
+
+static h2_stream_t **stream_bucket(h2_session_t *s, uint32_t id) {
+    return &s->buckets[(id >> 1) & (H2_STREAM_BUCKETS - 1)];
+}
+
+static h2_stream_t *stream_find(h2_session_t *s, uint32_t id) {
+    for (h2_stream_t *st = *stream_bucket(s, id); st != NULL; st = st->hash_next) {
+        if (st->id == id) {
+            return st;
+        }
+    }
+    return NULL;
+}
+
+static h2_stream_t *stream_new(h2_session_t *s, uint32_t id) {
+    h2_stream_t *st = slab_pool_alloc(&s->ctx->h2.streams);
+    if (st == NULL) {
+        return NULL;
+    }
+    h2_stream_t **bucket = stream_bucket(s, id);
+    st->id = id;
+    st->hash_next = *bucket;
+    *bucket = st;
+    st->send_window = s->peer_initial_window;
+    st->recv_window = H2_RECV_WINDOW;
+    st->start_ns = s->conn->rx_last_ns;
+    ++s->stream_count;
+    return st;
+}
+
+static void stream_free(h2_session_t *s, h2_stream_t *st) {
+    worker_ctx_t *ctx = s->ctx;
+    h2_stream_t **link = stream_bucket(s, st->id);
+    while (*link != st) {
+        link = &(*link)->hash_next;
+    }
+    *link = st->hash_next;
+    if (st->resp != NULL) {
+        http_response_reset(st->resp);
+        slab_pool_free(&ctx->resp_pool, st->resp);
+    }
+    buf_pool_release(&ctx->bufs, st->req, st->req_cap);
+    --s->stream_count;
+    slab_pool_free(&ctx->h2.streams, st);
+}
+
+static void ready_push(h2_session_t *s, h2_stream_t *st) {
+    if (st->ready || st->local_closed) {
+        return;
+    }
+    st->ready = true;
+    st->blocked = false;
+    st->ready_next = NULL;
+    if (s->ready_tail != NULL) {
+        s->ready_tail->ready_next = st;
+    } else {
+        s->ready_head = st;
+    }
+    s->ready_tail = st;
+    ++s->ready_count;
+}
+
+static h2_stream_t *ready_pop(h2_session_t *s) {
+    h2_stream_t *st = s->ready_head;
+    if (st == NULL) {
+        return NULL;
+    }
+    s->ready_head = st->ready_next;
+    if (s->ready_head == NULL) {
+        s->ready_tail = NULL;
+    }
+    st->ready = false;
+    --s->ready_count;
+    return st;
+}
+
+static void ready_remove(h2_session_t *s, h2_stream_t *st) {
+    if (!st->ready) {
+        return;
+    }
+    h2_stream_t *prev = NULL;
+    for (h2_stream_t *it = s->ready_head; it != st; it = it->ready_next) {
+        prev = it;
+    }
+    if (prev != NULL) {
+        prev->ready_next = st->ready_next;
+    } else {
+        s->ready_head = st->ready_next;
+    }
+    if (s->ready_tail == st) {
+        s->ready_tail = prev;
+    }
+    st->ready = false;
+    --s->ready_count;
+}
+
+/* Nothing more is sent on st; it is freed once the batch in flight has drained. */
+static void stream_retire(h2_session_t *s, h2_stream_t *st) {
+    if (st->local_closed) {
+        return;
+    }
+    ready_remove(s, st);
+    st->local_closed = true;
+    st->done_next = s->done;
+    s->done = st;
+}
+
+static void stream_reset(h2_session_t *s, h2_stream_t *st, uint32_t code) {
+    queue_rst(s, st->id, code);
+    st->reset = true;
+    stream_retire(s, st);
+}
+
+static void session_retire_done(h2_session_t *s) {
+    uint64_t now_ns = 0;
+    while (s->done != NULL) {
+        h2_stream_t *st = s->done;
+        s->done = st->done_next;
+        if (!st->reset && st->resp != NULL) {
+            if (now_ns == 0) {
+                now_ns = util_now_ns();
+            }
+            http_response_t *resp = st->resp;
+            uint64_t latency_ns = now_ns > resp->start_ns ? now_ns - resp->start_ns : 0;
+            metrics_observe_response(resp->route, resp->status, latency_ns);
+            ++s->conn->responses_sent;
+            ++s->ctx->tx.responses;
+            /* Answered before the request ended: the rest of it is not wanted. */
+            if (!st->remote_closed) {
+                queue_rst(s, st->id, H2_NO_ERROR);
+            }
+        }
+        stream_free(s, st);
+    }
+}
+
+/* Grow the request buffer to at least need bytes, keeping what is in it. */
+static int stream_reserve(h2_session_t *s, h2_stream_t *st, size_t need) {
+    if (need <= st->req_cap) {
+        return 0;
+    }
+    size_t cap = 0;
+    char *next = buf_pool_acquire(&s->ctx->bufs, need, &cap);
+    if (next == NULL) {
+        return -1;
+    }
+    if (st->req != NULL) {
+        memcpy(next, st->req, st->head_len + H2_LENGTH_GAP + st->body_len);
+        buf_pool_release(&s->ctx->bufs, st->req, st->req_cap);
+    }
+    st->req = next;
+    st->req_cap = cap;
+    return 0;
+}
+
+static void stream_set_response(h2_session_t *s, h2_stream_t *st, http_response_t *resp) {
+    /* Frames delimit the body; a producer must not add chunk framing of its own. */
+    resp->chunked = false;
+    st->resp = resp;
+    const char *blank = memmem(resp->head, resp->head_len, "\r\n\r\n", 4);
+    st->head_end = blank != NULL ? (size_t)(blank - resp->head) + 2 : resp->head_len;
+    st->tail_off = blank != NULL ? (size_t)(blank - resp->head) + 4 : resp->head_len;
+    st->tail_end = resp->head_len;
+    ready_push(s, st);
+}
+
+static http_response_t *stream_response(h2_session_t *s, h2_stream_t *st) {
+    http_response_t *resp = slab_pool_alloc(&s->ctx->resp_pool);
+    if (resp == NULL) {
+        stream_reset(s, st, H2_INTERNAL_ERROR);
+        return NULL;
+    }
+    http_response_init(resp, &s->ctx->bufs);
+    resp->start_ns = st->start_ns;
+    return resp;
+}
+
+static void stream_respond_error(h2_session_t *s, h2_stream_t *st, int status) {
+    http_response_t *resp = stream_response(s, st);
+    if (resp == NULL) {
+        return;
+    }
+    if (http_build_error_response(resp, status, false) != 0) {
+        http_response_reset(resp);
+        (void)http_build_error_response(resp, 500, false);
+    }
+    stream_set_response(s, st, resp);
+}
+
+static void stream_route(h2_session_t *s, h2_stream_t *st, const http_request_t *req) {
+    worker_ctx_t *ctx = s->ctx;
+    http_response_t *resp = stream_response(s, st);
+    if (resp == NULL) {
+        return;
+    }
+    if (http_route_request(req, resp, ctx->cfg.static_root, ctx->module_ctx, false) != 0) {
+        http_route_id_t route = resp->route;
+        http_response_reset(resp);
+        (void)http_build_error_response(resp, 500, false);
+        resp->route = route;
+    }
+    /* An upstream relays straight to the client socket, which HTTP/2 frames; not proxied here. */
+    if (resp->upstream >= 0) {
+        http_response_reset(resp);
+        (void)http_build_error_response(resp, 502, false);
+        resp->route = HTTP_ROUTE_PROXY;
+    }
+    st->head_only = req->method_id == HTTP_METHOD_HEAD;
+    stream_set_response(s, st, resp);
+}
+
+/* The request ended with its body buffered: give it its Content-Length and route it. */
+static void stream_dispatch(h2_session_t *s, h2_stream_t *st) {
+    if (st->declared && st->received != st->declared_len) {
+        stream_reset(s, st, H2_PROTOCOL_ERROR);
+        return;
+    }
+
+    char *text = st->req;
+    size_t len;
+    if (st->body_len == 0) {
+        memcpy(st->req + st->head_len, "\r\n", 2);
+        len = st->head_len + 2;
+    } else {
+        char line[H2_LENGTH_GAP];
+        int n = snprintf(line, sizeof(line), "content-length: %zu\r\n\r\n", st->body_len);
+        size_t shift = H2_LENGTH_GAP - (size_t)n;
+        memcpy(st->req + st->head_len + shift, line, (size_t)n);
+        memmove(st->req + shift, st->req, st->head_len);
+        text = st->req + shift;
+        len = st->head_len + (size_t)n + st->body_len;
+    }
+
+    http_request_t req;
+    size_t consumed = 0;
+    int status = 400;
+    if (http_parse_request(text, len, &req, &consumed, &status) != HTTP_PARSE_OK) {
+        stream_respond_error(s, st, status);
+        return;
+    }
+    stream_route(s, st, &req);
+}
+
+static void stream_end_request(h2_session_t *s, h2_stream_t *st) {
+    if (!st->streamed) {
+        stream_dispatch(s, st);
+        return;
+    }
+    http_response_t *resp = stream_response(s, st);
+    if (resp == NULL) {
+        return;
+    }
+    if (http_body_stream_finish(&st->body_stream, resp, false) != 0) {
+        http_route_id_t route = resp->route;
+        http_response_reset(resp);
+        (void)http_build_error_response(resp, 500, false);
+        resp->route = route;
+    }
+    stream_set_response(s, st, resp);
+}
+
+static void stream_body(h2_session_t *s, h2_stream_t *st, const uint8_t *data, size_t len) {
+    st->received += len;
+    if (st->declared && st->received > st->declared_len) {
+        stream_reset(s, st, H2_PROTOCOL_ERROR);
+        return;
+    }
+    if (st->streamed) {
+        if (len > 0 && http_body_stream_data(&st->body_stream, (const char *)data, len) != 0) {
+            stream_respond_error(s, st, 500);
+        }
+        return;
+    }
+    if (st->body_len + len > HTTP_MAX_CONTENT_LENGTH) {
+        stream_respond_error(s, st, 413);
+        return;
+    }
+    if (stream_reserve(s, st, st->head_len + H2_LENGTH_GAP + st->body_len + len) != 0) {
+        stream_reset(s, st, H2_INTERNAL_ERROR);
+        return;
+    }
+    memcpy(st->req + st->head_len + H2_LENGTH_GAP + st->body_len, data, len);
+    st->body_len += len;
+}
+
+static void on_field(void *arg, const char *name, size_t name_len, const char *value, size_t value_len) {
+    h2_fields_t *f = arg;
+    if (f->trailers || f->malformed) {
+        return;
+    }
+    if (http_scan_value_invalid(value, value_len) != value_len) {
+        f->malformed = true;
+        return;
+    }
+
+    if (name_len > 0 && name[0] == ':') {
+        int k = 0;
+        while (k < H2_PSEUDO_COUNT && !name_is(name, name_len, k_pseudo_names[k])) {
+            ++k;
+        }
+        if (k == H2_PSEUDO_COUNT || f->regular || f->seen[k]) {
+            f->malformed = true;
+            return;
+        }
+        if (value_len > sizeof(f->pseudo) - f->pseudo_len) {
+            f->too_large = true;
+            return;
+        }
+        memcpy(f->pseudo + f->pseudo_len, value, value_len);
+        f->seen[k] = true;
+        f->off[k] = f->pseudo_len;
+        f->len[k] = value_len;
+        f->pseudo_len += value_len;
+        return;
+    }
+
+    f->regular = true;
+    if (name_len == 0 || http_scan_token_len(name, name_len) != name_len || connection_specific(name, name_len)) {
+        f->malformed = true;
+        return;
+    }
+    for (size_t i = 0; i < name_len; ++i) {
+        if (name[i] >= 'A' && name[i] <= 'Z') {
+            f->malformed = true;
+            return;
+        }
+    }
+    if (name_is(name, name_len, "te")) {
+        f->malformed = !name_is(value, value_len, "trailers");
+        return;
+    }
+    if (name_is(name, name_len, "content-length")) {
+        size_t n = 0;
+        if (value_len == 0 || value_len > 18) {
+            f->malformed = true;
+            return;
+        }
+        for (size_t i = 0; i < value_len; ++i) {
+            if (value[i] < '0' || value[i] > '9') {
+                f->malformed = true;
+                return;
+            }
+            n = n * 10 + (size_t)(value[i] - '0');
+        }
+        if (f->declared && f->declared_len != n) {
+            f->malformed = true;
+        }
+        f->declared = true;
+        f->declared_len = n;
+        return;
+    }
+    /* No 100 to wait for: flow control already paces the body. */
+    if (name_is(name, name_len, "expect") || (f->seen[H2_PSEUDO_AUTHORITY] && name_is(name, name_len, "host"))) {
+        return;
+    }
+
+    size_t need = name_len + 2 + value_len + 2;
+    if (need > sizeof(f->lines) - f->lines_len) {
+        f->too_large = true;
+        return;
+    }
+    char *p = f->lines + f->lines_len;
+    memcpy(p, name, name_len);
+    p += name_len;
+    memcpy(p, ": ", 2);
+    p += 2;
+    memcpy(p, value, value_len);
+    p += value_len;
+    memcpy(p, "\r\n", 2);
+    f->lines_len += need;
+}
+
+/* Rebuild the request head and decide, as for HTTP/1.1, how its body is read. */
+static void stream_start_request(h2_session_t *s, h2_stream_t *st, const h2_fields_t *f) {
+    const char *method = f->pseudo + f->off[H2_PSEUDO_METHOD];
+    size_t method_len = f->len[H2_PSEUDO_METHOD];
+    const char *path = f->pseudo + f->off[H2_PSEUDO_PATH];
+    size_t path_len = f->len[H2_PSEUDO_PATH];
+    bool authority = f->seen[H2_PSEUDO_AUTHORITY] && f->len[H2_PSEUDO_AUTHORITY] > 0;
+    size_t head_len = method_len + 1 + path_len + sizeof(" HTTP/1.1\r\n") - 1 +
+        (authority ? sizeof("host: \r\n") - 1 + f->len[H2_PSEUDO_AUTHORITY] : 0) +
+        f->lines_len;
+    size_t body_hint = 0;
+    if (!st->remote_closed && f->declared) {
+        body_hint = f->declared_len < HTTP_MAX_CONTENT_LENGTH ? f->declared_len : HTTP_MAX_CONTENT_LENGTH;
+    }
+    if (stream_reserve(s, st, head_len + H2_LENGTH_GAP + body_hint) != 0) {
+        stream_reset(s, st, H2_INTERNAL_ERROR);
+        return;
+    }
+
+    char *p = st->req;
+    memcpy(p, method, method_len);
+    p += method_len;
+    *p++ = ' ';
+    memcpy(p, path, path_len);
+    p += path_len;
+    memcpy(p, " HTTP/1.1\r\n", sizeof(" HTTP/1.1\r\n") - 1);
+    p += sizeof(" HTTP/1.1\r\n") - 1;
+    if (authority) {
+        memcpy(p, "host: ", 6);
+        p += 6;
+        memcpy(p, f->pseudo + f->off[H2_PSEUDO_AUTHORITY], f->len[H2_PSEUDO_AUTHORITY]);
+        p += f->len[H2_PSEUDO_AUTHORITY];
+        memcpy(p, "\r\n", 2);
+        p += 2;
+    }
+    memcpy(p, f->lines, f->lines_len);
+    st->head_len = head_len;
+    st->declared = f->declared;
+    st->declared_len = f->declared_len;
+
+    if (st->remote_closed) {
+        stream_dispatch(s, st);
+        return;
+    }
+
+    /* The head as HTTP/1.1 would carry this body, only to route it. */
+    char *framing = st->req + head_len;
+    int n;
+    if (f->declared) {
+        n = snprintf(framing, H2_LENGTH_GAP, "content-length: %zu\r\n\r\n", f->declared_len);
+    } else {
+        n = snprintf(framing, H2_LENGTH_GAP, "transfer-encoding: chunked\r\n\r\n");
+    }
+    http_parser_t parser;
+    http_parser_init(&parser);
+    parser.report_headers = true;
+    http_request_t req;
+    size_t consumed = 0;
+    int status = 400;
+    http_parse_result_t res = http_parser_execute(&parser, st->req, head_len + (size_t)n, &req, &consumed, &status);
+    if (res == HTTP_PARSE_ERROR) {
+        stream_respond_error(s, st, status);
+        return;
+    }
+    if (res == HTTP_PARSE_HEADERS) {
+        http_body_mode_t mode = http_route_body(&req, &st->body_stream, &status);
+        if (mode == HTTP_BODY_REJECTED) {
+            stream_respond_error(s, st, status);
+        } else if (mode == HTTP_BODY_STREAMED) {
+            st->streamed = true;
+        }
+    }
+}
+
+/* A complete header block: a new request, or trailers ending one. */
+static void session_header_block(h2_session_t *s, uint32_t id, uint8_t flags, const uint8_t *block, size_t len) {
+    h2_stream_t *st = stream_find(s, id);
+    bool open = st == NULL && id > s->last_stream_id;
+    if (open && (id & 1) == 0) {
+        session_error(s, H2_PROTOCOL_ERROR);
+        return;
+    }
+
+    /* A block that opens no stream is still decoded to keep the table in step. */
+    h2_fields_t fields;
+    fields.trailers = !open || s->stream_count >= H2_MAX_CONCURRENT_STREAMS;
+    fields.malformed = false;
+    fields.too_large = false;
+    fields.regular = false;
+    memset(fields.seen, 0, sizeof(fields.seen));
+    fields.declared = false;
+    fields.declared_len = 0;
+    fields.pseudo_len = 0;
+    fields.lines_len = 0;
+    if (hpack_decode(&s->hpack, block, len, on_field, &fields) != 0) {
+        session_error(s, H2_COMPRESSION_ERROR);
+        return;
+    }
+
+    if (!open) {
+        if (st == NULL) {
+            queue_rst(s, id, H2_STREAM_CLOSED);
+            return;
+        }
+        if (st->remote_closed) {
+            stream_reset(s, st, H2_STREAM_CLOSED);
+            return;
+        }
+        if (!(flags & H2_FLAG_END_STREAM)) {
+            stream_reset(s, st, H2_PROTOCOL_ERROR);
+            return;
+        }
+        st->remote_closed = true;
+        if (st->resp == NULL && !st->reset) {
+            stream_end_request(s, st);
+        }
+        return;
+    }
+
+    s->last_stream_id = id;
+    if (s->stream_count >= H2_MAX_CONCURRENT_STREAMS) {
+        queue_rst(s, id, H2_REFUSED_STREAM);
+        return;
+    }
+    st = stream_new(s, id);
+    if (st == NULL) {
+        queue_rst(s, id, H2_REFUSED_STREAM);
+        return;
+    }
+    st->remote_closed = (flags & H2_FLAG_END_STREAM) != 0;
+    metrics_inc_requests();
+
+    if (fields.malformed ||
+        !fields.seen[H2_PSEUDO_METHOD] ||
+        !fields.seen[H2_PSEUDO_SCHEME] ||
+        !fields.seen[H2_PSEUDO_PATH] ||
+        fields.len[H2_PSEUDO_PATH] == 0) {
+        stream_reset(s, st, H2_PROTOCOL_ERROR);
+        return;
+    }
+    if (fields.too_large) {
+        stream_respond_error(s, st, 431);
+        return;
+    }
+    stream_start_request(s, st, &fields);
+}
+
+static int session_block_append(h2_session_t *s, const uint8_t *data, size_t len) {
+    if (s->hblock_len + len > H2_HEADER_BLOCK_MAX) {
+        return -1;
+    }
+    if (s->hblock_len + len > s->hblock_cap) {
+        size_t cap = 0;
+        char *next = buf_pool_acquire(&s->ctx->bufs, s->hblock_len + len, &cap);
+        if (next == NULL) {
+            return -1;
+        }
+        if (s->hblock_len > 0) {
+            memcpy(next, s->hblock, s->hblock_len);
+        }
+        buf_pool_release(&s->ctx->bufs, s->hblock, s->hblock_cap);
+        s->hblock = next;
+        s->hblock_cap = cap;
+    }
+    memcpy(s->hblock + s->hblock_len, data, len);
+    s->hblock_len += len;
+    return 0;
+}
+
+static void session_block_release(h2_session_t *s) {
+    buf_pool_release(&s->ctx->bufs, s->hblock, s->hblock_cap);
+    s->hblock = NULL;
+    s->hblock_cap = 0;
+    s->hblock_len = 0;
+}
+
+static void frame_headers(h2_session_t *s, uint8_t flags, uint32_t id, const uint8_t *p, size_t len) {
+    size_t off = 0;
+    size_t pad = 0;
+    if (id == 0) {
+        session_error(s, H2_PROTOCOL_ERROR);
+        return;
+    }
+    if (flags & H2_FLAG_PADDED) {
+        if (len < 1) {
+            session_error(s, H2_FRAME_SIZE_ERROR);
+            return;
+        }
+        pad = p[0];
+        off = 1;
+    }
+    if (flags & H2_FLAG_PRIORITY) {
+        off += 5;
+    }
+    if (off + pad > len) {
+        session_error(s, H2_PROTOCOL_ERROR);
+        return;
+    }
+    const uint8_t *frag = p + off;
+    size_t frag_len = len - off - pad;
+
+    if (flags & H2_FLAG_END_HEADERS) {
+        session_header_block(s, id, flags, frag, frag_len);
+        return;
+    }
+    s->hblock_len = 0;
+    if (session_block_append(s, frag, frag_len) != 0) {
+        session_error(s, H2_ENHANCE_YOUR_CALM);
+        return;
+    }
+    s->cont_stream = id;
+    s->cont_flags = flags;
+}
+
+static void frame_continuation(h2_session_t *s, uint8_t flags, uint32_t id, const uint8_t *p, size_t len) {
+    if (s->cont_stream == 0 || id != s->cont_stream) {
+        session_error(s, H2_PROTOCOL_ERROR);
+        return;
+    }
+    if (session_block_append(s, p, len) != 0) {
+        session_error(s, H2_ENHANCE_YOUR_CALM);
+        return;
+    }
+    if (flags & H2_FLAG_END_HEADERS) {
+        s->cont_stream = 0;
+        session_header_block(s, id, s->cont_flags, (const uint8_t *)s->hblock, s->hblock_len);
+        session_block_release(s);
+    }
+}
+
+static void frame_data(h2_session_t *s, uint8_t flags, uint32_t id, const uint8_t *p, size_t len) {
+    if (id == 0) {
+        session_error(s, H2_PROTOCOL_ERROR);
+        return;
+    }
+    size_t off = 0;
+    size_t pad = 0;
+    if (flags & H2_FLAG_PADDED) {
+        if (len < 1) {
+            session_error(s, H2_FRAME_SIZE_ERROR);
+            return;
+        }
+        pad = p[0];
+        off = 1;
+        if (off + pad > len) {
+            session_error(s, H2_PROTOCOL_ERROR);
+            return;
+        }
+    }
+
+    /* The whole frame counts against the windows, padding included. */
+    s->recv_window -= (int64_t)len;
+    if (s->recv_window < 0) {
+        session_error(s, H2_FLOW_CONTROL_ERROR);
+        return;
+    }
+    s->recv_unacked += (uint32_t)len;
+    if (s->recv_unacked >= H2_RECV_WINDOW / 2) {
+        queue_window_update(s, 0, s->recv_unacked);
+        s->recv_window += s->recv_unacked;
+        s->recv_unacked = 0;
+    }
+
+    h2_stream_t *st = stream_find(s, id);
+    if (st == NULL) {
+        if (id > s->last_stream_id) {
+            session_error(s, H2_PROTOCOL_ERROR);
+        }
+        return;
+    }
+    if (st->remote_closed) {
+        if (!st->reset) {
+            stream_reset(s, st, H2_STREAM_CLOSED);
+        }
+        return;
+    }
+    st->recv_window -= (int64_t)len;
+    if (st->recv_window < 0) {
+        stream_reset(s, st, H2_FLOW_CONTROL_ERROR);
+        return;
+    }
+
+    if (st->resp == NULL && !st->reset) {
+        stream_body(s, st, p + off, len - off - pad);
+    }
+    if (flags & H2_FLAG_END_STREAM) {
+        st->remote_closed = true;
+        if (st->resp == NULL && !st->reset) {
+            stream_end_request(s, st);
+        }
+        return;
+    }
+    st->recv_unacked += (uint32_t)len;
+    if (st->recv_unacked >= H2_RECV_WINDOW / 2 && !st->local_closed) {
+        queue_window_update(s, id, st->recv_unacked);
+        st->recv_window += st->recv_unacked;
+        st->recv_unacked = 0;
+    }
+}
+
+/* Apply a new peer initial window to every stream (RFC 9113, 6.9.2). */
+static int session_shift_windows(h2_session_t *s, int64_t delta) {
+    for (size_t i = 0; i < H2_STREAM_BUCKETS; ++i) {
+        for (h2_stream_t *st = s->buckets[i]; st != NULL; st = st->hash_next) {
+            st->send_window += delta;
+            if (st->send_window > H2_WINDOW_MAX) {
+                return -1;
+            }
+            if (st->blocked && st->send_window > 0) {
+                ready_push(s, st);
+            }
+        }
+    }
+    return 0;
+}
+
+static uint32_t session_apply_settings(h2_session_t *s, const uint8_t *p, size_t len) {
+    for (size_t i = 0; i + 6 <= len; i += 6) {
+        unsigned id = (unsigned)p[i] << 8 | p[i + 1];
+        uint32_t value = get_u32(p + i + 2);
+        switch (id) {
+            case H2_SETTINGS_ENABLE_PUSH:
+                if (value > 1) {
+                    return H2_PROTOCOL_ERROR;
+                }
+                break;
+            case H2_SETTINGS_INITIAL_WINDOW_SIZE:
+                if (value > H2_WINDOW_MAX ||
+                    session_shift_windows(s, (int64_t)value - (int64_t)s->peer_initial_window) != 0) {
+                    return H2_FLOW_CONTROL_ERROR;
+                }
+                s->peer_initial_window = value;
+                break;
+            case H2_SETTINGS_MAX_FRAME_SIZE:
+                if (value < H2_FRAME_SIZE || value > H2_FRAME_SIZE_LIMIT) {
+                    return H2_PROTOCOL_ERROR;
+                }
+                s->peer_max_frame = value;
+                break;
+            default:
+                /* Our encoder never indexes, so the peer's table size does not matter. */
+                break;
+        }
+    }
+    return H2_NO_ERROR;
+}
+
+static void frame_settings(h2_session_t *s, uint8_t flags, uint32_t id, const uint8_t *p, size_t len) {
+    if (id != 0) {
+        session_error(s, H2_PROTOCOL_ERROR);
+        return;
+    }
+    if (flags & H2_FLAG_ACK) {
+        if (len != 0) {
+            session_error(s, H2_FRAME_SIZE_ERROR);
+        }
+        return;
+    }
+    if (len % 6 != 0) {
+        session_error(s, H2_FRAME_SIZE_ERROR);
+        return;
+    }
+    uint32_t code = session_apply_settings(s, p, len);
+    if (code != H2_NO_ERROR) {
+        session_error(s, code);
+        return;
+    }
+    (void)ctrl_frame(s, H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+}
+
+static void frame_window_update(h2_session_t *s, uint32_t id, const uint8_t *p, size_t len) {
+    if (len != 4) {
+        session_error(s, H2_FRAME_SIZE_ERROR);
+        return;
+    }
+    uint32_t increment = get_u32(p) & 0x7fffffff;
+    if (id == 0) {
+        if (increment == 0) {
+            session_error(s, H2_PROTOCOL_ERROR);
+            return;
+        }
+        s->send_window += increment;
+        if (s->send_window > H2_WINDOW_MAX) {
+            session_error(s, H2_FLOW_CONTROL_ERROR);
+        }
+        return;
+    }
+
+    h2_stream_t *st = stream_find(s, id);
+    if (st == NULL) {
+        if (id > s->last_stream_id) {
+            session_error(s, H2_PROTOCOL_ERROR);
+        }
+        return;
+    }
+    if (st->local_closed) {
+        return;
+    }
+    if (increment == 0) {
+        stream_reset(s, st, H2_PROTOCOL_ERROR);
+        return;
+    }
+    st->send_window += increment;
+    if (st->send_window > H2_WINDOW_MAX) {
+        stream_reset(s, st, H2_FLOW_CONTROL_ERROR);
+        return;
+    }
+    if (st->blocked && st->send_window > 0) {
+        ready_push(s, st);
+    }
+}
+
+static void session_frame(h2_session_t *s, uint8_t type, uint8_t flags, uint32_t id, const uint8_t *p, size_t len) {
+    if (s->cont_stream != 0 && type != H2_CONTINUATION) {
+        session_error(s, H2_PROTOCOL_ERROR);
+        return;
+    }
+    if (!s->settings_seen) {
+        if (type != H2_SETTINGS || (flags & H2_FLAG_ACK)) {
+            session_error(s, H2_PROTOCOL_ERROR);
+            return;
+        }
+        s->settings_seen = true;
+    }
+
+    switch (type) {
+        case H2_DATA:
+            frame_data(s, flags, id, p, len);
+            break;
+        case H2_HEADERS:
+            frame_headers(s, flags, id, p, len);
+            break;
+        case H2_PRIORITY:
+            if (id == 0) {
+                session_error(s, H2_PROTOCOL_ERROR);
+            } else if (len != 5) {
+                session_error(s, H2_FRAME_SIZE_ERROR);
+            }
+            break;
+        case H2_RST_STREAM: {
+            if (id == 0) {
+                session_error(s, H2_PROTOCOL_ERROR);
+                break;
+            }
+            if (len != 4) {
+                session_error(s, H2_FRAME_SIZE_ERROR);
+                break;
+            }
+            h2_stream_t *st = stream_find(s, id);
+            if (st == NULL) {
+                if (id > s->last_stream_id) {
+                    session_error(s, H2_PROTOCOL_ERROR);
+                }
+                break;
+            }
+            st->remote_closed = true;
+            st->reset = true;
+            stream_retire(s, st);
+            break;
+        }
+        case H2_SETTINGS:
+            frame_settings(s, flags, id, p, len);
+            break;
+        case H2_PING:
+            if (id != 0) {
+                session_error(s, H2_PROTOCOL_ERROR);
+            } else if (len != 8) {
+                session_error(s, H2_FRAME_SIZE_ERROR);
+            } else if (!(flags & H2_FLAG_ACK)) {
+                (void)ctrl_frame(s, H2_PING, H2_FLAG_ACK, 0, p, len);
+            }
+            break;
+        case H2_GOAWAY:
+            /* Streams already open run to completion; the client closes when it is done. */
+            if (id != 0) {
+                session_error(s, H2_PROTOCOL_ERROR);
+            }
+            break;
+        case H2_WINDOW_UPDATE:
+            frame_window_update(s, id, p, len);
+            break;
+        case H2_CONTINUATION:
+            frame_continuation(s, flags, id, p, len);
+            break;
+        case H2_PUSH_PROMISE:
+            session_error(s, H2_PROTOCOL_ERROR);
+            break;
+        default:
+            /* Unknown frame types are ignored (RFC 9113, 4.1). */
+            break;
+    }
+}
+
+static bool stream_body_done(const h2_stream_t *st) {
+    const http_response_t *resp = st->resp;
+    return st->tail_off == st->tail_end &&
+        resp->body_sent == resp->body_len &&
+        (resp->file_fd < 0 || resp->file_remaining == 0) &&
+        !http_response_has_more(resp);
+}
+
+/* HPACK the status and fields of the rendered HTTP/1.1 head, minus what HTTP/2 leaves out. */
+static ssize_t encode_response_head(const h2_stream_t *st, uint8_t *out, size_t cap) {
+    const http_response_t *resp = st->resp;
+    ssize_t n = hpack_encode_status(resp->status, out, cap);
+    if (n < 0) {
+        return -1;
+    }
+    size_t len = (size_t)n;
+
+    const char *p = resp->head;
+    const char *end = resp->head + st->head_end;
+    const char *eol = memchr(p, '\n', (size_t)(end - p));
+    p = eol != NULL ? eol + 1 : end;
+    while (p < end) {
+        eol = memchr(p, '\n', (size_t)(end - p));
+        const char *next = eol != NULL ? eol + 1 : end;
+        size_t line_len = (size_t)((eol != NULL ? eol : end) - p);
+        if (line_len > 0 && p[line_len - 1] == '\r') {
+            --line_len;
+        }
+        const char *colon = memchr(p, ':', line_len);
+        if (colon != NULL) {
+            size_t name_len = (size_t)(colon - p);
+            const char *value = colon + 1;
+            size_t value_len = line_len - name_len - 1;
+            trim(&value, &value_len);
+            if (!connection_specific(p, name_len)) {
+                n = hpack_encode_field(p, name_len, value, value_len, out + len, cap - len);
+                if (n < 0) {
+                    return -1;
+                }
+                len += (size_t)n;
+            }
+        }
+        p = next;
+    }
+    return (ssize_t)len;
+}
+
+static h2_emit_t stream_emit_headers(h2_session_t *s, h2_stream_t *st, size_t *len) {
+    size_t room = s->wbuf_cap - *len;
+    if (room <= H2_FRAME_HEADER_LEN) {
+        return H2_EMIT_FULL;
+    }
+    size_t cap = room - H2_FRAME_HEADER_LEN;
+    if (cap > s->peer_max_frame) {
+        cap = s->peer_max_frame;
+    }
+    uint8_t *frame = (uint8_t *)s->wbuf + *len;
+    ssize_t n = encode_response_head(st, frame + H2_FRAME_HEADER_LEN, cap);
+    if (n < 0) {
+        /* Retry in an empty batch unless it could not fit a whole frame anyway. */
+        if (cap < s->peer_max_frame && *len > 0) {
+            return H2_EMIT_FULL;
+        }
+        stream_reset(s, st, H2_INTERNAL_ERROR);
+        return H2_EMIT_FRAME;
+    }
+
+    bool end = st->head_only || stream_body_done(st);
+    put_frame_header(
+        frame,
+        (size_t)n,
+        H2_HEADERS,
+        (uint8_t)(H2_FLAG_END_HEADERS | (end ? H2_FLAG_END_STREAM : 0)),
+        st->id
+    );
+    *len += H2_FRAME_HEADER_LEN + (size_t)n;
+    st->headers_sent = true;
+    if (end) {
+        stream_retire(s, st);
+    }
+    return H2_EMIT_FRAME;
+}
+
+/*
+ * One DATA frame: memory bytes are copied into the batch; a file range is
+ * left for sendfile() or splice() behind its frame header and ends the batch.
+ */
+static h2_emit_t stream_emit_data(h2_session_t *s, h2_stream_t *st, size_t *len) {
+    http_response_t *resp = st->resp;
+    const char *src = NULL;
+    size_t avail = 0;
+    if (st->tail_off < st->tail_end) {
+        src = resp->head + st->tail_off;
+        avail = st->tail_end - st->tail_off;
+    } else {
+        if (resp->body_sent == resp->body_len && resp->file_remaining == 0) {
+            bool was_closing = resp->close_after_send;
+            (void)http_response_next_segment(resp);
+            if (resp->close_after_send && !was_closing) {
+                /* The producer failed: the body cannot be completed. */
+                stream_reset(s, st, H2_INTERNAL_ERROR);
+                return H2_EMIT_FRAME;
+            }
+        }
+        if (resp->body_sent < resp->body_len) {
+            const char *base = resp->mem != NULL ? resp->mem : resp->body;
+            src = base + resp->body_sent;
+            avail = resp->body_len - resp->body_sent;
+        }
+    }
+    bool file = avail == 0 && resp->file_fd >= 0 && resp->file_remaining > 0;
+
+    size_t room = s->wbuf_cap - *len;
+    uint8_t *frame = (uint8_t *)s->wbuf + *len;
+    if (avail == 0 && !file) {
+        if (room < H2_FRAME_HEADER_LEN) {
+            return H2_EMIT_FULL;
+        }
+        put_frame_header(frame, 0, H2_DATA, H2_FLAG_END_STREAM, st->id);
+        *len += H2_FRAME_HEADER_LEN;
+        stream_retire(s, st);
+        return H2_EMIT_FRAME;
+    }
+
+    if (st->send_window <= 0) {
+        st->blocked = true;
+        return H2_EMIT_BLOCKED;
+    }
+    if (s->send_window <= 0) {
+        return H2_EMIT_WAIT;
+    }
+    if (room <= H2_FRAME_HEADER_LEN) {
+        return H2_EMIT_FULL;
+    }
+    int64_t window = st->send_window < s->send_window ? st->send_window : s->send_window;
+    if (window > (int64_t)s->peer_max_frame) {
+        window = s->peer_max_frame;
+    }
+
+    size_t n;
+    if (file) {
+        n = resp->file_remaining < (off_t)window ? (size_t)resp->file_remaining : (size_t)window;
+        s->wire.file_fd = resp->file_fd;
+        s->wire.file_offset = resp->file_offset;
+        s->wire.file_remaining = (off_t)n;
+        resp->file_offset += (off_t)n;
+        resp->file_remaining -= (off_t)n;
+        *len += H2_FRAME_HEADER_LEN;
+    } else {
+        n = avail < (size_t)window ? avail : (size_t)window;
+        if (n > room - H2_FRAME_HEADER_LEN) {
+            n = room - H2_FRAME_HEADER_LEN;
+        }
+        memcpy(frame + H2_FRAME_HEADER_LEN, src, n);
+        if (st->tail_off < st->tail_end) {
+            st->tail_off += n;
+        } else {
+            resp->body_sent += n;
+        }
+        *len += H2_FRAME_HEADER_LEN + n;
+    }
+    st->send_window -= (int64_t)n;
+    s->send_window -= (int64_t)n;
+
+    bool end = stream_body_done(st);
+    put_frame_header(frame, n, H2_DATA, end ? H2_FLAG_END_STREAM : 0, st->id);
+    if (end) {
+        stream_retire(s, st);
+    }
+    return file ? H2_EMIT_FILE : H2_EMIT_FRAME;
+}
+
+/* Round-robin one frame per ready stream until the batch is full or nothing can move. */
+static void session_fill_streams(h2_session_t *s, size_t *len) {
+    bool progress = true;
+    while (progress && s->ready_head != NULL) {
+        progress = false;
+        for (unsigned n = s->ready_count; n > 0 && s->ready_head != NULL; --n) {
+            h2_stream_t *st = ready_pop(s);
+            h2_emit_t r = st->headers_sent ? stream_emit_data(s, st, len) : stream_emit_headers(s, st, len);
+            if (!st->blocked) {
+                ready_push(s, st);
+            }
+            if (r == H2_EMIT_FULL || r == H2_EMIT_FILE) {
+                return;
+            }
+            if (r == H2_EMIT_FRAME) {
+                progress = true;
+            }
+        }
+    }
+}
+
+/* Load the next batch into the wire; false if there is nothing to send. */
+static bool session_fill(h2_session_t *s) {
+    http_response_t *wire = &s->wire;
+    wire->mem = NULL;
+    wire->body_len = 0;
+    wire->body_sent = 0;
+    wire->file_fd = -1;
+    wire->file_offset = 0;
+    wire->file_remaining = 0;
+    bool streams = !s->closing && s->preface_done && s->ready_head != NULL;
+    if (s->ctrl_len == 0 && !streams) {
+        return false;
+    }
+    if (s->wbuf == NULL) {
+        s->wbuf = buf_pool_acquire(&s->ctx->bufs, H2_WIRE_CAP, &s->wbuf_cap);
+        if (s->wbuf == NULL) {
+            return false;
+        }
+    }
+
+    size_t len = s->ctrl_len;
+    memcpy(s->wbuf, s->ctrl, s->ctrl_len);
+    s->ctrl_len = 0;
+    /* After an upgrade, stream 1 waits for the client preface: only our SETTINGS follow the 101 at once. */
+    if (streams) {
+        session_fill_streams(s, &len);
+    }
+    if (len == 0) {
+        return false;
+    }
+    wire->mem = s->wbuf;
+    wire->body_len = len;
+    return true;
+}
+
+static void session_release_wire(h2_session_t *s) {
+    buf_pool_release(&s->ctx->bufs, s->wbuf, s->wbuf_cap);
+    s->wbuf = NULL;
+    s->wbuf_cap = 0;
+}
+
+/* Put the wire in the queue if it is not there and there is something to send. */
+static void session_schedule(h2_session_t *s) {
+    if (s->wire_queued) {
+        return;
+    }
+    session_retire_done(s);
+    if (!session_fill(s)) {
+        session_release_wire(s);
+        return;
+    }
+    connection_t *conn = s->conn;
+    conn->out_q[(conn->out_head + conn->out_count) % CONN_PIPELINE_DEPTH] = &s->wire;
+    ++conn->out_count;
+    s->wire_queued = true;
+}
+
+static h2_session_t *session_new(worker_ctx_t *ctx, connection_t *conn) {
+    h2_session_t *s = slab_pool_alloc(&ctx->h2.sessions);
+    if (s == NULL) {
+        return NULL;
+    }
+    s->ctx = ctx;
+    s->conn = conn;
+    http_response_init(&s->wire, &ctx->bufs);
+    s->wire.active = true;
+    s->wire.head_borrowed = true;
+    s->peer_max_frame = H2_FRAME_SIZE;
+    s->peer_initial_window = H2_DEFAULT_WINDOW;
+    s->send_window = H2_DEFAULT_WINDOW;
+    s->recv_window = H2_RECV_WINDOW;
+    hpack_decoder_init(&s->hpack);
+
+    uint8_t settings[12];
+    settings[0] = 0;
+    settings[1] = H2_SETTINGS_MAX_CONCURRENT_STREAMS;
+    put_u32(settings + 2, H2_MAX_CONCURRENT_STREAMS);
+    settings[6] = 0;
+    settings[7] = H2_SETTINGS_INITIAL_WINDOW_SIZE;
+    put_u32(settings + 8, H2_RECV_WINDOW);
+    (void)ctrl_frame(s, H2_SETTINGS, 0, 0, settings, sizeof(settings));
+    queue_window_update(s, 0, H2_RECV_WINDOW - H2_DEFAULT_WINDOW);
+    return s;
+}
+
+int h2_session_start(worker_ctx_t *ctx, connection_t *conn) {
+    h2_session_t *s = session_new(ctx, conn);
+    if (s == NULL) {
+        return -1;
+    }
+    conn->h2 = s;
+    return 0;
+}
+
+int h2_session_upgrade(
+    worker_ctx_t *ctx,
+    connection_t *conn,
+    const http_request_t *req,
+    const char *raw,
+    size_t raw_len
+) {
+    const http_view_t *value = http_request_header(req, HTTP_HDR_HTTP2_SETTINGS);
+    uint8_t settings[H2_SETTINGS_HEADER_MAX];
+    ssize_t settings_len = value == NULL ? -1 : base64url_decode(value->ptr, value->len, settings, sizeof(settings));
+    if (settings_len < 0 || settings_len % 6 != 0) {
+        return -1;
+    }
+
+    h2_session_t *s = session_new(ctx, conn);
+    if (s == NULL) {
+        return -1;
+    }
+    /* The 101 acknowledges these; no SETTINGS ACK is sent for them. */
+    if (session_apply_settings(s, settings, (size_t)settings_len) != H2_NO_ERROR) {
+        slab_pool_free(&ctx->h2.sessions, s);
+        return -1;
+    }
+    conn->h2 = s;
+
+    /* The request that asked for the upgrade is answered on stream 1, half-closed by the client. */
+    s->last_stream_id = 1;
+    h2_stream_t *st = stream_new(s, 1);
+    if (st == NULL) {
+        return 0;
+    }
+    st->remote_closed = true;
+    st->start_ns = conn->request_start_ns;
+    if (stream_reserve(s, st, raw_len) != 0) {
+        stream_reset(s, st, H2_INTERNAL_ERROR);
+        return 0;
+    }
+    memcpy(st->req, raw, raw_len);
+
+    http_request_t copy;
+    size_t consumed = 0;
+    int status = 400;
+    if (http_parse_request(st->req, raw_len, &copy, &consumed, &status) != HTTP_PARSE_OK) {
+        stream_respond_error(s, st, status);
+        return 0;
+    }
+    stream_route(s, st, &copy);
+    return 0;
+}
+
+void h2_session_destroy(worker_ctx_t *ctx, connection_t *conn) {
+    h2_session_t *s = conn->h2;
+    if (s == NULL) {
+        return;
+    }
+    if (s->wire_queued) {
+        /* Nothing is queued behind the wire. */
+        --conn->out_count;
+        conn->out_q[(conn->out_head + conn->out_count) % CONN_PIPELINE_DEPTH] = NULL;
+    }
+    for (size_t i = 0; i < H2_STREAM_BUCKETS; ++i) {
+        while (s->buckets[i] != NULL) {
+            stream_free(s, s->buckets[i]);
+        }
+    }
+    session_release_wire(s);
+    session_block_release(s);
+    slab_pool_free(&ctx->h2.sessions, s);
+    conn->h2 = NULL;
+}
+
+int h2_session_input(worker_ctx_t *ctx, connection_t *conn) {
+    (void)ctx;
+    h2_session_t *s = conn->h2;
+    size_t off = 0;
+
+    if (!s->closing && !s->preface_done && conn->in_len > 0) {
+        int match = h2_preface_match(conn->in_buf, conn->in_len);
+        if (match < 0) {
+            return -1;
+        }
+        if (match > 0) {
+            s->preface_done = true;
+            off = H2_PREFACE_LEN;
+        }
+    }
+
+    while (s->preface_done && !s->closing && conn->in_len - off >= H2_FRAME_HEADER_LEN) {
+        const uint8_t *p = (const uint8_t *)conn->in_buf + off;
+        uint32_t len = get_u24(p);
+        if (len > H2_FRAME_SIZE) {
+            session_error(s, H2_FRAME_SIZE_ERROR);
+            break;
+        }
+        if (conn->in_len - off < H2_FRAME_HEADER_LEN + len) {
+            break;
+        }
+        session_frame(s, p[3], p[4], get_u32(p + 5) & 0x7fffffff, p + H2_FRAME_HEADER_LEN, len);
+        off += H2_FRAME_HEADER_LEN + len;
+    }
+
+    if (s->closing || off >= conn->in_len) {
+        conn->in_len = 0;
+    } else if (off > 0) {
+        memmove(conn->in_buf, conn->in_buf + off, conn->in_len - off);
+        conn->in_len -= off;
+    }
+    session_schedule(s);
+    return 0;
+}
+
+bool h2_session_is_wire(const h2_session_t *s, const http_response_t *resp) {
+    return resp == &s->wire;
+}
+
+bool h2_session_sent(worker_ctx_t *ctx, connection_t *conn) {
+    (void)ctx;
+    h2_session_t *s = conn->h2;
+    session_retire_done(s);
+    if (session_fill(s)) {
+        return false;
+    }
+    /* The wire is at the front: the responses queued before it went out first. */
+    conn->out_q[conn->out_head] = NULL;
+    conn->out_head = (conn->out_head + 1) % CONN_PIPELINE_DEPTH;
+    --conn->out_count;
+    s->wire_queued = false;
+    session_release_wire(s);
+    return s->closing;
+}
+
+bool h2_session_active(const h2_session_t *s) {
+    return s->stream_count > 0;
+}
+
+#endif
@@ -1,15 +1,28 @@
 #include "server.h"
 
 #include <errno.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "static_cache.h"
+
+/* Long-only options take values past any short option character. */
+enum {
+    OPT_ACCEPT_MODE = 256
+};
+
 static void print_usage(const char *prog) {
     fprintf(
         stderr,
-        "Usage: %s [-p port] [-t threads] [-s static_root] [-i idle_timeout_sec]\n",
+        "Usage: %s [-p port] [-t threads] [-s static_root] [-i idle_timeout_sec]\n"
+        "          [-R header_timeout_sec] [-B body_timeout_sec] [-W write_timeout_sec] [-E epoll|uring]\n"
+        "          [-C static_cache_entries] [-M render_budget_kb] [-w inotify|stat|off] [-V revalidate_sec]\n"
+        "          [-A prefix=max_age_sec]... [-m module.so[:arg]]... [-P /prefix=host:port[/base]|unix:path[:/base]]...\n"
+        "          [-c tls_cert.pem -k tls_key.pem] [-b rebalance_threshold_pct]\n"
+        "          [--accept-mode reuseport-hash|reuseport-cpu|exclusive|acceptor]\n",
         prog
     );
 }
@@ -28,6 +41,47 @@ static int parse_int_arg(const char *arg, int min, int max, int *out) {
     return 0;
 }
 
+/* "assets/=31536000": Cache-Control max-age for static paths below a prefix. */
+static int parse_cache_rule(const char *arg, http_cache_rule_t *rule) {
+    const char *eq = strrchr(arg, '=');
+    if (eq == NULL || (size_t)(eq - arg) >= sizeof(rule->prefix)) {
+        return -1;
+    }
+    if (parse_int_arg(eq + 1, 0, 10 * 365 * 24 * 3600, &rule->max_age) != 0) {
+        return -1;
+    }
+    memcpy(rule->prefix, arg, (size_t)(eq - arg));
+    rule->prefix[eq - arg] = '\0';
+    return 0;
+}
+
+/* "./hello.so:arg": a handler module and the argument passed to its init(). */
+static int parse_module_spec(const char *arg, http_module_spec_t *spec) {
+    const char *colon = strchr(arg, ':');
+    size_t path_len = colon != NULL ? (size_t)(colon - arg) : strlen(arg);
+    const char *module_arg = colon != NULL ? colon + 1 : "";
+    if (path_len == 0 || path_len >= sizeof(spec->path) || strlen(module_arg) >= sizeof(spec->arg)) {
+        return -1;
+    }
+    memcpy(spec->path, arg, path_len);
+    spec->path[path_len] = '\0';
+    snprintf(spec->arg, sizeof(spec->arg), "%s", module_arg);
+    return 0;
+}
+
+/* "/api=127.0.0.1:9000" or "/api=unix:/run/api.sock": forward a path prefix to an upstream. */
+static int parse_proxy_spec(const char *arg, http_proxy_spec_t *spec) {
+    const char *eq = strchr(arg, '=');
+    if (eq == NULL || arg[0] != '/' || (size_t)(eq - arg) >= sizeof(spec->prefix) ||
+        eq[1] == '\0' || strlen(eq + 1) >= sizeof(spec->upstream)) {
+        return -1;
+    }
+    memcpy(spec->prefix, arg, (size_t)(eq - arg));
+    spec->prefix[eq - arg] = '\0';
+    snprintf(spec->upstream, sizeof(spec->upstream), "%s", eq + 1);
+    return 0;
+}
+
 int main(int argc, char **argv) {
     server_config_t cfg;
     memset(&cfg, 0, sizeof(cfg));
@@ -35,10 +89,21 @@ int main(int argc, char **argv) {
     cfg.threads = 1;
     cfg.backlog = 1024;
     cfg.idle_timeout_sec = 10;
+    cfg.header_timeout_sec = 5;
+    cfg.body_timeout_sec = 10;
+    cfg.write_timeout_sec = 10;
+    cfg.static_cache_entries = STATIC_CACHE_DEFAULT_ENTRIES;
+    cfg.static_render_budget_kb = STATIC_CACHE_DEFAULT_RENDER_BUDGET / 1024;
+    cfg.static_watch = STATIC_WATCH_INOTIFY;
+    cfg.static_revalidate_sec = 2;
     snprintf(cfg.static_root, sizeof(cfg.static_root), "%s", "./static");
 
+    static const struct option long_options[] = {
+        {"accept-mode", required_argument, NULL, OPT_ACCEPT_MODE},
+        {NULL, 0, NULL, 0}
+    };
     int opt;
-    while ((opt = getopt(argc, argv, "p:t:s:i:h")) != -1) {
+    while ((opt = getopt_long(argc, argv, "p:t:s:i:R:B:W:E:C:M:w:V:A:m:P:c:k:b:h", long_options, NULL)) != -1) {
         switch (opt) {
             case 'p':
                 if (parse_int_arg(optarg, 1, 65535, &cfg.port) != 0) {
@@ -65,6 +130,118 @@ int main(int argc, char **argv) {
                     return 1;
                 }
                 break;
+            case 'R':
+                if (parse_int_arg(optarg, 1, 3600, &cfg.header_timeout_sec) != 0) {
+                    fprintf(stderr, "invalid header timeout: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'B':
+                if (parse_int_arg(optarg, 1, 3600, &cfg.body_timeout_sec) != 0) {
+                    fprintf(stderr, "invalid body timeout: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'W':
+                if (parse_int_arg(optarg, 1, 3600, &cfg.write_timeout_sec) != 0) {
+                    fprintf(stderr, "invalid write timeout: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'E':
+                if (strcmp(optarg, "epoll") == 0) {
+                    cfg.engine = SERVER_ENGINE_EPOLL;
+                } else if (strcmp(optarg, "uring") == 0) {
+                    cfg.engine = SERVER_ENGINE_URING;
+                } else {
+                    fprintf(stderr, "invalid engine: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'C':
+                if (parse_int_arg(optarg, 0, STATIC_CACHE_MAX_ENTRIES, &cfg.static_cache_entries) != 0) {
+                    fprintf(stderr, "invalid static cache size: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'M':
+                if (parse_int_arg(optarg, 0, 4 * 1024 * 1024, &cfg.static_render_budget_kb) != 0) {
+                    fprintf(stderr, "invalid render budget: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'w':
+                if (strcmp(optarg, "inotify") == 0) {
+                    cfg.static_watch = STATIC_WATCH_INOTIFY;
+                } else if (strcmp(optarg, "stat") == 0) {
+                    cfg.static_watch = STATIC_WATCH_STAT;
+                } else if (strcmp(optarg, "off") == 0) {
+                    cfg.static_watch = STATIC_WATCH_OFF;
+                } else {
+                    fprintf(stderr, "invalid watch mode: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'V':
+                if (parse_int_arg(optarg, 1, 3600, &cfg.static_revalidate_sec) != 0) {
+                    fprintf(stderr, "invalid revalidate interval: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'A':
+                if (cfg.cache_rule_count >= HTTP_CACHE_RULES_MAX ||
+                    parse_cache_rule(optarg, &cfg.cache_rules[cfg.cache_rule_count]) != 0) {
+                    fprintf(stderr, "invalid cache rule: %s\n", optarg);
+                    return 1;
+                }
+                ++cfg.cache_rule_count;
+                break;
+            case 'm':
+                if (cfg.module_count >= HTTP_MODULES_MAX ||
+                    parse_module_spec(optarg, &cfg.modules[cfg.module_count]) != 0) {
+                    fprintf(stderr, "invalid module: %s\n", optarg);
+                    return 1;
+                }
+                ++cfg.module_count;
+                break;
+            case 'P':
+                if (cfg.proxy_count >= HTTP_PROXIES_MAX ||
+                    parse_proxy_spec(optarg, &cfg.proxies[cfg.proxy_count]) != 0) {
+                    fprintf(stderr, "invalid proxy: %s\n", optarg);
+                    return 1;
+                }
+                ++cfg.proxy_count;
+                break;
+            case 'c':
+            case 'k': {
+                char *dst = opt == 'c' ? cfg.tls_cert : cfg.tls_key;
+                if (optarg[0] == '\0' || strlen(optarg) >= sizeof(cfg.tls_cert)) {
+                    fprintf(stderr, "invalid TLS %s path: %s\n", opt == 'c' ? "certificate" : "key", optarg);
+                    return 1;
+                }
+                snprintf(dst, sizeof(cfg.tls_cert), "%s", optarg);
+                break;
+            }
+            case 'b':
+                if (parse_int_arg(optarg, 0, 100, &cfg.rebalance_threshold) != 0) {
+                    fprintf(stderr, "invalid rebalance threshold: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_ACCEPT_MODE:
+                if (strcmp(optarg, "reuseport-hash") == 0) {
+                    cfg.accept_mode = SERVER_ACCEPT_REUSEPORT_HASH;
+                } else if (strcmp(optarg, "reuseport-cpu") == 0) {
+                    cfg.accept_mode = SERVER_ACCEPT_REUSEPORT_CPU;
+                } else if (strcmp(optarg, "exclusive") == 0) {
+                    cfg.accept_mode = SERVER_ACCEPT_EXCLUSIVE;
+                } else if (strcmp(optarg, "acceptor") == 0) {
+                    cfg.accept_mode = SERVER_ACCEPT_ACCEPTOR;
+                } else {
+                    fprintf(stderr, "invalid accept mode: %s\n", optarg);
+                    return 1;
+                }
+                break;
             case 'h':
                 print_usage(argv[0]);
                 return 0;
@@ -74,5 +251,10 @@ int main(int argc, char **argv) {
         }
     }
 
+    if ((cfg.tls_cert[0] == '\0') != (cfg.tls_key[0] == '\0')) {
+        fprintf(stderr, "TLS needs both a certificate (-c) and a key (-k)\n");
+        return 1;
+    }
+
     return server_run(&cfg);
 }
@@ -0,0 +1,237 @@
+#include "rebalance.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "tls.h"
+
+/* What moves with a connection; everything else starts fresh on the target. */
+typedef struct {
+    mpsc_node_t node;
+    int fd;
+    /* Just accepted by the acceptor thread: not counted anywhere yet and never served. */
+    bool fresh;
+    struct tls_conn *tls;
+    unsigned long long responses_sent;
+    uint64_t last_active_ms;
+} conn_handoff_t;
+
+int rebalance_init(worker_ctx_t *ctx) {
+    mpsc_init(&ctx->handoffs);
+    ctx->handoff_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return ctx->handoff_fd >= 0 ? 0 : -1;
+}
+
+static void drop_handoff(conn_handoff_t *h) {
+    tls_conn_free(h->tls);
+    close(h->fd);
+    if (!h->fresh) {
+        metrics_dec_connections();
+    }
+    free(h);
+}
+
+void rebalance_destroy(worker_ctx_t *ctx) {
+    mpsc_node_t *node = mpsc_take_all(&ctx->handoffs);
+    while (node != NULL) {
+        mpsc_node_t *next = node->next;
+        drop_handoff((conn_handoff_t *)node);
+        node = next;
+    }
+    if (ctx->handoff_fd >= 0) {
+        close(ctx->handoff_fd);
+        ctx->handoff_fd = -1;
+    }
+}
+
+/* Lower busy share first, then fewer ready events per loop, then fewer connections. */
+static bool lighter(const worker_load_t *a, const worker_load_t *b) {
+    unsigned a_busy = atomic_load_explicit(&a->busy_permille, memory_order_relaxed);
+    unsigned b_busy = atomic_load_explicit(&b->busy_permille, memory_order_relaxed);
+    if (a_busy != b_busy) {
+        return a_busy < b_busy;
+    }
+    unsigned a_events = atomic_load_explicit(&a->events_per_loop_x16, memory_order_relaxed);
+    unsigned b_events = atomic_load_explicit(&b->events_per_loop_x16, memory_order_relaxed);
+    if (a_events != b_events) {
+        return a_events < b_events;
+    }
+    return atomic_load_explicit(&a->conns, memory_order_relaxed) < atomic_load_explicit(&b->conns, memory_order_relaxed);
+}
+
+void rebalance_account(worker_ctx_t *ctx, uint64_t now_ns, int events, uint64_t busy_ns) {
+    worker_balance_t *b = &ctx->balance;
+    if (ctx->cfg.rebalance_threshold == 0) {
+        return;
+    }
+    b->busy_ns += busy_ns;
+    b->events += (unsigned long long)events;
+    ++b->loops;
+    if (b->window_start_ns == 0) {
+        b->window_start_ns = now_ns;
+        return;
+    }
+    uint64_t span = now_ns - b->window_start_ns;
+    if (span < REBALANCE_WINDOW_NS) {
+        return;
+    }
+
+    unsigned busy = b->busy_ns >= span ? 1000 : (unsigned)(b->busy_ns * 1000 / span);
+    b->busy_permille = (b->busy_permille * 3 + busy) / 4;
+    atomic_store_explicit(&ctx->load.busy_permille, b->busy_permille, memory_order_relaxed);
+    atomic_store_explicit(&ctx->load.events_per_loop_x16, (unsigned)(b->events * 16 / b->loops), memory_order_relaxed);
+    b->window_start_ns = now_ns;
+    b->busy_ns = 0;
+    b->events = 0;
+    b->loops = 0;
+
+    worker_ctx_t *best = NULL;
+    for (int i = 0; i < ctx->peer_count; ++i) {
+        worker_ctx_t *peer = &ctx->peers[i];
+        if (peer == ctx || !atomic_load_explicit(&peer->load.adopts, memory_order_acquire)) {
+            continue;
+        }
+        if (best == NULL || lighter(&peer->load, &best->load)) {
+            best = peer;
+        }
+    }
+    b->target = NULL;
+    b->budget = 0;
+    if (best != NULL &&
+        b->busy_permille >= atomic_load_explicit(&best->load.busy_permille, memory_order_relaxed) +
+            (unsigned)ctx->cfg.rebalance_threshold * 10) {
+        b->target = best;
+        b->budget = ctx->conn_count / REBALANCE_BUDGET_DIV > 0 ? (unsigned)(ctx->conn_count / REBALANCE_BUDGET_DIV) : 1;
+    }
+}
+
+/* Served at least once, with nothing buffered, queued or multiplexed, so only the socket needs to move. */
+static bool idle_between_requests(const connection_t *conn) {
+    if (conn->responses_sent == 0 || conn->out_count > 0 || conn->in_len > 0 || conn->streaming ||
+        conn->closing || conn->read_paused || conn->h2 != NULL) {
+        return false;
+    }
+    return conn->tls == NULL || (tls_established(conn->tls) && !tls_pending(conn->tls));
+}
+
+static void push_handoff(worker_ctx_t *target, conn_handoff_t *h) {
+    if (mpsc_push(&target->handoffs, &h->node)) {
+        uint64_t one = 1;
+        ssize_t n;
+        do {
+            n = write(target->handoff_fd, &one, sizeof(one));
+        } while (n < 0 && errno == EINTR);
+    }
+}
+
+bool rebalance_try_hand_off(worker_ctx_t *ctx, connection_t *conn, rebalance_io_fn detach) {
+    worker_balance_t *b = &ctx->balance;
+    if (b->budget == 0 || !idle_between_requests(conn)) {
+        return false;
+    }
+    worker_ctx_t *target = b->target;
+    if (!atomic_load_explicit(&target->load.adopts, memory_order_acquire)) {
+        b->budget = 0;
+        return false;
+    }
+    conn_handoff_t *h = malloc(sizeof(*h));
+    if (h == NULL) {
+        return false;
+    }
+    if (detach(ctx, conn) != 0) {
+        free(h);
+        return false;
+    }
+
+    h->fd = conn->fd;
+    h->fresh = false;
+    h->tls = conn->tls;
+    h->responses_sent = conn->responses_sent;
+    h->last_active_ms = conn->last_active_ms;
+    timer_wheel_cancel(&ctx->timers, &conn->timer);
+    ctx->conns[conn->fd] = NULL;
+    conn->tls = NULL;
+    conn_free(ctx, conn);
+    --b->budget;
+
+    push_handoff(target, h);
+    return true;
+}
+
+int rebalance_deliver(worker_ctx_t *target, int fd) {
+    conn_handoff_t *h = calloc(1, sizeof(*h));
+    if (h == NULL) {
+        return -1;
+    }
+    h->fd = fd;
+    h->fresh = true;
+    push_handoff(target, h);
+    return 0;
+}
+
+/* The acceptor counts a socket against this worker until it is settled here, adopted or not. */
+static void settle_fresh(worker_ctx_t *ctx) {
+    unsigned accepted = atomic_load_explicit(&ctx->load.accepted, memory_order_relaxed);
+    atomic_store_explicit(&ctx->load.accepted, accepted + 1, memory_order_release);
+}
+
+static void reject_handoff(worker_ctx_t *ctx, conn_handoff_t *h) {
+    if (h->fresh) {
+        settle_fresh(ctx);
+    }
+    drop_handoff(h);
+}
+
+void rebalance_adopt(worker_ctx_t *ctx, rebalance_io_fn attach) {
+    /* Reset the eventfd before taking the queue, so a push after the take raises it again. */
+    uint64_t count;
+    ssize_t n;
+    do {
+        n = read(ctx->handoff_fd, &count, sizeof(count));
+    } while (n < 0 && errno == EINTR);
+
+    mpsc_node_t *node = mpsc_take_all(&ctx->handoffs);
+    while (node != NULL) {
+        conn_handoff_t *h = (conn_handoff_t *)node;
+        node = node->next;
+
+        connection_t *conn = worker_ensure_conn_capacity(ctx, h->fd) == 0 ? conn_create(ctx, h->fd) : NULL;
+        if (conn == NULL) {
+            reject_handoff(ctx, h);
+            continue;
+        }
+        if (h->fresh && ctx->cfg.tls_cert[0] != '\0' && (h->tls = tls_conn_new(h->fd)) == NULL) {
+            conn_free(ctx, conn);
+            reject_handoff(ctx, h);
+            continue;
+        }
+        conn->tls = h->tls;
+        h->tls = NULL;
+        if (!h->fresh) {
+            conn->responses_sent = h->responses_sent;
+            conn->last_active_ms = h->last_active_ms;
+        }
+        ctx->conns[h->fd] = conn;
+        if (attach(ctx, conn) != 0) {
+            ctx->conns[h->fd] = NULL;
+            conn_free(ctx, conn);
+            reject_handoff(ctx, h);
+            continue;
+        }
+        if (h->fresh) {
+            metrics_inc_connections();
+            settle_fresh(ctx);
+        } else {
+            metrics_inc_rebalanced_connections();
+        }
+        conn_update_timer(ctx, conn);
+        free(h);
+    }
+}
+
+#endif
@@ -3,6 +3,7 @@
 #ifdef __linux__
 
 #include <errno.h>
+#include <limits.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
@@ -15,27 +16,29 @@
 #include <sys/epoll.h>
 #include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "accept.h"
+#include "hpack.h"
 #include "http_parser.h"
 #include "http_router.h"
+#include "http_scan.h"
 #include "metrics.h"
-#include "net.h"
+#include "pool.h"
+#include "rebalance.h"
+#include "static_cache.h"
+#include "static_compress.h"
+#include "static_watch.h"
+#include "tls.h"
+#include "upstream.h"
 #include "util.h"
+#include "worker.h"
 
 #define MAX_EVENTS 256
 
 static volatile sig_atomic_t g_stop = 0;
 
-typedef struct {
-    int id;
-    server_config_t cfg;
-    int epoll_fd;
-    int listen_fd;
-    connection_t **conns;
-    size_t conns_cap;
-} worker_ctx_t;
-
 static void on_signal(int signo) {
     (void)signo;
     g_stop = 1;
@@ -52,53 +55,20 @@ static int install_signal_handlers(void) {
     if (sigaction(SIGTERM, &sa, NULL) != 0) {
         return -1;
     }
-    return 0;
-}
 
-static int ensure_conn_capacity(worker_ctx_t *ctx, int fd) {
-    if (fd < 0) {
+    sa.sa_handler = SIG_IGN;
+    if (sigaction(SIGPIPE, &sa, NULL) != 0) {
         return -1;
     }
-    if ((size_t)fd < ctx->conns_cap) {
-        return 0;
-    }
-
-    size_t new_cap = ctx->conns_cap == 0 ? 1024 : ctx->conns_cap;
-    while (new_cap <= (size_t)fd) {
-        if (new_cap > SIZE_MAX / 2) {
-            return -1;
-        }
-        new_cap *= 2;
-    }
-
-    connection_t **next = realloc(ctx->conns, new_cap * sizeof(*ctx->conns));
-    if (next == NULL) {
-        return -1;
-    }
-
-    memset(next + ctx->conns_cap, 0, (new_cap - ctx->conns_cap) * sizeof(*ctx->conns));
-    ctx->conns = next;
-    ctx->conns_cap = new_cap;
     return 0;
 }
 
-static connection_t *conn_create(int fd) {
-    connection_t *conn = calloc(1, sizeof(*conn));
-    if (conn == NULL) {
-        return NULL;
-    }
-    conn->fd = fd;
-    conn->last_active_ms = util_now_ms();
-    conn->resp.file_fd = -1;
-    return conn;
+bool server_stopping(void) {
+    return g_stop != 0;
 }
 
-static void conn_free(connection_t *conn) {
-    if (conn == NULL) {
-        return;
-    }
-    http_response_reset(&conn->resp);
-    free(conn);
+void server_request_stop(void) {
+    g_stop = 1;
 }
 
 static void close_connection(worker_ctx_t *ctx, int fd) {
@@ -110,11 +80,10 @@ static void close_connection(worker_ctx_t *ctx, int fd) {
         return;
     }
 
+    worker_detach_conn(ctx, conn);
     epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
     close(fd);
-    ctx->conns[fd] = NULL;
-    metrics_dec_connections();
-    conn_free(conn);
+    conn_free(ctx, conn);
 }
 
 static int update_conn_interest(worker_ctx_t *ctx, connection_t *conn) {
@@ -122,72 +91,18 @@ static int update_conn_interest(worker_ctx_t *ctx, connection_t *conn) {
     memset(&ev, 0, sizeof(ev));
     ev.data.fd = conn->fd;
     ev.events = EPOLLIN | EPOLLET;
-    if (conn->resp.active) {
+    if (conn->out_count > 0) {
         ev.events |= EPOLLOUT;
     }
 
     return epoll_ctl(ctx->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
 }
 
-static void compact_input_buffer(connection_t *conn, size_t consumed) {
-    if (consumed >= conn->in_len) {
-        conn->in_len = 0;
-        return;
-    }
-
-    size_t remaining = conn->in_len - consumed;
-    memmove(conn->in_buf, conn->in_buf + consumed, remaining);
-    conn->in_len = remaining;
-}
-
-static void prepare_parse_error_response(connection_t *conn, int status) {
-    http_response_reset(&conn->resp);
-    if (http_build_error_response(&conn->resp, status, true) != 0) {
-        http_response_reset(&conn->resp);
-        (void)http_build_error_response(&conn->resp, 500, true);
-    }
-    conn->in_len = 0;
-}
-
-static void try_parse_and_route(worker_ctx_t *ctx, connection_t *conn) {
-    while (!conn->resp.active) {
-        if (conn->in_len == 0) {
-            return;
-        }
-
-        http_request_t req;
-        size_t consumed = 0;
-        int error_status = 400;
-        http_parse_result_t res = http_parse_request(
-            conn->in_buf,
-            conn->in_len,
-            &req,
-            &consumed,
-            &error_status
-        );
-
-        if (res == HTTP_PARSE_INCOMPLETE) {
-            return;
-        }
-
-        metrics_inc_requests();
-
-        if (res == HTTP_PARSE_ERROR) {
-            prepare_parse_error_response(conn, error_status);
-            return;
-        }
-
-        http_response_reset(&conn->resp);
-        if (http_route_request(&req, &conn->resp, ctx->cfg.static_root, false) != 0) {
-            http_response_reset(&conn->resp);
-            (void)http_build_error_response(&conn->resp, 500, true);
-        }
-
-        compact_input_buffer(conn, consumed);
-        return;
-    }
-}
-
+/*
+ * Returns 0 when the connection is idle or waiting for EPOLLOUT, 1 when input
+ * was paused on a full buffer and there is room again, and -1 if the
+ * connection was closed.
+ */
 static int flush_response(worker_ctx_t *ctx, int fd) {
     if ((size_t)fd >= ctx->conns_cap) {
         return -1;
@@ -199,130 +114,149 @@ static int flush_response(worker_ctx_t *ctx, int fd) {
     }
 
     while (true) {
-        if (!conn->resp.active) {
-            try_parse_and_route(ctx, conn);
-            if (!conn->resp.active) {
-                break;
-            }
-        }
-
-        while (conn->resp.head_sent < conn->resp.head_len) {
-            ssize_t n = write(
-                fd,
-                conn->resp.head + conn->resp.head_sent,
-                conn->resp.head_len - conn->resp.head_sent
-            );
-            if (n > 0) {
-                conn->resp.head_sent += (size_t)n;
-                metrics_add_bytes_out((size_t)n);
-                conn->last_active_ms = util_now_ms();
-                continue;
-            }
-            if (n < 0 && errno == EINTR) {
-                continue;
-            }
-            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-                return 0;
-            }
+        if (conn_parse_requests(ctx, conn) != 0) {
             close_connection(ctx, fd);
             return -1;
         }
+        if (conn->out_count == 0) {
+            break;
+        }
 
-        while (conn->resp.body_sent < conn->resp.body_len) {
-            ssize_t n = write(
-                fd,
-                conn->resp.body + conn->resp.body_sent,
-                conn->resp.body_len - conn->resp.body_sent
-            );
-            if (n > 0) {
-                conn->resp.body_sent += (size_t)n;
-                metrics_add_bytes_out((size_t)n);
-                conn->last_active_ms = util_now_ms();
-                continue;
+        struct iovec iov[CONN_PIPELINE_DEPTH * 2];
+        bool file_follows = false;
+        int iovcnt = conn_build_output_iov(conn, iov, (int)(sizeof(iov) / sizeof(iov[0])), &file_follows);
+        ssize_t n;
+        ++ctx->tx.syscalls;
+        if (iovcnt > 0) {
+            /* MSG_MORE corks the head so it leaves in the same segment as the first file bytes. */
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = (size_t)iovcnt;
+            if (conn_tls_records(conn)) {
+                n = tls_writev(conn->tls, iov, iovcnt);
+            } else {
+                n = sendmsg(fd, &msg, MSG_NOSIGNAL | (file_follows ? MSG_MORE : 0));
             }
-            if (n < 0 && errno == EINTR) {
-                continue;
+            if (n > 0) {
+                conn_advance_output(conn, (size_t)n);
             }
-            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-                return 0;
+        } else if (conn_front_response(conn)->relay != NULL) {
+            n = upstream_relay(ctx, conn, conn_front_response(conn));
+            if (n == 0 && conn_front_response(conn)->relay != NULL) {
+                /* Nothing from the upstream yet; its next event resumes the flush. */
+                break;
             }
-            close_connection(ctx, fd);
-            return -1;
-        }
-
-        while (conn->resp.file_fd >= 0 && conn->resp.file_remaining > 0) {
-            off_t off = conn->resp.file_offset;
-            ssize_t n = sendfile(fd, conn->resp.file_fd, &off, (size_t)conn->resp.file_remaining);
-            if (n > 0) {
-                conn->resp.file_offset = off;
-                conn->resp.file_remaining -= n;
-                metrics_add_bytes_out((size_t)n);
-                conn->last_active_ms = util_now_ms();
+            if (n == 0) {
+                /* The upstream closed the connection to end the body. */
+                if (conn_complete_sent(ctx, conn)) {
+                    close_connection(ctx, fd);
+                    return -1;
+                }
                 continue;
             }
-            if (n < 0 && errno == EINTR) {
-                continue;
+        } else {
+            http_response_t *resp = conn_front_response(conn);
+            off_t off = resp->file_offset;
+            if (conn_tls_records(conn)) {
+                n = tls_sendfile(conn->tls, resp->file_fd, &off, (size_t)resp->file_remaining);
+            } else {
+                n = sendfile(fd, resp->file_fd, &off, (size_t)resp->file_remaining);
             }
-            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-                return 0;
+            if (n > 0) {
+                resp->file_offset = off;
+                resp->file_remaining -= n;
             }
-            close_connection(ctx, fd);
-            return -1;
         }
 
-        bool close_after = conn->resp.close_after_send;
-        http_response_reset(&conn->resp);
-        if (close_after) {
-            close_connection(ctx, fd);
-            return -1;
+        if (n > 0) {
+            metrics_add_bytes_out((size_t)n);
+            conn->last_active_ms = util_now_ms();
+            if (conn_complete_sent(ctx, conn)) {
+                close_connection(ctx, fd);
+                return -1;
+            }
+            continue;
         }
-
-        if (conn->in_len == 0) {
-            break;
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            /* Socket full: EPOLLOUT resumes the flush, and only then is more body produced. */
+            if (update_conn_interest(ctx, conn) != 0) {
+                close_connection(ctx, fd);
+                return -1;
+            }
+            return 0;
         }
+        close_connection(ctx, fd);
+        return -1;
     }
 
-    if ((size_t)fd < ctx->conns_cap && ctx->conns[fd] != NULL) {
-        if (update_conn_interest(ctx, ctx->conns[fd]) != 0) {
-            close_connection(ctx, fd);
-            return -1;
-        }
+    conn_release_idle_buffers(ctx, conn);
+
+    if (update_conn_interest(ctx, conn) != 0) {
+        close_connection(ctx, fd);
+        return -1;
     }
 
+    if (conn->read_paused && conn->in_len < CONN_INBUF_CAP) {
+        conn->read_paused = false;
+        return 1;
+    }
     return 0;
 }
 
-static void handle_client_read(worker_ctx_t *ctx, int fd) {
-    if ((size_t)fd >= ctx->conns_cap || ctx->conns[fd] == NULL) {
-        return;
-    }
-
+/*
+ * Drain the socket into the input buffer. When the buffer is full and the
+ * response queue is at its depth limit, reading pauses until flush_response()
+ * has made room; a single request larger than the buffer gets a 413.
+ * Returns -1 if the connection was closed.
+ */
+static int read_input(worker_ctx_t *ctx, int fd) {
     connection_t *conn = ctx->conns[fd];
     char overflow_buf[4096];
 
     for (;;) {
-        ssize_t n;
-        if (conn->in_len < sizeof(conn->in_buf)) {
-            n = read(fd, conn->in_buf + conn->in_len, sizeof(conn->in_buf) - conn->in_len);
-        } else {
-            n = read(fd, overflow_buf, sizeof(overflow_buf));
+        int room = conn_reserve_input(ctx, conn);
+        if (room > 0 && !conn->closing) {
+            if (conn_parse_requests(ctx, conn) != 0) {
+                close_connection(ctx, fd);
+                return -1;
+            }
+            room = conn_reserve_input(ctx, conn);
+            if (room > 0 && conn->out_count >= CONN_PIPELINE_DEPTH) {
+                conn->read_paused = true;
+                break;
+            }
+        }
+        if (room < 0) {
+            close_connection(ctx, fd);
+            return -1;
         }
 
+        char *dst = room == 0 ? conn->in_buf + conn->in_len : overflow_buf;
+        size_t cap = room == 0 ? conn->in_cap - conn->in_len : sizeof(overflow_buf);
+        ssize_t n = conn->tls != NULL ? tls_read(conn->tls, dst, cap) : read(fd, dst, cap);
+
         if (n > 0) {
             metrics_add_bytes_in((size_t)n);
-            conn->last_active_ms = util_now_ms();
+            conn_note_rx(conn);
 
-            if (conn->in_len < sizeof(conn->in_buf)) {
+            if (conn->closing) {
+                conn->in_len = 0;
+            } else if (room == 0) {
                 conn->in_len += (size_t)n;
-            } else if (!conn->resp.active) {
-                prepare_parse_error_response(conn, 413);
+            } else if (conn_queue_error(ctx, conn, 413) != 0) {
+                close_connection(ctx, fd);
+                return -1;
             }
             continue;
         }
 
         if (n == 0) {
             close_connection(ctx, fd);
-            return;
+            return -1;
         }
 
         if (errno == EINTR) {
@@ -333,38 +267,79 @@ static void handle_client_read(worker_ctx_t *ctx, int fd) {
         }
 
         close_connection(ctx, fd);
-        return;
+        return -1;
     }
 
-    conn = ((size_t)fd < ctx->conns_cap) ? ctx->conns[fd] : NULL;
-    if (conn == NULL) {
-        return;
+    return 0;
+}
+
+/*
+ * Advance a TLS handshake on readiness. Returns 1 once it is complete, 0
+ * while it waits for the socket and -1 if the connection was closed.
+ */
+static int handshake_tls(worker_ctx_t *ctx, connection_t *conn) {
+    bool want_write = false;
+    int rc = tls_handshake(conn->tls, &want_write);
+    if (rc < 0) {
+        close_connection(ctx, conn->fd);
+        return -1;
     }
+    if (rc == 0) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.data.fd = conn->fd;
+        ev.events = EPOLLIN | EPOLLET | (want_write ? EPOLLOUT : 0);
+        if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) != 0) {
+            close_connection(ctx, conn->fd);
+            return -1;
+        }
+        return 0;
+    }
+    metrics_observe_tls_handshake(tls_resumed(conn->tls), tls_kernel_tx(conn->tls));
+    return 1;
+}
 
-    try_parse_and_route(ctx, conn);
+static void handle_client_read(worker_ctx_t *ctx, int fd) {
+    if ((size_t)fd >= ctx->conns_cap || ctx->conns[fd] == NULL) {
+        return;
+    }
 
-    if ((size_t)fd < ctx->conns_cap && ctx->conns[fd] != NULL) {
-        if (flush_response(ctx, fd) != 0) {
+    for (;;) {
+        if (read_input(ctx, fd) != 0) {
+            return;
+        }
+        if (flush_response(ctx, fd) <= 0) {
             return;
         }
     }
+}
 
-    if ((size_t)fd < ctx->conns_cap && ctx->conns[fd] != NULL) {
-        if (update_conn_interest(ctx, ctx->conns[fd]) != 0) {
-            close_connection(ctx, fd);
-        }
+/* Readiness on an upstream connection: let its client send whatever became available. */
+static void handle_upstream_event(worker_ctx_t *ctx, int fd, uint32_t revents) {
+    connection_t *client = upstream_handle_event(ctx, fd, revents);
+    if (client == NULL) {
+        return;
+    }
+    int client_fd = client->fd;
+    if (flush_response(ctx, client_fd) > 0) {
+        handle_client_read(ctx, client_fd);
+    }
+    if ((size_t)client_fd < ctx->conns_cap && ctx->conns[client_fd] != NULL) {
+        conn_update_timer(ctx, ctx->conns[client_fd]);
     }
 }
 
 static void handle_accept(worker_ctx_t *ctx) {
-    for (;;) {
+    /* On a shared listener one connection per readiness report leaves the rest to the other workers. */
+    int budget = ctx->cfg.accept_mode == SERVER_ACCEPT_EXCLUSIVE ? 1 : INT_MAX;
+    while (budget-- > 0) {
         int client_fd = accept4(ctx->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (client_fd < 0) {
             if (errno == EINTR) {
                 continue;
             }
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                return;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                metrics_inc_accept_errors();
             }
             return;
         }
@@ -372,16 +347,21 @@ static void handle_accept(worker_ctx_t *ctx) {
         int one = 1;
         (void)setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
 
-        if (ensure_conn_capacity(ctx, client_fd) != 0) {
+        if (worker_ensure_conn_capacity(ctx, client_fd) != 0) {
             close(client_fd);
             continue;
         }
 
-        connection_t *conn = conn_create(client_fd);
+        connection_t *conn = conn_create(ctx, client_fd);
         if (conn == NULL) {
             close(client_fd);
             continue;
         }
+        if (ctx->cfg.tls_cert[0] != '\0' && (conn->tls = tls_conn_new(client_fd)) == NULL) {
+            conn_free(ctx, conn);
+            close(client_fd);
+            continue;
+        }
 
         struct epoll_event ev;
         memset(&ev, 0, sizeof(ev));
@@ -389,109 +369,82 @@ static void handle_accept(worker_ctx_t *ctx) {
         ev.events = EPOLLIN | EPOLLET;
 
         if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) != 0) {
-            conn_free(conn);
+            conn_free(ctx, conn);
             close(client_fd);
             continue;
         }
 
         ctx->conns[client_fd] = conn;
         metrics_inc_connections();
+        conn_update_timer(ctx, conn);
     }
 }
 
-static void close_idle_connections(worker_ctx_t *ctx, uint64_t now_ms) {
-    uint64_t timeout_ms = (uint64_t)ctx->cfg.idle_timeout_sec * 1000ULL;
-    for (size_t i = 0; i < ctx->conns_cap; ++i) {
-        connection_t *conn = ctx->conns[i];
-        if (conn == NULL) {
-            continue;
-        }
-        if (now_ms - conn->last_active_ms > timeout_ms) {
-            close_connection(ctx, conn->fd);
-        }
-    }
+static void epoll_close_conn(worker_ctx_t *ctx, connection_t *conn) {
+    close_connection(ctx, conn->fd);
 }
 
-static int worker_init(worker_ctx_t *ctx) {
-    ctx->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
-    if (ctx->epoll_fd < 0) {
-        perror("epoll_create1");
-        return -1;
-    }
-
-    ctx->listen_fd = net_create_listener(ctx->cfg.port, ctx->cfg.backlog, 1);
-    if (ctx->listen_fd < 0) {
-        perror("net_create_listener");
-        close(ctx->epoll_fd);
-        ctx->epoll_fd = -1;
-        return -1;
-    }
+static int epoll_detach_conn(worker_ctx_t *ctx, connection_t *conn) {
+    return epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+}
 
+/* Edge-triggered registration reports input that is already waiting, so nothing sent during the handoff is missed. */
+static int epoll_attach_conn(worker_ctx_t *ctx, connection_t *conn) {
     struct epoll_event ev;
     memset(&ev, 0, sizeof(ev));
-    ev.data.fd = ctx->listen_fd;
+    ev.data.fd = conn->fd;
     ev.events = EPOLLIN | EPOLLET;
-    if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, ctx->listen_fd, &ev) != 0) {
-        perror("epoll_ctl listen add");
-        close(ctx->listen_fd);
-        close(ctx->epoll_fd);
-        ctx->listen_fd = -1;
-        ctx->epoll_fd = -1;
-        return -1;
-    }
-
-    ctx->conns_cap = 1024;
-    ctx->conns = calloc(ctx->conns_cap, sizeof(*ctx->conns));
-    if (ctx->conns == NULL) {
-        fprintf(stderr, "calloc connection table failed\\n");
-        close(ctx->listen_fd);
-        close(ctx->epoll_fd);
-        ctx->listen_fd = -1;
-        ctx->epoll_fd = -1;
-        return -1;
-    }
-
-    return 0;
+    return epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev);
 }
 
 static void worker_destroy(worker_ctx_t *ctx) {
-    if (ctx->conns != NULL) {
-        for (size_t i = 0; i < ctx->conns_cap; ++i) {
-            if (ctx->conns[i] != NULL) {
-                close(ctx->conns[i]->fd);
-                metrics_dec_connections();
-                conn_free(ctx->conns[i]);
-                ctx->conns[i] = NULL;
-            }
-        }
-        free(ctx->conns);
-        ctx->conns = NULL;
-    }
+    worker_state_destroy(ctx);
 
-    if (ctx->listen_fd >= 0) {
-        close(ctx->listen_fd);
-        ctx->listen_fd = -1;
-    }
     if (ctx->epoll_fd >= 0) {
         close(ctx->epoll_fd);
         ctx->epoll_fd = -1;
     }
 }
 
-static void *worker_main(void *arg) {
-    worker_ctx_t *ctx = arg;
+static int epoll_worker_run(worker_ctx_t *ctx) {
+    ctx->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (ctx->epoll_fd < 0) {
+        perror("epoll_create1");
+        return -1;
+    }
 
-    if (worker_init(ctx) != 0) {
-        fprintf(stderr, "worker %d init failed\\n", ctx->id);
-        g_stop = 1;
-        return NULL;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    if (ctx->listen_fd >= 0) {
+        /* A shared listener stays level-triggered so a connection left for later is reported again. */
+        ev.data.fd = ctx->listen_fd;
+        ev.events = ctx->cfg.accept_mode == SERVER_ACCEPT_EXCLUSIVE ? EPOLLIN | EPOLLEXCLUSIVE : EPOLLIN | EPOLLET;
+        if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, ctx->listen_fd, &ev) != 0) {
+            perror("epoll_ctl listen add");
+            return -1;
+        }
+    }
+    ctx->close_conn = epoll_close_conn;
+
+    /* Handed-off connections arrive from busier peers and, without a listener, from the acceptor. */
+    bool rebalancing = ctx->cfg.rebalance_threshold > 0 && ctx->peer_count > 1;
+    if (rebalancing || ctx->listen_fd < 0) {
+        ev.data.fd = ctx->handoff_fd;
+        ev.events = EPOLLIN | EPOLLET;
+        if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, ctx->handoff_fd, &ev) != 0) {
+            perror("epoll_ctl handoff add");
+            return -1;
+        }
+    }
+    if (rebalancing) {
+        atomic_store_explicit(&ctx->load.adopts, true, memory_order_release);
     }
 
     struct epoll_event events[MAX_EVENTS];
-    uint64_t last_idle_scan_ms = util_now_ms();
 
     while (!g_stop) {
         int n = epoll_wait(ctx->epoll_fd, events, MAX_EVENTS, 250);
+        uint64_t woke_ns = util_now_ns();
         if (n < 0) {
             if (errno == EINTR) {
                 continue;
@@ -502,44 +455,126 @@ static void *worker_main(void *arg) {
 
         for (int i = 0; i < n; ++i) {
             int fd = events[i].data.fd;
-            uint32_t ev = events[i].events;
+            uint32_t revents = events[i].events;
 
             if (fd == ctx->listen_fd) {
-                if (ev & EPOLLIN) {
+                if (revents & EPOLLIN) {
                     handle_accept(ctx);
                 }
                 continue;
             }
+            if (fd == ctx->handoff_fd) {
+                rebalance_adopt(ctx, epoll_attach_conn);
+                continue;
+            }
 
             if ((size_t)fd >= ctx->conns_cap || ctx->conns[fd] == NULL) {
+                handle_upstream_event(ctx, fd, revents);
                 continue;
             }
 
-            if (ev & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+            if (revents & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
                 close_connection(ctx, fd);
                 continue;
             }
 
-            if (ev & EPOLLIN) {
+            connection_t *conn = ctx->conns[fd];
+            if (conn->tls != NULL && !tls_established(conn->tls)) {
+                int rc = handshake_tls(ctx, conn);
+                if (rc < 0) {
+                    continue;
+                }
+                if (rc == 0) {
+                    conn_update_timer(ctx, conn);
+                    continue;
+                }
+                /* The first request may have come in with the client's Finished. */
+                revents |= EPOLLIN;
+            }
+
+            if (revents & EPOLLIN) {
                 handle_client_read(ctx, fd);
             }
 
-            if ((size_t)fd < ctx->conns_cap && ctx->conns[fd] != NULL && (ev & EPOLLOUT)) {
-                (void)flush_response(ctx, fd);
+            if ((size_t)fd < ctx->conns_cap && ctx->conns[fd] != NULL && (revents & EPOLLOUT)) {
+                if (flush_response(ctx, fd) > 0) {
+                    handle_client_read(ctx, fd);
+                }
+            }
+
+            if ((size_t)fd < ctx->conns_cap && ctx->conns[fd] != NULL &&
+                !rebalance_try_hand_off(ctx, ctx->conns[fd], epoll_detach_conn)) {
+                conn_update_timer(ctx, ctx->conns[fd]);
             }
         }
 
-        uint64_t now_ms = util_now_ms();
-        if (now_ms - last_idle_scan_ms >= 1000) {
-            close_idle_connections(ctx, now_ms);
-            last_idle_scan_ms = now_ms;
+        worker_publish_tx_stats(ctx);
+        worker_run_timers(ctx, util_now_ms());
+        uint64_t done_ns = util_now_ns();
+        rebalance_account(ctx, done_ns, n, done_ns - woke_ns);
+    }
+    atomic_store_explicit(&ctx->load.adopts, false, memory_order_release);
+    return 0;
+}
+
+static void *worker_main(void *arg) {
+    worker_ctx_t *ctx = arg;
+
+    accept_worker_enter(ctx);
+    if (worker_state_init(ctx) != 0) {
+        fprintf(stderr, "worker %d init failed\n", ctx->id);
+        g_stop = 1;
+        /* Pools that did come up are unregistered before the contexts are freed. */
+        worker_destroy(ctx);
+        return NULL;
+    }
+
+    /*
+     * Upstream connections live in the epoll set, TLS handshakes and records
+     * are driven by readiness, and sockets from the acceptor thread arrive
+     * through the handoff eventfd, so any of them keeps every worker on epoll.
+     */
+    const char *needs_epoll = ctx->cfg.proxy_count > 0 ? "proxy routes"
+        : ctx->cfg.tls_cert[0] != '\0' ? "TLS"
+        : ctx->cfg.accept_mode == SERVER_ACCEPT_ACCEPTOR ? "acceptor mode"
+        : NULL;
+    int rc;
+    if (ctx->cfg.engine == SERVER_ENGINE_URING && needs_epoll == NULL && uring_worker_run(ctx) == 0) {
+        rc = 0;
+    } else {
+        if (ctx->cfg.engine == SERVER_ENGINE_URING && needs_epoll != NULL) {
+            fprintf(stderr, "worker %d: epoll is required for %s, using epoll\n", ctx->id, needs_epoll);
+        } else if (ctx->cfg.engine == SERVER_ENGINE_URING) {
+            fprintf(stderr, "worker %d: io_uring unavailable, falling back to epoll\n", ctx->id);
         }
+        rc = epoll_worker_run(ctx);
+    }
+    if (rc != 0) {
+        g_stop = 1;
     }
 
     worker_destroy(ctx);
     return NULL;
 }
 
+/* Once no worker runs: the acceptor stops, and connections still queued to workers are closed. */
+static void free_workers(worker_ctx_t *ctxs, int count) {
+    accept_close(ctxs, count);
+    for (int i = 0; i < count; ++i) {
+        rebalance_destroy(&ctxs[i]);
+    }
+    free(ctxs);
+}
+
+static void stop_services(void) {
+    static_compress_stop();
+    static_watch_stop();
+    static_cache_destroy();
+    http_router_destroy();
+    http_modules_unload();
+    tls_server_destroy();
+}
+
 int server_run(const server_config_t *cfg) {
     if (cfg == NULL || cfg->threads <= 0) {
         return 1;
@@ -551,47 +586,129 @@ int server_run(const server_config_t *cfg) {
     }
 
     metrics_init();
+    for (unsigned r = 0; r < HTTP_ROUTE_COUNT; ++r) {
+        metrics_set_route_name(r, http_route_name((http_route_id_t)r));
+    }
+    http_scan_init();
+    hpack_init();
+    if (cfg->tls_cert[0] != '\0' && tls_server_init(cfg->tls_cert, cfg->tls_key) != 0) {
+        return 1;
+    }
+    if (http_router_init() != 0) {
+        fprintf(stderr, "route table init failed\n");
+        tls_server_destroy();
+        return 1;
+    }
+    if (http_modules_load(cfg->modules, (size_t)cfg->module_count) != 0) {
+        http_router_destroy();
+        return 1;
+    }
+    if (upstream_targets_init(cfg->proxies, (size_t)cfg->proxy_count) != 0) {
+        http_router_destroy();
+        http_modules_unload();
+        return 1;
+    }
+    http_router_set_cache_rules(cfg->cache_rules, (size_t)cfg->cache_rule_count);
+    if (static_cache_init((size_t)cfg->static_cache_entries, (size_t)cfg->static_render_budget_kb * 1024) != 0) {
+        fprintf(stderr, "static cache init failed\n");
+        http_router_destroy();
+        http_modules_unload();
+        return 1;
+    }
+    int watch = cfg->static_cache_entries > 0
+        ? static_watch_start(cfg->static_root, cfg->static_watch, cfg->static_revalidate_sec)
+        : STATIC_WATCH_OFF;
+    if (watch < 0) {
+        static_cache_destroy();
+        http_router_destroy();
+        http_modules_unload();
+        return 1;
+    }
+    if (cfg->static_cache_entries > 0 &&
+        static_compress_start(cfg->static_root, http_static_publish_compressed) != 0) {
+        fprintf(stderr, "static compressor failed to start, serving sidecars only\n");
+    }
 
+    /* Contexts are cache-line aligned for their published load; peers see each other from the start. */
     pthread_t *threads = calloc((size_t)cfg->threads, sizeof(*threads));
-    worker_ctx_t *ctxs = calloc((size_t)cfg->threads, sizeof(*ctxs));
+    worker_ctx_t *ctxs = aligned_alloc(_Alignof(worker_ctx_t), (size_t)cfg->threads * sizeof(*ctxs));
     if (threads == NULL || ctxs == NULL) {
         free(threads);
         free(ctxs);
+        stop_services();
         return 1;
     }
-
+    memset(ctxs, 0, (size_t)cfg->threads * sizeof(*ctxs));
     for (int i = 0; i < cfg->threads; ++i) {
         ctxs[i].id = i;
         ctxs[i].cfg = *cfg;
         ctxs[i].epoll_fd = -1;
         ctxs[i].listen_fd = -1;
+        ctxs[i].handoff_fd = -1;
+        ctxs[i].peers = ctxs;
+        ctxs[i].peer_count = cfg->threads;
+        if (rebalance_init(&ctxs[i]) != 0) {
+            perror("eventfd");
+            free_workers(ctxs, i + 1);
+            free(threads);
+            stop_services();
+            return 1;
+        }
+    }
+    if (accept_open(ctxs, cfg->threads) != 0) {
+        free_workers(ctxs, cfg->threads);
+        free(threads);
+        stop_services();
+        return 1;
+    }
 
+    for (int i = 0; i < cfg->threads; ++i) {
         if (pthread_create(&threads[i], NULL, worker_main, &ctxs[i]) != 0) {
             g_stop = 1;
             for (int j = 0; j < i; ++j) {
                 pthread_join(threads[j], NULL);
             }
+            free_workers(ctxs, cfg->threads);
             free(threads);
-            free(ctxs);
+            stop_services();
             return 1;
         }
     }
+    if (accept_start(ctxs, cfg->threads) != 0) {
+        fprintf(stderr, "acceptor thread failed to start\n");
+        g_stop = 1;
+    }
 
     fprintf(
         stderr,
-        "httpd listening on 0.0.0.0:%d with %d thread(s), static_root=%s, idle_timeout=%ds\n",
+        "httpd listening on 0.0.0.0:%d with %d thread(s), engine=%s, static_root=%s, "
+        "timeouts idle=%ds header=%ds body=%ds write=%ds, static_cache=%d render=%dKB watch=%s, scan=%s, modules=%d proxies=%d tls=%s rebalance=%d accept=%s\n",
         cfg->port,
         cfg->threads,
+        cfg->engine == SERVER_ENGINE_URING ? "uring" : "epoll",
         cfg->static_root,
-        cfg->idle_timeout_sec
+        cfg->idle_timeout_sec,
+        cfg->header_timeout_sec,
+        cfg->body_timeout_sec,
+        cfg->write_timeout_sec,
+        cfg->static_cache_entries,
+        cfg->static_render_budget_kb,
+        static_watch_mode_name((static_watch_mode_t)watch),
+        http_scan_impl_name(http_scan_active()),
+        cfg->module_count,
+        cfg->proxy_count,
+        cfg->tls_cert[0] != '\0' ? "on" : "off",
+        cfg->rebalance_threshold,
+        accept_mode_name(cfg->accept_mode)
     );
 
     for (int i = 0; i < cfg->threads; ++i) {
         pthread_join(threads[i], NULL);
     }
 
+    free_workers(ctxs, cfg->threads);
     free(threads);
-    free(ctxs);
+    stop_services();
     return 0;
 }
 
@@ -0,0 +1,571 @@
+#include "upstream.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "net.h"
+#include "tls.h"
+#include "worker.h"
+
+/* Content-Length bodies at least this long are spliced through a pipe rather than copied. */
+#define UPSTREAM_SPLICE_MIN (64 * 1024)
+#define UPSTREAM_SPLICE_CHUNK (64 * 1024)
+
+typedef struct {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    char prefix[HTTP_PROXY_PREFIX_CAP];
+    char host[HTTP_PROXY_UPSTREAM_CAP];
+    char base[HTTP_PROXY_UPSTREAM_CAP];
+    bool has_base;
+} upstream_target_t;
+
+typedef enum {
+    UPSTREAM_SENDING = 0,       /* writing the request, connect possibly still in progress */
+    UPSTREAM_HEAD,              /* reading the response head */
+    UPSTREAM_BODY,              /* the client pulls the body through upstream_relay() */
+    UPSTREAM_IDLE               /* pooled */
+} upstream_state_t;
+
+/*
+ * One upstream connection and the exchange it carries. buf holds the request
+ * until the response head has been read after it; then the buffer passes to
+ * the response, which sends the body bytes that came with the head from it.
+ */
+typedef struct upstream_conn {
+    int fd;
+    unsigned target;
+    upstream_state_t state;
+    bool reused;                /* from the idle list, and no reply byte read yet */
+    bool splicing;
+    int pipe_r;
+    int pipe_w;
+    size_t piped;
+    connection_t *client;
+    http_response_t *resp;
+    char *buf;
+    size_t buf_cap;
+    size_t buf_len;
+    size_t request_len;
+    size_t sent;
+    http_upstream_head_t head;
+    uint64_t remaining;
+    http_chunk_scan_t chunks;
+    struct upstream_conn *next_idle;
+} upstream_conn_t;
+
+static upstream_target_t g_targets[HTTP_PROXIES_MAX];
+static size_t g_target_count;
+
+int upstream_targets_init(const http_proxy_spec_t *specs, size_t count) {
+    if (count > HTTP_PROXIES_MAX) {
+        return -1;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        upstream_target_t *t = &g_targets[i];
+        const char *spec = specs[i].upstream;
+        bool unix_socket = strncmp(spec, "unix:", 5) == 0;
+        /* A base path follows the address: "host:port/v1", "unix:/run/app.sock:/v1". */
+        const char *base = unix_socket ? strstr(spec + 5, ":/") : strchr(spec, '/');
+        char address[HTTP_PROXY_UPSTREAM_CAP];
+        size_t address_len = base != NULL ? (size_t)(base - spec) : strlen(spec);
+        memcpy(address, spec, address_len);
+        address[address_len] = '\0';
+        t->has_base = base != NULL;
+        if (base != NULL) {
+            snprintf(t->base, sizeof(t->base), "%s", unix_socket ? base + 1 : base);
+        }
+
+        if (net_resolve_address(address, &t->addr, &t->addr_len) != 0) {
+            fprintf(stderr, "proxy %s: cannot resolve %s\n", specs[i].prefix, address);
+            return -1;
+        }
+        snprintf(t->prefix, sizeof(t->prefix), "%s", specs[i].prefix);
+        snprintf(t->host, sizeof(t->host), "%s", unix_socket ? "localhost" : address);
+        if (http_router_add_proxy_route(t->prefix, (unsigned)i, t->host, t->has_base ? t->base : NULL) != 0) {
+            fprintf(stderr, "proxy %s: cannot route this prefix\n", specs[i].prefix);
+            return -1;
+        }
+    }
+    g_target_count = count;
+    return 0;
+}
+
+int upstream_pool_init(upstream_pool_t *pool) {
+    memset(pool, 0, sizeof(*pool));
+    return slab_pool_init(&pool->slab, "upstream", sizeof(upstream_conn_t), CONN_SLAB_OBJS);
+}
+
+static void upstream_free(upstream_pool_t *pool, upstream_conn_t *uc) {
+    if (uc->fd >= 0) {
+        if ((size_t)uc->fd < pool->by_fd_cap) {
+            pool->by_fd[uc->fd] = NULL;
+        }
+        close(uc->fd);
+    }
+    if (uc->pipe_r >= 0) {
+        close(uc->pipe_r);
+        close(uc->pipe_w);
+    }
+    slab_pool_free(&pool->slab, uc);
+}
+
+void upstream_pool_destroy(upstream_pool_t *pool) {
+    for (size_t t = 0; t < HTTP_PROXIES_MAX; ++t) {
+        while (pool->idle[t] != NULL) {
+            upstream_conn_t *uc = pool->idle[t];
+            pool->idle[t] = uc->next_idle;
+            upstream_free(pool, uc);
+        }
+        pool->idle_count[t] = 0;
+    }
+    free(pool->by_fd);
+    pool->by_fd = NULL;
+    pool->by_fd_cap = 0;
+    slab_pool_destroy(&pool->slab);
+}
+
+static int by_fd_reserve(upstream_pool_t *pool, int fd) {
+    if ((size_t)fd < pool->by_fd_cap) {
+        return 0;
+    }
+    size_t cap = pool->by_fd_cap == 0 ? 1024 : pool->by_fd_cap;
+    while (cap <= (size_t)fd) {
+        cap *= 2;
+    }
+    upstream_conn_t **next = realloc(pool->by_fd, cap * sizeof(*next));
+    if (next == NULL) {
+        return -1;
+    }
+    memset(next + pool->by_fd_cap, 0, (cap - pool->by_fd_cap) * sizeof(*next));
+    pool->by_fd = next;
+    pool->by_fd_cap = cap;
+    return 0;
+}
+
+/* Open a socket to the target of uc and add it to the epoll set; uc->fd is -1 on failure. */
+static int upstream_connect(worker_ctx_t *ctx, upstream_conn_t *uc) {
+    const upstream_target_t *t = &g_targets[uc->target];
+    uc->fd = net_connect_nonblocking(&t->addr, t->addr_len);
+    if (uc->fd < 0) {
+        return -1;
+    }
+    /* Edge-triggered both ways for the connection's whole life; each state retries until EAGAIN. */
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.data.fd = uc->fd;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    if (by_fd_reserve(&ctx->upstreams, uc->fd) != 0 || epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, uc->fd, &ev) != 0) {
+        close(uc->fd);
+        uc->fd = -1;
+        return -1;
+    }
+    ctx->upstreams.by_fd[uc->fd] = uc;
+    return 0;
+}
+
+static void upstream_close(worker_ctx_t *ctx, upstream_conn_t *uc) {
+    if (uc->fd >= 0) {
+        epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, uc->fd, NULL);
+    }
+    if (uc->buf != NULL) {
+        buf_pool_release(&ctx->bufs, uc->buf, uc->buf_cap);
+    }
+    upstream_free(&ctx->upstreams, uc);
+}
+
+/* The upstream has handed over the whole body: detach, then pool the connection or close it. */
+static void upstream_finish(worker_ctx_t *ctx, upstream_conn_t *uc) {
+    upstream_pool_t *pool = &ctx->upstreams;
+    uc->resp->relay = NULL;
+    uc->resp = NULL;
+    uc->client = NULL;
+    if (!uc->head.keep_alive || uc->piped > 0 || pool->idle_count[uc->target] >= UPSTREAM_IDLE_MAX ||
+        server_stopping()) {
+        upstream_close(ctx, uc);
+        return;
+    }
+    uc->state = UPSTREAM_IDLE;
+    uc->splicing = false;
+    uc->next_idle = pool->idle[uc->target];
+    pool->idle[uc->target] = uc;
+    ++pool->idle_count[uc->target];
+}
+
+static bool upstream_advance(worker_ctx_t *ctx, upstream_conn_t *uc);
+
+/* Nothing usable came back: answer 502, or resend on a fresh connection if a pooled one had gone stale. */
+static bool upstream_fail(worker_ctx_t *ctx, upstream_conn_t *uc) {
+    if (uc->reused) {
+        epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, uc->fd, NULL);
+        ctx->upstreams.by_fd[uc->fd] = NULL;
+        close(uc->fd);
+        uc->reused = false;
+        uc->sent = 0;
+        uc->buf_len = 0;
+        uc->state = UPSTREAM_SENDING;
+        if (upstream_connect(ctx, uc) == 0) {
+            return upstream_advance(ctx, uc);
+        }
+    }
+
+    http_response_t *resp = uc->resp;
+    resp->relay = NULL;
+    upstream_close(ctx, uc);
+    http_route_id_t route = resp->route;
+    bool close_after_send = resp->close_after_send;
+    http_response_reset(resp);
+    if (http_build_error_response(resp, 502, close_after_send) != 0) {
+        http_response_reset(resp);
+        (void)http_build_error_response(resp, 500, true);
+    }
+    resp->route = route;
+    return true;
+}
+
+/*
+ * Splice a long Content-Length body through a pipe of its own when one can be
+ * had and the client socket takes plaintext.
+ */
+static bool upstream_use_splice(upstream_conn_t *uc) {
+    if (uc->head.framing != HTTP_FRAMING_LENGTH || uc->remaining < UPSTREAM_SPLICE_MIN || conn_tls_records(uc->client)) {
+        return false;
+    }
+    if (uc->pipe_r < 0) {
+        int fds[2];
+        if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+            return false;
+        }
+        uc->pipe_r = fds[0];
+        uc->pipe_w = fds[1];
+    }
+    return true;
+}
+
+/* The head is in: give the response its head and the body bytes read along with it. */
+static bool upstream_begin_body(worker_ctx_t *ctx, upstream_conn_t *uc) {
+    http_response_t *resp = uc->resp;
+    size_t head_len = uc->head.head_len;
+    if (uc->head.framing == HTTP_FRAMING_CLOSE) {
+        /* Only the end of the connection ends this body, so the client's must end too. */
+        resp->close_after_send = true;
+    }
+    resp->head = buf_pool_acquire(resp->pool, head_len + 64, &resp->head_cap);
+    ssize_t n = -1;
+    if (resp->head != NULL) {
+        n = http_proxy_format_head(uc->buf, &uc->head, resp->close_after_send, resp->head, resp->head_cap);
+    }
+    if (n < 0) {
+        return upstream_fail(ctx, uc);
+    }
+    resp->status = uc->head.status;
+    resp->head_len = (size_t)n;
+    resp->head_sent = 0;
+
+    size_t extra = uc->buf_len - head_len;
+    memmove(uc->buf, uc->buf + head_len, extra);
+    resp->body = uc->buf;
+    resp->body_cap = uc->buf_cap;
+    resp->mem = NULL;
+    resp->body_sent = 0;
+    resp->body_len = extra;
+    uc->buf = NULL;
+    uc->buf_cap = 0;
+    uc->buf_len = 0;
+    uc->state = UPSTREAM_BODY;
+
+    bool done = false;
+    switch (uc->head.framing) {
+        case HTTP_FRAMING_NONE:
+            resp->body_len = 0;
+            done = true;
+            break;
+        case HTTP_FRAMING_LENGTH:
+            if (extra > uc->head.content_length) {
+                resp->body_len = (size_t)uc->head.content_length;
+            }
+            uc->remaining = uc->head.content_length - resp->body_len;
+            done = uc->remaining == 0;
+            uc->splicing = !done && upstream_use_splice(uc);
+            break;
+        case HTTP_FRAMING_CHUNKED: {
+            http_chunk_scan_init(&uc->chunks);
+            ssize_t body = http_chunk_scan(&uc->chunks, resp->body, extra, &done);
+            if (body < 0) {
+                /* Too late for a 502: send the head and drop the client. */
+                resp->body_len = 0;
+                resp->close_after_send = true;
+                resp->relay = NULL;
+                upstream_close(ctx, uc);
+                return true;
+            }
+            resp->body_len = (size_t)body;
+            break;
+        }
+        case HTTP_FRAMING_CLOSE:
+            break;
+    }
+    if (resp->body_len < extra) {
+        /* Bytes beyond the body: the upstream is out of step, do not reuse it. */
+        uc->head.keep_alive = false;
+    }
+    if (done) {
+        upstream_finish(ctx, uc);
+    }
+    return true;
+}
+
+static bool upstream_read_head(worker_ctx_t *ctx, upstream_conn_t *uc) {
+    for (;;) {
+        ssize_t n = read(uc->fd, uc->buf + uc->buf_len, uc->buf_cap - uc->buf_len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return false;
+        }
+        if (n <= 0) {
+            return upstream_fail(ctx, uc);
+        }
+        uc->reused = false;
+        uc->buf_len += (size_t)n;
+
+        for (;;) {
+            http_parse_result_t res = http_proxy_parse_head(uc->buf, uc->buf_len, uc->resp->head_only, &uc->head);
+            if (res == HTTP_PARSE_INCOMPLETE && uc->buf_len < uc->buf_cap) {
+                break;
+            }
+            if (res != HTTP_PARSE_OK || uc->head.status == 101) {
+                return upstream_fail(ctx, uc);
+            }
+            if (uc->head.status >= 200) {
+                return upstream_begin_body(ctx, uc);
+            }
+            /* Interim responses are not relayed: the client never asked to continue. */
+            uc->buf_len -= uc->head.head_len;
+            memmove(uc->buf, uc->buf + uc->head.head_len, uc->buf_len);
+        }
+    }
+}
+
+/* Move an exchange on as far as the socket allows; true when the client has something new to send. */
+static bool upstream_advance(worker_ctx_t *ctx, upstream_conn_t *uc) {
+    switch (uc->state) {
+        case UPSTREAM_SENDING:
+            /* Until a connect completes, send() fails with EAGAIN, or with the connect error. */
+            while (uc->sent < uc->request_len) {
+                ssize_t n = send(uc->fd, uc->buf + uc->sent, uc->request_len - uc->sent, MSG_NOSIGNAL);
+                if (n > 0) {
+                    uc->sent += (size_t)n;
+                    continue;
+                }
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    return false;
+                }
+                return upstream_fail(ctx, uc);
+            }
+            /* The response overwrites the request from here on. */
+            uc->buf_len = 0;
+            uc->state = UPSTREAM_HEAD;
+            return upstream_read_head(ctx, uc);
+        case UPSTREAM_HEAD:
+            return upstream_read_head(ctx, uc);
+        case UPSTREAM_BODY:
+            return true;
+        default:
+            return false;
+    }
+}
+
+int upstream_start(worker_ctx_t *ctx, connection_t *conn, http_response_t *resp) {
+    if (resp->upstream < 0 || (size_t)resp->upstream >= g_target_count || ctx->epoll_fd < 0) {
+        return -1;
+    }
+    upstream_pool_t *pool = &ctx->upstreams;
+    unsigned target = (unsigned)resp->upstream;
+    upstream_conn_t *uc = pool->idle[target];
+    if (uc != NULL) {
+        pool->idle[target] = uc->next_idle;
+        --pool->idle_count[target];
+        uc->next_idle = NULL;
+        uc->reused = true;
+    } else {
+        uc = slab_pool_alloc(&pool->slab);
+        if (uc == NULL) {
+            return -1;
+        }
+        uc->target = target;
+        uc->pipe_r = -1;
+        uc->pipe_w = -1;
+        if (upstream_connect(ctx, uc) != 0) {
+            slab_pool_free(&pool->slab, uc);
+            return -1;
+        }
+    }
+
+    uc->state = UPSTREAM_SENDING;
+    uc->client = conn;
+    uc->resp = resp;
+    uc->buf = resp->body;
+    uc->buf_cap = resp->body_cap;
+    uc->request_len = resp->upstream_request;
+    uc->sent = 0;
+    uc->buf_len = 0;
+    uc->remaining = 0;
+    uc->piped = 0;
+    resp->body = NULL;
+    resp->body_cap = 0;
+    resp->body_len = 0;
+    resp->upstream_request = 0;
+    resp->relay = uc;
+    (void)upstream_advance(ctx, uc);
+    return 0;
+}
+
+connection_t *upstream_handle_event(worker_ctx_t *ctx, int fd, uint32_t events) {
+    upstream_pool_t *pool = &ctx->upstreams;
+    if (fd < 0 || (size_t)fd >= pool->by_fd_cap || pool->by_fd[fd] == NULL) {
+        return NULL;
+    }
+    upstream_conn_t *uc = pool->by_fd[fd];
+    if (uc->state == UPSTREAM_IDLE) {
+        /* An idle connection has nothing to say: anything readable is a close or garbage. */
+        if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0) {
+            upstream_conn_t **link = &pool->idle[uc->target];
+            while (*link != uc) {
+                link = &(*link)->next_idle;
+            }
+            *link = uc->next_idle;
+            --pool->idle_count[uc->target];
+            upstream_close(ctx, uc);
+        }
+        return NULL;
+    }
+    connection_t *client = uc->client;
+    return upstream_advance(ctx, uc) ? client : NULL;
+}
+
+/* Socket to pipe to socket; the pipe is refilled only once the client has taken all of it. */
+static ssize_t relay_splice(worker_ctx_t *ctx, connection_t *conn, upstream_conn_t *uc) {
+    for (;;) {
+        if (uc->piped > 0) {
+            ssize_t n = splice(uc->pipe_r, NULL, conn->fd, NULL, uc->piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0) {
+                uc->piped -= (size_t)n;
+                if (uc->piped == 0 && uc->remaining == 0) {
+                    upstream_finish(ctx, uc);
+                }
+                return n;
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n == 0) {
+                errno = EPIPE;
+            }
+            return -1;
+        }
+
+        size_t want = uc->remaining < UPSTREAM_SPLICE_CHUNK ? (size_t)uc->remaining : UPSTREAM_SPLICE_CHUNK;
+        ssize_t n = splice(uc->fd, NULL, uc->pipe_w, NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            uc->remaining -= (uint64_t)n;
+            uc->piped = (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (n == 0) {
+            /* The upstream closed short of Content-Length. */
+            errno = EPIPE;
+        }
+        return -1;
+    }
+}
+
+/* Read a piece into the response's body buffer and send it; what the client does not take stays in the window. */
+static ssize_t relay_copy(worker_ctx_t *ctx, connection_t *conn, upstream_conn_t *uc) {
+    http_response_t *resp = uc->resp;
+    size_t want = resp->body_cap;
+    if (uc->head.framing == HTTP_FRAMING_LENGTH && uc->remaining < want) {
+        want = (size_t)uc->remaining;
+    }
+    ssize_t n;
+    do {
+        n = read(uc->fd, resp->body, want);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+    if (n == 0) {
+        if (uc->head.framing == HTTP_FRAMING_CLOSE) {
+            upstream_finish(ctx, uc);
+            return 0;
+        }
+        errno = EPIPE;
+        return -1;
+    }
+
+    bool done = false;
+    size_t body = (size_t)n;
+    if (uc->head.framing == HTTP_FRAMING_LENGTH) {
+        uc->remaining -= (uint64_t)n;
+        done = uc->remaining == 0;
+    } else if (uc->head.framing == HTTP_FRAMING_CHUNKED) {
+        ssize_t scanned = http_chunk_scan(&uc->chunks, resp->body, body, &done);
+        if (scanned < 0) {
+            errno = EPROTO;
+            return -1;
+        }
+        if ((size_t)scanned < body) {
+            uc->head.keep_alive = false;
+        }
+        body = (size_t)scanned;
+    }
+    resp->mem = NULL;
+    resp->body_sent = 0;
+    resp->body_len = body;
+    if (done) {
+        upstream_finish(ctx, uc);
+    }
+
+    ssize_t sent = conn_tls_records(conn) ? tls_write(conn->tls, resp->body, body)
+                                          : send(conn->fd, resp->body, body, MSG_NOSIGNAL);
+    if (sent > 0) {
+        resp->body_sent = (size_t)sent;
+    }
+    return sent;
+}
+
+ssize_t upstream_relay(worker_ctx_t *ctx, connection_t *conn, http_response_t *resp) {
+    upstream_conn_t *uc = resp->relay;
+    if (uc->state != UPSTREAM_BODY) {
+        return 0;
+    }
+    return uc->splicing ? relay_splice(ctx, conn, uc) : relay_copy(ctx, conn, uc);
+}
+
+void upstream_abort(worker_ctx_t *ctx, http_response_t *resp) {
+    upstream_conn_t *uc = resp->relay;
+    resp->relay = NULL;
+    if (uc != NULL) {
+        upstream_close(ctx, uc);
+    }
+}
+
+#endif
@@ -0,0 +1,602 @@
+#include "worker.h"
+
+#ifdef __linux__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "http_parser.h"
+#include "metrics.h"
+#include "net.h"
+#include "tls.h"
+#include "util.h"
+
+int worker_state_init(worker_ctx_t *ctx) {
+    if (slab_pool_init(&ctx->conn_pool, "conn", sizeof(connection_t), CONN_SLAB_OBJS) != 0 ||
+        slab_pool_init(&ctx->resp_pool, "resp", sizeof(http_response_t), CONN_SLAB_OBJS) != 0 ||
+        buf_pool_init(&ctx->bufs) != 0 ||
+        upstream_pool_init(&ctx->upstreams) != 0 ||
+        h2_pool_init(&ctx->h2) != 0) {
+        fprintf(stderr, "connection pool init failed\n");
+        return -1;
+    }
+
+    ctx->conns_cap = 1024;
+    ctx->conns = calloc(ctx->conns_cap, sizeof(*ctx->conns));
+    if (ctx->conns == NULL) {
+        fprintf(stderr, "calloc connection table failed\n");
+        return -1;
+    }
+
+    timer_wheel_init(&ctx->timers, WORKER_TIMER_TICK_MS, util_now_ms());
+    metrics_register_thread(ctx->id);
+    http_modules_worker_init(ctx->module_ctx, ctx->id);
+    return 0;
+}
+
+void worker_state_destroy(worker_ctx_t *ctx) {
+    if (ctx->conns != NULL) {
+        for (size_t i = 0; i < ctx->conns_cap; ++i) {
+            if (ctx->conns[i] != NULL) {
+                close(ctx->conns[i]->fd);
+                metrics_dec_connections();
+                conn_free(ctx, ctx->conns[i]);
+                ctx->conns[i] = NULL;
+            }
+        }
+        free(ctx->conns);
+        ctx->conns = NULL;
+    }
+
+    upstream_pool_destroy(&ctx->upstreams);
+    h2_pool_destroy(&ctx->h2);
+    slab_pool_destroy(&ctx->conn_pool);
+    slab_pool_destroy(&ctx->resp_pool);
+    buf_pool_destroy(&ctx->bufs);
+    http_modules_worker_destroy(ctx->module_ctx);
+}
+
+int worker_ensure_conn_capacity(worker_ctx_t *ctx, int fd) {
+    if (fd < 0) {
+        return -1;
+    }
+    if ((size_t)fd < ctx->conns_cap) {
+        return 0;
+    }
+
+    size_t new_cap = ctx->conns_cap == 0 ? 1024 : ctx->conns_cap;
+    while (new_cap <= (size_t)fd) {
+        if (new_cap > SIZE_MAX / 2) {
+            return -1;
+        }
+        new_cap *= 2;
+    }
+
+    connection_t **next = realloc(ctx->conns, new_cap * sizeof(*ctx->conns));
+    if (next == NULL) {
+        return -1;
+    }
+
+    memset(next + ctx->conns_cap, 0, (new_cap - ctx->conns_cap) * sizeof(*ctx->conns));
+    ctx->conns = next;
+    ctx->conns_cap = new_cap;
+    return 0;
+}
+
+void worker_publish_tx_stats(worker_ctx_t *ctx) {
+    tx_stats_t *cur = &ctx->tx;
+    tx_stats_t *pub = &ctx->tx_published;
+    if (cur->responses == pub->responses && cur->syscalls == pub->syscalls && cur->packets == pub->packets) {
+        return;
+    }
+    metrics_add_tx(
+        cur->responses - pub->responses,
+        cur->syscalls - pub->syscalls,
+        cur->packets - pub->packets,
+        cur->closed_responses - pub->closed_responses
+    );
+    *pub = *cur;
+}
+
+static void on_conn_timeout(timer_node_t *node, void *arg) {
+    worker_ctx_t *ctx = arg;
+    connection_t *conn = (connection_t *)((char *)node - offsetof(connection_t, timer));
+    ctx->close_conn(ctx, conn);
+}
+
+void worker_run_timers(worker_ctx_t *ctx, uint64_t now_ms) {
+    (void)timer_wheel_advance(&ctx->timers, now_ms, on_conn_timeout, ctx);
+}
+
+connection_t *conn_create(worker_ctx_t *ctx, int fd) {
+    connection_t *conn = slab_pool_alloc(&ctx->conn_pool);
+    if (conn == NULL) {
+        return NULL;
+    }
+    conn->fd = fd;
+    conn->last_active_ms = util_now_ms();
+    ++ctx->conn_count;
+    atomic_store_explicit(&ctx->load.conns, (unsigned)ctx->conn_count, memory_order_relaxed);
+    http_parser_init(&conn->parser);
+    conn->parser.report_headers = true;
+    return conn;
+}
+
+void conn_note_rx(connection_t *conn) {
+    conn->rx_last_ns = util_now_ns();
+    conn->last_active_ms = conn->rx_last_ns / 1000000ULL;
+    if (conn->in_len == 0) {
+        conn->request_start_ns = conn->rx_last_ns;
+    }
+}
+
+static void conn_release_input(worker_ctx_t *ctx, connection_t *conn) {
+    buf_pool_release(&ctx->bufs, conn->in_buf, conn->in_cap);
+    conn->in_buf = NULL;
+    conn->in_cap = 0;
+    conn->in_len = 0;
+}
+
+int conn_reserve_input(worker_ctx_t *ctx, connection_t *conn) {
+    if (conn->in_len < conn->in_cap) {
+        return 0;
+    }
+    if (conn->in_cap >= CONN_INBUF_CAP || (conn->streaming && conn->in_cap > 0)) {
+        return 1;
+    }
+
+    size_t want = conn->in_cap == 0 ? CONN_INBUF_INITIAL : conn->in_cap * 2;
+    size_t cap = 0;
+    char *next = buf_pool_acquire(&ctx->bufs, want, &cap);
+    if (next == NULL) {
+        return -1;
+    }
+    if (conn->in_len > 0) {
+        memcpy(next, conn->in_buf, conn->in_len);
+    }
+    buf_pool_release(&ctx->bufs, conn->in_buf, conn->in_cap);
+    conn->in_buf = next;
+    conn->in_cap = cap;
+    return 0;
+}
+
+void conn_release_idle_buffers(worker_ctx_t *ctx, connection_t *conn) {
+    if (conn->in_len == 0 && conn->in_buf != NULL) {
+        conn_release_input(ctx, conn);
+    }
+}
+
+http_response_t *conn_front_response(connection_t *conn) {
+    return conn->out_count == 0 ? NULL : conn->out_q[conn->out_head];
+}
+
+static http_response_t *conn_push_response(worker_ctx_t *ctx, connection_t *conn) {
+    if (conn->out_count >= CONN_PIPELINE_DEPTH) {
+        return NULL;
+    }
+    http_response_t *resp = slab_pool_alloc(&ctx->resp_pool);
+    if (resp == NULL) {
+        return NULL;
+    }
+    http_response_init(resp, &ctx->bufs);
+    conn->out_q[(conn->out_head + conn->out_count) % CONN_PIPELINE_DEPTH] = resp;
+    ++conn->out_count;
+    return resp;
+}
+
+static void conn_pop_response(worker_ctx_t *ctx, connection_t *conn) {
+    http_response_t *resp = conn_front_response(conn);
+    if (resp == NULL) {
+        return;
+    }
+    if (resp->relay != NULL) {
+        upstream_abort(ctx, resp);
+    }
+    http_response_reset(resp);
+    slab_pool_free(&ctx->resp_pool, resp);
+    conn->out_q[conn->out_head] = NULL;
+    conn->out_head = (conn->out_head + 1) % CONN_PIPELINE_DEPTH;
+    --conn->out_count;
+}
+
+void conn_free(worker_ctx_t *ctx, connection_t *conn) {
+    if (conn == NULL) {
+        return;
+    }
+    h2_session_destroy(ctx, conn);
+    tls_conn_free(conn->tls);
+    conn->tls = NULL;
+    while (conn->out_count > 0) {
+        conn_pop_response(ctx, conn);
+    }
+    conn_release_input(ctx, conn);
+    slab_pool_free(&ctx->conn_pool, conn);
+    --ctx->conn_count;
+    atomic_store_explicit(&ctx->load.conns, (unsigned)ctx->conn_count, memory_order_relaxed);
+}
+
+void worker_detach_conn(worker_ctx_t *ctx, connection_t *conn) {
+    uint64_t segs = 0;
+    if (conn->responses_sent > 0 && net_tcp_data_segs_out(conn->fd, &segs) == 0) {
+        ctx->tx.packets += segs;
+        ctx->tx.closed_responses += conn->responses_sent;
+    }
+    timer_wheel_cancel(&ctx->timers, &conn->timer);
+    ctx->conns[conn->fd] = NULL;
+    metrics_dec_connections();
+    /* close_notify has to leave before the engine closes the socket. */
+    tls_conn_free(conn->tls);
+    conn->tls = NULL;
+}
+
+bool conn_tls_records(const connection_t *conn) {
+    return conn->tls != NULL && !tls_kernel_tx(conn->tls);
+}
+
+static conn_phase_t conn_current_phase(const connection_t *conn) {
+    if (conn->out_count > 0) {
+        return CONN_PHASE_WRITE;
+    }
+    if (conn->h2 != NULL) {
+        return h2_session_active(conn->h2) ? CONN_PHASE_BODY : CONN_PHASE_IDLE;
+    }
+    if (conn->parser.state == HTTP_PARSER_BODY) {
+        return CONN_PHASE_BODY;
+    }
+    if (conn->in_len > 0 || conn->parser.state != HTTP_PARSER_REQUEST_LINE) {
+        return CONN_PHASE_HEADER;
+    }
+    return CONN_PHASE_IDLE;
+}
+
+void conn_update_timer(worker_ctx_t *ctx, connection_t *conn) {
+    conn_phase_t phase = conn_current_phase(conn);
+    if (phase != conn->phase || !timer_node_armed(&conn->timer)) {
+        conn->phase = phase;
+        conn->phase_start_ms = util_now_ms();
+    }
+
+    uint64_t deadline;
+    switch (phase) {
+        case CONN_PHASE_HEADER:
+            deadline = conn->phase_start_ms + (uint64_t)ctx->cfg.header_timeout_sec * 1000ULL;
+            break;
+        case CONN_PHASE_BODY:
+            deadline = conn->last_active_ms + (uint64_t)ctx->cfg.body_timeout_sec * 1000ULL;
+            break;
+        case CONN_PHASE_WRITE:
+            deadline = conn->last_active_ms + (uint64_t)ctx->cfg.write_timeout_sec * 1000ULL;
+            break;
+        default:
+            deadline = conn->last_active_ms + (uint64_t)ctx->cfg.idle_timeout_sec * 1000ULL;
+            break;
+    }
+    timer_wheel_arm(&ctx->timers, &conn->timer, deadline);
+}
+
+static void compact_input_buffer(connection_t *conn, size_t consumed) {
+    if (consumed >= conn->in_len) {
+        conn->in_len = 0;
+        return;
+    }
+
+    size_t remaining = conn->in_len - consumed;
+    memmove(conn->in_buf, conn->in_buf + consumed, remaining);
+    conn->in_len = remaining;
+}
+
+int conn_queue_error(worker_ctx_t *ctx, connection_t *conn, int status) {
+    conn->in_len = 0;
+    conn->closing = true;
+    conn->streaming = false;
+    http_parser_init(&conn->parser);
+
+    http_response_t *resp = conn_push_response(ctx, conn);
+    if (resp == NULL) {
+        return -1;
+    }
+    if (http_build_error_response(resp, status, true) != 0) {
+        http_response_reset(resp);
+        (void)http_build_error_response(resp, 500, true);
+    }
+    resp->start_ns = conn->request_start_ns;
+    return 0;
+}
+
+/* Queue the final response of a request; the parser is reset for the next one. */
+static http_response_t *conn_finish_request(worker_ctx_t *ctx, connection_t *conn) {
+    http_response_t *resp = conn_push_response(ctx, conn);
+    if (resp == NULL) {
+        return NULL;
+    }
+    resp->start_ns = conn->request_start_ns;
+    /* Bytes left over arrived no later than the most recent read. */
+    conn->request_start_ns = conn->rx_last_ns;
+    http_parser_init(&conn->parser);
+    conn->parser.report_headers = true;
+    return resp;
+}
+
+/*
+ * The head of a request with a body is complete: let the route pick how the
+ * body is read and answer Expect: 100-continue accordingly. A streamed body
+ * starts right after the head, which is dropped from the buffer.
+ */
+static int conn_start_body(worker_ctx_t *ctx, connection_t *conn, const http_request_t *req, size_t *offset) {
+    int status = 0;
+    http_body_mode_t mode = http_route_body(req, &conn->stream, &status);
+    if (mode == HTTP_BODY_REJECTED) {
+        metrics_inc_requests();
+        return conn_queue_error(ctx, conn, status);
+    }
+
+    /* Skip the 100 when the client already started sending the body. */
+    size_t head_len = conn->parser.header_block_len;
+    if (req->expect_continue && conn->in_len - *offset == head_len) {
+        http_response_t *resp = conn_push_response(ctx, conn);
+        if (resp == NULL) {
+            return -1;
+        }
+        (void)http_build_continue_response(resp);
+        resp->route = mode == HTTP_BODY_STREAMED ? conn->stream.route : HTTP_ROUTE_OTHER;
+    }
+
+    if (mode == HTTP_BODY_STREAMED) {
+        conn->streaming = true;
+        *offset += head_len;
+    }
+    return 0;
+}
+
+/* Hand the buffered part of a streamed body to its route; queue the response at the end. */
+static int conn_stream_body(worker_ctx_t *ctx, connection_t *conn, size_t *offset, bool *done) {
+    size_t data_len = 0;
+    size_t consumed = 0;
+    int error_status = 400;
+    char *data = conn->in_buf + *offset;
+    http_parse_result_t res = http_parser_read_body(
+        &conn->parser,
+        data,
+        conn->in_len - *offset,
+        &data_len,
+        &consumed,
+        &error_status
+    );
+    *done = res != HTTP_PARSE_INCOMPLETE;
+    if (res == HTTP_PARSE_ERROR) {
+        metrics_inc_requests();
+        return conn_queue_error(ctx, conn, error_status);
+    }
+    if (data_len > 0 && http_body_stream_data(&conn->stream, data, data_len) != 0) {
+        metrics_inc_requests();
+        return conn_queue_error(ctx, conn, 500);
+    }
+    *offset += consumed;
+    if (res == HTTP_PARSE_INCOMPLETE) {
+        return 0;
+    }
+
+    metrics_inc_requests();
+    conn->streaming = false;
+    http_response_t *resp = conn_finish_request(ctx, conn);
+    if (resp == NULL) {
+        return -1;
+    }
+    if (http_body_stream_finish(&conn->stream, resp, false) != 0) {
+        http_route_id_t route = resp->route;
+        http_response_reset(resp);
+        (void)http_build_error_response(resp, 500, true);
+        resp->route = route;
+    }
+    if (resp->close_after_send) {
+        conn->closing = true;
+    }
+    return 0;
+}
+
+int conn_parse_requests(worker_ctx_t *ctx, connection_t *conn) {
+    size_t offset = 0;
+
+    /* HTTP/2 with prior knowledge: the client preface takes the place of the first request. */
+    if (conn->h2 == NULL && conn->responses_sent == 0 && conn->out_count == 0 && conn->in_len > 0) {
+        int preface = h2_preface_match(conn->in_buf, conn->in_len);
+        if (preface == 0) {
+            return 0;
+        }
+        if (preface > 0 && h2_session_start(ctx, conn) != 0) {
+            return -1;
+        }
+    }
+    if (conn->h2 != NULL) {
+        return h2_session_input(ctx, conn);
+    }
+
+    while (!conn->closing && offset < conn->in_len && conn->out_count < CONN_PIPELINE_DEPTH) {
+        if (conn->streaming) {
+            bool done = false;
+            if (conn_stream_body(ctx, conn, &offset, &done) != 0) {
+                return -1;
+            }
+            if (!done) {
+                break;
+            }
+            continue;
+        }
+
+        http_request_t req;
+        size_t consumed = 0;
+        int error_status = 400;
+        http_parse_result_t res = http_parser_execute(
+            &conn->parser,
+            conn->in_buf + offset,
+            conn->in_len - offset,
+            &req,
+            &consumed,
+            &error_status
+        );
+
+        if (res == HTTP_PARSE_INCOMPLETE) {
+            conn->in_len = offset + http_parser_compact(
+                &conn->parser,
+                conn->in_buf + offset,
+                conn->in_len - offset
+            );
+            break;
+        }
+        if (res == HTTP_PARSE_HEADERS) {
+            if (conn_start_body(ctx, conn, &req, &offset) != 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        metrics_inc_requests();
+
+        if (res == HTTP_PARSE_ERROR) {
+            return conn_queue_error(ctx, conn, error_status);
+        }
+
+        /* The 101 goes out first; the request itself is answered on stream 1. Over TLS, h2 is chosen with ALPN. */
+        if (conn->out_count == 0 &&
+            conn->tls == NULL &&
+            h2_upgrade_requested(&req) &&
+            h2_session_upgrade(ctx, conn, &req, conn->in_buf + offset, consumed) == 0) {
+            http_response_t *resp = conn_push_response(ctx, conn);
+            if (resp == NULL) {
+                return -1;
+            }
+            (void)h2_build_upgrade_response(resp);
+            resp->start_ns = conn->request_start_ns;
+            compact_input_buffer(conn, offset + consumed);
+            return h2_session_input(ctx, conn);
+        }
+
+        http_response_t *resp = conn_finish_request(ctx, conn);
+        if (resp == NULL) {
+            return -1;
+        }
+        if (http_route_request(&req, resp, ctx->cfg.static_root, ctx->module_ctx, false) != 0) {
+            http_route_id_t route = resp->route;
+            http_response_reset(resp);
+            (void)http_build_error_response(resp, 500, true);
+            resp->route = route;
+        }
+        if (resp->upstream >= 0 && upstream_start(ctx, conn, resp) != 0) {
+            bool close_after_send = resp->close_after_send;
+            http_response_reset(resp);
+            (void)http_build_error_response(resp, 502, close_after_send);
+            resp->route = HTTP_ROUTE_PROXY;
+        }
+        if (resp->close_after_send) {
+            conn->closing = true;
+        }
+        offset += consumed;
+    }
+
+    if (conn->closing) {
+        conn->in_len = 0;
+    } else {
+        compact_input_buffer(conn, offset);
+    }
+    return 0;
+}
+
+static bool response_done(const http_response_t *resp) {
+    return resp->head_sent == resp->head_len &&
+        resp->body_sent == resp->body_len &&
+        (resp->file_fd < 0 || resp->file_remaining == 0) &&
+        !http_response_has_more(resp) &&
+        resp->relay == NULL;
+}
+
+int conn_build_output_iov(connection_t *conn, struct iovec *iov, int iov_cap, bool *file_follows) {
+    int iovcnt = 0;
+    *file_follows = false;
+    for (unsigned i = 0; i < conn->out_count && iovcnt + 2 <= iov_cap; ++i) {
+        http_response_t *resp = conn->out_q[(conn->out_head + i) % CONN_PIPELINE_DEPTH];
+        (void)http_response_next_segment(resp);
+        if (resp->head_sent < resp->head_len) {
+            iov[iovcnt].iov_base = resp->head + resp->head_sent;
+            iov[iovcnt].iov_len = resp->head_len - resp->head_sent;
+            ++iovcnt;
+        }
+        if (resp->body_sent < resp->body_len) {
+            const char *base = resp->mem != NULL ? resp->mem : resp->body;
+            iov[iovcnt].iov_base = (void *)(base + resp->body_sent);
+            iov[iovcnt].iov_len = resp->body_len - resp->body_sent;
+            ++iovcnt;
+        }
+        if (resp->file_fd >= 0 && resp->file_remaining > 0) {
+            *file_follows = true;
+            break;
+        }
+        /* A relayed body continues from its upstream once these windows are out. */
+        if (resp->relay != NULL) {
+            break;
+        }
+        /* Later segments are loaded only once these windows have gone out. */
+        if (http_response_has_more(resp)) {
+            break;
+        }
+    }
+    return iovcnt;
+}
+
+void conn_advance_output(connection_t *conn, size_t n) {
+    for (unsigned i = 0; i < conn->out_count && n > 0; ++i) {
+        http_response_t *resp = conn->out_q[(conn->out_head + i) % CONN_PIPELINE_DEPTH];
+        size_t take = resp->head_len - resp->head_sent;
+        if (take > n) {
+            take = n;
+        }
+        resp->head_sent += take;
+        n -= take;
+
+        take = resp->body_len - resp->body_sent;
+        if (take > n) {
+            take = n;
+        }
+        resp->body_sent += take;
+        n -= take;
+    }
+}
+
+bool conn_complete_sent(worker_ctx_t *ctx, connection_t *conn) {
+    http_response_t *resp;
+    uint64_t now_ns = 0;
+    while ((resp = conn_front_response(conn)) != NULL) {
+        if (!response_done(resp)) {
+            /* A producer only reports its end when asked for the next piece. */
+            (void)http_response_next_segment(resp);
+            if (!response_done(resp)) {
+                break;
+            }
+        }
+        if (conn->h2 != NULL && h2_session_is_wire(conn->h2, resp)) {
+            return h2_session_sent(ctx, conn);
+        }
+        bool close_after = resp->close_after_send;
+        if (resp->status < 200) {
+            conn_pop_response(ctx, conn);
+            continue;
+        }
+        if (now_ns == 0) {
+            now_ns = util_now_ns();
+        }
+        uint64_t latency_ns = now_ns > resp->start_ns ? now_ns - resp->start_ns : 0;
+        metrics_observe_response(resp->route, resp->status, latency_ns);
+        conn_pop_response(ctx, conn);
+        ++conn->responses_sent;
+        ++ctx->tx.responses;
+        if (close_after) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif
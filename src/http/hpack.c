@@ -0,0 +1,466 @@
+#include "hpack.h"
+
+#include <string.h>
+
+#define HPACK_STATIC_COUNT 61
+#define HUFFMAN_SYMBOLS 257
+#define HUFFMAN_EOS 256
+#define HUFFMAN_MAX_BITS 30
+/* Largest integer accepted in a representation; anything bigger is an attack, not a header. */
+#define HPACK_INT_MAX (1U << 24)
+
+typedef struct {
+    const char *name;
+    const char *value;
+} hpack_static_t;
+
+/* RFC 7541 Appendix A; index 1 is element 0. */
+static const hpack_static_t k_static[HPACK_STATIC_COUNT] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""}
+};
+
+/*
+ * Code length of every symbol (RFC 7541 Appendix B), EOS last. The code is
+ * canonical: codes of one length are consecutive in symbol order and follow
+ * all shorter ones, so the lengths determine the codes.
+ */
+static const uint8_t k_huffman_bits[HUFFMAN_SYMBOLS] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30
+};
+
+/* Canonical decoding tables: codes of length n are first[n] .. first[n] + count[n] - 1. */
+static uint32_t g_first[HUFFMAN_MAX_BITS + 1];
+static uint16_t g_count[HUFFMAN_MAX_BITS + 1];
+static uint16_t g_offset[HUFFMAN_MAX_BITS + 1];
+static uint16_t g_sorted[HUFFMAN_SYMBOLS];
+
+/* Huffman-decoded names and values; a header block is decoded in one call on one thread. */
+static _Thread_local char g_scratch[2][HPACK_STRING_MAX];
+
+void hpack_init(void) {
+    memset(g_count, 0, sizeof(g_count));
+    for (unsigned s = 0; s < HUFFMAN_SYMBOLS; ++s) {
+        ++g_count[k_huffman_bits[s]];
+    }
+    uint32_t code = 0;
+    uint16_t offset = 0;
+    for (unsigned n = 1; n <= HUFFMAN_MAX_BITS; ++n) {
+        g_first[n] = code;
+        g_offset[n] = offset;
+        code = (code + g_count[n]) << 1;
+        offset = (uint16_t)(offset + g_count[n]);
+    }
+    uint16_t fill[HUFFMAN_MAX_BITS + 1];
+    memcpy(fill, g_offset, sizeof(fill));
+    for (unsigned s = 0; s < HUFFMAN_SYMBOLS; ++s) {
+        g_sorted[fill[k_huffman_bits[s]]++] = (uint16_t)s;
+    }
+}
+
+static int huffman_decode(const uint8_t *in, size_t len, char *out, size_t cap, size_t *out_len) {
+    uint32_t code = 0;
+    unsigned bits = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < len; ++i) {
+        for (int b = 7; b >= 0; --b) {
+            code = (code << 1) | ((in[i] >> b) & 1U);
+            ++bits;
+            if (code - g_first[bits] < g_count[bits] && code >= g_first[bits]) {
+                uint16_t sym = g_sorted[g_offset[bits] + (code - g_first[bits])];
+                if (sym == HUFFMAN_EOS || n == cap) {
+                    return -1;
+                }
+                out[n++] = (char)sym;
+                code = 0;
+                bits = 0;
+            } else if (bits == HUFFMAN_MAX_BITS) {
+                return -1;
+            }
+        }
+    }
+    /* Padding is the most significant bits of EOS: fewer than 8 one bits. */
+    if (bits > 7 || code != (1U << bits) - 1) {
+        return -1;
+    }
+    *out_len = n;
+    return 0;
+}
+
+void hpack_decoder_init(hpack_decoder_t *dec) {
+    memset(dec, 0, sizeof(*dec));
+    dec->max_size = HPACK_TABLE_SIZE;
+}
+
+static void table_evict_oldest(hpack_decoder_t *dec) {
+    unsigned slot = (dec->next + HPACK_ENTRIES_MAX - dec->count) % HPACK_ENTRIES_MAX;
+    const hpack_entry_t *e = &dec->entries[slot];
+    dec->size -= e->name_len + e->value_len + 32;
+    dec->data_start = e->off + e->name_len + e->value_len;
+    --dec->count;
+    if (dec->count == 0) {
+        dec->data_start = 0;
+        dec->data_end = 0;
+    }
+}
+
+static void table_shrink(hpack_decoder_t *dec, size_t limit) {
+    while (dec->count > 0 && dec->size > limit) {
+        table_evict_oldest(dec);
+    }
+}
+
+/* name must not point into the table: eviction may overwrite it. */
+static void table_insert(hpack_decoder_t *dec, const char *name, size_t name_len, const char *value, size_t value_len) {
+    size_t need = name_len + value_len + 32;
+    if (need > dec->max_size) {
+        /* Not an error: the table just ends up empty. */
+        table_shrink(dec, 0);
+        return;
+    }
+    table_shrink(dec, dec->max_size - need);
+
+    size_t raw = name_len + value_len;
+    if (dec->data_end + raw > sizeof(dec->data)) {
+        size_t live = dec->data_end - dec->data_start;
+        memmove(dec->data, dec->data + dec->data_start, live);
+        for (unsigned i = 0; i < dec->count; ++i) {
+            dec->entries[(dec->next + HPACK_ENTRIES_MAX - 1 - i) % HPACK_ENTRIES_MAX].off -= (uint32_t)dec->data_start;
+        }
+        dec->data_start = 0;
+        dec->data_end = live;
+    }
+    hpack_entry_t *e = &dec->entries[dec->next];
+    e->off = (uint32_t)dec->data_end;
+    e->name_len = (uint32_t)name_len;
+    e->value_len = (uint32_t)value_len;
+    memcpy(dec->data + dec->data_end, name, name_len);
+    memcpy(dec->data + dec->data_end + name_len, value, value_len);
+    dec->data_end += raw;
+    dec->next = (dec->next + 1) % HPACK_ENTRIES_MAX;
+    ++dec->count;
+    dec->size += need;
+}
+
+/* Name and value of a static (1..61) or dynamic (62..) index. */
+static int table_lookup(
+    const hpack_decoder_t *dec,
+    uint32_t index,
+    const char **name,
+    size_t *name_len,
+    const char **value,
+    size_t *value_len
+) {
+    if (index == 0) {
+        return -1;
+    }
+    if (index <= HPACK_STATIC_COUNT) {
+        const hpack_static_t *s = &k_static[index - 1];
+        *name = s->name;
+        *name_len = strlen(s->name);
+        *value = s->value;
+        *value_len = strlen(s->value);
+        return 0;
+    }
+    uint32_t dyn = index - HPACK_STATIC_COUNT;
+    if (dyn > dec->count) {
+        return -1;
+    }
+    const hpack_entry_t *e = &dec->entries[(dec->next + HPACK_ENTRIES_MAX - dyn) % HPACK_ENTRIES_MAX];
+    *name = dec->data + e->off;
+    *name_len = e->name_len;
+    *value = dec->data + e->off + e->name_len;
+    *value_len = e->value_len;
+    return 0;
+}
+
+static int decode_int(const uint8_t **p, const uint8_t *end, unsigned prefix_bits, uint32_t *out) {
+    if (*p >= end) {
+        return -1;
+    }
+    uint32_t max = (1U << prefix_bits) - 1;
+    uint32_t v = **p & max;
+    ++*p;
+    if (v < max) {
+        *out = v;
+        return 0;
+    }
+    for (unsigned shift = 0; *p < end && shift <= 21; shift += 7) {
+        uint8_t b = **p;
+        ++*p;
+        v += (uint32_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            if (v > HPACK_INT_MAX) {
+                return -1;
+            }
+            *out = v;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* A string literal; Huffman-coded ones are decoded into scratch. */
+static int decode_string(const uint8_t **p, const uint8_t *end, char *scratch, const char **out, size_t *out_len) {
+    if (*p >= end) {
+        return -1;
+    }
+    bool huffman = (**p & 0x80) != 0;
+    uint32_t len;
+    if (decode_int(p, end, 7, &len) != 0 || len > (size_t)(end - *p)) {
+        return -1;
+    }
+    if (huffman) {
+        if (huffman_decode(*p, len, scratch, HPACK_STRING_MAX, out_len) != 0) {
+            return -1;
+        }
+        *out = scratch;
+    } else {
+        if (len > HPACK_STRING_MAX) {
+            return -1;
+        }
+        *out = (const char *)*p;
+        *out_len = len;
+    }
+    *p += len;
+    return 0;
+}
+
+int hpack_decode(hpack_decoder_t *dec, const uint8_t *block, size_t len, hpack_emit_fn emit, void *arg) {
+    const uint8_t *p = block;
+    const uint8_t *end = block + len;
+    bool fields_seen = false;
+    while (p < end) {
+        uint8_t b = *p;
+        const char *name;
+        const char *value;
+        size_t name_len;
+        size_t value_len;
+        uint32_t index;
+
+        if (b & 0x80) {
+            if (decode_int(&p, end, 7, &index) != 0 ||
+                table_lookup(dec, index, &name, &name_len, &value, &value_len) != 0) {
+                return -1;
+            }
+            emit(arg, name, name_len, value, value_len);
+            fields_seen = true;
+            continue;
+        }
+        if ((b & 0xe0) == 0x20) {
+            /* Size updates may only open a block. */
+            if (fields_seen || decode_int(&p, end, 5, &index) != 0 || index > HPACK_TABLE_SIZE) {
+                return -1;
+            }
+            dec->max_size = index;
+            table_shrink(dec, dec->max_size);
+            continue;
+        }
+
+        bool indexing = (b & 0xc0) == 0x40;
+        if (decode_int(&p, end, indexing ? 6 : 4, &index) != 0) {
+            return -1;
+        }
+        if (index == 0) {
+            if (decode_string(&p, end, g_scratch[0], &name, &name_len) != 0) {
+                return -1;
+            }
+        } else {
+            const char *unused;
+            size_t unused_len;
+            if (table_lookup(dec, index, &name, &name_len, &unused, &unused_len) != 0) {
+                return -1;
+            }
+            if (indexing && index > HPACK_STATIC_COUNT) {
+                memcpy(g_scratch[0], name, name_len);
+                name = g_scratch[0];
+            }
+        }
+        if (decode_string(&p, end, g_scratch[1], &value, &value_len) != 0) {
+            return -1;
+        }
+        if (indexing) {
+            table_insert(dec, name, name_len, value, value_len);
+        }
+        emit(arg, name, name_len, value, value_len);
+        fields_seen = true;
+    }
+    return 0;
+}
+
+static ssize_t encode_int(uint32_t v, unsigned prefix_bits, uint8_t first, uint8_t *out, size_t cap) {
+    uint32_t max = (1U << prefix_bits) - 1;
+    if (cap == 0) {
+        return -1;
+    }
+    if (v < max) {
+        out[0] = (uint8_t)(first | v);
+        return 1;
+    }
+    out[0] = (uint8_t)(first | max);
+    v -= max;
+    size_t n = 1;
+    while (v >= 0x80) {
+        if (n == cap) {
+            return -1;
+        }
+        out[n++] = (uint8_t)(0x80 | (v & 0x7f));
+        v >>= 7;
+    }
+    if (n == cap) {
+        return -1;
+    }
+    out[n++] = (uint8_t)v;
+    return (ssize_t)n;
+}
+
+/* A raw (not Huffman-coded) string literal, lowercased when asked. */
+static ssize_t encode_string(const char *s, size_t len, bool lower, uint8_t *out, size_t cap) {
+    ssize_t n = encode_int((uint32_t)len, 7, 0, out, cap);
+    if (n < 0 || len > cap - (size_t)n) {
+        return -1;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        char c = s[i];
+        out[(size_t)n + i] = (uint8_t)(lower && c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+    }
+    return n + (ssize_t)len;
+}
+
+static bool name_matches(const char *lower, const char *name, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        char c = name[i];
+        if (c >= 'A' && c <= 'Z') {
+            c = (char)(c + ('a' - 'A'));
+        }
+        if (lower[i] != c) {
+            return false;
+        }
+    }
+    return lower[len] == '\0';
+}
+
+ssize_t hpack_encode_status(int status, uint8_t *out, size_t cap) {
+    static const int indexed[] = {200, 204, 206, 304, 400, 404, 500};
+    for (unsigned i = 0; i < sizeof(indexed) / sizeof(indexed[0]); ++i) {
+        if (indexed[i] == status) {
+            return encode_int(8 + i, 7, 0x80, out, cap);
+        }
+    }
+    char digits[4];
+    digits[0] = (char)('0' + status / 100 % 10);
+    digits[1] = (char)('0' + status / 10 % 10);
+    digits[2] = (char)('0' + status % 10);
+    /* Literal never indexed, name ":status" (static 8). */
+    ssize_t n = encode_int(8, 4, 0x10, out, cap);
+    if (n < 0) {
+        return -1;
+    }
+    ssize_t v = encode_string(digits, 3, false, out + n, cap - (size_t)n);
+    return v < 0 ? -1 : n + v;
+}
+
+ssize_t hpack_encode_field(
+    const char *name,
+    size_t name_len,
+    const char *value,
+    size_t value_len,
+    uint8_t *out,
+    size_t cap
+) {
+    uint32_t index = 0;
+    for (uint32_t i = 0; i < HPACK_STATIC_COUNT; ++i) {
+        if (k_static[i].name[0] != ':' && name_matches(k_static[i].name, name, name_len)) {
+            index = i + 1;
+            break;
+        }
+    }
+    ssize_t n = encode_int(index, 4, 0x10, out, cap);
+    if (n < 0) {
+        return -1;
+    }
+    if (index == 0) {
+        ssize_t s = encode_string(name, name_len, true, out + n, cap - (size_t)n);
+        if (s < 0) {
+            return -1;
+        }
+        n += s;
+    }
+    ssize_t v = encode_string(value, value_len, false, out + n, cap - (size_t)n);
+    return v < 0 ? -1 : n + v;
+}
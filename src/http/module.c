@@ -0,0 +1,283 @@
+#include "http_module.h"
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http_router.h"
+#include "http_scan.h"
+
+#define MODULE_HEADERS_CAP 1024
+
+/* The ABI mirrors these internal values so requests need no translation. */
+_Static_assert(
+    (int)HTTPD_METHOD_GET == (int)HTTP_METHOD_GET && (int)HTTPD_METHOD_PATCH == (int)HTTP_METHOD_PATCH,
+    "method tokens"
+);
+_Static_assert(HTTPD_MAX_PARAMS >= HTTP_ROUTE_MAX_PARAMS, "route parameters");
+_Static_assert(HTTPD_RESPONSE_COPY_MAX == HTTP_RESPONSE_BODY_CAP, "response body cap");
+
+typedef struct {
+    void *handle;
+    const httpd_module_t *desc;
+    void *state;
+    bool initialised;
+} loaded_module_t;
+
+struct httpd_registrar {
+    unsigned module;
+};
+
+/* Lives on the stack of one handler call. */
+struct httpd_response {
+    http_response_t *resp;
+    bool close_after_send;
+    bool responded;
+    size_t headers_len;
+    char headers[MODULE_HEADERS_CAP];
+};
+
+static loaded_module_t g_modules[HTTP_MODULES_MAX];
+static size_t g_module_count;
+static http_module_route_t **g_routes;
+static size_t g_route_count;
+
+static int host_route(
+    httpd_registrar_t *reg,
+    unsigned methods,
+    const char *pattern,
+    httpd_handler_fn handler,
+    void *route_data
+) {
+    if (reg == NULL || handler == NULL || pattern == NULL) {
+        return -1;
+    }
+    http_module_route_t **routes = realloc(g_routes, (g_route_count + 1) * sizeof(*routes));
+    if (routes == NULL) {
+        return -1;
+    }
+    g_routes = routes;
+    http_module_route_t *route = malloc(sizeof(*route));
+    if (route == NULL) {
+        return -1;
+    }
+    route->module = reg->module;
+    route->handler = handler;
+    route->route_data = route_data;
+    if (http_router_add_module_route(methods, pattern, route) != 0) {
+        const char *name = g_modules[reg->module].desc->name;
+        fprintf(stderr, "module %s: cannot route %s\n", name != NULL ? name : "?", pattern);
+        free(route);
+        return -1;
+    }
+    g_routes[g_route_count++] = route;
+    return 0;
+}
+
+static int host_header(const httpd_request_t *req, const char *name, httpd_str_t *value) {
+    const http_view_t *v = http_request_find_header(req->server, name);
+    if (v == NULL) {
+        return -1;
+    }
+    value->ptr = v->ptr;
+    value->len = v->len;
+    return 0;
+}
+
+static int host_header_at(const httpd_request_t *req, size_t index, httpd_str_t *name, httpd_str_t *value) {
+    const http_request_t *r = req->server;
+    if (index >= r->header_count) {
+        return -1;
+    }
+    name->ptr = r->headers[index].name.ptr;
+    name->len = r->headers[index].name.len;
+    value->ptr = r->headers[index].value.ptr;
+    value->len = r->headers[index].value.len;
+    return 0;
+}
+
+static int host_add_header(httpd_response_t *resp, const char *name, const char *value) {
+    size_t name_len = strlen(name);
+    size_t value_len = strlen(value);
+    if (resp->responded || name_len == 0 || http_scan_token_len(name, name_len) != name_len ||
+        strpbrk(value, "\r\n") != NULL) {
+        return -1;
+    }
+    size_t need = name_len + 2 + value_len + 2;
+    if (need >= sizeof(resp->headers) - resp->headers_len) {
+        return -1;
+    }
+    char *out = resp->headers + resp->headers_len;
+    memcpy(out, name, name_len);
+    memcpy(out + name_len, ": ", 2);
+    memcpy(out + name_len + 2, value, value_len);
+    memcpy(out + name_len + 2 + value_len, "\r\n", 3);
+    resp->headers_len += need;
+    return 0;
+}
+
+static int module_respond(
+    httpd_response_t *resp,
+    int status,
+    const char *content_type,
+    const void *body,
+    size_t len,
+    bool borrowed
+) {
+    if (resp->responded || status < 200 || status > 599 || (body == NULL && len > 0)) {
+        return -1;
+    }
+    if (http_response_prepare(
+            resp->resp,
+            status,
+            content_type != NULL ? content_type : "application/octet-stream",
+            resp->headers,
+            body,
+            len,
+            borrowed,
+            resp->close_after_send
+        ) != 0) {
+        return -1;
+    }
+    resp->responded = true;
+    return 0;
+}
+
+static int host_respond(httpd_response_t *resp, int status, const char *content_type, const void *body, size_t len) {
+    return module_respond(resp, status, content_type, body, len, false);
+}
+
+static int host_respond_static(
+    httpd_response_t *resp,
+    int status,
+    const char *content_type,
+    const void *body,
+    size_t len
+) {
+    return module_respond(resp, status, content_type, body, len, true);
+}
+
+static const httpd_host_api_t g_host_api = {
+    .abi_version = HTTPD_MODULE_ABI_VERSION,
+    .route = host_route,
+    .header = host_header,
+    .header_at = host_header_at,
+    .add_header = host_add_header,
+    .respond = host_respond,
+    .respond_static = host_respond_static,
+};
+
+int http_modules_load(const http_module_spec_t *specs, size_t count) {
+    if (count > HTTP_MODULES_MAX) {
+        return -1;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        loaded_module_t *m = &g_modules[g_module_count];
+        m->handle = dlopen(specs[i].path, RTLD_NOW | RTLD_LOCAL);
+        if (m->handle == NULL) {
+            fprintf(stderr, "module %s: %s\n", specs[i].path, dlerror());
+            http_modules_unload();
+            return -1;
+        }
+        ++g_module_count;
+
+        m->desc = dlsym(m->handle, HTTPD_MODULE_SYMBOL);
+        if (m->desc == NULL || m->desc->abi_version != HTTPD_MODULE_ABI_VERSION || m->desc->init == NULL) {
+            fprintf(stderr, "module %s: no compatible %s descriptor\n", specs[i].path, HTTPD_MODULE_SYMBOL);
+            m->desc = NULL;
+            http_modules_unload();
+            return -1;
+        }
+        httpd_registrar_t reg = {(unsigned)i};
+        if (m->desc->init(&g_host_api, &reg, specs[i].arg, &m->state) != 0) {
+            fprintf(stderr, "module %s: init failed\n", specs[i].path);
+            http_modules_unload();
+            return -1;
+        }
+        m->initialised = true;
+    }
+    return 0;
+}
+
+void http_modules_unload(void) {
+    while (g_module_count > 0) {
+        loaded_module_t *m = &g_modules[--g_module_count];
+        if (m->initialised && m->desc->destroy != NULL) {
+            m->desc->destroy(m->state);
+        }
+        dlclose(m->handle);
+        memset(m, 0, sizeof(*m));
+    }
+    for (size_t i = 0; i < g_route_count; ++i) {
+        free(g_routes[i]);
+    }
+    free(g_routes);
+    g_routes = NULL;
+    g_route_count = 0;
+}
+
+void http_modules_worker_init(void *ctx[HTTP_MODULES_MAX], int worker_id) {
+    for (size_t i = 0; i < HTTP_MODULES_MAX; ++i) {
+        const loaded_module_t *m = &g_modules[i];
+        ctx[i] = i < g_module_count && m->desc->worker_init != NULL ? m->desc->worker_init(m->state, worker_id) : NULL;
+    }
+}
+
+void http_modules_worker_destroy(void *ctx[HTTP_MODULES_MAX]) {
+    for (size_t i = 0; i < g_module_count; ++i) {
+        const loaded_module_t *m = &g_modules[i];
+        if (ctx[i] != NULL && m->desc->worker_destroy != NULL) {
+            m->desc->worker_destroy(m->state, ctx[i]);
+        }
+        ctx[i] = NULL;
+    }
+}
+
+int http_module_handle(
+    const http_module_route_t *route,
+    const http_request_t *req,
+    const http_route_match_t *match,
+    http_response_t *resp,
+    void *const module_ctx[HTTP_MODULES_MAX],
+    bool close_after_send
+) {
+    httpd_str_t params[HTTPD_MAX_PARAMS];
+    for (size_t i = 0; i < match->param_count; ++i) {
+        params[i].ptr = match->params[i].ptr;
+        params[i].len = match->params[i].len;
+    }
+
+    httpd_request_t mreq;
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.size = sizeof(mreq);
+    mreq.method = (int)req->method_id;
+    mreq.method_name.ptr = req->method.ptr;
+    mreq.method_name.len = req->method.len;
+    mreq.path.ptr = req->path.ptr;
+    mreq.path.len = req->path.len;
+    const char *query = memchr(req->path.ptr, '?', req->path.len);
+    if (query != NULL) {
+        mreq.path.len = (size_t)(query - req->path.ptr);
+        mreq.query.ptr = query + 1;
+        mreq.query.len = req->path.len - mreq.path.len - 1;
+    }
+    mreq.body.ptr = req->body;
+    mreq.body.len = req->body_len;
+    mreq.params = params;
+    mreq.param_count = match->param_count;
+    mreq.rest.ptr = match->rest.ptr;
+    mreq.rest.len = match->rest.len;
+    mreq.header_count = req->header_count;
+    mreq.server = req;
+
+    httpd_response_t mresp;
+    mresp.resp = resp;
+    mresp.close_after_send = close_after_send;
+    mresp.responded = false;
+    mresp.headers_len = 0;
+    mresp.headers[0] = '\0';
+
+    int rc = route->handler(&mreq, &mresp, module_ctx[route->module], route->route_data);
+    return rc == 0 && mresp.responded ? 0 : -1;
+}
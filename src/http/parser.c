@@ -7,219 +7,825 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "http_scan.h"
 #include "util.h"
 
-static ssize_t find_header_end(const char *buf, size_t len) {
-    if (len < 4) {
-        return -1;
+typedef struct {
+    const char *lower;
+    size_t len;
+    http_header_id_t id;
+} known_header_t;
+
+static const known_header_t k_known_headers[] = {
+    {"host", 4, HTTP_HDR_HOST},
+    {"connection", 10, HTTP_HDR_CONNECTION},
+    {"content-length", 14, HTTP_HDR_CONTENT_LENGTH},
+    {"content-type", 12, HTTP_HDR_CONTENT_TYPE},
+    {"transfer-encoding", 17, HTTP_HDR_TRANSFER_ENCODING},
+    {"accept", 6, HTTP_HDR_ACCEPT},
+    {"accept-encoding", 15, HTTP_HDR_ACCEPT_ENCODING},
+    {"if-none-match", 13, HTTP_HDR_IF_NONE_MATCH},
+    {"if-modified-since", 17, HTTP_HDR_IF_MODIFIED_SINCE},
+    {"range", 5, HTTP_HDR_RANGE},
+    {"if-range", 8, HTTP_HDR_IF_RANGE},
+    {"expect", 6, HTTP_HDR_EXPECT},
+    {"upgrade", 7, HTTP_HDR_UPGRADE},
+    {"http2-settings", 14, HTTP_HDR_HTTP2_SETTINGS},
+    {"cookie", 6, HTTP_HDR_COOKIE},
+    {"user-agent", 10, HTTP_HDR_USER_AGENT},
+    {"authorization", 13, HTTP_HDR_AUTHORIZATION}
+};
+
+static http_header_id_t identify_header(const char *name, size_t name_len) {
+    unsigned char first = (unsigned char)(name[0] | 0x20);
+    for (size_t i = 0; i < sizeof(k_known_headers) / sizeof(k_known_headers[0]); ++i) {
+        const known_header_t *k = &k_known_headers[i];
+        if (k->len == name_len && (unsigned char)k->lower[0] == first && http_scan_name_eq(name, k->lower, name_len)) {
+            return k->id;
+        }
     }
-    for (size_t i = 3; i < len; ++i) {
-        if (buf[i - 3] == '\r' && buf[i - 2] == '\n' && buf[i - 1] == '\r' && buf[i] == '\n') {
-            return (ssize_t)(i - 3);
+    return HTTP_HDR_OTHER;
+}
+
+typedef struct {
+    const char *lower;
+    size_t len;
+    http_method_t id;
+} known_method_t;
+
+static const known_method_t k_known_methods[] = {
+    {"get", 3, HTTP_METHOD_GET},
+    {"head", 4, HTTP_METHOD_HEAD},
+    {"post", 4, HTTP_METHOD_POST},
+    {"put", 3, HTTP_METHOD_PUT},
+    {"delete", 6, HTTP_METHOD_DELETE},
+    {"options", 7, HTTP_METHOD_OPTIONS},
+    {"patch", 5, HTTP_METHOD_PATCH}
+};
+
+static http_method_t identify_method(const char *name, size_t name_len) {
+    for (size_t i = 0; i < sizeof(k_known_methods) / sizeof(k_known_methods[0]); ++i) {
+        const known_method_t *k = &k_known_methods[i];
+        if (k->len == name_len && http_scan_name_eq(name, k->lower, name_len)) {
+            return k->id;
         }
     }
-    return -1;
+    return HTTP_METHOD_OTHER;
 }
 
-static int parse_content_length(const char *value, size_t *out_len) {
-    if (value == NULL || *value == '\0') {
+static int parse_content_length(const char *value, size_t value_len, size_t *out_len) {
+    if (value == NULL || value_len == 0) {
         return -1;
     }
 
     size_t total = 0;
-    for (const char *p = value; *p != '\0'; ++p) {
-        if (!isdigit((unsigned char)*p)) {
+    for (size_t i = 0; i < value_len; ++i) {
+        if (!isdigit((unsigned char)value[i])) {
             return -1;
         }
-        int digit = *p - '0';
+        int digit = value[i] - '0';
         if (total > (SIZE_MAX - (size_t)digit) / 10U) {
             return -1;
         }
         total = total * 10U + (size_t)digit;
-        if (total > HTTP_MAX_CONTENT_LENGTH) {
-            return -2;
-        }
     }
 
     *out_len = total;
     return 0;
 }
 
-http_parse_result_t http_parse_request(
-    const char *buf,
+static int parse_request_line(http_parser_t *parser, const char *buf, size_t start, size_t end) {
+    size_t line_len = end - start;
+    if (line_len == 0) {
+        return 400;
+    }
+    if (line_len > HTTP_MAX_REQUEST_LINE_LEN) {
+        return 414;
+    }
+
+    const char *line = buf + start;
+    size_t sp1 = http_scan_find_char(line, line_len, ' ');
+    if (sp1 == line_len) {
+        return 400;
+    }
+    size_t sp2 = sp1 + 1 + http_scan_find_char(line + sp1 + 1, line_len - sp1 - 1, ' ');
+    if (sp2 == line_len) {
+        return 400;
+    }
+    if (http_scan_find_char(line + sp2 + 1, line_len - sp2 - 1, ' ') != line_len - sp2 - 1) {
+        return 400;
+    }
+    if (sp1 == 0 || http_scan_token_len(line, sp1) != sp1) {
+        return 400;
+    }
+
+    parser->method_off = start;
+    parser->method_len = sp1;
+    parser->method_id = identify_method(line, sp1);
+    parser->path_off = start + sp1 + 1;
+    parser->path_len = sp2 - sp1 - 1;
+    parser->version_off = start + sp2 + 1;
+    parser->version_len = line_len - sp2 - 1;
+
+    if (parser->method_len > HTTP_MAX_METHOD_LEN ||
+        parser->path_len > HTTP_MAX_PATH_LEN ||
+        parser->version_len > HTTP_MAX_VERSION_LEN) {
+        return 414;
+    }
+
+    if (parser->version_len != 8 || memcmp(buf + parser->version_off, "HTTP/1.1", 8) != 0) {
+        return 505;
+    }
+
+    return 0;
+}
+
+static int parse_header_line(http_parser_t *parser, const char *buf, size_t line_start, size_t hdr_len) {
+    const char *line = buf + line_start;
+    size_t name_len = http_scan_find_char(line, hdr_len, ':');
+    if (name_len == hdr_len) {
+        return 400;
+    }
+
+    size_t value_len = hdr_len - name_len - 1;
+
+    if (name_len == 0 || name_len > HTTP_MAX_HEADER_NAME_LEN || value_len > HTTP_MAX_HEADER_VALUE_LEN) {
+        return 431;
+    }
+    if (http_scan_token_len(line, name_len) != name_len) {
+        return 400;
+    }
+
+    const char *value = line + name_len + 1;
+    if (http_scan_value_invalid(value, value_len) != value_len) {
+        return 400;
+    }
+    while (value_len > 0 && (*value == ' ' || *value == '\t')) {
+        ++value;
+        --value_len;
+    }
+    while (value_len > 0 && (value[value_len - 1] == ' ' || value[value_len - 1] == '\t')) {
+        --value_len;
+    }
+
+    if (parser->header_count >= HTTP_MAX_HEADERS) {
+        return 431;
+    }
+
+    http_header_id_t id = identify_header(line, name_len);
+    if (id == HTTP_HDR_CONTENT_LENGTH) {
+        size_t parsed = 0;
+        int rc = parse_content_length(value, value_len, &parsed);
+        if (rc != 0) {
+            return 400;
+        }
+        if (parser->saw_content_length && parser->content_length != parsed) {
+            return 400;
+        }
+        parser->saw_content_length = true;
+        parser->content_length = parsed;
+    } else if (id == HTTP_HDR_TRANSFER_ENCODING) {
+        /* Only a lone "chunked" is understood; a second field could hide another coding. */
+        if (parser->chunked) {
+            return 400;
+        }
+        if (value_len != 7 || !http_scan_name_eq(value, "chunked", 7)) {
+            return 501;
+        }
+        parser->chunked = true;
+    } else if (id == HTTP_HDR_EXPECT) {
+        if (value_len != 12 || !http_scan_name_eq(value, "100-continue", 12)) {
+            return 417;
+        }
+        parser->expect_continue = true;
+    } else if (id == HTTP_HDR_CONNECTION) {
+        if (value_len == 5 && http_scan_name_eq(value, "close", 5)) {
+            parser->connection_close = true;
+        }
+    }
+
+    http_header_span_t *span = &parser->headers[parser->header_count];
+    span->name_off = (uint32_t)line_start;
+    span->name_len = (uint16_t)name_len;
+    span->value_off = (uint32_t)(value - buf);
+    span->value_len = (uint16_t)value_len;
+    span->id = (uint8_t)id;
+    if (id != HTTP_HDR_OTHER && parser->known[id] == 0) {
+        parser->known[id] = (uint8_t)(parser->header_count + 1);
+    }
+
+    ++parser->header_count;
+    return 0;
+}
+
+static http_view_t make_view(const char *buf, size_t off, size_t len) {
+    http_view_t view = {buf + off, len};
+    return view;
+}
+
+#define HTTP_MAX_CHUNK_LINE_LEN 1024
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = (char)(c | 0x20);
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+/*
+ * Advance the chunked decoder over buf[raw_pos, len). Returns 0 (check
+ * chunk_state for completion) or the status to reject the request with.
+ */
+static int decode_chunked(http_parser_t *parser, char *buf, size_t len) {
+    size_t pos = parser->raw_pos;
+    while (pos < len && parser->chunk_state != HTTP_CHUNK_DONE) {
+        char c = buf[pos];
+        switch (parser->chunk_state) {
+            case HTTP_CHUNK_SIZE: {
+                int digit = hex_value(c);
+                if (digit >= 0) {
+                    if (parser->chunk_remaining > (parser->body_limit - parser->body_total) / 16) {
+                        return 413;
+                    }
+                    parser->chunk_remaining = parser->chunk_remaining * 16 + (size_t)digit;
+                    ++parser->chunk_digits;
+                } else if (parser->chunk_digits == 0) {
+                    return 400;
+                } else if (c == ';' || c == ' ' || c == '\t') {
+                    parser->chunk_line_len = 0;
+                    parser->chunk_state = HTTP_CHUNK_EXT;
+                } else if (c == '\r') {
+                    parser->chunk_state = HTTP_CHUNK_SIZE_LF;
+                } else {
+                    return 400;
+                }
+                if (parser->chunk_remaining > parser->body_limit - parser->body_total) {
+                    return 413;
+                }
+                ++pos;
+                break;
+            }
+            case HTTP_CHUNK_EXT:
+                /* Extensions are skipped; they only need to stay short. */
+                if (c == '\r') {
+                    parser->chunk_state = HTTP_CHUNK_SIZE_LF;
+                } else if (c == '\n' || ++parser->chunk_line_len > HTTP_MAX_CHUNK_LINE_LEN) {
+                    return 400;
+                }
+                ++pos;
+                break;
+            case HTTP_CHUNK_SIZE_LF:
+                if (c != '\n') {
+                    return 400;
+                }
+                parser->chunk_digits = 0;
+                parser->chunk_state = parser->chunk_remaining == 0 ? HTTP_CHUNK_TRAILER_START : HTTP_CHUNK_DATA;
+                ++pos;
+                break;
+            case HTTP_CHUNK_DATA: {
+                size_t take = len - pos;
+                if (take > parser->chunk_remaining) {
+                    take = parser->chunk_remaining;
+                }
+                char *dst = buf + parser->header_block_len + parser->body_len;
+                if (dst != buf + pos) {
+                    memmove(dst, buf + pos, take);
+                }
+                parser->body_len += take;
+                parser->body_total += take;
+                parser->chunk_remaining -= take;
+                pos += take;
+                if (parser->chunk_remaining == 0) {
+                    parser->chunk_state = HTTP_CHUNK_DATA_CR;
+                }
+                break;
+            }
+            case HTTP_CHUNK_DATA_CR:
+                if (c != '\r') {
+                    return 400;
+                }
+                parser->chunk_state = HTTP_CHUNK_DATA_LF;
+                ++pos;
+                break;
+            case HTTP_CHUNK_DATA_LF:
+                if (c != '\n') {
+                    return 400;
+                }
+                parser->chunk_state = HTTP_CHUNK_SIZE;
+                ++pos;
+                break;
+            case HTTP_CHUNK_TRAILER_START:
+                if (c == '\r') {
+                    parser->chunk_state = HTTP_CHUNK_TRAILER_END_LF;
+                } else if (c == '\n') {
+                    return 400;
+                } else {
+                    /* Trailer fields are read past and dropped. */
+                    parser->chunk_line_len = 1;
+                    parser->chunk_state = HTTP_CHUNK_TRAILER_LINE;
+                }
+                ++pos;
+                break;
+            case HTTP_CHUNK_TRAILER_LINE:
+                if (c == '\r') {
+                    parser->chunk_state = HTTP_CHUNK_TRAILER_LF;
+                } else if (c == '\n') {
+                    return 400;
+                } else if (++parser->chunk_line_len > HTTP_MAX_HEADER_LINE_LEN) {
+                    return 431;
+                }
+                ++pos;
+                break;
+            case HTTP_CHUNK_TRAILER_LF:
+                if (c != '\n') {
+                    return 400;
+                }
+                parser->chunk_state = HTTP_CHUNK_TRAILER_START;
+                ++pos;
+                break;
+            case HTTP_CHUNK_TRAILER_END_LF:
+                if (c != '\n') {
+                    return 400;
+                }
+                parser->chunk_state = HTTP_CHUNK_DONE;
+                ++pos;
+                break;
+            default:
+                return 400;
+        }
+    }
+    parser->raw_pos = pos;
+    return 0;
+}
+
+void http_parser_init(http_parser_t *parser) {
+    memset(parser, 0, sizeof(*parser));
+    parser->state = HTTP_PARSER_REQUEST_LINE;
+    parser->body_limit = HTTP_MAX_CONTENT_LENGTH;
+}
+
+static void fill_request(const http_parser_t *parser, char *buf, http_request_t *out, size_t body_len) {
+    out->method = make_view(buf, parser->method_off, parser->method_len);
+    out->method_id = parser->method_id;
+    out->path = make_view(buf, parser->path_off, parser->path_len);
+    out->version = make_view(buf, parser->version_off, parser->version_len);
+    for (size_t i = 0; i < parser->header_count; ++i) {
+        const http_header_span_t *span = &parser->headers[i];
+        out->headers[i].name = make_view(buf, span->name_off, span->name_len);
+        out->headers[i].value = make_view(buf, span->value_off, span->value_len);
+        out->headers[i].id = (http_header_id_t)span->id;
+    }
+    out->header_count = parser->header_count;
+    memcpy(out->known, parser->known, sizeof(out->known));
+    out->content_length = parser->content_length;
+    out->chunked = parser->chunked;
+    out->expect_continue = parser->expect_continue;
+    out->body = buf + parser->header_block_len;
+    out->body_len = body_len;
+    out->connection_close = parser->connection_close;
+}
+
+http_parse_result_t http_parser_execute(
+    http_parser_t *parser,
+    char *buf,
     size_t len,
     http_request_t *out,
     size_t *consumed,
     int *error_status
 ) {
-    if (out == NULL || consumed == NULL || error_status == NULL) {
+    if (parser == NULL || out == NULL || consumed == NULL || error_status == NULL) {
         return HTTP_PARSE_ERROR;
     }
 
-    memset(out, 0, sizeof(*out));
     *consumed = 0;
     *error_status = 400;
 
-    ssize_t header_start = find_header_end(buf, len);
-    if (header_start < 0) {
-        return HTTP_PARSE_INCOMPLETE;
-    }
+    while (parser->state == HTTP_PARSER_REQUEST_LINE || parser->state == HTTP_PARSER_HEADERS) {
+        size_t lf_pos = parser->scan_pos + http_scan_find_char(
+            buf + parser->scan_pos,
+            len - parser->scan_pos,
+            '\n'
+        );
+
+        if (lf_pos >= len) {
+            parser->scan_pos = len;
+            size_t pending = len - parser->line_start;
+            if (parser->state == HTTP_PARSER_REQUEST_LINE && pending > HTTP_MAX_REQUEST_LINE_LEN + 1) {
+                *error_status = 414;
+                return HTTP_PARSE_ERROR;
+            }
+            if (parser->state == HTTP_PARSER_HEADERS && pending > HTTP_MAX_HEADER_LINE_LEN + 1) {
+                *error_status = 431;
+                return HTTP_PARSE_ERROR;
+            }
+            return HTTP_PARSE_INCOMPLETE;
+        }
+
+        if (lf_pos == parser->line_start || buf[lf_pos - 1] != '\r') {
+            *error_status = 400;
+            return HTTP_PARSE_ERROR;
+        }
 
-    size_t header_end = (size_t)header_start;
-    size_t header_block_len = header_end + 4;
+        size_t line_end = lf_pos - 1;
+        int status;
+        if (parser->state == HTTP_PARSER_REQUEST_LINE) {
+            status = parse_request_line(parser, buf, parser->line_start, line_end);
+            parser->state = HTTP_PARSER_HEADERS;
+        } else if (line_end == parser->line_start) {
+            /* Transfer-Encoding with Content-Length is a request smuggling vector (RFC 9112 6.3). */
+            status = parser->chunked && parser->saw_content_length ? 400 : 0;
+            parser->header_block_len = lf_pos + 1;
+            parser->raw_pos = lf_pos + 1;
+            parser->state = HTTP_PARSER_BODY;
+        } else {
+            status = parse_header_line(parser, buf, parser->line_start, line_end - parser->line_start);
+        }
 
-    size_t line_end = SIZE_MAX;
-    for (size_t i = 1; i < header_block_len; ++i) {
-        if (buf[i - 1] == '\r' && buf[i] == '\n') {
-            line_end = i - 1;
-            break;
+        if (status != 0) {
+            *error_status = status;
+            return HTTP_PARSE_ERROR;
         }
+
+        parser->line_start = lf_pos + 1;
+        parser->scan_pos = lf_pos + 1;
     }
 
-    if (line_end == SIZE_MAX || line_end == 0) {
-        *error_status = 400;
+    if (parser->state != HTTP_PARSER_BODY) {
         return HTTP_PARSE_ERROR;
     }
 
-    if (line_end >= 4096) {
-        *error_status = 414;
-        return HTTP_PARSE_ERROR;
+    if (parser->report_headers && !parser->headers_reported && (parser->chunked || parser->content_length > 0)) {
+        parser->headers_reported = true;
+        fill_request(parser, buf, out, 0);
+        return HTTP_PARSE_HEADERS;
     }
 
-    char line[4096];
-    memcpy(line, buf, line_end);
-    line[line_end] = '\0';
+    size_t total_needed;
+    size_t body_len;
+    if (parser->chunked) {
+        int status = decode_chunked(parser, buf, len);
+        if (status != 0) {
+            *error_status = status;
+            return HTTP_PARSE_ERROR;
+        }
+        if (parser->chunk_state != HTTP_CHUNK_DONE) {
+            return HTTP_PARSE_INCOMPLETE;
+        }
+        total_needed = parser->raw_pos;
+        body_len = parser->body_len;
+    } else {
+        if (parser->content_length > parser->body_limit) {
+            *error_status = 413;
+            return HTTP_PARSE_ERROR;
+        }
+        total_needed = parser->header_block_len + parser->content_length;
+        body_len = parser->content_length;
+        if (len < total_needed) {
+            return HTTP_PARSE_INCOMPLETE;
+        }
+    }
 
-    char *sp1 = strchr(line, ' ');
-    if (sp1 == NULL) {
-        *error_status = 400;
-        return HTTP_PARSE_ERROR;
+    fill_request(parser, buf, out, body_len);
+    *consumed = total_needed;
+    parser->state = HTTP_PARSER_DONE;
+
+    return HTTP_PARSE_OK;
+}
+
+size_t http_parser_compact(http_parser_t *parser, char *buf, size_t len) {
+    if (parser->state != HTTP_PARSER_BODY || !parser->chunked || parser->raw_pos > len) {
+        return len;
     }
-    char *sp2 = strchr(sp1 + 1, ' ');
-    if (sp2 == NULL) {
-        *error_status = 400;
-        return HTTP_PARSE_ERROR;
+    size_t decoded_end = parser->header_block_len + parser->body_len;
+    if (parser->raw_pos == decoded_end) {
+        return len;
     }
-    if (strchr(sp2 + 1, ' ') != NULL) {
-        *error_status = 400;
+    size_t tail = len - parser->raw_pos;
+    memmove(buf + decoded_end, buf + parser->raw_pos, tail);
+    parser->raw_pos = decoded_end;
+    return decoded_end + tail;
+}
+
+http_parse_result_t http_parser_read_body(
+    http_parser_t *parser,
+    char *buf,
+    size_t len,
+    size_t *data_len,
+    size_t *consumed,
+    int *error_status
+) {
+    if (parser == NULL || data_len == NULL || consumed == NULL || error_status == NULL) {
         return HTTP_PARSE_ERROR;
     }
 
-    *sp1 = '\0';
-    *sp2 = '\0';
-
-    if (strlen(line) > HTTP_MAX_METHOD_LEN || strlen(sp1 + 1) > HTTP_MAX_PATH_LEN || strlen(sp2 + 1) > HTTP_MAX_VERSION_LEN) {
-        *error_status = 414;
+    *data_len = 0;
+    *consumed = 0;
+    *error_status = 400;
+    if (parser->state != HTTP_PARSER_BODY) {
         return HTTP_PARSE_ERROR;
     }
 
-    strcpy(out->method, line);
-    strcpy(out->path, sp1 + 1);
-    strcpy(out->version, sp2 + 1);
+    if (!parser->chunked) {
+        size_t take = parser->content_length - parser->body_total;
+        if (take > len) {
+            take = len;
+        }
+        parser->body_total += take;
+        *data_len = take;
+        *consumed = take;
+    } else {
+        parser->body_limit = SIZE_MAX;
+        parser->header_block_len = 0;
+        parser->raw_pos = 0;
+        parser->body_len = 0;
+        int status = decode_chunked(parser, buf, len);
+        if (status != 0) {
+            *error_status = status;
+            return HTTP_PARSE_ERROR;
+        }
+        *data_len = parser->body_len;
+        *consumed = parser->raw_pos;
+        if (parser->chunk_state != HTTP_CHUNK_DONE) {
+            return HTTP_PARSE_INCOMPLETE;
+        }
+    }
 
-    if (strcmp(out->version, "HTTP/1.1") != 0) {
-        *error_status = 505;
-        return HTTP_PARSE_ERROR;
+    if (!parser->chunked && parser->body_total < parser->content_length) {
+        return HTTP_PARSE_INCOMPLETE;
     }
+    parser->state = HTTP_PARSER_DONE;
+    return HTTP_PARSE_OK;
+}
 
-    size_t content_length = 0;
-    bool saw_content_length = false;
-    bool connection_close = false;
-    size_t header_count = 0;
+http_parse_result_t http_parse_request(
+    char *buf,
+    size_t len,
+    http_request_t *out,
+    size_t *consumed,
+    int *error_status
+) {
+    http_parser_t parser;
+    http_parser_init(&parser);
+    return http_parser_execute(&parser, buf, len, out, consumed, error_status);
+}
 
-    size_t pos = line_end + 2;
-    while (pos < header_block_len) {
-        size_t hdr_line_end = SIZE_MAX;
-        for (size_t i = pos + 1; i < header_block_len; ++i) {
-            if (buf[i - 1] == '\r' && buf[i] == '\n') {
-                hdr_line_end = i - 1;
-                break;
-            }
-        }
+const http_view_t *http_request_header(const http_request_t *req, http_header_id_t id) {
+    if (req == NULL || id >= HTTP_HDR_KNOWN_COUNT || req->known[id] == 0) {
+        return NULL;
+    }
+    return &req->headers[req->known[id] - 1].value;
+}
 
-        if (hdr_line_end == SIZE_MAX) {
-            *error_status = 400;
-            return HTTP_PARSE_ERROR;
+const http_view_t *http_request_find_header(const http_request_t *req, const char *name) {
+    if (req == NULL || name == NULL) {
+        return NULL;
+    }
+    size_t name_len = strlen(name);
+    for (size_t i = 0; i < req->header_count; ++i) {
+        const http_header_t *hdr = &req->headers[i];
+        if (hdr->name.len == name_len && util_ascii_ncasecmp(hdr->name.ptr, name, name_len) == 0) {
+            return &hdr->value;
         }
+    }
+    return NULL;
+}
 
-        size_t hdr_len = hdr_line_end - pos;
-        if (hdr_len == 0) {
-            break;
-        }
+#define QVALUE_UNSET 0xFFFFu
 
-        const char *colon = memchr(buf + pos, ':', hdr_len);
-        if (colon == NULL) {
-            *error_status = 400;
-            return HTTP_PARSE_ERROR;
-        }
+static const struct {
+    const char *name;
+    const char *suffix;
+} k_encodings[HTTP_ENCODING_COUNT] = {
+    [HTTP_ENCODING_IDENTITY] = {"identity", ""},
+    [HTTP_ENCODING_GZIP] = {"gzip", ".gz"},
+    [HTTP_ENCODING_ZSTD] = {"zstd", ".zst"},
+    [HTTP_ENCODING_BR] = {"br", ".br"},
+};
 
-        size_t name_len = (size_t)(colon - (buf + pos));
-        size_t value_len = hdr_len - name_len - 1;
+const char *http_encoding_name(http_encoding_t encoding) {
+    return encoding < HTTP_ENCODING_COUNT ? k_encodings[encoding].name : "identity";
+}
 
-        if (name_len == 0 || name_len > HTTP_MAX_HEADER_NAME_LEN || value_len > HTTP_MAX_HEADER_VALUE_LEN) {
-            *error_status = 431;
-            return HTTP_PARSE_ERROR;
-        }
+const char *http_encoding_suffix(http_encoding_t encoding) {
+    return encoding < HTTP_ENCODING_COUNT ? k_encodings[encoding].suffix : "";
+}
 
-        char name[HTTP_MAX_HEADER_NAME_LEN + 1];
-        char value[HTTP_MAX_HEADER_VALUE_LEN + 1];
-        memcpy(name, buf + pos, name_len);
-        name[name_len] = '\0';
+static bool is_ows(char c) {
+    return c == ' ' || c == '\t';
+}
 
-        memcpy(value, colon + 1, value_len);
-        value[value_len] = '\0';
+static http_view_t trim_view(const char *p, const char *end) {
+    while (p < end && is_ows(*p)) {
+        ++p;
+    }
+    while (end > p && is_ows(end[-1])) {
+        --end;
+    }
+    http_view_t v = {p, (size_t)(end - p)};
+    return v;
+}
+
+/* qvalue = ( "0" [ "." 0*3DIGIT ] ) / ( "1" [ "." 0*3("0") ] ); anything else counts as 1. */
+static uint16_t parse_qvalue(http_view_t v) {
+    if (v.len == 0 || (v.ptr[0] != '0' && v.ptr[0] != '1')) {
+        return HTTP_QVALUE_MAX;
+    }
+    unsigned q = (unsigned)(v.ptr[0] - '0') * 1000u;
+    unsigned scale = 100;
+    for (size_t i = 2; i < v.len && i < 5 && v.ptr[1] == '.'; ++i) {
+        if (v.ptr[i] < '0' || v.ptr[i] > '9') {
+            return HTTP_QVALUE_MAX;
+        }
+        q += (unsigned)(v.ptr[i] - '0') * scale;
+        scale /= 10;
+    }
+    return (uint16_t)(q > HTTP_QVALUE_MAX ? HTTP_QVALUE_MAX : q);
+}
 
-        const char *trimmed = util_trim_left(value);
-        memmove(value, trimmed, strlen(trimmed) + 1);
-        util_trim_right(value);
+void http_accept_encoding(const http_view_t *value, uint16_t q[HTTP_ENCODING_COUNT]) {
+    uint16_t star = QVALUE_UNSET;
+    for (int i = 0; i < HTTP_ENCODING_COUNT; ++i) {
+        q[i] = QVALUE_UNSET;
+    }
 
-        if (util_ascii_casecmp(name, "Content-Length") == 0) {
-            size_t parsed = 0;
-            int rc = parse_content_length(value, &parsed);
-            if (rc == -2) {
-                *error_status = 413;
-                return HTTP_PARSE_ERROR;
-            }
-            if (rc != 0) {
-                *error_status = 400;
-                return HTTP_PARSE_ERROR;
+    if (value != NULL) {
+        const char *p = value->ptr;
+        const char *end = value->ptr + value->len;
+        while (p < end) {
+            const char *item_end = memchr(p, ',', (size_t)(end - p));
+            if (item_end == NULL) {
+                item_end = end;
             }
-            if (saw_content_length && content_length != parsed) {
-                *error_status = 400;
-                return HTTP_PARSE_ERROR;
+            const char *params = memchr(p, ';', (size_t)(item_end - p));
+            http_view_t coding = trim_view(p, params != NULL ? params : item_end);
+
+            uint16_t quality = HTTP_QVALUE_MAX;
+            while (params != NULL) {
+                const char *next = memchr(params + 1, ';', (size_t)(item_end - params - 1));
+                http_view_t param = trim_view(params + 1, next != NULL ? next : item_end);
+                if (param.len >= 2 && (param.ptr[0] == 'q' || param.ptr[0] == 'Q') && param.ptr[1] == '=') {
+                    http_view_t qv = {param.ptr + 2, param.len - 2};
+                    quality = parse_qvalue(qv);
+                }
+                params = next;
             }
-            saw_content_length = true;
-            content_length = parsed;
-        } else if (util_ascii_casecmp(name, "Connection") == 0) {
-            if (util_ascii_casecmp(value, "close") == 0) {
-                connection_close = true;
+
+            if (http_view_eq(&coding, "*")) {
+                if (star == QVALUE_UNSET) {
+                    star = quality;
+                }
+            } else if (http_view_case_eq(&coding, "x-gzip")) {
+                if (q[HTTP_ENCODING_GZIP] == QVALUE_UNSET) {
+                    q[HTTP_ENCODING_GZIP] = quality;
+                }
+            } else {
+                for (int i = 0; i < HTTP_ENCODING_COUNT; ++i) {
+                    if (q[i] == QVALUE_UNSET && http_view_case_eq(&coding, k_encodings[i].name)) {
+                        q[i] = quality;
+                    }
+                }
             }
+            p = item_end + 1;
         }
+    }
 
-        ++header_count;
-        if (header_count > HTTP_MAX_HEADERS) {
-            *error_status = 431;
-            return HTTP_PARSE_ERROR;
+    for (int i = 0; i < HTTP_ENCODING_COUNT; ++i) {
+        if (q[i] != QVALUE_UNSET) {
+            continue;
+        }
+        if (star != QVALUE_UNSET) {
+            q[i] = star;
+        } else {
+            q[i] = i == HTTP_ENCODING_IDENTITY ? HTTP_QVALUE_MAX : 0;
+        }
+    }
+}
+
+bool http_etag_list_match(const http_view_t *value, const char *etag) {
+    size_t etag_len = strlen(etag);
+    const char *p = value->ptr;
+    const char *end = value->ptr + value->len;
+    while (p < end) {
+        const char *item_end = memchr(p, ',', (size_t)(end - p));
+        if (item_end == NULL) {
+            item_end = end;
+        }
+        http_view_t tag = trim_view(p, item_end);
+        if (http_view_eq(&tag, "*")) {
+            return true;
+        }
+        /* Weak comparison: a W/ prefix on either side is ignored. */
+        if (tag.len >= 2 && tag.ptr[0] == 'W' && tag.ptr[1] == '/') {
+            tag.ptr += 2;
+            tag.len -= 2;
+        }
+        if (tag.len == etag_len && memcmp(tag.ptr, etag, etag_len) == 0) {
+            return true;
         }
+        p = item_end + 1;
+    }
+    return false;
+}
 
-        pos = hdr_line_end + 2;
+/* 1*DIGIT into *out; false on overflow or if v is empty or not all digits. */
+static bool parse_offset(http_view_t v, off_t *out) {
+    if (v.len == 0 || v.len > 18) {
+        return false;
+    }
+    off_t n = 0;
+    for (size_t i = 0; i < v.len; ++i) {
+        if (v.ptr[i] < '0' || v.ptr[i] > '9') {
+            return false;
+        }
+        n = n * 10 + (v.ptr[i] - '0');
     }
+    *out = n;
+    return true;
+}
 
-    size_t total_needed = header_block_len + content_length;
-    if (total_needed < header_block_len) {
-        *error_status = 400;
-        return HTTP_PARSE_ERROR;
+http_range_result_t http_parse_range(
+    const http_view_t *value,
+    off_t size,
+    http_byte_range_t *ranges,
+    size_t cap,
+    size_t *count
+) {
+    *count = 0;
+    http_view_t v = trim_view(value->ptr, value->ptr + value->len);
+    if (v.len < 6 || util_ascii_ncasecmp(v.ptr, "bytes=", 6) != 0) {
+        return HTTP_RANGE_NONE;
     }
 
-    if (len < total_needed) {
-        return HTTP_PARSE_INCOMPLETE;
+    const char *p = v.ptr + 6;
+    const char *end = v.ptr + v.len;
+    size_t specs = 0;
+    while (p <= end) {
+        const char *item_end = memchr(p, ',', (size_t)(end - p));
+        if (item_end == NULL) {
+            item_end = end;
+        }
+        http_view_t spec = trim_view(p, item_end);
+        p = item_end + 1;
+        if (spec.len == 0) {
+            continue;   /* empty list elements are allowed */
+        }
+        if (++specs > cap) {
+            return HTTP_RANGE_NONE;
+        }
+
+        const char *dash = memchr(spec.ptr, '-', spec.len);
+        if (dash == NULL) {
+            return HTTP_RANGE_NONE;
+        }
+        http_view_t first = {spec.ptr, (size_t)(dash - spec.ptr)};
+        http_view_t last = {dash + 1, spec.len - first.len - 1};
+        off_t start;
+        off_t stop;
+        if (first.len == 0) {
+            /* suffix-range: the final n bytes. */
+            off_t n;
+            if (!parse_offset(last, &n)) {
+                return HTTP_RANGE_NONE;
+            }
+            if (n == 0 || size == 0) {
+                continue;
+            }
+            start = n >= size ? 0 : size - n;
+            stop = size - 1;
+        } else {
+            if (!parse_offset(first, &start)) {
+                return HTTP_RANGE_NONE;
+            }
+            stop = size - 1;
+            if (last.len > 0) {
+                if (!parse_offset(last, &stop) || stop < start) {
+                    return HTTP_RANGE_NONE;
+                }
+                if (stop >= size) {
+                    stop = size - 1;
+                }
+            }
+            if (start >= size) {
+                continue;
+            }
+        }
+        ranges[*count].start = start;
+        ranges[*count].length = stop - start + 1;
+        ++*count;
+    }
+    if (specs == 0) {
+        return HTTP_RANGE_NONE;
     }
+    return *count == 0 ? HTTP_RANGE_UNSATISFIABLE : HTTP_RANGE_OK;
+}
 
-    out->content_length = content_length;
-    out->body = buf + header_block_len;
-    out->body_len = content_length;
-    out->connection_close = connection_close;
-    *consumed = total_needed;
+bool http_view_eq(const http_view_t *view, const char *s) {
+    size_t len = strlen(s);
+    return view != NULL && view->len == len && memcmp(view->ptr, s, len) == 0;
+}
 
-    return HTTP_PARSE_OK;
+bool http_view_case_eq(const http_view_t *view, const char *s) {
+    size_t len = strlen(s);
+    return view != NULL && view->len == len && util_ascii_ncasecmp(view->ptr, s, len) == 0;
 }
@@ -0,0 +1,409 @@
+#include "http_proxy.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "http_scan.h"
+
+#define PROXY_CHUNK_LINE_MAX 1024
+
+/* Bounded output buffer; overflow is sticky and checked once at the end. */
+typedef struct {
+    char *buf;
+    size_t cap;
+    size_t len;
+    bool overflow;
+} out_buf_t;
+
+static void out_put(out_buf_t *out, const char *p, size_t n) {
+    if (out->overflow || n > out->cap - out->len) {
+        out->overflow = true;
+        return;
+    }
+    memcpy(out->buf + out->len, p, n);
+    out->len += n;
+}
+
+static void out_puts(out_buf_t *out, const char *s) {
+    out_put(out, s, strlen(s));
+}
+
+static bool name_is(const char *name, size_t len, const char *lower) {
+    return len == strlen(lower) && http_scan_name_eq(name, lower, len);
+}
+
+/* Fields that describe one connection only (RFC 9110, 7.6.1) and are never relayed. */
+static bool hop_by_hop(const char *name, size_t len) {
+    return name_is(name, len, "connection") ||
+        name_is(name, len, "keep-alive") ||
+        name_is(name, len, "proxy-connection") ||
+        name_is(name, len, "te") ||
+        name_is(name, len, "upgrade");
+}
+
+static void trim(const char **p, size_t *len) {
+    while (*len > 0 && (**p == ' ' || **p == '\t')) {
+        ++*p;
+        --*len;
+    }
+    while (*len > 0 && ((*p)[*len - 1] == ' ' || (*p)[*len - 1] == '\t')) {
+        --*len;
+    }
+}
+
+/* Whether a comma-separated list holds token (case-insensitively). */
+static bool list_has(const char *value, size_t len, const char *token) {
+    while (len > 0) {
+        const char *comma = memchr(value, ',', len);
+        size_t item_len = comma != NULL ? (size_t)(comma - value) : len;
+        const char *item = value;
+        size_t n = item_len;
+        trim(&item, &n);
+        if (name_is(item, n, token)) {
+            return true;
+        }
+        if (comma == NULL) {
+            break;
+        }
+        value += item_len + 1;
+        len -= item_len + 1;
+    }
+    return false;
+}
+
+/* Next line of buf[*pos, len) without its line ending; false until a whole line is there. */
+static bool next_line(const char *buf, size_t len, size_t *pos, const char **line, size_t *line_len) {
+    if (*pos >= len) {
+        return false;
+    }
+    const char *start = buf + *pos;
+    const char *lf = memchr(start, '\n', len - *pos);
+    if (lf == NULL) {
+        return false;
+    }
+    size_t n = (size_t)(lf - start);
+    *pos += n + 1;
+    if (n > 0 && start[n - 1] == '\r') {
+        --n;
+    }
+    *line = start;
+    *line_len = n;
+    return true;
+}
+
+ssize_t http_proxy_format_request(
+    const http_request_t *req,
+    http_view_t path,
+    const char *host,
+    char *out,
+    size_t cap
+) {
+    out_buf_t o = {out, cap, 0, false};
+    out_put(&o, req->method.ptr, req->method.len);
+    out_put(&o, " ", 1);
+    out_put(&o, path.ptr, path.len);
+    out_puts(&o, " HTTP/1.1\r\n");
+
+    bool has_host = false;
+    for (size_t i = 0; i < req->header_count; ++i) {
+        const http_header_t *h = &req->headers[i];
+        switch (h->id) {
+            case HTTP_HDR_CONNECTION:
+            case HTTP_HDR_CONTENT_LENGTH:
+            case HTTP_HDR_TRANSFER_ENCODING:
+            case HTTP_HDR_EXPECT:
+            case HTTP_HDR_UPGRADE:
+            case HTTP_HDR_HTTP2_SETTINGS:
+                continue;
+            case HTTP_HDR_HOST:
+                has_host = true;
+                break;
+            default:
+                if (hop_by_hop(h->name.ptr, h->name.len)) {
+                    continue;
+                }
+                break;
+        }
+        out_put(&o, h->name.ptr, h->name.len);
+        out_put(&o, ": ", 2);
+        out_put(&o, h->value.ptr, h->value.len);
+        out_put(&o, "\r\n", 2);
+    }
+    if (!has_host) {
+        out_puts(&o, "Host: ");
+        out_puts(&o, host);
+        out_put(&o, "\r\n", 2);
+    }
+    if (req->body_len > 0 || req->chunked || req->content_length > 0) {
+        char length[48];
+        int n = snprintf(length, sizeof(length), "Content-Length: %zu\r\n", req->body_len);
+        out_put(&o, length, (size_t)n);
+    }
+    out_puts(&o, "Connection: keep-alive\r\n\r\n");
+    if (req->body_len > 0) {
+        out_put(&o, req->body, req->body_len);
+    }
+    return o.overflow ? -1 : (ssize_t)o.len;
+}
+
+static int parse_length(const char *value, size_t len, uint64_t *out) {
+    if (len == 0 || len > 19) {
+        return -1;
+    }
+    uint64_t v = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (value[i] < '0' || value[i] > '9') {
+            return -1;
+        }
+        v = v * 10 + (uint64_t)(value[i] - '0');
+    }
+    *out = v;
+    return 0;
+}
+
+http_parse_result_t http_proxy_parse_head(const char *buf, size_t len, bool head_request, http_upstream_head_t *head) {
+    memset(head, 0, sizeof(*head));
+    http_parse_result_t short_result = len >= HTTP_PROXY_HEAD_CAP ? HTTP_PARSE_ERROR : HTTP_PARSE_INCOMPLETE;
+    if (len > HTTP_PROXY_HEAD_CAP) {
+        len = HTTP_PROXY_HEAD_CAP;
+    }
+
+    size_t pos = 0;
+    const char *line;
+    size_t n;
+    if (!next_line(buf, len, &pos, &line, &n)) {
+        return short_result;
+    }
+    /* "HTTP/1.x SSS[ reason]" */
+    if (n < 12 || memcmp(line, "HTTP/1.", 7) != 0 || (line[7] != '0' && line[7] != '1') || line[8] != ' ' ||
+        (n > 12 && line[12] != ' ')) {
+        return HTTP_PARSE_ERROR;
+    }
+    int status = 0;
+    for (size_t i = 9; i < 12; ++i) {
+        if (line[i] < '0' || line[i] > '9') {
+            return HTTP_PARSE_ERROR;
+        }
+        status = status * 10 + (line[i] - '0');
+    }
+    if (status < 100) {
+        return HTTP_PARSE_ERROR;
+    }
+    bool http11 = line[7] == '1';
+
+    bool close = false;
+    bool keep_alive = false;
+    bool chunked = false;
+    bool other_coding = false;
+    bool have_length = false;
+    uint64_t length = 0;
+    for (;;) {
+        if (!next_line(buf, len, &pos, &line, &n)) {
+            return short_result;
+        }
+        if (n == 0) {
+            break;
+        }
+        const char *colon = memchr(line, ':', n);
+        if (colon == NULL || colon == line) {
+            return HTTP_PARSE_ERROR;
+        }
+        size_t name_len = (size_t)(colon - line);
+        const char *value = colon + 1;
+        size_t value_len = n - name_len - 1;
+        trim(&value, &value_len);
+
+        if (name_is(line, name_len, "content-length")) {
+            uint64_t v;
+            if (parse_length(value, value_len, &v) != 0 || (have_length && v != length)) {
+                return HTTP_PARSE_ERROR;
+            }
+            have_length = true;
+            length = v;
+        } else if (name_is(line, name_len, "transfer-encoding")) {
+            /* Only a final "chunked" delimits the body; any other coding runs to the close. */
+            const char *comma = value_len > 0 ? memrchr(value, ',', value_len) : NULL;
+            const char *last = comma != NULL ? comma + 1 : value;
+            size_t last_len = value_len - (size_t)(last - value);
+            trim(&last, &last_len);
+            if (name_is(last, last_len, "chunked")) {
+                chunked = true;
+            } else {
+                other_coding = true;
+            }
+        } else if (name_is(line, name_len, "connection")) {
+            close = close || list_has(value, value_len, "close");
+            keep_alive = keep_alive || list_has(value, value_len, "keep-alive");
+        }
+    }
+
+    head->status = status;
+    head->head_len = pos;
+    head->content_length = length;
+    if (head_request || status < 200 || status == 204 || status == 304) {
+        head->framing = HTTP_FRAMING_NONE;
+    } else if (chunked && !other_coding) {
+        head->framing = HTTP_FRAMING_CHUNKED;
+    } else if (have_length && !chunked && !other_coding) {
+        head->framing = HTTP_FRAMING_LENGTH;
+    } else {
+        head->framing = HTTP_FRAMING_CLOSE;
+    }
+    /* A length next to a transfer coding is suspect: use the coding, then drop the connection. */
+    head->keep_alive = !close && (http11 || keep_alive) && head->framing != HTTP_FRAMING_CLOSE &&
+        !(have_length && (chunked || other_coding));
+    return HTTP_PARSE_OK;
+}
+
+ssize_t http_proxy_format_head(
+    const char *buf,
+    const http_upstream_head_t *head,
+    bool close_after_send,
+    char *out,
+    size_t cap
+) {
+    out_buf_t o = {out, cap, 0, false};
+    size_t pos = 0;
+    const char *line;
+    size_t n;
+    if (!next_line(buf, head->head_len, &pos, &line, &n)) {
+        return -1;
+    }
+    /* Keep the status code and reason; the version is ours. */
+    out_puts(&o, "HTTP/1.1");
+    out_put(&o, line + 8, n - 8);
+    out_put(&o, "\r\n", 2);
+    while (next_line(buf, head->head_len, &pos, &line, &n) && n > 0) {
+        const char *colon = memchr(line, ':', n);
+        if (colon == NULL || hop_by_hop(line, (size_t)(colon - line))) {
+            continue;
+        }
+        out_put(&o, line, n);
+        out_put(&o, "\r\n", 2);
+    }
+    out_puts(&o, close_after_send ? "Connection: close\r\n\r\n" : "Connection: keep-alive\r\n\r\n");
+    return o.overflow ? -1 : (ssize_t)o.len;
+}
+
+void http_chunk_scan_init(http_chunk_scan_t *scan) {
+    memset(scan, 0, sizeof(*scan));
+    scan->state = HTTP_CHUNK_SIZE;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = (char)(c | 0x20);
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+ssize_t http_chunk_scan(http_chunk_scan_t *scan, const char *buf, size_t len, bool *done) {
+    size_t pos = 0;
+    while (pos < len && scan->state != HTTP_CHUNK_DONE) {
+        char c = buf[pos];
+        switch (scan->state) {
+            case HTTP_CHUNK_SIZE: {
+                int digit = hex_value(c);
+                if (digit >= 0) {
+                    if (scan->remaining > (UINT64_MAX >> 4)) {
+                        return -1;
+                    }
+                    scan->remaining = scan->remaining * 16 + (uint64_t)digit;
+                    ++scan->digits;
+                } else if (scan->digits == 0) {
+                    return -1;
+                } else if (c == ';' || c == ' ' || c == '\t') {
+                    scan->line_len = 0;
+                    scan->state = HTTP_CHUNK_EXT;
+                } else if (c == '\r') {
+                    scan->state = HTTP_CHUNK_SIZE_LF;
+                } else {
+                    return -1;
+                }
+                ++pos;
+                break;
+            }
+            case HTTP_CHUNK_EXT:
+                if (c == '\r') {
+                    scan->state = HTTP_CHUNK_SIZE_LF;
+                } else if (c == '\n' || ++scan->line_len > PROXY_CHUNK_LINE_MAX) {
+                    return -1;
+                }
+                ++pos;
+                break;
+            case HTTP_CHUNK_SIZE_LF:
+                if (c != '\n') {
+                    return -1;
+                }
+                scan->digits = 0;
+                scan->state = scan->remaining == 0 ? HTTP_CHUNK_TRAILER_START : HTTP_CHUNK_DATA;
+                ++pos;
+                break;
+            case HTTP_CHUNK_DATA: {
+                /* Data is skipped whole, not examined. */
+                size_t take = len - pos;
+                if (take > scan->remaining) {
+                    take = (size_t)scan->remaining;
+                }
+                scan->remaining -= take;
+                pos += take;
+                if (scan->remaining == 0) {
+                    scan->state = HTTP_CHUNK_DATA_CR;
+                }
+                break;
+            }
+            case HTTP_CHUNK_DATA_CR:
+                if (c != '\r') {
+                    return -1;
+                }
+                scan->state = HTTP_CHUNK_DATA_LF;
+                ++pos;
+                break;
+            case HTTP_CHUNK_DATA_LF:
+                if (c != '\n') {
+                    return -1;
+                }
+                scan->state = HTTP_CHUNK_SIZE;
+                ++pos;
+                break;
+            case HTTP_CHUNK_TRAILER_START:
+                if (c == '\r') {
+                    scan->state = HTTP_CHUNK_TRAILER_END_LF;
+                } else if (c == '\n') {
+                    return -1;
+                } else {
+                    scan->line_len = 1;
+                    scan->state = HTTP_CHUNK_TRAILER_LINE;
+                }
+                ++pos;
+                break;
+            case HTTP_CHUNK_TRAILER_LINE:
+                if (c == '\r') {
+                    scan->state = HTTP_CHUNK_TRAILER_LF;
+                } else if (c == '\n' || ++scan->line_len > HTTP_MAX_HEADER_LINE_LEN) {
+                    return -1;
+                }
+                ++pos;
+                break;
+            case HTTP_CHUNK_TRAILER_LF:
+                if (c != '\n') {
+                    return -1;
+                }
+                scan->state = HTTP_CHUNK_TRAILER_START;
+                ++pos;
+                break;
+            case HTTP_CHUNK_TRAILER_END_LF:
+                if (c != '\n') {
+                    return -1;
+                }
+                scan->state = HTTP_CHUNK_DONE;
+                ++pos;
+                break;
+            default:
+                return -1;
+        }
+    }
+    *done = scan->state == HTTP_CHUNK_DONE;
+    return (ssize_t)pos;
+}
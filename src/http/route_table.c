@@ -0,0 +1,315 @@
+#include "http_route_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ROUTE_NONE (-1)
+#define ROUTE_NODES_MIN 16
+#define ROUTE_EDGES_MIN 64
+
+/* Word-at-a-time multiplicative hash of a segment under its parent node. */
+static uint64_t segment_hash(uint32_t parent, const char *seg, size_t len) {
+    uint64_t h = (((uint64_t)parent << 32) | (uint32_t)len) * 0x9e3779b97f4a7c15ULL;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, seg + i, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 29;
+    }
+    if (i < len) {
+        uint64_t w = 0;
+        memcpy(&w, seg + i, len - i);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 29;
+    }
+    return h ^ (h >> 32);
+}
+
+/* Index of a new empty node, or 0 (never a valid child) on allocation failure. */
+static uint32_t node_new(http_route_table_t *table) {
+    if (table->node_count == table->node_cap) {
+        size_t cap = table->node_cap == 0 ? ROUTE_NODES_MIN : table->node_cap * 2;
+        http_route_node_t *nodes = realloc(table->nodes, cap * sizeof(*nodes));
+        if (nodes == NULL) {
+            return 0;
+        }
+        table->nodes = nodes;
+        table->node_cap = cap;
+    }
+    http_route_node_t *node = &table->nodes[table->node_count];
+    for (unsigned m = 0; m < HTTP_METHOD_COUNT; ++m) {
+        node->exact[m] = ROUTE_NONE;
+        node->prefix[m] = ROUTE_NONE;
+    }
+    node->exact_any = ROUTE_NONE;
+    node->prefix_any = ROUTE_NONE;
+    node->param_child = 0;
+    return (uint32_t)table->node_count++;
+}
+
+static uint32_t edge_find(const http_route_table_t *table, uint32_t parent, const char *seg, size_t len) {
+    if (table->edges == NULL) {
+        return 0;
+    }
+    uint64_t hash = segment_hash(parent, seg, len);
+    for (size_t i = (size_t)hash & table->edge_mask;; i = (i + 1) & table->edge_mask) {
+        const http_route_edge_t *edge = &table->edges[i];
+        if (edge->child == 0) {
+            return 0;
+        }
+        if (edge->hash == hash && edge->parent == parent && edge->seg_len == len && memcmp(edge->seg, seg, len) == 0) {
+            return edge->child;
+        }
+    }
+}
+
+static void edge_place(http_route_edge_t *edges, size_t mask, const http_route_edge_t *edge) {
+    size_t i = (size_t)edge->hash & mask;
+    while (edges[i].child != 0) {
+        i = (i + 1) & mask;
+    }
+    edges[i] = *edge;
+}
+
+/* Keep the edge table at most half full so probe runs stay short. */
+static int edges_reserve(http_route_table_t *table) {
+    size_t cap = table->edges == NULL ? 0 : table->edge_mask + 1;
+    if ((table->edge_count + 1) * 2 <= cap) {
+        return 0;
+    }
+    size_t new_cap = cap == 0 ? ROUTE_EDGES_MIN : cap * 2;
+    http_route_edge_t *edges = calloc(new_cap, sizeof(*edges));
+    if (edges == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < cap; ++i) {
+        if (table->edges[i].child != 0) {
+            edge_place(edges, new_cap - 1, &table->edges[i]);
+        }
+    }
+    free(table->edges);
+    table->edges = edges;
+    table->edge_mask = new_cap - 1;
+    return 0;
+}
+
+static uint32_t edge_add(http_route_table_t *table, uint32_t parent, const char *seg, size_t len) {
+    if (edges_reserve(table) != 0) {
+        return 0;
+    }
+    char *copy = malloc(len + 1);
+    if (copy == NULL) {
+        return 0;
+    }
+    uint32_t child = node_new(table);
+    if (child == 0) {
+        free(copy);
+        return 0;
+    }
+    memcpy(copy, seg, len);
+    copy[len] = '\0';
+    http_route_edge_t edge = {
+        .hash = segment_hash(parent, seg, len),
+        .parent = parent,
+        .child = child,
+        .seg_len = (uint32_t)len,
+        .seg = copy,
+    };
+    edge_place(table->edges, table->edge_mask, &edge);
+    ++table->edge_count;
+    return child;
+}
+
+/* End of the segment starting at start: the next '/' or len. */
+static size_t segment_end(const char *s, size_t start, size_t len) {
+    const char *slash = memchr(s + start, '/', len - start);
+    return slash == NULL ? len : (size_t)(slash - s);
+}
+
+int http_route_table_init(http_route_table_t *table) {
+    memset(table, 0, sizeof(*table));
+    if (node_new(table) != 0 || table->nodes == NULL) {
+        http_route_table_destroy(table);
+        return -1;
+    }
+    return 0;
+}
+
+void http_route_table_destroy(http_route_table_t *table) {
+    if (table->edges != NULL) {
+        for (size_t i = 0; i <= table->edge_mask; ++i) {
+            free(table->edges[i].seg);
+        }
+    }
+    free(table->edges);
+    free(table->nodes);
+    free(table->targets);
+    memset(table, 0, sizeof(*table));
+}
+
+static bool segment_is_wildcard(const char *pattern, size_t start, size_t end) {
+    return end - start == 1 && pattern[start] == '*';
+}
+
+static bool segment_is_param(const char *pattern, size_t start, size_t end) {
+    return end > start && pattern[start] == ':';
+}
+
+int http_route_table_add(http_route_table_t *table, unsigned methods, const char *pattern, const void *target) {
+    if (table->nodes == NULL || pattern == NULL || pattern[0] != '/' ||
+        methods == 0 || (methods & ~HTTP_METHODS_ANY) != 0) {
+        return -1;
+    }
+
+    size_t len = strlen(pattern);
+    size_t params = 0;
+    for (size_t p = 0, end; p < len; p = end) {
+        size_t start = p + 1;
+        end = segment_end(pattern, start, len);
+        if (segment_is_wildcard(pattern, start, end) && end != len) {
+            return -1;
+        }
+        if (segment_is_param(pattern, start, end) && (end - start < 2 || ++params > HTTP_ROUTE_MAX_PARAMS)) {
+            return -1;
+        }
+    }
+
+    uint32_t node = 0;
+    bool prefix = false;
+    for (size_t p = 0, end; p < len; p = end) {
+        size_t start = p + 1;
+        end = segment_end(pattern, start, len);
+        if (segment_is_wildcard(pattern, start, end)) {
+            prefix = true;
+            break;
+        }
+        uint32_t child;
+        if (segment_is_param(pattern, start, end)) {
+            child = table->nodes[node].param_child;
+            if (child == 0) {
+                child = node_new(table);
+                table->nodes[node].param_child = child;
+            }
+        } else {
+            child = edge_find(table, node, pattern + start, end - start);
+            if (child == 0) {
+                child = edge_add(table, node, pattern + start, end - start);
+            }
+        }
+        if (child == 0) {
+            return -1;
+        }
+        node = child;
+    }
+
+    http_route_node_t *n = &table->nodes[node];
+    int32_t *slots = prefix ? n->prefix : n->exact;
+    for (unsigned m = 0; m < HTTP_METHOD_COUNT; ++m) {
+        if ((methods & HTTP_METHOD_BIT(m)) != 0 && slots[m] != ROUTE_NONE) {
+            return -1;
+        }
+    }
+    if (table->route_count == table->route_cap) {
+        size_t cap = table->route_cap == 0 ? ROUTE_NODES_MIN : table->route_cap * 2;
+        const void **targets = realloc(table->targets, cap * sizeof(*targets));
+        if (targets == NULL) {
+            return -1;
+        }
+        table->targets = targets;
+        table->route_cap = cap;
+    }
+    int32_t index = (int32_t)table->route_count++;
+    table->targets[index] = target;
+    for (unsigned m = 0; m < HTTP_METHOD_COUNT; ++m) {
+        if ((methods & HTTP_METHOD_BIT(m)) != 0) {
+            slots[m] = index;
+        }
+    }
+    if (prefix) {
+        n->prefix_any = n->prefix_any == ROUTE_NONE ? index : n->prefix_any;
+    } else {
+        n->exact_any = n->exact_any == ROUTE_NONE ? index : n->exact_any;
+    }
+    return 0;
+}
+
+static http_route_lookup_t route_pick(
+    const http_route_table_t *table,
+    const int32_t *by_method,
+    int32_t any,
+    http_method_t method,
+    http_route_match_t *match
+) {
+    int32_t index = (unsigned)method < HTTP_METHOD_COUNT ? by_method[method] : ROUTE_NONE;
+    if (index == ROUTE_NONE) {
+        match->target = table->targets[any];
+        return HTTP_LOOKUP_BAD_METHOD;
+    }
+    match->target = table->targets[index];
+    return HTTP_LOOKUP_FOUND;
+}
+
+http_route_lookup_t http_route_table_lookup(
+    const http_route_table_t *table,
+    http_method_t method,
+    const char *path,
+    size_t path_len,
+    http_route_match_t *match
+) {
+    match->target = NULL;
+    match->param_count = 0;
+    match->rest.ptr = NULL;
+    match->rest.len = 0;
+    if (table->nodes == NULL || path_len == 0 || path[0] != '/') {
+        return HTTP_LOOKUP_NOT_FOUND;
+    }
+
+    const http_route_node_t *nodes = table->nodes;
+    uint32_t node = 0;
+    bool fallback = false;
+    uint32_t fallback_node = 0;
+    size_t fallback_rest = 0;
+    size_t fallback_params = 0;
+    /* Invariant: path[0, p) led to node and path[p] is '/' unless p == path_len. */
+    for (size_t p = 0;;) {
+        const http_route_node_t *n = &nodes[node];
+        if (p == path_len) {
+            if (n->exact_any != ROUTE_NONE) {
+                return route_pick(table, n->exact, n->exact_any, method, match);
+            }
+            break;
+        }
+        if (n->prefix_any != ROUTE_NONE) {
+            fallback = true;
+            fallback_node = node;
+            fallback_rest = p + 1;
+            fallback_params = match->param_count;
+        }
+
+        size_t start = p + 1;
+        size_t end = segment_end(path, start, path_len);
+        uint32_t child = edge_find(table, node, path + start, end - start);
+        if (child == 0 && n->param_child != 0 && end > start) {
+            child = n->param_child;
+            match->params[match->param_count].ptr = path + start;
+            match->params[match->param_count].len = end - start;
+            ++match->param_count;
+        }
+        if (child == 0) {
+            break;
+        }
+        node = child;
+        p = end;
+    }
+
+    if (!fallback) {
+        match->param_count = 0;
+        return HTTP_LOOKUP_NOT_FOUND;
+    }
+    const http_route_node_t *n = &nodes[fallback_node];
+    match->param_count = fallback_params;
+    match->rest.ptr = path + fallback_rest;
+    match->rest.len = path_len - fallback_rest;
+    return route_pick(table, n->prefix, n->prefix_any, method, match);
+}
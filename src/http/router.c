@@ -2,30 +2,22 @@
 
 #include <errno.h>
 #include <fcntl.h>
-#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "http_module.h"
+#include "http_route_table.h"
 #include "metrics.h"
+#include "static_cache.h"
+#include "static_compress.h"
 #include "util.h"
 
-#define STATIC_CACHE_MAX 256
-#define STATIC_CACHE_PATH_CAP 2048
-#define STATIC_CACHE_CTYPE_CAP 63
-
-typedef struct {
-    bool used;
-    char full_path[STATIC_CACHE_PATH_CAP];
-    int fd;
-    off_t file_size;
-    char content_type[STATIC_CACHE_CTYPE_CAP + 1];
-} static_cache_entry_t;
-
-static static_cache_entry_t g_static_cache[STATIC_CACHE_MAX];
-static pthread_mutex_t g_static_cache_mu = PTHREAD_MUTEX_INITIALIZER;
-static unsigned long g_static_cache_next_slot = 0;
+#define METRICS_RENDER_CAP (64 * 1024)
+#define BYTES_ROUTE_MAX (1ULL << 30)
+#define BYTES_ROUTE_PATTERN "abcdefghijklmnopqrstuvwxyz0123456789\n"
 
 static const char *content_type_for_path(const char *path) {
     const char *dot = strrchr(path, '.');
@@ -56,136 +48,261 @@ static const char *content_type_for_path(const char *path) {
     return "application/octet-stream";
 }
 
-static bool static_cache_lookup_dup(
-    const char *full_path,
-    int *out_fd,
-    off_t *out_size,
-    char *out_content_type,
-    size_t out_content_type_cap
-) {
-    bool found = false;
-    pthread_mutex_lock(&g_static_cache_mu);
-    for (int i = 0; i < STATIC_CACHE_MAX; ++i) {
-        static_cache_entry_t *entry = &g_static_cache[i];
-        if (!entry->used) {
-            continue;
-        }
-        if (strcmp(entry->full_path, full_path) != 0) {
-            continue;
-        }
-
-        int dup_fd = dup(entry->fd);
-        if (dup_fd >= 0) {
-            *out_fd = dup_fd;
-            *out_size = entry->file_size;
-            snprintf(out_content_type, out_content_type_cap, "%s", entry->content_type);
-            found = true;
-        }
-        break;
+const char *http_route_name(http_route_id_t route) {
+    switch (route) {
+        case HTTP_ROUTE_HEALTHZ:
+            return "healthz";
+        case HTTP_ROUTE_METRICS:
+            return "metrics";
+        case HTTP_ROUTE_ECHO:
+            return "echo";
+        case HTTP_ROUTE_STATIC:
+            return "static";
+        case HTTP_ROUTE_UPLOAD:
+            return "upload";
+        case HTTP_ROUTE_BYTES:
+            return "bytes";
+        case HTTP_ROUTE_MODULE:
+            return "module";
+        case HTTP_ROUTE_PROXY:
+            return "proxy";
+        default:
+            return "other";
     }
-    pthread_mutex_unlock(&g_static_cache_mu);
-    return found;
 }
 
-static void static_cache_insert(
-    const char *full_path,
-    int file_fd,
-    off_t file_size,
-    const char *content_type
-) {
-    int cached_fd = dup(file_fd);
-    if (cached_fd < 0) {
+void http_response_init(http_response_t *resp, buf_pool_t *pool) {
+    memset(resp, 0, sizeof(*resp));
+    resp->pool = pool;
+    resp->file_fd = -1;
+    resp->upstream = -1;
+}
+
+void http_response_reset(http_response_t *resp) {
+    if (resp == NULL) {
         return;
     }
 
-    pthread_mutex_lock(&g_static_cache_mu);
-
-    int existing_slot = -1;
-    int free_slot = -1;
-    for (int i = 0; i < STATIC_CACHE_MAX; ++i) {
-        static_cache_entry_t *entry = &g_static_cache[i];
-        if (entry->used) {
-            if (strcmp(entry->full_path, full_path) == 0) {
-                existing_slot = i;
-                break;
-            }
-        } else if (free_slot < 0) {
-            free_slot = i;
-        }
+    if (resp->file_ref != NULL) {
+        static_cache_release(resp->file_ref);
+    } else if (resp->file_fd >= 0) {
+        close(resp->file_fd);
     }
+    if (!resp->head_borrowed) {
+        buf_pool_release(resp->pool, resp->head, resp->head_cap);
+    }
+    buf_pool_release(resp->pool, resp->body, resp->body_cap);
 
-    int slot = existing_slot;
-    if (slot < 0) {
-        if (free_slot >= 0) {
-            slot = free_slot;
-        } else {
-            slot = (int)(g_static_cache_next_slot++ % STATIC_CACHE_MAX);
+    http_response_init(resp, resp->pool);
+}
+
+static int response_reserve_body(http_response_t *resp, size_t len);
+
+/* Room left in front of a produced piece for its chunk-size line. */
+#define RESPONSE_CHUNK_HEAD 10
+
+/* Pull the next piece of a producer segment into the body buffer. */
+static bool response_produce(http_response_t *resp) {
+    static const char last_chunk[] = "0\r\n\r\n";
+    size_t head = resp->chunked ? RESPONSE_CHUNK_HEAD : 0;
+    size_t tail = resp->chunked ? 2 : 0;
+    ssize_t n = -1;
+    if (response_reserve_body(resp, HTTP_RESPONSE_PRODUCE_CAP) == 0) {
+        n = resp->producer(resp, resp->body + head, resp->body_cap - head - tail);
+    }
+    if (n <= 0) {
+        resp->producing = false;
+        if (n < 0) {
+            /* Too late for an error status; a short body and a closed connection tell the client. */
+            resp->close_after_send = true;
+            return false;
+        }
+        if (!resp->chunked) {
+            return false;
         }
+        resp->mem = last_chunk;
+        resp->body_sent = 0;
+        resp->body_len = sizeof(last_chunk) - 1;
+        return true;
     }
 
-    static_cache_entry_t *entry = &g_static_cache[slot];
-    if (entry->used && entry->fd >= 0) {
-        close(entry->fd);
+    resp->mem = NULL;
+    resp->body_sent = 0;
+    resp->body_len = (size_t)n;
+    if (resp->chunked) {
+        char size_line[RESPONSE_CHUNK_HEAD + 1];
+        int len = snprintf(size_line, sizeof(size_line), "%zx\r\n", (size_t)n);
+        resp->body_sent = head - (size_t)len;
+        memcpy(resp->body + resp->body_sent, size_line, (size_t)len);
+        memcpy(resp->body + head + (size_t)n, "\r\n", 2);
+        resp->body_len = head + (size_t)n + 2;
     }
+    return true;
+}
 
-    entry->used = true;
-    snprintf(entry->full_path, sizeof(entry->full_path), "%s", full_path);
-    entry->fd = cached_fd;
-    entry->file_size = file_size;
-    snprintf(entry->content_type, sizeof(entry->content_type), "%s", content_type);
-
-    pthread_mutex_unlock(&g_static_cache_mu);
+bool http_response_has_more(const http_response_t *resp) {
+    return resp->producing || resp->seg_next < resp->seg_count;
 }
 
-void http_response_reset(http_response_t *resp) {
-    if (resp == NULL) {
-        return;
+bool http_response_next_segment(http_response_t *resp) {
+    bool loaded = false;
+    while (resp->file_remaining == 0) {
+        bool mem_pending = resp->body_sent != resp->body_len;
+        if (resp->producing) {
+            return mem_pending ? loaded : response_produce(resp) || loaded;
+        }
+        if (resp->seg_next >= resp->seg_count) {
+            break;
+        }
+        /* A file range may follow memory bytes still pending, so both leave in one go. */
+        const http_response_segment_t *seg = &resp->segs[resp->seg_next];
+        if (mem_pending && seg->kind != HTTP_SEGMENT_FILE) {
+            break;
+        }
+        ++resp->seg_next;
+        loaded = true;
+        switch (seg->kind) {
+            case HTTP_SEGMENT_MEMORY:
+                resp->mem = seg->data;
+                resp->body_sent = 0;
+                resp->body_len = seg->len;
+                break;
+            case HTTP_SEGMENT_FILE:
+                resp->file_offset = seg->offset;
+                resp->file_remaining = seg->length;
+                break;
+            case HTTP_SEGMENT_PRODUCER:
+                resp->producing = true;
+                break;
+        }
     }
+    return loaded;
+}
 
-    if (resp->file_fd >= 0) {
-        close(resp->file_fd);
+static int response_reserve_body(http_response_t *resp, size_t len) {
+    if (len > HTTP_RESPONSE_BODY_CAP) {
+        return -1;
+    }
+    if (resp->body != NULL && resp->body_cap >= len) {
+        return 0;
     }
 
-    memset(resp, 0, sizeof(*resp));
-    resp->file_fd = -1;
+    buf_pool_release(resp->pool, resp->body, resp->body_cap);
+    resp->body = NULL;
+    resp->body_cap = 0;
+
+    resp->body = buf_pool_acquire(resp->pool, len, &resp->body_cap);
+    return resp->body == NULL ? -1 : 0;
 }
 
-static int response_prepare_head(
-    http_response_t *resp,
+static int format_head(
+    char *buf,
+    size_t cap,
     int status,
     const char *reason,
     const char *content_type,
     size_t content_length,
+    const char *extra_headers,
     bool close_after_send
 ) {
     const char *connection = close_after_send ? "close" : "keep-alive";
+    if (status == 304) {
+        /* No body and no representation metadata beyond what extra_headers carries. */
+        int n = snprintf(buf, cap, "HTTP/1.1 304 %s\r\n%sConnection: %s\r\n\r\n", reason, extra_headers, connection);
+        return n < 0 || (size_t)n >= cap ? -1 : n;
+    }
+    if (content_length == HTTP_LENGTH_CHUNKED) {
+        int n = snprintf(
+            buf,
+            cap,
+            "HTTP/1.1 %d %s\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "Content-Type: %s\r\n"
+            "%s"
+            "Connection: %s\r\n"
+            "\r\n",
+            status,
+            reason,
+            content_type,
+            extra_headers,
+            connection
+        );
+        return n < 0 || (size_t)n >= cap ? -1 : n;
+    }
     int n = snprintf(
-        resp->head,
-        sizeof(resp->head),
+        buf,
+        cap,
         "HTTP/1.1 %d %s\r\n"
         "Content-Length: %zu\r\n"
         "Content-Type: %s\r\n"
+        "%s"
         "Connection: %s\r\n"
         "\r\n",
         status,
         reason,
         content_length,
         content_type,
+        extra_headers,
         connection
     );
-    if (n < 0 || (size_t)n >= sizeof(resp->head)) {
+    if (n < 0 || (size_t)n >= cap) {
+        return -1;
+    }
+    return n;
+}
+
+static int response_prepare_head_extra(
+    http_response_t *resp,
+    int status,
+    const char *reason,
+    const char *content_type,
+    size_t content_length,
+    const char *extra_headers,
+    bool close_after_send
+) {
+    if (resp->head == NULL) {
+        resp->head = buf_pool_acquire(resp->pool, HTTP_RESPONSE_HEAD_CAP, &resp->head_cap);
+        if (resp->head == NULL) {
+            return -1;
+        }
+    }
+
+    int n = format_head(
+        resp->head,
+        resp->head_cap,
+        status,
+        reason,
+        content_type,
+        content_length,
+        extra_headers,
+        close_after_send
+    );
+    if (n < 0) {
         return -1;
     }
 
     resp->active = true;
     resp->close_after_send = close_after_send;
+    resp->status = status;
     resp->head_len = (size_t)n;
     resp->head_sent = 0;
+    resp->mem = NULL;
     resp->body_sent = 0;
     resp->file_offset = 0;
     return 0;
 }
 
+static int response_prepare_head(
+    http_response_t *resp,
+    int status,
+    const char *reason,
+    const char *content_type,
+    size_t content_length,
+    bool close_after_send
+) {
+    return response_prepare_head_extra(resp, status, reason, content_type, content_length, "", close_after_send);
+}
+
 static int response_prepare_memory(
     http_response_t *resp,
     int status,
@@ -195,7 +312,7 @@ static int response_prepare_memory(
     size_t body_len,
     bool close_after_send
 ) {
-    if (body_len > sizeof(resp->body)) {
+    if (body_len > HTTP_RESPONSE_BODY_CAP) {
         return -1;
     }
 
@@ -204,6 +321,121 @@ static int response_prepare_memory(
     }
 
     if (body_len > 0) {
+        if (response_reserve_body(resp, body_len) != 0) {
+            return -1;
+        }
+        memcpy(resp->body, body, body_len);
+    }
+    resp->body_len = body_len;
+    resp->file_fd = -1;
+    resp->file_remaining = 0;
+    return 0;
+}
+
+/* Like response_prepare_memory() for bytes that outlive the response: sent in place, nothing copied. */
+static int response_prepare_static(
+    http_response_t *resp,
+    int status,
+    const char *reason,
+    const char *content_type,
+    const char *body,
+    size_t body_len,
+    bool close_after_send
+) {
+    if (response_prepare_head(resp, status, reason, content_type, body_len, close_after_send) != 0) {
+        return -1;
+    }
+    resp->mem = body;
+    resp->body_len = body_len;
+    resp->file_fd = -1;
+    resp->file_remaining = 0;
+    return 0;
+}
+
+static const char *status_reason(int status) {
+    switch (status) {
+        case 200:
+            return "OK";
+        case 201:
+            return "Created";
+        case 202:
+            return "Accepted";
+        case 204:
+            return "No Content";
+        case 301:
+            return "Moved Permanently";
+        case 302:
+            return "Found";
+        case 303:
+            return "See Other";
+        case 307:
+            return "Temporary Redirect";
+        case 308:
+            return "Permanent Redirect";
+        case 400:
+            return "Bad Request";
+        case 401:
+            return "Unauthorized";
+        case 403:
+            return "Forbidden";
+        case 404:
+            return "Not Found";
+        case 405:
+            return "Method Not Allowed";
+        case 409:
+            return "Conflict";
+        case 413:
+            return "Payload Too Large";
+        case 415:
+            return "Unsupported Media Type";
+        case 422:
+            return "Unprocessable Content";
+        case 429:
+            return "Too Many Requests";
+        case 500:
+            return "Internal Server Error";
+        case 502:
+            return "Bad Gateway";
+        case 503:
+            return "Service Unavailable";
+        case 504:
+            return "Gateway Timeout";
+        default:
+            return "Status";
+    }
+}
+
+int http_response_prepare(
+    http_response_t *resp,
+    int status,
+    const char *content_type,
+    const char *extra_headers,
+    const char *body,
+    size_t body_len,
+    bool borrowed,
+    bool close_after_send
+) {
+    if (!borrowed && body_len > HTTP_RESPONSE_BODY_CAP) {
+        return -1;
+    }
+    if (response_prepare_head_extra(
+            resp,
+            status,
+            status_reason(status),
+            content_type,
+            body_len,
+            extra_headers,
+            close_after_send
+        ) != 0) {
+        return -1;
+    }
+
+    if (borrowed) {
+        resp->mem = body;
+    } else if (body_len > 0) {
+        if (response_reserve_body(resp, body_len) != 0) {
+            return -1;
+        }
         memcpy(resp->body, body, body_len);
     }
     resp->body_len = body_len;
@@ -214,7 +446,7 @@ static int response_prepare_memory(
 
 static int route_not_found(http_response_t *resp, bool close_after_send) {
     static const char body[] = "not found\n";
-    return response_prepare_memory(
+    return response_prepare_static(
         resp,
         404,
         "Not Found",
@@ -227,7 +459,7 @@ static int route_not_found(http_response_t *resp, bool close_after_send) {
 
 static int route_method_not_allowed(http_response_t *resp, bool close_after_send) {
     static const char body[] = "method not allowed\n";
-    return response_prepare_memory(
+    return response_prepare_static(
         resp,
         405,
         "Method Not Allowed",
@@ -240,7 +472,7 @@ static int route_method_not_allowed(http_response_t *resp, bool close_after_send
 
 static int route_bad_request(http_response_t *resp, bool close_after_send) {
     static const char body[] = "bad request\n";
-    return response_prepare_memory(
+    return response_prepare_static(
         resp,
         400,
         "Bad Request",
@@ -253,7 +485,7 @@ static int route_bad_request(http_response_t *resp, bool close_after_send) {
 
 static int route_payload_too_large(http_response_t *resp, bool close_after_send) {
     static const char body[] = "payload too large\n";
-    return response_prepare_memory(
+    return response_prepare_static(
         resp,
         413,
         "Payload Too Large",
@@ -266,7 +498,7 @@ static int route_payload_too_large(http_response_t *resp, bool close_after_send)
 
 static int route_server_error(http_response_t *resp, bool close_after_send) {
     static const char body[] = "internal server error\n";
-    return response_prepare_memory(
+    return response_prepare_static(
         resp,
         500,
         "Internal Server Error",
@@ -277,215 +509,1285 @@ static int route_server_error(http_response_t *resp, bool close_after_send) {
     );
 }
 
-int http_build_error_response(http_response_t *resp, int status, bool close_after_send) {
-    switch (status) {
-        case 400:
-            return route_bad_request(resp, close_after_send);
-        case 404:
-            return route_not_found(resp, close_after_send);
-        case 405:
-            return route_method_not_allowed(resp, close_after_send);
-        case 413:
-            return route_payload_too_large(resp, close_after_send);
-        case 414: {
-            static const char body[] = "uri too long\\n";
-            return response_prepare_memory(
-                resp,
-                414,
-                "URI Too Long",
-                "text/plain",
-                body,
-                sizeof(body) - 1,
-                close_after_send
-            );
-        }
-        case 431: {
-            static const char body[] = "request header fields too large\\n";
-            return response_prepare_memory(
-                resp,
-                431,
-                "Request Header Fields Too Large",
-                "text/plain",
-                body,
-                sizeof(body) - 1,
-                close_after_send
-            );
-        }
-        case 505: {
-            static const char body[] = "http version not supported\\n";
-            return response_prepare_memory(
-                resp,
-                505,
-                "HTTP Version Not Supported",
-                "text/plain",
-                body,
-                sizeof(body) - 1,
-                close_after_send
-            );
-        }
-        default:
-            return route_server_error(resp, close_after_send);
-    }
+/* Whether responses of this type are worth negotiating a content coding for. */
+static bool content_type_compressible(const char *content_type) {
+    return strncmp(content_type, "text/", 5) == 0 ||
+        strcmp(content_type, "application/javascript") == 0 ||
+        strcmp(content_type, "application/json") == 0;
 }
 
-int http_route_request(
-    const http_request_t *req,
-    http_response_t *resp,
-    const char *static_root,
-    bool force_close
-) {
-    if (req == NULL || resp == NULL || static_root == NULL) {
-        return -1;
-    }
+#define STATIC_EXTRA_HEADERS_CAP 320
 
-    char path[HTTP_MAX_PATH_LEN + 1];
-    size_t path_len = strcspn(req->path, "?");
-    if (path_len > HTTP_MAX_PATH_LEN) {
-        return route_bad_request(resp, true);
-    }
-    memcpy(path, req->path, path_len);
-    path[path_len] = '\0';
+static http_cache_rule_t g_cache_rules[HTTP_CACHE_RULES_MAX];
+static size_t g_cache_rule_count;
 
-    bool close_after_send = force_close || req->connection_close;
+void http_router_set_cache_rules(const http_cache_rule_t *rules, size_t count) {
+    g_cache_rule_count = count < HTTP_CACHE_RULES_MAX ? count : HTTP_CACHE_RULES_MAX;
+    memcpy(g_cache_rules, rules, g_cache_rule_count * sizeof(*rules));
+}
 
-    if (strcmp(path, "/healthz") == 0) {
-        if (util_ascii_casecmp(req->method, "GET") != 0) {
-            return route_method_not_allowed(resp, close_after_send);
+static const http_cache_rule_t *cache_rule_for_path(const char *path) {
+    const http_cache_rule_t *best = NULL;
+    size_t best_len = 0;
+    for (size_t i = 0; i < g_cache_rule_count; ++i) {
+        size_t len = strlen(g_cache_rules[i].prefix);
+        if ((best == NULL || len > best_len) && strncmp(path, g_cache_rules[i].prefix, len) == 0) {
+            best = &g_cache_rules[i];
+            best_len = len;
         }
-        static const char body[] = "ok";
-        return response_prepare_memory(
-            resp,
-            200,
-            "OK",
-            "text/plain",
-            body,
-            sizeof(body) - 1,
-            close_after_send
-        );
     }
+    return best;
+}
 
-    if (strcmp(path, "/metrics") == 0) {
-        if (util_ascii_casecmp(req->method, "GET") != 0) {
-            return route_method_not_allowed(resp, close_after_send);
-        }
+static void append_header(char *buf, size_t cap, size_t *len, const char *name, const char *value) {
+    int n = snprintf(buf + *len, cap - *len, "%s: %s\r\n", name, value);
+    if (n > 0 && (size_t)n < cap - *len) {
+        *len += (size_t)n;
+    } else {
+        buf[*len] = '\0';
+    }
+}
 
-        size_t metric_len = 0;
-        metrics_render_plain(resp->body, sizeof(resp->body), &metric_len);
-        if (response_prepare_head(resp, 200, "OK", "text/plain", metric_len, close_after_send) != 0) {
-            return route_server_error(resp, true);
+/*
+ * Validator, caching and coding headers of a static response. A 304 repeats
+ * only ETag, Cache-Control and Vary.
+ */
+static const char *static_headers(
+    char *buf,
+    size_t cap,
+    const char *path,
+    const char *content_type,
+    http_encoding_t encoding,
+    const char *etag,
+    time_t mtime,
+    bool not_modified
+) {
+    size_t len = 0;
+    buf[0] = '\0';
+    if (etag[0] != '\0') {
+        append_header(buf, cap, &len, "ETag", etag);
+    }
+    if (!not_modified) {
+        char date[UTIL_HTTP_DATE_LEN + 1];
+        util_http_date_format(mtime, date);
+        append_header(buf, cap, &len, "Last-Modified", date);
+        append_header(buf, cap, &len, "Accept-Ranges", "bytes");
+    }
+    const http_cache_rule_t *rule = cache_rule_for_path(path);
+    if (rule != NULL) {
+        char value[32];
+        if (rule->max_age == 0) {
+            snprintf(value, sizeof(value), "no-cache");
+        } else {
+            snprintf(value, sizeof(value), "max-age=%d", rule->max_age);
         }
-        resp->body_len = metric_len;
-        resp->file_fd = -1;
-        resp->file_remaining = 0;
-        return 0;
+        append_header(buf, cap, &len, "Cache-Control", value);
     }
-
-    if (strcmp(path, "/echo") == 0) {
-        if (util_ascii_casecmp(req->method, "POST") != 0) {
-            return route_method_not_allowed(resp, close_after_send);
+    if (content_type_compressible(content_type)) {
+        if (encoding != HTTP_ENCODING_IDENTITY && !not_modified) {
+            append_header(buf, cap, &len, "Content-Encoding", http_encoding_name(encoding));
         }
+        append_header(buf, cap, &len, "Vary", "Accept-Encoding");
+    }
+    return buf;
+}
 
-        if (req->body_len > sizeof(resp->body)) {
-            return route_payload_too_large(resp, close_after_send);
-        }
+/* RFC 9110 13.2.2: If-None-Match takes precedence; If-Modified-Since only applies without it. */
+static bool request_not_modified(const http_request_t *req, const char *etag, time_t mtime) {
+    const http_view_t *inm = http_request_header(req, HTTP_HDR_IF_NONE_MATCH);
+    if (inm != NULL) {
+        return etag[0] != '\0' && http_etag_list_match(inm, etag);
+    }
+    const http_view_t *ims = http_request_header(req, HTTP_HDR_IF_MODIFIED_SINCE);
+    time_t since;
+    return ims != NULL && util_http_date_parse(ims->ptr, ims->len, &since) == 0 && mtime <= since;
+}
 
-        if (response_prepare_head(resp, 200, "OK", "application/octet-stream", req->body_len, close_after_send) != 0) {
-            return route_server_error(resp, true);
-        }
+/* What a static response is built from: one cached or freshly opened variant. */
+typedef struct {
+    const char *path;
+    const char *content_type;
+    http_encoding_t encoding;
+    const char *etag;
+    time_t mtime;
+    off_t size;
+    const char *mem;    /* body bytes of a pre-rendered variant, else NULL */
+} static_variant_t;
 
-        if (req->body_len > 0) {
-            memcpy(resp->body, req->body, req->body_len);
-        }
-        resp->body_len = req->body_len;
-        resp->file_fd = -1;
-        resp->file_remaining = 0;
-        return 0;
+enum {
+    STATIC_PREPARED = 0,    /* response complete, no file needed */
+    STATIC_ATTACH_FILE,     /* body refers to the variant; caller attaches the fd or entry */
+    STATIC_SEND_WHOLE       /* no precondition applies: send a plain 200 */
+};
+
+static int response_prepare_not_modified(http_response_t *resp, const static_variant_t *v, bool close_after_send) {
+    char extra_buf[STATIC_EXTRA_HEADERS_CAP];
+    const char *extra = static_headers(
+        extra_buf,
+        sizeof(extra_buf),
+        v->path,
+        v->content_type,
+        v->encoding,
+        v->etag,
+        0,
+        true
+    );
+    if (response_prepare_head_extra(resp, 304, "Not Modified", v->content_type, 0, extra, close_after_send) != 0) {
+        return -1;
     }
+    resp->body_len = 0;
+    return STATIC_PREPARED;
+}
 
-    if (strncmp(path, "/static/", 8) == 0) {
-        if (util_ascii_casecmp(req->method, "GET") != 0) {
-            return route_method_not_allowed(resp, close_after_send);
-        }
+/* If-Range: ranges only apply to the representation the client already has part of. */
+static bool if_range_allows(const http_request_t *req, const static_variant_t *v) {
+    const http_view_t *if_range = http_request_header(req, HTTP_HDR_IF_RANGE);
+    if (if_range == NULL) {
+        return true;
+    }
+    /* An entity-tag opens with a quote or W/; anything else is an HTTP-date, including one on a Wednesday. */
+    if ((if_range->len > 0 && if_range->ptr[0] == '"') ||
+        (if_range->len > 1 && if_range->ptr[0] == 'W' && if_range->ptr[1] == '/')) {
+        /* Strong comparison: a weak tag never matches. */
+        return v->etag[0] != '\0' && http_view_eq(if_range, v->etag);
+    }
+    time_t date;
+    return util_http_date_parse(if_range->ptr, if_range->len, &date) == 0 && date == v->mtime;
+}
 
-        const char *rel = path + 8;
-        if (!util_static_path_is_safe(rel)) {
-            return route_bad_request(resp, close_after_send);
-        }
+static int response_prepare_unsatisfiable(http_response_t *resp, const static_variant_t *v, bool close_after_send) {
+    char extra[64];
+    snprintf(extra, sizeof(extra), "Content-Range: bytes */%lld\r\n", (long long)v->size);
+    if (response_prepare_head_extra(resp, 416, "Range Not Satisfiable", "text/plain", 0, extra, close_after_send) != 0) {
+        return -1;
+    }
+    resp->body_len = 0;
+    return STATIC_PREPARED;
+}
 
-        char full_path[2048];
-        int n = snprintf(full_path, sizeof(full_path), "%s/%s", static_root, rel);
-        if (n < 0 || (size_t)n >= sizeof(full_path)) {
-            return route_bad_request(resp, close_after_send);
-        }
+/* Boundary line and headers opening part index of a multipart/byteranges body. */
+static int format_part_preamble(
+    char *out,
+    size_t cap,
+    size_t index,
+    const char *boundary,
+    const static_variant_t *v,
+    const http_byte_range_t *range
+) {
+    return snprintf(
+        out,
+        cap,
+        "%s--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+        index == 0 ? "" : "\r\n",
+        boundary,
+        v->content_type,
+        (long long)range->start,
+        (long long)(range->start + range->length - 1),
+        (long long)v->size
+    );
+}
 
-        int cached_fd = -1;
-        off_t cached_size = 0;
-        char cached_content_type[STATIC_CACHE_CTYPE_CAP + 1];
-        if (static_cache_lookup_dup(
-                full_path,
-                &cached_fd,
-                &cached_size,
-                cached_content_type,
-                sizeof(cached_content_type)
-            )) {
-            if (response_prepare_head(
-                    resp,
+static int response_prepare_single_range(
+    http_response_t *resp,
+    const static_variant_t *v,
+    const http_byte_range_t *range,
+    bool close_after_send
+) {
+    char extra_buf[STATIC_EXTRA_HEADERS_CAP];
+    static_headers(extra_buf, sizeof(extra_buf), v->path, v->content_type, v->encoding, v->etag, v->mtime, false);
+    size_t len = strlen(extra_buf);
+    char content_range[64];
+    snprintf(
+        content_range,
+        sizeof(content_range),
+        "bytes %lld-%lld/%lld",
+        (long long)range->start,
+        (long long)(range->start + range->length - 1),
+        (long long)v->size
+    );
+    append_header(extra_buf, sizeof(extra_buf), &len, "Content-Range", content_range);
+
+    if (response_prepare_head_extra(
+            resp,
+            206,
+            "Partial Content",
+            v->content_type,
+            (size_t)range->length,
+            extra_buf,
+            close_after_send
+        ) != 0) {
+        return -1;
+    }
+    if (v->mem != NULL) {
+        resp->mem = v->mem + range->start;
+        resp->body_len = (size_t)range->length;
+        return STATIC_ATTACH_FILE;
+    }
+    resp->body_len = 0;
+    resp->file_offset = range->start;
+    resp->file_remaining = range->length;
+    return STATIC_ATTACH_FILE;
+}
+
+/*
+ * multipart/byteranges: the body buffer holds the segment table followed by
+ * every preamble and the closing boundary; the ranges themselves are sent
+ * from the variant, borrowed from the cached bytes or straight from the file.
+ */
+static int response_prepare_multi_range(
+    http_response_t *resp,
+    const static_variant_t *v,
+    const http_byte_range_t *ranges,
+    size_t count,
+    bool close_after_send
+) {
+    char boundary[32];
+    snprintf(boundary, sizeof(boundary), "httpd-%016llx", (unsigned long long)(util_now_ns() ^ (uintptr_t)resp));
+    char closing[48];
+    int closing_len = snprintf(closing, sizeof(closing), "\r\n--%s--\r\n", boundary);
+
+    size_t seg_count = 2 * count + 1;
+    size_t table = seg_count * sizeof(http_response_segment_t);
+    size_t mem_total = table + (size_t)closing_len;
+    size_t content_length = (size_t)closing_len;
+    for (size_t i = 0; i < count; ++i) {
+        size_t preamble = (size_t)format_part_preamble(NULL, 0, i, boundary, v, &ranges[i]);
+        content_length += preamble + (size_t)ranges[i].length;
+        mem_total += preamble;
+    }
+    if (mem_total > HTTP_RESPONSE_BODY_CAP) {
+        return STATIC_SEND_WHOLE;
+    }
+    if (response_reserve_body(resp, mem_total) != 0) {
+        return -1;
+    }
+
+    char ctype[96];
+    snprintf(ctype, sizeof(ctype), "multipart/byteranges; boundary=%s", boundary);
+    char extra_buf[STATIC_EXTRA_HEADERS_CAP];
+    const char *extra = static_headers(
+        extra_buf,
+        sizeof(extra_buf),
+        v->path,
+        v->content_type,
+        v->encoding,
+        v->etag,
+        v->mtime,
+        false
+    );
+    if (response_prepare_head_extra(resp, 206, "Partial Content", ctype, content_length, extra, close_after_send) != 0) {
+        return -1;
+    }
+
+    http_response_segment_t *segs = (http_response_segment_t *)(void *)resp->body;
+    memset(segs, 0, table);
+    size_t off = table;
+    for (size_t i = 0; i < count; ++i) {
+        size_t preamble = (size_t)format_part_preamble(resp->body + off, resp->body_cap - off, i, boundary, v, &ranges[i]);
+        segs[2 * i].kind = HTTP_SEGMENT_MEMORY;
+        segs[2 * i].data = resp->body + off;
+        segs[2 * i].len = preamble;
+        off += preamble;
+
+        http_response_segment_t *range = &segs[2 * i + 1];
+        if (v->mem != NULL) {
+            range->kind = HTTP_SEGMENT_MEMORY;
+            range->data = v->mem + ranges[i].start;
+            range->len = (size_t)ranges[i].length;
+        } else {
+            range->kind = HTTP_SEGMENT_FILE;
+            range->offset = ranges[i].start;
+            range->length = ranges[i].length;
+        }
+    }
+    memcpy(resp->body + off, closing, (size_t)closing_len);
+    segs[2 * count].kind = HTTP_SEGMENT_MEMORY;
+    segs[2 * count].data = resp->body + off;
+    segs[2 * count].len = (size_t)closing_len;
+
+    resp->segs = segs;
+    resp->seg_count = (unsigned)seg_count;
+    resp->seg_next = 0;
+    resp->body_len = 0;
+    return STATIC_ATTACH_FILE;
+}
+
+/*
+ * Evaluate the conditional and Range headers of a GET for v and prepare the
+ * 304, 416 or 206 they call for. Returns STATIC_SEND_WHOLE if none applies,
+ * or -1 on failure.
+ */
+static int response_prepare_precondition(
+    const http_request_t *req,
+    http_response_t *resp,
+    const static_variant_t *v,
+    bool close_after_send
+) {
+    if (request_not_modified(req, v->etag, v->mtime)) {
+        return response_prepare_not_modified(resp, v, close_after_send);
+    }
+
+    const http_view_t *range = http_request_header(req, HTTP_HDR_RANGE);
+    if (range == NULL || !if_range_allows(req, v)) {
+        return STATIC_SEND_WHOLE;
+    }
+    http_byte_range_t ranges[HTTP_RANGES_MAX];
+    size_t count = 0;
+    switch (http_parse_range(range, v->size, ranges, HTTP_RANGES_MAX, &count)) {
+        case HTTP_RANGE_UNSATISFIABLE:
+            return response_prepare_unsatisfiable(resp, v, close_after_send);
+        case HTTP_RANGE_OK: {
+            /* Overlapping ranges that add up to more than the body are not worth honouring. */
+            off_t total = 0;
+            for (size_t i = 0; i < count; ++i) {
+                total += ranges[i].length;
+            }
+            if (total > v->size) {
+                return STATIC_SEND_WHOLE;
+            }
+            return count == 1
+                ? response_prepare_single_range(resp, v, &ranges[0], close_after_send)
+                : response_prepare_multi_range(resp, v, ranges, count, close_after_send);
+        }
+        default:
+            return STATIC_SEND_WHOLE;
+    }
+}
+
+/* Serve a cached file; the response takes over the reference to the entry. */
+static int response_prepare_cached_file(
+    const http_request_t *req,
+    http_response_t *resp,
+    static_cache_entry_t *entry,
+    bool close_after_send
+) {
+    static_variant_t v = {
+        .path = entry->path,
+        .content_type = entry->content_type,
+        .encoding = (http_encoding_t)entry->encoding,
+        .etag = entry->etag,
+        .mtime = entry->mtime.tv_sec,
+        .size = entry->size,
+        .mem = entry->render.data == NULL
+            ? NULL
+            : entry->render.data + entry->render.len[STATIC_CACHE_VARIANT_KEEP_ALIVE] - (size_t)entry->size,
+    };
+    int rc = response_prepare_precondition(req, resp, &v, close_after_send);
+    if (rc == STATIC_ATTACH_FILE) {
+        resp->file_fd = entry->fd;
+        resp->file_ref = entry;
+        return 0;
+    }
+    if (rc != STATIC_SEND_WHOLE) {
+        static_cache_release(entry);
+        return rc < 0 ? route_server_error(resp, true) : 0;
+    }
+
+    if (entry->render.data != NULL) {
+        /* The whole response is pre-rendered: borrow it as the head, no fd involved. */
+        int variant = close_after_send ? STATIC_CACHE_VARIANT_CLOSE : STATIC_CACHE_VARIANT_KEEP_ALIVE;
+        size_t offset = 0;
+        for (int v = 0; v < variant; ++v) {
+            offset += entry->render.len[v];
+        }
+        resp->active = true;
+        resp->close_after_send = close_after_send;
+        resp->status = 200;
+        resp->head = entry->render.data + offset;
+        resp->head_borrowed = true;
+        resp->head_len = entry->render.len[variant];
+        resp->head_sent = 0;
+        resp->body_len = 0;
+        resp->body_sent = 0;
+        resp->file_fd = -1;
+        resp->file_ref = entry;
+        return 0;
+    }
+
+    char extra_buf[STATIC_EXTRA_HEADERS_CAP];
+    const char *extra = static_headers(
+        extra_buf,
+        sizeof(extra_buf),
+        entry->path,
+        entry->content_type,
+        (http_encoding_t)entry->encoding,
+        entry->etag,
+        entry->mtime.tv_sec,
+        false
+    );
+    if (response_prepare_head_extra(
+            resp,
+            200,
+            "OK",
+            entry->content_type,
+            (size_t)entry->size,
+            extra,
+            close_after_send
+        ) != 0) {
+        static_cache_release(entry);
+        return route_server_error(resp, true);
+    }
+    resp->body_len = 0;
+    resp->file_fd = entry->fd;
+    resp->file_ref = entry;
+    resp->file_offset = 0;
+    resp->file_remaining = entry->size;
+    return 0;
+}
+
+/*
+ * Build both Connection variants of the 200 response for a small file in one
+ * allocation. Returns -1 if the file is too large, the render budget is
+ * spent, or the file changed size while being read.
+ */
+static int render_small_file(
+    int fd,
+    off_t file_size,
+    const char *content_type,
+    const char *extra_headers,
+    static_cache_render_t *out
+) {
+    if (file_size > STATIC_CACHE_RENDER_MAX_FILE) {
+        return -1;
+    }
+    size_t size = (size_t)file_size;
+
+    char heads[STATIC_CACHE_VARIANTS][HTTP_RESPONSE_HEAD_CAP];
+    size_t head_len[STATIC_CACHE_VARIANTS];
+    size_t total = 0;
+    for (int v = 0; v < STATIC_CACHE_VARIANTS; ++v) {
+        int n = format_head(
+            heads[v],
+            sizeof(heads[v]),
+            200,
+            "OK",
+            content_type,
+            size,
+            extra_headers,
+            v == STATIC_CACHE_VARIANT_CLOSE
+        );
+        if (n < 0) {
+            return -1;
+        }
+        head_len[v] = (size_t)n;
+        total += head_len[v] + size;
+    }
+    if (!static_cache_render_fits(total)) {
+        return -1;
+    }
+
+    char *data = malloc(total);
+    if (data == NULL) {
+        return -1;
+    }
+    char *body = data + head_len[0];
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = pread(fd, body + got, size - got, (off_t)got);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            free(data);
+            return -1;
+        }
+        got += (size_t)n;
+    }
+
+    char *p = data;
+    for (int v = 0; v < STATIC_CACHE_VARIANTS; ++v) {
+        memcpy(p, heads[v], head_len[v]);
+        if (p + head_len[v] != body) {
+            memcpy(p + head_len[v], body, size);
+        }
+        out->len[v] = head_len[v] + size;
+        p += out->len[v];
+    }
+    out->data = data;
+    return 0;
+}
+
+/*
+ * Publish fd as the encoding variant of path, pre-rendering it if it is
+ * small. The cache takes fd on success; otherwise it stays with the caller.
+ */
+static static_cache_entry_t *publish_variant(
+    const char *path,
+    size_t path_len,
+    http_encoding_t encoding,
+    static_cache_source_t source,
+    int fd,
+    off_t size,
+    const struct stat *st,
+    const char *content_type,
+    unsigned long long generation
+) {
+    char etag[STATIC_CACHE_ETAG_CAP];
+    static_cache_format_etag(etag, sizeof(etag), st, encoding);
+    char extra_buf[STATIC_EXTRA_HEADERS_CAP];
+    const char *extra = static_headers(
+        extra_buf,
+        sizeof(extra_buf),
+        path,
+        content_type,
+        encoding,
+        etag,
+        st->st_mtim.tv_sec,
+        false
+    );
+    static_cache_render_t render;
+    bool rendered = render_small_file(fd, size, content_type, extra, &render) == 0;
+    static_cache_file_t file = {
+        .fd = fd,
+        .size = size,
+        .st = st,
+        .content_type = content_type,
+        .source = source,
+        .render = rendered ? &render : NULL,
+    };
+    static_cache_entry_t *entry = static_cache_insert(path, path_len, encoding, &file, generation);
+    if (entry == NULL && rendered) {
+        free(render.data);
+    }
+    return entry;
+}
+
+/* Remember that a variant does not exist so later requests skip the open(). */
+static void publish_absent(
+    const char *path,
+    size_t path_len,
+    http_encoding_t encoding,
+    const char *content_type,
+    unsigned long long generation
+) {
+    static_cache_file_t file = {
+        .fd = -1,
+        .content_type = content_type,
+        .source = STATIC_CACHE_ABSENT,
+    };
+    static_cache_release(static_cache_insert(path, path_len, encoding, &file, generation));
+}
+
+void http_static_publish_compressed(
+    const char *path,
+    size_t path_len,
+    http_encoding_t encoding,
+    int fd,
+    off_t size,
+    const struct stat *source,
+    unsigned long long generation
+) {
+    const char *ctype = content_type_for_path(path);
+    if (fd < 0) {
+        publish_absent(path, path_len, encoding, ctype, generation);
+        return;
+    }
+    static_cache_entry_t *entry = publish_variant(
+        path,
+        path_len,
+        encoding,
+        STATIC_CACHE_GENERATED,
+        fd,
+        size,
+        source,
+        ctype,
+        generation
+    );
+    if (entry == NULL) {
+        close(fd);
+    }
+    static_cache_release(entry);
+}
+
+/*
+ * Open file_path and serve it as the encoding variant of rel, caching it on
+ * the way. Sets *missing (and prepares nothing) if there is no such file.
+ */
+static int serve_static_file(
+    const http_request_t *req,
+    http_response_t *resp,
+    const char *rel,
+    size_t rel_len,
+    const char *file_path,
+    http_encoding_t encoding,
+    const char *content_type,
+    bool close_after_send,
+    bool *missing
+) {
+    *missing = false;
+    unsigned long long generation = static_cache_generation();
+    int fd = open(file_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT && errno != ENOTDIR) {
+            return route_server_error(resp, true);
+        }
+        *missing = true;
+    } else {
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            close(fd);
+            fd = -1;
+            *missing = true;
+        } else if (st.st_size < 0) {
+            close(fd);
+            return route_server_error(resp, true);
+        } else {
+            static_cache_source_t source = encoding == HTTP_ENCODING_IDENTITY ? STATIC_CACHE_FILE : STATIC_CACHE_SIDECAR;
+            static_cache_entry_t *entry = publish_variant(
+                rel,
+                rel_len,
+                encoding,
+                source,
+                fd,
+                st.st_size,
+                &st,
+                content_type,
+                generation
+            );
+            if (entry != NULL) {
+                return response_prepare_cached_file(req, resp, entry, close_after_send);
+            }
+
+            char etag[STATIC_CACHE_ETAG_CAP];
+            static_cache_format_etag(etag, sizeof(etag), &st, encoding);
+            static_variant_t v = {
+                .path = rel,
+                .content_type = content_type,
+                .encoding = encoding,
+                .etag = etag,
+                .mtime = st.st_mtim.tv_sec,
+                .size = st.st_size,
+            };
+            int rc = response_prepare_precondition(req, resp, &v, close_after_send);
+            if (rc == STATIC_ATTACH_FILE) {
+                resp->file_fd = fd;
+                return 0;
+            }
+            if (rc != STATIC_SEND_WHOLE) {
+                close(fd);
+                return rc < 0 ? route_server_error(resp, true) : 0;
+            }
+            char extra_buf[STATIC_EXTRA_HEADERS_CAP];
+            const char *extra = static_headers(
+                extra_buf,
+                sizeof(extra_buf),
+                rel,
+                content_type,
+                encoding,
+                etag,
+                st.st_mtim.tv_sec,
+                false
+            );
+            if (response_prepare_head_extra(
+                    resp,
                     200,
                     "OK",
-                    cached_content_type,
-                    (size_t)cached_size,
+                    content_type,
+                    (size_t)st.st_size,
+                    extra,
                     close_after_send
                 ) != 0) {
-                close(cached_fd);
+                close(fd);
                 return route_server_error(resp, true);
             }
-
             resp->body_len = 0;
-            resp->file_fd = cached_fd;
+            resp->file_fd = fd;
             resp->file_offset = 0;
-            resp->file_remaining = cached_size;
+            resp->file_remaining = st.st_size;
             return 0;
         }
+    }
 
-        int fd = open(full_path, O_RDONLY | O_CLOEXEC);
-        if (fd < 0) {
-            if (errno == ENOENT || errno == ENOTDIR) {
-                return route_not_found(resp, close_after_send);
-            }
-            return route_server_error(resp, true);
+    /* No sidecar: have one generated if possible, otherwise remember it is absent. */
+    if (encoding != HTTP_ENCODING_IDENTITY &&
+        !(encoding == static_compress_encoding() && static_compress_request(rel, rel_len))) {
+        publish_absent(rel, rel_len, encoding, content_type, generation);
+    }
+    return 0;
+}
+
+/* Codings the client accepts (q > 0), best first; ties go to the smaller output. */
+static size_t negotiate_encodings(const http_request_t *req, http_encoding_t out[HTTP_ENCODING_COUNT]) {
+    uint16_t q[HTTP_ENCODING_COUNT];
+    http_accept_encoding(http_request_header(req, HTTP_HDR_ACCEPT_ENCODING), q);
+
+    size_t n = 0;
+    for (int e = HTTP_ENCODING_COUNT - 1; e > HTTP_ENCODING_IDENTITY; --e) {
+        if (q[e] == 0) {
+            continue;
         }
+        size_t i = n++;
+        while (i > 0 && q[out[i - 1]] < q[e]) {
+            out[i] = out[i - 1];
+            --i;
+        }
+        out[i] = (http_encoding_t)e;
+    }
+    return n;
+}
 
-        struct stat st;
-        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
-            close(fd);
-            return route_not_found(resp, close_after_send);
+static int route_static(
+    const http_request_t *req,
+    http_response_t *resp,
+    const char *static_root,
+    const char *rel,
+    size_t rel_len,
+    bool close_after_send
+) {
+    char full_path[2048];
+    int n = snprintf(full_path, sizeof(full_path), "%s/%s", static_root, rel);
+    if (n < 0 || (size_t)n >= sizeof(full_path) - 8) {
+        return route_bad_request(resp, close_after_send);
+    }
+
+    const char *ctype = content_type_for_path(rel);
+    http_encoding_t encodings[HTTP_ENCODING_COUNT];
+    size_t encoding_count = content_type_compressible(ctype) ? negotiate_encodings(req, encodings) : 0;
+    for (size_t i = 0; i < encoding_count; ++i) {
+        static_cache_entry_t *entry = static_cache_acquire(rel, rel_len, encodings[i]);
+        if (entry != NULL) {
+            if (entry->source != STATIC_CACHE_ABSENT) {
+                return response_prepare_cached_file(req, resp, entry, close_after_send);
+            }
+            static_cache_release(entry);
+            continue;
         }
 
-        if (st.st_size < 0) {
-            close(fd);
-            return route_server_error(resp, true);
+        snprintf(full_path + n, sizeof(full_path) - (size_t)n, "%s", http_encoding_suffix(encodings[i]));
+        bool missing;
+        int rc = serve_static_file(req, resp, rel, rel_len, full_path, encodings[i], ctype, close_after_send, &missing);
+        if (!missing) {
+            return rc;
         }
+    }
+    full_path[n] = '\0';
+
+    static_cache_entry_t *entry = static_cache_acquire(rel, rel_len, HTTP_ENCODING_IDENTITY);
+    if (entry != NULL) {
+        return response_prepare_cached_file(req, resp, entry, close_after_send);
+    }
+    bool missing;
+    int rc = serve_static_file(req, resp, rel, rel_len, full_path, HTTP_ENCODING_IDENTITY, ctype, close_after_send, &missing);
+    return missing ? route_not_found(resp, close_after_send) : rc;
+}
 
-        const char *ctype = content_type_for_path(rel);
-        if (response_prepare_head(
+int http_build_error_response(http_response_t *resp, int status, bool close_after_send) {
+    switch (status) {
+        case 400:
+            return route_bad_request(resp, close_after_send);
+        case 404:
+            return route_not_found(resp, close_after_send);
+        case 405:
+            return route_method_not_allowed(resp, close_after_send);
+        case 413:
+            return route_payload_too_large(resp, close_after_send);
+        case 414: {
+            static const char body[] = "uri too long\\n";
+            return response_prepare_static(
                 resp,
-                200,
-                "OK",
-                ctype,
-                (size_t)st.st_size,
+                414,
+                "URI Too Long",
+                "text/plain",
+                body,
+                sizeof(body) - 1,
                 close_after_send
-            ) != 0) {
-            close(fd);
+            );
+        }
+        case 431: {
+            static const char body[] = "request header fields too large\\n";
+            return response_prepare_static(
+                resp,
+                431,
+                "Request Header Fields Too Large",
+                "text/plain",
+                body,
+                sizeof(body) - 1,
+                close_after_send
+            );
+        }
+        case 501: {
+            static const char body[] = "not implemented\n";
+            return response_prepare_static(
+                resp,
+                501,
+                "Not Implemented",
+                "text/plain",
+                body,
+                sizeof(body) - 1,
+                close_after_send
+            );
+        }
+        case 502: {
+            static const char body[] = "bad gateway\n";
+            return response_prepare_static(
+                resp,
+                502,
+                "Bad Gateway",
+                "text/plain",
+                body,
+                sizeof(body) - 1,
+                close_after_send
+            );
+        }
+        case 417: {
+            static const char body[] = "expectation failed\n";
+            return response_prepare_static(
+                resp,
+                417,
+                "Expectation Failed",
+                "text/plain",
+                body,
+                sizeof(body) - 1,
+                close_after_send
+            );
+        }
+        case 505: {
+            static const char body[] = "http version not supported\\n";
+            return response_prepare_static(
+                resp,
+                505,
+                "HTTP Version Not Supported",
+                "text/plain",
+                body,
+                sizeof(body) - 1,
+                close_after_send
+            );
+        }
+        default:
+            return route_server_error(resp, close_after_send);
+    }
+}
+
+/* /bytes/<n>: n bytes of a repeating pattern; state is {bytes produced, n}. */
+static ssize_t produce_pattern(http_response_t *resp, char *buf, size_t cap) {
+    static const char pattern[] = BYTES_ROUTE_PATTERN;
+    const size_t period = sizeof(pattern) - 1;
+    uint64_t pos = resp->producer_state[0];
+    uint64_t left = resp->producer_state[1] - pos;
+    size_t n = left < cap ? (size_t)left : cap;
+    size_t phase = (size_t)(pos % period);
+    for (size_t i = 0; i < n;) {
+        size_t run = period - phase;
+        if (run > n - i) {
+            run = n - i;
+        }
+        memcpy(buf + i, pattern + phase, run);
+        i += run;
+        phase = 0;
+    }
+    resp->producer_state[0] = pos + n;
+    return (ssize_t)n;
+}
+
+static int route_bytes(const http_request_t *req, http_response_t *resp, http_view_t count, bool close_after_send) {
+    uint64_t total = 0;
+    if (count.len == 0 || count.len > 10) {
+        return route_bad_request(resp, close_after_send);
+    }
+    for (size_t i = 0; i < count.len; ++i) {
+        if (count.ptr[i] < '0' || count.ptr[i] > '9') {
+            return route_bad_request(resp, close_after_send);
+        }
+        total = total * 10 + (uint64_t)(count.ptr[i] - '0');
+    }
+    if (total > BYTES_ROUTE_MAX) {
+        return route_bad_request(resp, close_after_send);
+    }
+
+    /* ?chunked stands in for a generator that cannot tell its length up front. */
+    const char *query = memchr(req->path.ptr, '?', req->path.len);
+    bool chunked = query != NULL &&
+        (size_t)(req->path.ptr + req->path.len - query) == 8 &&
+        memcmp(query, "?chunked", 8) == 0;
+    size_t content_length = chunked ? HTTP_LENGTH_CHUNKED : (size_t)total;
+    if (response_prepare_head(resp, 200, "OK", "text/plain", content_length, close_after_send) != 0) {
+        return route_server_error(resp, true);
+    }
+    resp->body_len = 0;
+    resp->file_fd = -1;
+    resp->file_remaining = 0;
+    resp->producer = produce_pattern;
+    resp->producer_state[0] = 0;
+    resp->producer_state[1] = total;
+    resp->chunked = chunked;
+    resp->seg_inline[0].kind = HTTP_SEGMENT_PRODUCER;
+    resp->segs = resp->seg_inline;
+    resp->seg_count = 1;
+    resp->seg_next = 0;
+    return 0;
+}
+
+#define FNV1A64_OFFSET 0xcbf29ce484222325ULL
+#define FNV1A64_PRIME 0x100000001b3ULL
+
+/* The upload route keeps nothing but a length and an FNV-1a digest of the body. */
+int http_body_stream_data(http_body_stream_t *stream, const char *data, size_t len) {
+    uint64_t hash = stream->hash;
+    for (size_t i = 0; i < len; ++i) {
+        hash = (hash ^ (unsigned char)data[i]) * FNV1A64_PRIME;
+    }
+    stream->hash = hash;
+    stream->bytes += len;
+    return 0;
+}
+
+int http_body_stream_finish(http_body_stream_t *stream, http_response_t *resp, bool force_close) {
+    resp->route = stream->route;
+    char body[64];
+    int n = snprintf(
+        body,
+        sizeof(body),
+        "%llu %016llx\n",
+        (unsigned long long)stream->bytes,
+        (unsigned long long)stream->hash
+    );
+    if (n < 0 || (size_t)n >= sizeof(body)) {
+        return route_server_error(resp, true);
+    }
+    return response_prepare_memory(
+        resp,
+        200,
+        "OK",
+        "text/plain",
+        body,
+        (size_t)n,
+        force_close || stream->close_after_send
+    );
+}
+
+/* Everything a route handler is given besides the response it fills. */
+typedef struct {
+    const http_request_t *req;
+    const http_route_match_t *match;
+    const struct route_def *def;
+    const char *static_root;
+    void *const *module_ctx;
+    bool close_after_send;
+} route_call_t;
+
+typedef int (*route_handler_fn)(const route_call_t *call, http_response_t *resp);
+
+/* An entry of the route table; a route without a handler streams its body. */
+typedef struct route_def {
+    const char *pattern;
+    unsigned methods;
+    http_route_id_t id;
+    route_handler_fn handler;
+    const http_module_route_t *module;
+    unsigned upstream;
+    const char *upstream_host;
+    const char *upstream_base;
+    size_t prefix_len;
+} route_def_t;
+
+static int handle_healthz(const route_call_t *call, http_response_t *resp) {
+    static const char body[] = "ok";
+    return response_prepare_static(
+        resp,
+        200,
+        "OK",
+        "text/plain",
+        body,
+        sizeof(body) - 1,
+        call->close_after_send
+    );
+}
+
+static int handle_metrics(const route_call_t *call, http_response_t *resp) {
+    size_t metric_len = 0;
+    if (response_reserve_body(resp, METRICS_RENDER_CAP) != 0) {
+        return route_server_error(resp, true);
+    }
+    metrics_render_plain(resp->body, resp->body_cap, &metric_len);
+    if (response_prepare_head(resp, 200, "OK", "text/plain", metric_len, call->close_after_send) != 0) {
+        return route_server_error(resp, true);
+    }
+    resp->body_len = metric_len;
+    resp->file_fd = -1;
+    resp->file_remaining = 0;
+    return 0;
+}
+
+static int handle_echo(const route_call_t *call, http_response_t *resp) {
+    const http_request_t *req = call->req;
+    if (req->body_len > HTTP_RESPONSE_BODY_CAP) {
+        return route_payload_too_large(resp, call->close_after_send);
+    }
+
+    if (response_prepare_head(resp, 200, "OK", "application/octet-stream", req->body_len, call->close_after_send) != 0) {
+        return route_server_error(resp, true);
+    }
+
+    if (req->body_len > 0) {
+        if (response_reserve_body(resp, req->body_len) != 0) {
             return route_server_error(resp, true);
         }
+        memcpy(resp->body, req->body, req->body_len);
+    }
+    resp->body_len = req->body_len;
+    resp->file_fd = -1;
+    resp->file_remaining = 0;
+    return 0;
+}
 
-        static_cache_insert(full_path, fd, st.st_size, ctype);
-        resp->body_len = 0;
-        resp->file_fd = fd;
-        resp->file_offset = 0;
-        resp->file_remaining = st.st_size;
-        return 0;
+static int handle_bytes(const route_call_t *call, http_response_t *resp) {
+    return route_bytes(call->req, resp, call->match->params[0], call->close_after_send);
+}
+
+static int handle_static(const route_call_t *call, http_response_t *resp) {
+    const http_view_t *rest = &call->match->rest;
+    char rel[HTTP_MAX_PATH_LEN + 1];
+    memcpy(rel, rest->ptr, rest->len);
+    rel[rest->len] = '\0';
+    if (!util_static_path_is_safe(rel)) {
+        return route_bad_request(resp, call->close_after_send);
+    }
+
+    return route_static(call->req, resp, call->static_root, rel, rest->len, call->close_after_send);
+}
+
+static int handle_module(const route_call_t *call, http_response_t *resp) {
+    return http_module_handle(
+        call->def->module,
+        call->req,
+        call->match,
+        resp,
+        call->module_ctx,
+        call->close_after_send
+    );
+}
+
+/* The request is written out for the upstream here; the worker does the I/O. */
+static int handle_proxy(const route_call_t *call, http_response_t *resp) {
+    const http_request_t *req = call->req;
+    const route_def_t *def = call->def;
+    char rewritten[HTTP_PROXY_UPSTREAM_CAP + HTTP_MAX_PATH_LEN + 2];
+    http_view_t path = req->path;
+    if (def->upstream_base != NULL) {
+        /* Under base "/v1", "/api/items?x" goes out as "/v1/items?x" and "/api?x" as "/v1?x". */
+        const char *rest = req->path.ptr + def->prefix_len;
+        size_t rest_len = req->path.len - def->prefix_len;
+        size_t base_len = strlen(def->upstream_base);
+        while (base_len > 0 && def->upstream_base[base_len - 1] == '/') {
+            --base_len;
+        }
+        size_t len = 0;
+        memcpy(rewritten, def->upstream_base, base_len);
+        len += base_len;
+        if (base_len == 0 && (rest_len == 0 || rest[0] != '/')) {
+            rewritten[len++] = '/';
+        }
+        memcpy(rewritten + len, rest, rest_len);
+        path.ptr = rewritten;
+        path.len = len + rest_len;
+    }
+
+    size_t need = req->body_len + HTTP_PROXY_HEAD_CAP;
+    if (response_reserve_body(resp, need < HTTP_RESPONSE_BODY_CAP ? need : HTTP_RESPONSE_BODY_CAP) != 0) {
+        return route_server_error(resp, true);
+    }
+    ssize_t n = http_proxy_format_request(req, path, def->upstream_host, resp->body, resp->body_cap);
+    if (n < 0) {
+        return route_payload_too_large(resp, call->close_after_send);
+    }
+    resp->active = true;
+    resp->close_after_send = call->close_after_send;
+    resp->upstream = (int)def->upstream;
+    resp->upstream_request = (size_t)n;
+    resp->head_only = req->method_id == HTTP_METHOD_HEAD;
+    return 0;
+}
+
+#define ROUTE_GET HTTP_METHOD_BIT(HTTP_METHOD_GET)
+#define ROUTE_POST HTTP_METHOD_BIT(HTTP_METHOD_POST)
+#define ROUTE_PUT HTTP_METHOD_BIT(HTTP_METHOD_PUT)
+
+static const route_def_t k_routes[] = {
+    {"/healthz", ROUTE_GET, HTTP_ROUTE_HEALTHZ, handle_healthz, NULL, 0, NULL, NULL, 0},
+    {"/metrics", ROUTE_GET, HTTP_ROUTE_METRICS, handle_metrics, NULL, 0, NULL, NULL, 0},
+    {"/echo", ROUTE_POST, HTTP_ROUTE_ECHO, handle_echo, NULL, 0, NULL, NULL, 0},
+    {"/upload", ROUTE_POST | ROUTE_PUT, HTTP_ROUTE_UPLOAD, NULL, NULL, 0, NULL, NULL, 0},
+    {"/bytes/:count", ROUTE_GET, HTTP_ROUTE_BYTES, handle_bytes, NULL, 0, NULL, NULL, 0},
+    {"/static/*", ROUTE_GET, HTTP_ROUTE_STATIC, handle_static, NULL, 0, NULL, NULL, 0}
+};
+
+static http_route_table_t g_routes;
+/* Entries added by modules and proxies, owned here because the table points at them. */
+static route_def_t **g_added_defs;
+static size_t g_added_def_count;
+
+int http_router_init(void) {
+    if (http_route_table_init(&g_routes) != 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < sizeof(k_routes) / sizeof(k_routes[0]); ++i) {
+        if (http_route_table_add(&g_routes, k_routes[i].methods, k_routes[i].pattern, &k_routes[i]) != 0) {
+            http_route_table_destroy(&g_routes);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void http_router_destroy(void) {
+    http_route_table_destroy(&g_routes);
+    for (size_t i = 0; i < g_added_def_count; ++i) {
+        free(g_added_defs[i]);
+    }
+    free(g_added_defs);
+    g_added_defs = NULL;
+    g_added_def_count = 0;
+}
+
+static route_def_t *added_def_new(void) {
+    route_def_t **defs = realloc(g_added_defs, (g_added_def_count + 1) * sizeof(*defs));
+    if (defs == NULL) {
+        return NULL;
+    }
+    g_added_defs = defs;
+    return calloc(1, sizeof(route_def_t));
+}
+
+int http_router_add_module_route(unsigned methods, const char *pattern, const http_module_route_t *route) {
+    route_def_t *def = added_def_new();
+    if (def == NULL) {
+        return -1;
+    }
+    def->pattern = pattern;
+    def->methods = methods;
+    def->id = HTTP_ROUTE_MODULE;
+    def->handler = handle_module;
+    def->module = route;
+    if (http_route_table_add(&g_routes, methods, pattern, def) != 0) {
+        free(def);
+        return -1;
+    }
+    g_added_defs[g_added_def_count++] = def;
+    return 0;
+}
+
+int http_router_add_proxy_route(const char *prefix, unsigned upstream, const char *host, const char *base) {
+    /* The prefix is taken literally: no parameters or wildcards, trailing slashes ignored. */
+    size_t len = strlen(prefix);
+    while (len > 0 && prefix[len - 1] == '/') {
+        --len;
+    }
+    if (prefix[0] != '/' || strpbrk(prefix, ":*?") != NULL || len + 3 > HTTP_PROXY_PREFIX_CAP) {
+        return -1;
+    }
+    route_def_t *def = added_def_new();
+    if (def == NULL) {
+        return -1;
+    }
+    def->pattern = prefix;
+    def->methods = HTTP_METHODS_ANY;
+    def->id = HTTP_ROUTE_PROXY;
+    def->handler = handle_proxy;
+    def->upstream = upstream;
+    def->upstream_host = host;
+    def->upstream_base = base;
+    def->prefix_len = len;
+
+    char pattern[HTTP_PROXY_PREFIX_CAP];
+    memcpy(pattern, prefix, len);
+    memcpy(pattern + len, "/*", 3);
+    pattern[len] = '\0';
+    /* "/api" itself, then everything below it; "/" needs only the latter. */
+    if (len > 0 && http_route_table_add(&g_routes, HTTP_METHODS_ANY, pattern, def) != 0) {
+        free(def);
+        return -1;
     }
+    pattern[len] = '/';
+    if (http_route_table_add(&g_routes, HTTP_METHODS_ANY, pattern, def) != 0) {
+        /* The exact route, if added, keeps pointing at def, so def stays owned. */
+        g_added_defs[g_added_def_count++] = def;
+        return -1;
+    }
+    g_added_defs[g_added_def_count++] = def;
+    return 0;
+}
+
+static http_route_lookup_t route_lookup(const http_request_t *req, http_route_match_t *match) {
+    http_view_t path = req->path;
+    const char *query = memchr(path.ptr, '?', path.len);
+    if (query != NULL) {
+        path.len = (size_t)(query - path.ptr);
+    }
+    return http_route_table_lookup(&g_routes, req->method_id, path.ptr, path.len, match);
+}
+
+static void stream_begin(const route_def_t *def, const http_request_t *req, http_body_stream_t *stream) {
+    memset(stream, 0, sizeof(*stream));
+    stream->route = def->id;
+    stream->close_after_send = req->connection_close;
+    stream->hash = FNV1A64_OFFSET;
+}
 
-    return route_not_found(resp, close_after_send);
+int http_route_request(
+    const http_request_t *req,
+    http_response_t *resp,
+    const char *static_root,
+    void *const module_ctx[HTTP_MODULES_MAX],
+    bool force_close
+) {
+    if (req == NULL || resp == NULL || static_root == NULL) {
+        return -1;
+    }
+
+    bool close_after_send = force_close || req->connection_close;
+    http_route_match_t match;
+    http_route_lookup_t found = route_lookup(req, &match);
+    if (found == HTTP_LOOKUP_NOT_FOUND) {
+        return route_not_found(resp, close_after_send);
+    }
+    const route_def_t *def = match.target;
+    resp->route = def->id;
+    if (found == HTTP_LOOKUP_BAD_METHOD) {
+        return route_method_not_allowed(resp, close_after_send);
+    }
+    if (def->handler == NULL) {
+        /* A streaming route reached without a streamed body: feed it what there is. */
+        http_body_stream_t stream;
+        stream_begin(def, req, &stream);
+        http_body_stream_data(&stream, req->body, req->body_len);
+        return http_body_stream_finish(&stream, resp, force_close);
+    }
+    route_call_t call = {req, &match, def, static_root, module_ctx, close_after_send};
+    return def->handler(&call, resp);
+}
+
+http_body_mode_t http_route_body(const http_request_t *req, http_body_stream_t *stream, int *status) {
+    http_route_match_t match;
+    http_route_lookup_t found = route_lookup(req, &match);
+    const route_def_t *def = match.target;
+
+    if (found != HTTP_LOOKUP_NOT_FOUND && def->handler == NULL) {
+        if (found == HTTP_LOOKUP_BAD_METHOD) {
+            *status = 405;
+            return HTTP_BODY_REJECTED;
+        }
+        stream_begin(def, req, stream);
+        return HTTP_BODY_STREAMED;
+    }
+
+    if (!req->chunked && req->content_length > HTTP_MAX_CONTENT_LENGTH) {
+        *status = 413;
+        return HTTP_BODY_REJECTED;
+    }
+    /* The client holds the body back until 100; refusing now saves the upload. */
+    if (req->expect_continue && found != HTTP_LOOKUP_FOUND) {
+        *status = found == HTTP_LOOKUP_NOT_FOUND ? 404 : 405;
+        return HTTP_BODY_REJECTED;
+    }
+    return HTTP_BODY_BUFFERED;
+}
+
+int http_build_continue_response(http_response_t *resp) {
+    static const char head[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    resp->active = true;
+    resp->status = 100;
+    resp->head = (char *)head;
+    resp->head_borrowed = true;
+    resp->head_len = sizeof(head) - 1;
+    return 0;
 }
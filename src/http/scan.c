@@ -0,0 +1,335 @@
+#include "http_scan.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HTTP_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+typedef struct {
+    size_t (*find_char)(const char *p, size_t len, char c);
+    size_t (*token_len)(const char *p, size_t len);
+    size_t (*value_invalid)(const char *p, size_t len);
+    bool (*name_eq)(const char *p, const char *lower, size_t len);
+} http_scan_ops_t;
+
+static bool is_tchar(unsigned char c) {
+    if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+        return true;
+    }
+    switch (c) {
+        case '!':
+        case '#':
+        case '$':
+        case '%':
+        case '&':
+        case '\'':
+        case '*':
+        case '+':
+        case '-':
+        case '.':
+        case '^':
+        case '_':
+        case '`':
+        case '|':
+        case '~':
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool is_value_invalid(unsigned char c) {
+    return (c < 0x20 && c != '\t') || c == 0x7f;
+}
+
+static unsigned char ascii_lower(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? (unsigned char)(c | 0x20) : c;
+}
+
+static size_t find_char_scalar(const char *p, size_t len, char c) {
+    const char *hit = memchr(p, c, len);
+    return hit == NULL ? len : (size_t)(hit - p);
+}
+
+static size_t token_len_scalar(const char *p, size_t len) {
+    size_t i = 0;
+    while (i < len && is_tchar((unsigned char)p[i])) {
+        ++i;
+    }
+    return i;
+}
+
+static size_t value_invalid_scalar(const char *p, size_t len) {
+    size_t i = 0;
+    while (i < len && !is_value_invalid((unsigned char)p[i])) {
+        ++i;
+    }
+    return i;
+}
+
+static bool name_eq_scalar(const char *p, const char *lower, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        if (ascii_lower((unsigned char)p[i]) != (unsigned char)lower[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static const http_scan_ops_t g_scalar_ops = {
+    find_char_scalar,
+    token_len_scalar,
+    value_invalid_scalar,
+    name_eq_scalar
+};
+
+#ifdef HTTP_SCAN_X86
+
+/*
+ * tchar classification by nibble lookup: a byte is a tchar when
+ * g_tchar_lo[low nibble] has the bit for its high nibble set. High nibbles
+ * 8..15 map to no bit, so non-ASCII bytes are never tchars.
+ */
+static uint8_t g_tchar_lo[16];
+static const uint8_t g_tchar_hi[16] = {1, 2, 4, 8, 16, 32, 64, 128, 0, 0, 0, 0, 0, 0, 0, 0};
+
+static void build_tchar_tables(void) {
+    memset(g_tchar_lo, 0, sizeof(g_tchar_lo));
+    for (unsigned c = 0; c < 128; ++c) {
+        if (is_tchar((unsigned char)c)) {
+            g_tchar_lo[c & 0x0f] |= (uint8_t)(1u << (c >> 4));
+        }
+    }
+}
+
+__attribute__((target("sse4.2")))
+static size_t find_char_sse42(const char *p, size_t len, char c) {
+    const __m128i needle = _mm_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(p + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+    return i + find_char_scalar(p + i, len - i, c);
+}
+
+__attribute__((target("sse4.2")))
+static size_t token_len_sse42(const char *p, size_t len) {
+    const __m128i lo_tbl = _mm_loadu_si128((const __m128i *)(const void *)g_tchar_lo);
+    const __m128i hi_tbl = _mm_loadu_si128((const __m128i *)(const void *)g_tchar_hi);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(p + i));
+        __m128i lo = _mm_and_si128(v, nibble);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+        __m128i bits = _mm_and_si128(_mm_shuffle_epi8(lo_tbl, lo), _mm_shuffle_epi8(hi_tbl, hi));
+        unsigned bad = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(bits, zero));
+        if (bad != 0) {
+            return i + (size_t)__builtin_ctz(bad);
+        }
+    }
+    return i + token_len_scalar(p + i, len - i);
+}
+
+__attribute__((target("sse4.2")))
+static size_t value_invalid_sse42(const char *p, size_t len) {
+    static const char ranges[16] = {0x00, 0x08, 0x0a, 0x1f, 0x7f, 0x7f};
+    const __m128i rv = _mm_loadu_si128((const __m128i *)(const void *)ranges);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(p + i));
+        int idx = _mm_cmpestri(rv, 6, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if (idx < 16) {
+            return i + (size_t)idx;
+        }
+    }
+    return i + value_invalid_scalar(p + i, len - i);
+}
+
+__attribute__((target("sse4.2")))
+static bool name_eq_sse42(const char *p, const char *lower, size_t len) {
+    const __m128i before_a = _mm_set1_epi8('A' - 1);
+    const __m128i after_z = _mm_set1_epi8('Z' + 1);
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(p + i));
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, before_a), _mm_cmpgt_epi8(after_z, v));
+        __m128i folded = _mm_or_si128(v, _mm_and_si128(upper, case_bit));
+        __m128i want = _mm_loadu_si128((const __m128i *)(const void *)(lower + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(folded, want)) != 0xffff) {
+            return false;
+        }
+    }
+    return name_eq_scalar(p + i, lower + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t find_char_avx2(const char *p, size_t len, char c) {
+    const __m256i needle = _mm256_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)(p + i));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+    return i + find_char_sse42(p + i, len - i, c);
+}
+
+__attribute__((target("avx2")))
+static size_t token_len_avx2(const char *p, size_t len) {
+    const __m256i lo_tbl = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(const void *)g_tchar_lo));
+    const __m256i hi_tbl = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(const void *)g_tchar_hi));
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)(p + i));
+        __m256i lo = _mm256_and_si256(v, nibble);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+        __m256i bits = _mm256_and_si256(_mm256_shuffle_epi8(lo_tbl, lo), _mm256_shuffle_epi8(hi_tbl, hi));
+        uint32_t bad = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bits, zero));
+        if (bad != 0) {
+            return i + (size_t)__builtin_ctz(bad);
+        }
+    }
+    return i + token_len_sse42(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t value_invalid_avx2(const char *p, size_t len) {
+    const __m256i space = _mm256_set1_epi8(0x20);
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)(p + i));
+        __m256i printable = _mm256_cmpeq_epi8(_mm256_max_epu8(v, space), v);
+        __m256i ok = _mm256_or_si256(printable, _mm256_cmpeq_epi8(v, tab));
+        ok = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, del), ok);
+        uint32_t bad = ~(uint32_t)_mm256_movemask_epi8(ok);
+        if (bad != 0) {
+            return i + (size_t)__builtin_ctz(bad);
+        }
+    }
+    return i + value_invalid_sse42(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static bool name_eq_avx2(const char *p, const char *lower, size_t len) {
+    const __m256i before_a = _mm256_set1_epi8('A' - 1);
+    const __m256i after_z = _mm256_set1_epi8('Z' + 1);
+    const __m256i case_bit = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)(p + i));
+        __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, before_a), _mm256_cmpgt_epi8(after_z, v));
+        __m256i folded = _mm256_or_si256(v, _mm256_and_si256(upper, case_bit));
+        __m256i want = _mm256_loadu_si256((const __m256i *)(const void *)(lower + i));
+        if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(folded, want)) != 0xffffffffu) {
+            return false;
+        }
+    }
+    return name_eq_sse42(p + i, lower + i, len - i);
+}
+
+static const http_scan_ops_t g_sse42_ops = {
+    find_char_sse42,
+    token_len_sse42,
+    value_invalid_sse42,
+    name_eq_sse42
+};
+
+static const http_scan_ops_t g_avx2_ops = {
+    find_char_avx2,
+    token_len_avx2,
+    value_invalid_avx2,
+    name_eq_avx2
+};
+
+#endif
+
+static const http_scan_ops_t *g_ops = &g_scalar_ops;
+static http_scan_impl_t g_active = HTTP_SCAN_SCALAR;
+
+int http_scan_select(http_scan_impl_t impl) {
+    switch (impl) {
+        case HTTP_SCAN_SCALAR:
+            g_ops = &g_scalar_ops;
+            g_active = impl;
+            return 0;
+#ifdef HTTP_SCAN_X86
+        case HTTP_SCAN_SSE42:
+            __builtin_cpu_init();
+            if (!__builtin_cpu_supports("sse4.2")) {
+                return -1;
+            }
+            build_tchar_tables();
+            g_ops = &g_sse42_ops;
+            g_active = impl;
+            return 0;
+        case HTTP_SCAN_AVX2:
+            __builtin_cpu_init();
+            if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("sse4.2")) {
+                return -1;
+            }
+            build_tchar_tables();
+            g_ops = &g_avx2_ops;
+            g_active = impl;
+            return 0;
+#endif
+        default:
+            return -1;
+    }
+}
+
+void http_scan_init(void) {
+    if (http_scan_select(HTTP_SCAN_AVX2) == 0) {
+        return;
+    }
+    if (http_scan_select(HTTP_SCAN_SSE42) == 0) {
+        return;
+    }
+    (void)http_scan_select(HTTP_SCAN_SCALAR);
+}
+
+http_scan_impl_t http_scan_active(void) {
+    return g_active;
+}
+
+const char *http_scan_impl_name(http_scan_impl_t impl) {
+    switch (impl) {
+        case HTTP_SCAN_SSE42:
+            return "sse4.2";
+        case HTTP_SCAN_AVX2:
+            return "avx2";
+        default:
+            return "scalar";
+    }
+}
+
+size_t http_scan_find_char(const char *p, size_t len, char c) {
+    return g_ops->find_char(p, len, c);
+}
+
+size_t http_scan_token_len(const char *p, size_t len) {
+    return g_ops->token_len(p, len);
+}
+
+size_t http_scan_value_invalid(const char *p, size_t len) {
+    return g_ops->value_invalid(p, len);
+}
+
+bool http_scan_name_eq(const char *p, const char *lower, size_t len) {
+    return g_ops->name_eq(p, lower, len);
+}
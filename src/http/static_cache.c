@@ -0,0 +1,439 @@
+#include "static_cache.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define STATIC_CACHE_READ_ATTEMPTS 4
+
+typedef struct {
+    static_cache_entry_t *entries;
+    unsigned capacity;
+    unsigned used;
+    unsigned hand;
+
+    /* Bucket heads and entry links hold index + 1; 0 terminates a chain. */
+    atomic_uint *buckets;
+    unsigned bucket_mask;
+
+    /* Odd while a writer is relinking chains. */
+    atomic_uint seq;
+    atomic_ullong generation;
+    pthread_mutex_t write_mu;
+
+    size_t render_budget;
+    atomic_size_t render_bytes;
+} static_cache_t;
+
+static static_cache_t g_cache = {.write_mu = PTHREAD_MUTEX_INITIALIZER};
+
+static uint64_t key_hash(const char *path, size_t len, http_encoding_t encoding) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)path[i];
+        h *= 1099511628211ULL;
+    }
+    h ^= (uint64_t)encoding + 1;
+    h *= 1099511628211ULL;
+    return h;
+}
+
+static bool entry_tryget(static_cache_entry_t *entry) {
+    unsigned refs = atomic_load_explicit(&entry->refs, memory_order_relaxed);
+    while (refs > 0) {
+        if (atomic_compare_exchange_weak_explicit(
+                &entry->refs,
+                &refs,
+                refs + 1,
+                memory_order_acquire,
+                memory_order_relaxed
+            )) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool entry_matches(
+    const static_cache_entry_t *entry,
+    const char *path,
+    size_t path_len,
+    http_encoding_t encoding
+) {
+    return entry->encoding == encoding && entry->path_len == path_len && memcmp(entry->path, path, path_len) == 0;
+}
+
+static size_t render_size(const static_cache_render_t *render) {
+    size_t total = 0;
+    for (int v = 0; v < STATIC_CACHE_VARIANTS; ++v) {
+        total += render->len[v];
+    }
+    return total;
+}
+
+int static_cache_init(size_t capacity, size_t render_budget) {
+    if (capacity > STATIC_CACHE_MAX_ENTRIES) {
+        return -1;
+    }
+    g_cache.entries = NULL;
+    g_cache.buckets = NULL;
+    g_cache.capacity = 0;
+    g_cache.used = 0;
+    g_cache.hand = 0;
+    atomic_store_explicit(&g_cache.seq, 0, memory_order_relaxed);
+    atomic_store_explicit(&g_cache.generation, 0, memory_order_relaxed);
+    atomic_store_explicit(&g_cache.render_bytes, 0, memory_order_relaxed);
+    g_cache.render_budget = render_budget;
+    if (capacity == 0) {
+        return 0;
+    }
+
+    unsigned buckets = 16;
+    while (buckets < capacity * 2) {
+        buckets <<= 1;
+    }
+    g_cache.entries = calloc(capacity, sizeof(*g_cache.entries));
+    g_cache.buckets = calloc(buckets, sizeof(*g_cache.buckets));
+    if (g_cache.entries == NULL || g_cache.buckets == NULL) {
+        free(g_cache.entries);
+        free(g_cache.buckets);
+        g_cache.entries = NULL;
+        g_cache.buckets = NULL;
+        return -1;
+    }
+    g_cache.capacity = (unsigned)capacity;
+    g_cache.bucket_mask = buckets - 1;
+    return 0;
+}
+
+void static_cache_destroy(void) {
+    for (unsigned i = 0; i < g_cache.used; ++i) {
+        static_cache_entry_t *entry = &g_cache.entries[i];
+        if (entry->linked) {
+            entry->linked = false;
+            static_cache_release(entry);
+        }
+    }
+    free(g_cache.entries);
+    free(g_cache.buckets);
+    g_cache.entries = NULL;
+    g_cache.buckets = NULL;
+    g_cache.capacity = 0;
+    g_cache.used = 0;
+}
+
+size_t static_cache_capacity(void) {
+    return g_cache.capacity;
+}
+
+void static_cache_format_etag(char *out, size_t cap, const struct stat *st, http_encoding_t encoding) {
+    /* Same inode, size and nanosecond mtime means the same bytes; the coding tells variants apart. */
+    int n = snprintf(
+        out,
+        cap,
+        "\"%llx-%llx-%llx.%lx%s%s\"",
+        (unsigned long long)st->st_ino,
+        (unsigned long long)st->st_size,
+        (unsigned long long)st->st_mtim.tv_sec,
+        (unsigned long)st->st_mtim.tv_nsec,
+        encoding == HTTP_ENCODING_IDENTITY ? "" : "-",
+        encoding == HTTP_ENCODING_IDENTITY ? "" : http_encoding_name(encoding)
+    );
+    if (n < 0 || (size_t)n >= cap) {
+        out[0] = '\0';
+    }
+}
+
+bool static_cache_render_fits(size_t len) {
+    return g_cache.capacity > 0 &&
+        atomic_load_explicit(&g_cache.render_bytes, memory_order_relaxed) + len <= g_cache.render_budget;
+}
+
+static_cache_entry_t *static_cache_acquire(const char *path, size_t path_len, http_encoding_t encoding) {
+    if (g_cache.capacity == 0) {
+        return NULL;
+    }
+
+    uint64_t hash = key_hash(path, path_len, encoding);
+    atomic_uint *bucket = &g_cache.buckets[hash & g_cache.bucket_mask];
+    for (int attempt = 0; attempt < STATIC_CACHE_READ_ATTEMPTS; ++attempt) {
+        unsigned seq = atomic_load_explicit(&g_cache.seq, memory_order_acquire);
+        if ((seq & 1u) != 0) {
+            continue;
+        }
+
+        /* A recycled entry can lead into another chain; bound the walk. */
+        unsigned idx = atomic_load_explicit(bucket, memory_order_acquire);
+        for (unsigned steps = 0; idx != 0 && steps < g_cache.capacity; ++steps) {
+            static_cache_entry_t *entry = &g_cache.entries[idx - 1];
+            if (atomic_load_explicit(&entry->hash, memory_order_relaxed) == hash && entry_tryget(entry)) {
+                if (entry_matches(entry, path, path_len, encoding)) {
+                    if (!atomic_load_explicit(&entry->referenced, memory_order_relaxed)) {
+                        atomic_store_explicit(&entry->referenced, 1, memory_order_relaxed);
+                    }
+                    return entry;
+                }
+                static_cache_release(entry);
+            }
+            idx = atomic_load_explicit(&entry->next, memory_order_acquire);
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&g_cache.seq, memory_order_relaxed) == seq) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+void static_cache_release(static_cache_entry_t *entry) {
+    if (entry == NULL) {
+        return;
+    }
+    int fd = entry->fd;
+    char *rendered = entry->render.data;
+    size_t rendered_size = render_size(&entry->render);
+    if (atomic_fetch_sub_explicit(&entry->refs, 1, memory_order_acq_rel) == 1) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (rendered != NULL) {
+            free(rendered);
+            atomic_fetch_sub_explicit(&g_cache.render_bytes, rendered_size, memory_order_relaxed);
+        }
+    }
+}
+
+static void write_begin(void) {
+    atomic_fetch_add_explicit(&g_cache.seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void write_end(void) {
+    atomic_fetch_add_explicit(&g_cache.seq, 1, memory_order_release);
+}
+
+static static_cache_entry_t *find_linked(
+    uint64_t hash,
+    const char *path,
+    size_t path_len,
+    http_encoding_t encoding
+) {
+    unsigned idx = atomic_load_explicit(&g_cache.buckets[hash & g_cache.bucket_mask], memory_order_relaxed);
+    while (idx != 0) {
+        static_cache_entry_t *entry = &g_cache.entries[idx - 1];
+        if (atomic_load_explicit(&entry->hash, memory_order_relaxed) == hash &&
+            entry_matches(entry, path, path_len, encoding)) {
+            return entry;
+        }
+        idx = atomic_load_explicit(&entry->next, memory_order_relaxed);
+    }
+    return NULL;
+}
+
+/* Remove entry from its chain and drop the cache's reference. Caller holds write_mu. */
+static void unlink_entry(static_cache_entry_t *entry) {
+    unsigned target = (unsigned)(entry - g_cache.entries) + 1;
+    uint64_t hash = atomic_load_explicit(&entry->hash, memory_order_relaxed);
+    atomic_uint *link = &g_cache.buckets[hash & g_cache.bucket_mask];
+    unsigned idx = atomic_load_explicit(link, memory_order_relaxed);
+    while (idx != 0 && idx != target) {
+        link = &g_cache.entries[idx - 1].next;
+        idx = atomic_load_explicit(link, memory_order_relaxed);
+    }
+    if (idx == target) {
+        /* entry->next is left intact so readers standing on it can move on. */
+        atomic_store_explicit(link, atomic_load_explicit(&entry->next, memory_order_relaxed), memory_order_release);
+    }
+    entry->linked = false;
+    static_cache_release(entry);
+}
+
+/* CLOCK sweep: recently hit entries get a second chance; pinned ones are skipped. */
+static static_cache_entry_t *claim_slot(void) {
+    if (g_cache.used < g_cache.capacity) {
+        return &g_cache.entries[g_cache.used++];
+    }
+
+    for (unsigned scanned = 0; scanned < g_cache.capacity * 2; ++scanned) {
+        static_cache_entry_t *entry = &g_cache.entries[g_cache.hand];
+        g_cache.hand = (g_cache.hand + 1) % g_cache.capacity;
+
+        if (entry->linked) {
+            if (atomic_exchange_explicit(&entry->referenced, 0, memory_order_relaxed)) {
+                continue;
+            }
+            unlink_entry(entry);
+        }
+        if (atomic_load_explicit(&entry->refs, memory_order_acquire) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+unsigned long long static_cache_generation(void) {
+    return atomic_load_explicit(&g_cache.generation, memory_order_acquire);
+}
+
+static_cache_entry_t *static_cache_insert(
+    const char *path,
+    size_t path_len,
+    http_encoding_t encoding,
+    const static_cache_file_t *file,
+    unsigned long long generation
+) {
+    if (g_cache.capacity == 0 || path_len > HTTP_MAX_PATH_LEN) {
+        return NULL;
+    }
+
+    uint64_t hash = key_hash(path, path_len, encoding);
+    pthread_mutex_lock(&g_cache.write_mu);
+    if (atomic_load_explicit(&g_cache.generation, memory_order_relaxed) != generation) {
+        pthread_mutex_unlock(&g_cache.write_mu);
+        return NULL;
+    }
+
+    static_cache_entry_t *entry = find_linked(hash, path, path_len, encoding);
+    if (entry != NULL) {
+        atomic_fetch_add_explicit(&entry->refs, 1, memory_order_relaxed);
+        pthread_mutex_unlock(&g_cache.write_mu);
+        if (file->fd >= 0) {
+            close(file->fd);
+        }
+        if (file->render != NULL) {
+            free(file->render->data);
+        }
+        return entry;
+    }
+
+    write_begin();
+    entry = claim_slot();
+    if (entry == NULL) {
+        write_end();
+        pthread_mutex_unlock(&g_cache.write_mu);
+        return NULL;
+    }
+
+    entry->fd = file->fd;
+    entry->render.data = NULL;
+    memset(entry->render.len, 0, sizeof(entry->render.len));
+    if (file->render != NULL) {
+        size_t bytes = render_size(file->render);
+        if (atomic_load_explicit(&g_cache.render_bytes, memory_order_relaxed) + bytes <= g_cache.render_budget) {
+            atomic_fetch_add_explicit(&g_cache.render_bytes, bytes, memory_order_relaxed);
+            entry->render = *file->render;
+            entry->fd = -1;
+            close(file->fd);
+        } else {
+            free(file->render->data);
+        }
+    }
+    entry->encoding = (uint8_t)encoding;
+    entry->source = (uint8_t)file->source;
+    entry->size = file->size;
+    if (file->st != NULL) {
+        entry->dev = file->st->st_dev;
+        entry->ino = file->st->st_ino;
+        entry->source_size = file->st->st_size;
+        entry->mtime = file->st->st_mtim;
+        static_cache_format_etag(entry->etag, sizeof(entry->etag), file->st, encoding);
+    } else {
+        entry->etag[0] = '\0';
+        entry->dev = 0;
+        entry->ino = 0;
+        entry->source_size = 0;
+        memset(&entry->mtime, 0, sizeof(entry->mtime));
+    }
+    snprintf(entry->content_type, sizeof(entry->content_type), "%s", file->content_type);
+    memcpy(entry->path, path, path_len);
+    entry->path[path_len] = '\0';
+    entry->path_len = path_len;
+    entry->linked = true;
+    atomic_store_explicit(&entry->referenced, 0, memory_order_relaxed);
+    atomic_store_explicit(&entry->hash, hash, memory_order_relaxed);
+
+    atomic_uint *bucket = &g_cache.buckets[hash & g_cache.bucket_mask];
+    atomic_store_explicit(&entry->next, atomic_load_explicit(bucket, memory_order_relaxed), memory_order_relaxed);
+    /* One reference for the cache, one for the caller; publishes the fields above. */
+    atomic_store_explicit(&entry->refs, 2, memory_order_release);
+    atomic_store_explicit(bucket, (unsigned)(entry - g_cache.entries) + 1, memory_order_release);
+    write_end();
+
+    pthread_mutex_unlock(&g_cache.write_mu);
+    return entry;
+}
+
+static bool path_below(const static_cache_entry_t *entry, const char *dir, size_t dir_len) {
+    if (dir_len == 0) {
+        return true;
+    }
+    return entry->path_len > dir_len && entry->path[dir_len] == '/' && memcmp(entry->path, dir, dir_len) == 0;
+}
+
+/* Caller holds write_mu. Later inserts must not publish files opened before this point. */
+static void bump_generation(void) {
+    atomic_fetch_add_explicit(&g_cache.generation, 1, memory_order_release);
+}
+
+void static_cache_invalidate(const char *path, size_t path_len) {
+    if (g_cache.capacity == 0) {
+        return;
+    }
+    pthread_mutex_lock(&g_cache.write_mu);
+    bump_generation();
+    write_begin();
+    for (int encoding = 0; encoding < HTTP_ENCODING_COUNT; ++encoding) {
+        uint64_t hash = key_hash(path, path_len, (http_encoding_t)encoding);
+        static_cache_entry_t *entry = find_linked(hash, path, path_len, (http_encoding_t)encoding);
+        if (entry != NULL) {
+            unlink_entry(entry);
+        }
+    }
+    write_end();
+    pthread_mutex_unlock(&g_cache.write_mu);
+}
+
+void static_cache_invalidate_prefix(const char *dir, size_t dir_len) {
+    if (g_cache.capacity == 0) {
+        return;
+    }
+    pthread_mutex_lock(&g_cache.write_mu);
+    bump_generation();
+    write_begin();
+    for (unsigned i = 0; i < g_cache.used; ++i) {
+        static_cache_entry_t *entry = &g_cache.entries[i];
+        if (entry->linked && path_below(entry, dir, dir_len)) {
+            unlink_entry(entry);
+        }
+    }
+    write_end();
+    pthread_mutex_unlock(&g_cache.write_mu);
+}
+
+size_t static_cache_revalidate(bool (*still_valid)(const static_cache_entry_t *entry, void *arg), void *arg) {
+    size_t dropped = 0;
+    if (g_cache.capacity == 0) {
+        return 0;
+    }
+    pthread_mutex_lock(&g_cache.write_mu);
+    for (unsigned i = 0; i < g_cache.used; ++i) {
+        static_cache_entry_t *entry = &g_cache.entries[i];
+        if (!entry->linked || still_valid(entry, arg)) {
+            continue;
+        }
+        if (dropped == 0) {
+            bump_generation();
+            write_begin();
+        }
+        unlink_entry(entry);
+        ++dropped;
+    }
+    if (dropped > 0) {
+        write_end();
+    }
+    pthread_mutex_unlock(&g_cache.write_mu);
+    return dropped;
+}
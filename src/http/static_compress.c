@@ -0,0 +1,255 @@
+#include "static_compress.h"
+
+#if defined(__linux__) && defined(HTTPD_HAVE_ZLIB)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "static_cache.h"
+
+#define STATIC_COMPRESS_QUEUE 64
+#define STATIC_COMPRESS_CHUNK (64 * 1024)
+#define STATIC_COMPRESS_LEVEL 6
+
+typedef struct {
+    size_t len;
+    char path[HTTP_MAX_PATH_LEN + 1];
+} compress_job_t;
+
+typedef struct {
+    pthread_mutex_t mu;
+    pthread_cond_t cond;
+    compress_job_t jobs[STATIC_COMPRESS_QUEUE];
+    size_t head;
+    size_t count;
+    /* Path being compressed right now, so duplicates are not queued behind it. */
+    compress_job_t current;
+    bool busy;
+    bool running;
+    bool stopping;
+
+    int root_fd;
+    static_compress_publish_fn publish;
+    pthread_t thread;
+} static_compress_t;
+
+static static_compress_t g_compress = {
+    .mu = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .root_fd = -1,
+};
+
+static bool job_matches(const compress_job_t *job, const char *path, size_t len) {
+    return job->len == len && memcmp(job->path, path, len) == 0;
+}
+
+static int write_all(int fd, const unsigned char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* gzip src into out_fd; returns the compressed size or -1. */
+static off_t gzip_file(int src, int out_fd) {
+    static unsigned char in[STATIC_COMPRESS_CHUNK];
+    static unsigned char out[STATIC_COMPRESS_CHUNK];
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, STATIC_COMPRESS_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+
+    off_t total = 0;
+    int flush = Z_NO_FLUSH;
+    while (flush != Z_FINISH) {
+        ssize_t n = read(src, in, sizeof(in));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            deflateEnd(&zs);
+            return -1;
+        }
+        flush = n == 0 ? Z_FINISH : Z_NO_FLUSH;
+        zs.next_in = in;
+        zs.avail_in = (uInt)n;
+        do {
+            zs.next_out = out;
+            zs.avail_out = sizeof(out);
+            if (deflate(&zs, flush) == Z_STREAM_ERROR) {
+                deflateEnd(&zs);
+                return -1;
+            }
+            size_t have = sizeof(out) - zs.avail_out;
+            if (write_all(out_fd, out, have) != 0) {
+                deflateEnd(&zs);
+                return -1;
+            }
+            total += (off_t)have;
+        } while (zs.avail_out == 0);
+    }
+    deflateEnd(&zs);
+    return total;
+}
+
+static void compress_one(const compress_job_t *job) {
+    unsigned long long generation = static_cache_generation();
+    int src = openat(g_compress.root_fd, job->path, O_RDONLY | O_CLOEXEC);
+    if (src < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(src, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(src);
+        return;
+    }
+
+    int out = -1;
+    off_t size = -1;
+    if (st.st_size >= STATIC_COMPRESS_MIN_SOURCE && st.st_size <= STATIC_COMPRESS_MAX_SOURCE) {
+        out = memfd_create("httpd-gzip", MFD_CLOEXEC);
+        if (out >= 0) {
+            size = gzip_file(src, out);
+        }
+    }
+    close(src);
+
+    /* Not worth serving (or failed): publish a negative entry so requests stop asking. */
+    if (size < 0 || size >= st.st_size) {
+        if (out >= 0) {
+            close(out);
+        }
+        out = -1;
+        size = 0;
+    }
+    g_compress.publish(job->path, job->len, HTTP_ENCODING_GZIP, out, size, &st, generation);
+}
+
+static void *compress_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&g_compress.mu);
+    for (;;) {
+        while (g_compress.count == 0 && !g_compress.stopping) {
+            pthread_cond_wait(&g_compress.cond, &g_compress.mu);
+        }
+        if (g_compress.stopping) {
+            break;
+        }
+        g_compress.current = g_compress.jobs[g_compress.head];
+        g_compress.head = (g_compress.head + 1) % STATIC_COMPRESS_QUEUE;
+        --g_compress.count;
+        g_compress.busy = true;
+        pthread_mutex_unlock(&g_compress.mu);
+
+        compress_one(&g_compress.current);
+
+        pthread_mutex_lock(&g_compress.mu);
+        g_compress.busy = false;
+    }
+    pthread_mutex_unlock(&g_compress.mu);
+    return NULL;
+}
+
+int static_compress_start(const char *root, static_compress_publish_fn publish) {
+    g_compress.root_fd = open(root, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (g_compress.root_fd < 0) {
+        return 0;
+    }
+    g_compress.publish = publish;
+    g_compress.head = 0;
+    g_compress.count = 0;
+    g_compress.busy = false;
+    g_compress.stopping = false;
+    if (pthread_create(&g_compress.thread, NULL, compress_main, NULL) != 0) {
+        close(g_compress.root_fd);
+        g_compress.root_fd = -1;
+        return -1;
+    }
+    pthread_mutex_lock(&g_compress.mu);
+    g_compress.running = true;
+    pthread_mutex_unlock(&g_compress.mu);
+    return 0;
+}
+
+void static_compress_stop(void) {
+    pthread_mutex_lock(&g_compress.mu);
+    bool running = g_compress.running;
+    g_compress.running = false;
+    g_compress.stopping = true;
+    pthread_cond_signal(&g_compress.cond);
+    pthread_mutex_unlock(&g_compress.mu);
+    if (!running) {
+        return;
+    }
+    pthread_join(g_compress.thread, NULL);
+    close(g_compress.root_fd);
+    g_compress.root_fd = -1;
+}
+
+http_encoding_t static_compress_encoding(void) {
+    return HTTP_ENCODING_GZIP;
+}
+
+bool static_compress_request(const char *path, size_t path_len) {
+    if (path_len > HTTP_MAX_PATH_LEN) {
+        return false;
+    }
+    bool queued = false;
+    pthread_mutex_lock(&g_compress.mu);
+    if (g_compress.running) {
+        queued = g_compress.busy && job_matches(&g_compress.current, path, path_len);
+        for (size_t i = 0; i < g_compress.count && !queued; ++i) {
+            queued = job_matches(&g_compress.jobs[(g_compress.head + i) % STATIC_COMPRESS_QUEUE], path, path_len);
+        }
+        if (!queued && g_compress.count < STATIC_COMPRESS_QUEUE) {
+            compress_job_t *job = &g_compress.jobs[(g_compress.head + g_compress.count) % STATIC_COMPRESS_QUEUE];
+            memcpy(job->path, path, path_len);
+            job->path[path_len] = '\0';
+            job->len = path_len;
+            ++g_compress.count;
+            pthread_cond_signal(&g_compress.cond);
+            queued = true;
+        }
+    }
+    pthread_mutex_unlock(&g_compress.mu);
+    return queued;
+}
+
+#else
+
+int static_compress_start(const char *root, static_compress_publish_fn publish) {
+    (void)root;
+    (void)publish;
+    return 0;
+}
+
+void static_compress_stop(void) {
+}
+
+http_encoding_t static_compress_encoding(void) {
+    return HTTP_ENCODING_IDENTITY;
+}
+
+bool static_compress_request(const char *path, size_t path_len) {
+    (void)path;
+    (void)path_len;
+    return false;
+}
+
+#endif
@@ -0,0 +1,331 @@
+#include "static_watch.h"
+
+#ifdef __linux__
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "static_cache.h"
+
+#define STATIC_WATCH_MASK                                                                           \
+    (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+     IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#define STATIC_WATCH_MAX_DEPTH 32
+#define STATIC_WATCH_PATH_CAP 4096
+
+typedef struct {
+    static_watch_mode_t mode;
+    int interval_ms;
+    char root[STATIC_WATCH_PATH_CAP];
+    int root_fd;
+    int inotify_fd;
+    int stop_fd;
+
+    /* Directory path below root for each inotify watch descriptor. */
+    char **dirs;
+    size_t dirs_cap;
+
+    pthread_t thread;
+    bool running;
+} static_watch_t;
+
+static static_watch_t g_watch = {.root_fd = -1, .inotify_fd = -1, .stop_fd = -1};
+
+static int set_watch_dir(int wd, const char *rel) {
+    if ((size_t)wd >= g_watch.dirs_cap) {
+        size_t cap = g_watch.dirs_cap == 0 ? 64 : g_watch.dirs_cap;
+        while (cap <= (size_t)wd) {
+            cap *= 2;
+        }
+        char **next = realloc(g_watch.dirs, cap * sizeof(*next));
+        if (next == NULL) {
+            return -1;
+        }
+        memset(next + g_watch.dirs_cap, 0, (cap - g_watch.dirs_cap) * sizeof(*next));
+        g_watch.dirs = next;
+        g_watch.dirs_cap = cap;
+    }
+
+    char *copy = strdup(rel);
+    if (copy == NULL) {
+        return -1;
+    }
+    free(g_watch.dirs[wd]);
+    g_watch.dirs[wd] = copy;
+    return 0;
+}
+
+static const char *watch_dir(int wd) {
+    return wd >= 0 && (size_t)wd < g_watch.dirs_cap ? g_watch.dirs[wd] : NULL;
+}
+
+static int join_rel(char *out, size_t cap, const char *dir, const char *name) {
+    int n = dir[0] == '\0' ? snprintf(out, cap, "%s", name) : snprintf(out, cap, "%s/%s", dir, name);
+    return n < 0 || (size_t)n >= cap ? -1 : n;
+}
+
+/* Watch rel and every directory below it. */
+static int add_watch_tree(const char *rel, int depth) {
+    char abs_path[STATIC_WATCH_PATH_CAP];
+    int n = rel[0] == '\0'
+        ? snprintf(abs_path, sizeof(abs_path), "%s", g_watch.root)
+        : snprintf(abs_path, sizeof(abs_path), "%s/%s", g_watch.root, rel);
+    if (n < 0 || (size_t)n >= sizeof(abs_path)) {
+        return -1;
+    }
+
+    int wd = inotify_add_watch(g_watch.inotify_fd, abs_path, STATIC_WATCH_MASK);
+    if (wd < 0) {
+        return -1;
+    }
+    if (set_watch_dir(wd, rel) != 0) {
+        return -1;
+    }
+    if (depth >= STATIC_WATCH_MAX_DEPTH) {
+        return 0;
+    }
+
+    DIR *dir = opendir(abs_path);
+    if (dir == NULL) {
+        return 0;
+    }
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+            continue;
+        }
+        bool is_dir = de->d_type == DT_DIR;
+        if (de->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = fstatat(dirfd(dir), de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+        }
+        char child[STATIC_WATCH_PATH_CAP];
+        if (is_dir && join_rel(child, sizeof(child), rel, de->d_name) > 0) {
+            (void)add_watch_tree(child, depth + 1);
+        }
+    }
+    closedir(dir);
+    return 0;
+}
+
+static void handle_event(const struct inotify_event *ev) {
+    if ((ev->mask & IN_Q_OVERFLOW) != 0) {
+        static_cache_invalidate_prefix("", 0);
+        return;
+    }
+    if ((ev->mask & IN_IGNORED) != 0) {
+        if (watch_dir(ev->wd) != NULL) {
+            free(g_watch.dirs[ev->wd]);
+            g_watch.dirs[ev->wd] = NULL;
+        }
+        return;
+    }
+
+    const char *dir = watch_dir(ev->wd);
+    if (dir == NULL) {
+        return;
+    }
+    if ((ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) != 0) {
+        static_cache_invalidate_prefix(dir, strlen(dir));
+        return;
+    }
+    if (ev->len == 0) {
+        return;
+    }
+
+    char rel[STATIC_WATCH_PATH_CAP];
+    int n = join_rel(rel, sizeof(rel), dir, ev->name);
+    if (n < 0) {
+        return;
+    }
+    if ((ev->mask & IN_ISDIR) != 0) {
+        static_cache_invalidate_prefix(rel, (size_t)n);
+        if ((ev->mask & (IN_CREATE | IN_MOVED_TO)) != 0) {
+            (void)add_watch_tree(rel, 1);
+        }
+        return;
+    }
+    static_cache_invalidate(rel, (size_t)n);
+
+    /* A precompressed sidecar changed: drop the variants of the file it belongs to. */
+    for (int e = HTTP_ENCODING_IDENTITY + 1; e < HTTP_ENCODING_COUNT; ++e) {
+        size_t suffix_len = strlen(http_encoding_suffix((http_encoding_t)e));
+        if ((size_t)n > suffix_len && strcmp(rel + n - suffix_len, http_encoding_suffix((http_encoding_t)e)) == 0) {
+            static_cache_invalidate(rel, (size_t)n - suffix_len);
+        }
+    }
+}
+
+static void drain_events(void) {
+    _Alignas(struct inotify_event) char buf[16 * 1024];
+    for (;;) {
+        ssize_t n = read(g_watch.inotify_fd, buf, sizeof(buf));
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        for (char *p = buf; p < buf + n;) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            handle_event(ev);
+            p += sizeof(*ev) + ev->len;
+        }
+    }
+}
+
+static bool same_file(const struct stat *st, const static_cache_entry_t *entry) {
+    return S_ISREG(st->st_mode) &&
+        st->st_dev == entry->dev &&
+        st->st_ino == entry->ino &&
+        st->st_size == entry->source_size &&
+        st->st_mtim.tv_sec == entry->mtime.tv_sec &&
+        st->st_mtim.tv_nsec == entry->mtime.tv_nsec;
+}
+
+static bool entry_unchanged(const static_cache_entry_t *entry, void *arg) {
+    (void)arg;
+    struct stat st;
+    char sidecar[STATIC_WATCH_PATH_CAP];
+    const char *suffix = http_encoding_suffix((http_encoding_t)entry->encoding);
+    if (snprintf(sidecar, sizeof(sidecar), "%s%s", entry->path, suffix) >= (int)sizeof(sidecar)) {
+        return false;
+    }
+
+    if (entry->source == STATIC_CACHE_FILE || entry->source == STATIC_CACHE_SIDECAR) {
+        return fstatat(g_watch.root_fd, sidecar, &st, 0) == 0 && same_file(&st, entry);
+    }
+
+    /* Generated and negative entries stand in for a sidecar that must still be missing. */
+    if (fstatat(g_watch.root_fd, sidecar, &st, 0) == 0 || errno != ENOENT) {
+        return false;
+    }
+    if (entry->source == STATIC_CACHE_ABSENT && entry->ino == 0) {
+        return true;
+    }
+    return fstatat(g_watch.root_fd, entry->path, &st, 0) == 0 && same_file(&st, entry);
+}
+
+static void *watch_main(void *arg) {
+    (void)arg;
+    for (;;) {
+        struct pollfd pfds[2] = {
+            {.fd = g_watch.stop_fd, .events = POLLIN},
+            {.fd = g_watch.inotify_fd, .events = POLLIN},
+        };
+        bool inotify = g_watch.mode == STATIC_WATCH_INOTIFY;
+        int n = poll(pfds, inotify ? 2 : 1, inotify ? -1 : g_watch.interval_ms);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (pfds[0].revents != 0) {
+            break;
+        }
+        if (inotify) {
+            drain_events();
+        } else if (n == 0) {
+            (void)static_cache_revalidate(entry_unchanged, NULL);
+        }
+    }
+    return NULL;
+}
+
+static void close_fd(int *fd) {
+    if (*fd >= 0) {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+static void release_resources(void) {
+    close_fd(&g_watch.inotify_fd);
+    close_fd(&g_watch.root_fd);
+    close_fd(&g_watch.stop_fd);
+    for (size_t i = 0; i < g_watch.dirs_cap; ++i) {
+        free(g_watch.dirs[i]);
+    }
+    free(g_watch.dirs);
+    g_watch.dirs = NULL;
+    g_watch.dirs_cap = 0;
+}
+
+int static_watch_start(const char *root, static_watch_mode_t mode, int interval_sec) {
+    if (mode == STATIC_WATCH_OFF) {
+        return STATIC_WATCH_OFF;
+    }
+    if (strlen(root) >= sizeof(g_watch.root) || interval_sec <= 0) {
+        return -1;
+    }
+    snprintf(g_watch.root, sizeof(g_watch.root), "%s", root);
+    g_watch.interval_ms = interval_sec * 1000;
+
+    g_watch.root_fd = open(root, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (g_watch.root_fd < 0) {
+        /* Nothing below a missing root can be cached, so there is nothing to watch. */
+        fprintf(stderr, "static root %s: %s, cache watcher disabled\n", root, strerror(errno));
+        return STATIC_WATCH_OFF;
+    }
+    g_watch.stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (g_watch.stop_fd < 0) {
+        perror("eventfd");
+        release_resources();
+        return -1;
+    }
+
+    if (mode == STATIC_WATCH_INOTIFY) {
+        g_watch.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (g_watch.inotify_fd < 0 || add_watch_tree("", 0) != 0) {
+            fprintf(stderr, "inotify unavailable (%s), revalidating with fstatat\n", strerror(errno));
+            close_fd(&g_watch.inotify_fd);
+            mode = STATIC_WATCH_STAT;
+        }
+    }
+    g_watch.mode = mode;
+
+    if (pthread_create(&g_watch.thread, NULL, watch_main, NULL) != 0) {
+        release_resources();
+        return -1;
+    }
+    g_watch.running = true;
+    return mode;
+}
+
+void static_watch_stop(void) {
+    if (!g_watch.running) {
+        return;
+    }
+    uint64_t one = 1;
+    ssize_t n = write(g_watch.stop_fd, &one, sizeof(one));
+    (void)n;
+    pthread_join(g_watch.thread, NULL);
+    g_watch.running = false;
+    release_resources();
+}
+
+const char *static_watch_mode_name(static_watch_mode_t mode) {
+    switch (mode) {
+        case STATIC_WATCH_INOTIFY:
+            return "inotify";
+        case STATIC_WATCH_STAT:
+            return "stat";
+        default:
+            return "off";
+    }
+}
+
+#endif
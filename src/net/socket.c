@@ -2,12 +2,20 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <netdb.h>
 #include <netinet/in.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <linux/filter.h>
+#include <linux/tcp.h>
+#endif
+
 int net_set_nonblocking(int fd) {
     int flags = fcntl(fd, F_GETFL, 0);
     if (flags < 0) {
@@ -83,3 +91,103 @@ int net_create_listener(int port, int backlog, int reuse_port) {
 
     return fd;
 }
+
+int net_steer_by_cpu(int fd, unsigned group_size) {
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    /* Listener index = receiving CPU % group size. */
+    struct sock_filter code[] = {
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU)},
+        {BPF_ALU | BPF_MOD | BPF_K, 0, 0, group_size},
+        {BPF_RET | BPF_A, 0, 0, 0},
+    };
+    struct sock_fprog prog = {(unsigned short)(sizeof(code) / sizeof(code[0])), code};
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+#else
+    (void)fd;
+    (void)group_size;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+int net_tcp_data_segs_out(int fd, uint64_t *out) {
+#ifdef __linux__
+    struct tcp_info info;
+    memset(&info, 0, sizeof(info));
+    socklen_t len = sizeof(info);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) {
+        return -1;
+    }
+    if (len < offsetof(struct tcp_info, tcpi_data_segs_out) + sizeof(info.tcpi_data_segs_out)) {
+        return -1;
+    }
+    *out = info.tcpi_data_segs_out;
+    return 0;
+#else
+    (void)fd;
+    (void)out;
+    return -1;
+#endif
+}
+
+int net_resolve_address(const char *spec, struct sockaddr_storage *addr, socklen_t *addr_len) {
+    memset(addr, 0, sizeof(*addr));
+    if (strncmp(spec, "unix:", 5) == 0) {
+        struct sockaddr_un *un = (struct sockaddr_un *)addr;
+        const char *path = spec + 5;
+        size_t len = strlen(path);
+        if (len == 0 || len >= sizeof(un->sun_path)) {
+            return -1;
+        }
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, path, len + 1);
+        *addr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len + 1);
+        return 0;
+    }
+
+    const char *colon = strrchr(spec, ':');
+    if (colon == NULL || colon == spec || colon[1] == '\0') {
+        return -1;
+    }
+    char host[256];
+    const char *host_start = spec;
+    size_t host_len = (size_t)(colon - spec);
+    if (spec[0] == '[' && colon[-1] == ']') {
+        ++host_start;
+        host_len -= 2;
+    }
+    if (host_len == 0 || host_len >= sizeof(host)) {
+        return -1;
+    }
+    memcpy(host, host_start, host_len);
+    host[host_len] = '\0';
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *res = NULL;
+    if (getaddrinfo(host, colon + 1, &hints, &res) != 0 || res == NULL) {
+        return -1;
+    }
+    memcpy(addr, res->ai_addr, res->ai_addrlen);
+    *addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+int net_connect_nonblocking(const struct sockaddr_storage *addr, socklen_t addr_len) {
+    int fd = socket(addr->ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (addr->ss_family != AF_UNIX) {
+        int one = 1;
+        (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    if (connect(fd, (const struct sockaddr *)addr, addr_len) != 0 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
@@ -0,0 +1,320 @@
+#include "tls.h"
+
+#if defined(__linux__) && defined(HTTPD_HAVE_OPENSSL)
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+struct tls_conn {
+    SSL *ssl;
+    bool established;
+    bool kernel_tx;
+    /* A fatal error ended the session, so no close_notify may follow. */
+    bool failed;
+};
+
+static SSL_CTX *g_ctx;
+
+/* Wire-format ALPN list in order of preference. */
+static const unsigned char k_alpn[] = "\x02h2\x08http/1.1";
+
+static int select_alpn(
+    SSL *ssl,
+    const unsigned char **out,
+    unsigned char *out_len,
+    const unsigned char *in,
+    unsigned in_len,
+    void *arg
+) {
+    (void)ssl;
+    (void)arg;
+    unsigned char *selected = NULL;
+    if (SSL_select_next_proto(&selected, out_len, k_alpn, sizeof(k_alpn) - 1, in, in_len) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+static void report_errors(const char *what, const char *path) {
+    unsigned long err = ERR_get_error();
+    char reason[256];
+    ERR_error_string_n(err, reason, sizeof(reason));
+    fprintf(stderr, "tls: %s %s: %s\n", what, path, err != 0 ? reason : "failed");
+    ERR_clear_error();
+}
+
+int tls_server_init(const char *cert_path, const char *key_path) {
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if (ctx == NULL) {
+        report_errors("context", "");
+        return -1;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+    uint64_t options = SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE;
+#ifdef SSL_OP_ENABLE_KTLS
+    options |= SSL_OP_ENABLE_KTLS;
+#endif
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+    /* A peer that just closes the socket ends the stream like close_notify would. */
+    options |= SSL_OP_IGNORE_UNEXPECTED_EOF;
+#endif
+    SSL_CTX_set_options(ctx, options);
+    /* Records are only buffered while in flight, and retries may gather their bytes anew. */
+    SSL_CTX_set_mode(
+        ctx,
+        SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS
+    );
+
+    /* Stateless tickets only: no session cache shared between workers. */
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    SSL_CTX_set_num_tickets(ctx, 1);
+    SSL_CTX_set_alpn_select_cb(ctx, select_alpn, NULL);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert_path) != 1) {
+        report_errors("certificate", cert_path);
+        SSL_CTX_free(ctx);
+        return -1;
+    }
+    if (SSL_CTX_use_PrivateKey_file(ctx, key_path, SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(ctx) != 1) {
+        report_errors("private key", key_path);
+        SSL_CTX_free(ctx);
+        return -1;
+    }
+    g_ctx = ctx;
+    return 0;
+}
+
+void tls_server_destroy(void) {
+    SSL_CTX_free(g_ctx);
+    g_ctx = NULL;
+}
+
+tls_conn_t *tls_conn_new(int fd) {
+    tls_conn_t *tc = calloc(1, sizeof(*tc));
+    if (tc == NULL) {
+        return NULL;
+    }
+    tc->ssl = SSL_new(g_ctx);
+    if (tc->ssl == NULL || SSL_set_fd(tc->ssl, fd) != 1) {
+        ERR_clear_error();
+        SSL_free(tc->ssl);
+        free(tc);
+        return NULL;
+    }
+    SSL_set_accept_state(tc->ssl);
+    return tc;
+}
+
+void tls_conn_free(tls_conn_t *tc) {
+    if (tc == NULL) {
+        return;
+    }
+    if (tc->established && !tc->failed) {
+        /* Best effort: on a full socket the alert is simply dropped. */
+        (void)SSL_shutdown(tc->ssl);
+    }
+    ERR_clear_error();
+    SSL_free(tc->ssl);
+    free(tc);
+}
+
+/* Turn a failed SSL call into the result of the system call it stands for. */
+static ssize_t tls_fail(tls_conn_t *tc, int rc, bool reading) {
+    int saved = errno;
+    int err = SSL_get_error(tc->ssl, rc);
+    ERR_clear_error();
+    switch (err) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            if (reading) {
+                return 0;
+            }
+            errno = EPIPE;
+            return -1;
+        case SSL_ERROR_SYSCALL:
+            tc->failed = true;
+            errno = saved != 0 ? saved : EPIPE;
+            return -1;
+        default:
+            tc->failed = true;
+            errno = EPROTO;
+            return -1;
+    }
+}
+
+int tls_handshake(tls_conn_t *tc, bool *want_write) {
+    if (tc->established) {
+        return 1;
+    }
+    int rc = SSL_do_handshake(tc->ssl);
+    if (rc == 1) {
+        tc->established = true;
+        tc->kernel_tx = BIO_get_ktls_send(SSL_get_wbio(tc->ssl));
+        return 1;
+    }
+    int err = SSL_get_error(tc->ssl, rc);
+    ERR_clear_error();
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        *want_write = err == SSL_ERROR_WANT_WRITE;
+        return 0;
+    }
+    tc->failed = true;
+    return -1;
+}
+
+bool tls_established(const tls_conn_t *tc) {
+    return tc->established;
+}
+
+bool tls_resumed(const tls_conn_t *tc) {
+    return SSL_session_reused(tc->ssl) == 1;
+}
+
+bool tls_kernel_tx(const tls_conn_t *tc) {
+    return tc->kernel_tx;
+}
+
+bool tls_pending(const tls_conn_t *tc) {
+    return SSL_has_pending(tc->ssl) == 1;
+}
+
+ssize_t tls_read(tls_conn_t *tc, void *buf, size_t len) {
+    int n = SSL_read(tc->ssl, buf, len > INT_MAX ? INT_MAX : (int)len);
+    return n > 0 ? n : tls_fail(tc, n, true);
+}
+
+ssize_t tls_write(tls_conn_t *tc, const void *buf, size_t len) {
+    int n = SSL_write(tc->ssl, buf, len > INT_MAX ? INT_MAX : (int)len);
+    return n > 0 ? n : tls_fail(tc, n, false);
+}
+
+ssize_t tls_writev(tls_conn_t *tc, const struct iovec *iov, int iovcnt) {
+    if (iovcnt == 1 || iov[0].iov_len >= TLS_RECORD_MAX) {
+        return tls_write(tc, iov[0].iov_base, iov[0].iov_len);
+    }
+    /* The output ahead of a retry never shrinks, so a retry gathers at least as many bytes. */
+    char record[TLS_RECORD_MAX];
+    size_t len = 0;
+    for (int i = 0; i < iovcnt && len < sizeof(record); ++i) {
+        size_t take = iov[i].iov_len < sizeof(record) - len ? iov[i].iov_len : sizeof(record) - len;
+        memcpy(record + len, iov[i].iov_base, take);
+        len += take;
+    }
+    return tls_write(tc, record, len);
+}
+
+ssize_t tls_sendfile(tls_conn_t *tc, int file_fd, off_t *offset, size_t count) {
+    char record[TLS_RECORD_MAX];
+    size_t want = count < sizeof(record) ? count : sizeof(record);
+    ssize_t got = pread(file_fd, record, want, *offset);
+    if (got <= 0) {
+        if (got == 0) {
+            /* The file shrank under the response. */
+            errno = EIO;
+        }
+        return -1;
+    }
+    ssize_t n = tls_write(tc, record, (size_t)got);
+    if (n > 0) {
+        *offset += n;
+    }
+    return n;
+}
+
+#else
+
+#include <errno.h>
+#include <stdio.h>
+
+int tls_server_init(const char *cert_path, const char *key_path) {
+    (void)cert_path;
+    (void)key_path;
+    fprintf(stderr, "tls: httpd was built without OpenSSL\n");
+    return -1;
+}
+
+void tls_server_destroy(void) {
+}
+
+tls_conn_t *tls_conn_new(int fd) {
+    (void)fd;
+    return NULL;
+}
+
+void tls_conn_free(tls_conn_t *tc) {
+    (void)tc;
+}
+
+int tls_handshake(tls_conn_t *tc, bool *want_write) {
+    (void)tc;
+    (void)want_write;
+    return -1;
+}
+
+bool tls_established(const tls_conn_t *tc) {
+    (void)tc;
+    return false;
+}
+
+bool tls_resumed(const tls_conn_t *tc) {
+    (void)tc;
+    return false;
+}
+
+bool tls_kernel_tx(const tls_conn_t *tc) {
+    (void)tc;
+    return false;
+}
+
+bool tls_pending(const tls_conn_t *tc) {
+    (void)tc;
+    return false;
+}
+
+ssize_t tls_read(tls_conn_t *tc, void *buf, size_t len) {
+    (void)tc;
+    (void)buf;
+    (void)len;
+    errno = ENOTSUP;
+    return -1;
+}
+
+ssize_t tls_write(tls_conn_t *tc, const void *buf, size_t len) {
+    (void)tc;
+    (void)buf;
+    (void)len;
+    errno = ENOTSUP;
+    return -1;
+}
+
+ssize_t tls_writev(tls_conn_t *tc, const struct iovec *iov, int iovcnt) {
+    (void)tc;
+    (void)iov;
+    (void)iovcnt;
+    errno = ENOTSUP;
+    return -1;
+}
+
+ssize_t tls_sendfile(tls_conn_t *tc, int file_fd, off_t *offset, size_t count) {
+    (void)tc;
+    (void)file_fd;
+    (void)offset;
+    (void)count;
+    errno = ENOTSUP;
+    return -1;
+}
+
+#endif
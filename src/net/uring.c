@@ -0,0 +1,232 @@
+#include "uring.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(uring_t *ring, unsigned entries) {
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+    int fd = sys_io_uring_setup(entries, &p);
+    if (fd < 0 && errno == EINVAL) {
+        memset(&p, 0, sizeof(p));
+        fd = sys_io_uring_setup(entries, &p);
+    }
+    if (fd < 0) {
+        return -1;
+    }
+
+    /* The wait timeout is passed through IORING_ENTER_EXT_ARG. */
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+        close(fd);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    ring->fd = fd;
+    ring->features = p.features;
+
+    size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sq_map_len = sq_len > cq_len ? sq_len : cq_len;
+    ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        ring->sq_map = NULL;
+        uring_destroy(ring);
+        return -1;
+    }
+    ring->cq_map = ring->sq_map;
+
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        uring_destroy(ring);
+        return -1;
+    }
+
+    char *sq = ring->sq_map;
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_entries = p.sq_entries;
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+
+    char *cq = ring->cq_map;
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    /* Identity-map the index array once; SQEs are then used in ring order. */
+    for (unsigned i = 0; i < ring->sq_entries; ++i) {
+        ring->sq_array[i] = i;
+    }
+    ring->sqe_head = *ring->sq_tail;
+    ring->sqe_tail = ring->sqe_head;
+    return 0;
+}
+
+void uring_destroy(uring_t *ring) {
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_len);
+        ring->sqes = NULL;
+    }
+    if (ring->sq_map != NULL) {
+        munmap(ring->sq_map, ring->sq_map_len);
+        ring->sq_map = NULL;
+        ring->cq_map = NULL;
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+        ring->fd = -1;
+    }
+}
+
+unsigned uring_sq_space(uring_t *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    return ring->sq_entries - (ring->sqe_tail - head);
+}
+
+struct io_uring_sqe *uring_get_sqe(uring_t *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries) {
+        return NULL;
+    }
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+    ++ring->sqe_tail;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring_submit_and_wait(uring_t *ring, unsigned wait_nr, unsigned timeout_ms) {
+    unsigned to_submit = ring->sqe_tail - ring->sqe_head;
+    if (to_submit == 0 && wait_nr == 0) {
+        return 0;
+    }
+    if (to_submit > 0) {
+        __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+        ring->sqe_head = ring->sqe_tail;
+    }
+
+    struct __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000LL;
+
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+
+    unsigned flags = IORING_ENTER_EXT_ARG;
+    if (wait_nr > 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+    }
+
+    int rc = sys_io_uring_enter(ring->fd, to_submit, wait_nr, flags, &arg, sizeof(arg));
+    if (rc < 0 && (errno == ETIME || errno == EINTR)) {
+        return 0;
+    }
+    return rc < 0 ? -1 : 0;
+}
+
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(uring_t *ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_buf_ring_init(uring_t *ring, uring_buf_ring_t *br, unsigned short bgid, unsigned entries, unsigned buf_size) {
+    memset(br, 0, sizeof(*br));
+    if (entries == 0 || (entries & (entries - 1)) != 0 || entries > 32768) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    br->ring_len = entries * sizeof(struct io_uring_buf);
+    void *mem = mmap(NULL, br->ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return -1;
+    }
+    br->ring = mem;
+    br->bufs = malloc((size_t)entries * buf_size);
+    if (br->bufs == NULL) {
+        munmap(mem, br->ring_len);
+        br->ring = NULL;
+        return -1;
+    }
+    br->entries = entries;
+    br->buf_size = buf_size;
+    br->bgid = bgid;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)mem;
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        free(br->bufs);
+        munmap(mem, br->ring_len);
+        memset(br, 0, sizeof(*br));
+        return -1;
+    }
+
+    for (unsigned i = 0; i < entries; ++i) {
+        uring_buf_ring_recycle(br, (unsigned short)i);
+    }
+    return 0;
+}
+
+void uring_buf_ring_destroy(uring_t *ring, uring_buf_ring_t *br) {
+    if (br->ring == NULL) {
+        return;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = br->bgid;
+    (void)sys_io_uring_register(ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    munmap(br->ring, br->ring_len);
+    free(br->bufs);
+    memset(br, 0, sizeof(*br));
+}
+
+char *uring_buf_ring_ptr(const uring_buf_ring_t *br, unsigned short bid) {
+    return br->bufs + (size_t)bid * br->buf_size;
+}
+
+void uring_buf_ring_recycle(uring_buf_ring_t *br, unsigned short bid) {
+    struct io_uring_buf *buf = &br->ring->bufs[br->tail & (br->entries - 1)];
+    buf->addr = (uint64_t)(uintptr_t)uring_buf_ring_ptr(br, bid);
+    buf->len = br->buf_size;
+    buf->bid = bid;
+    ++br->tail;
+    __atomic_store_n(&br->ring->tail, br->tail, __ATOMIC_RELEASE);
+}
+
+#endif
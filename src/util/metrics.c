@@ -1,18 +1,67 @@
 #include "metrics.h"
 
+#include <stdarg.h>
 #include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+#include "pool.h"
+
+#define METRICS_STATUS_SPAN (METRICS_STATUS_MAX - METRICS_STATUS_MIN + 1)
+
+/* Upper bounds of the finite latency buckets, in nanoseconds; the last bucket is +Inf. */
+static const uint64_t k_latency_bounds_ns[METRICS_LATENCY_BUCKETS] = {
+    100000ULL, 250000ULL, 500000ULL,
+    1000000ULL, 2500000ULL, 5000000ULL,
+    10000000ULL, 25000000ULL, 50000000ULL,
+    100000000ULL, 250000000ULL, 500000000ULL,
+    1000000000ULL, 2500000000ULL, 5000000000ULL,
+    10000000000ULL
+};
+
+static const char *const k_latency_bounds_text[METRICS_LATENCY_BUCKETS] = {
+    "0.0001", "0.00025", "0.0005",
+    "0.001", "0.0025", "0.005",
+    "0.01", "0.025", "0.05",
+    "0.1", "0.25", "0.5",
+    "1", "2.5", "5",
+    "10"
+};
+
 typedef struct {
-    atomic_ullong requests_total;
-    atomic_ullong connections_current;
+    _Alignas(64) atomic_ullong requests_total;
     atomic_ullong bytes_in;
     atomic_ullong bytes_out;
-    atomic_ullong start_ms;
-} metrics_state_t;
+    atomic_ullong connections_opened;
+    atomic_ullong connections_closed;
+    atomic_ullong connections_rebalanced;
+    atomic_ullong accept_errors;
+    atomic_ullong tx_responses;
+    atomic_ullong tx_syscalls;
+    atomic_ullong tx_packets;
+    atomic_ullong tx_closed_responses;
+    atomic_ullong tls_handshakes;
+    atomic_ullong tls_resumed;
+    atomic_ullong tls_kernel_tx;
+    atomic_ullong route_responses[METRICS_MAX_ROUTES];
+    atomic_ullong route_latency_sum_ns[METRICS_MAX_ROUTES];
+    atomic_ullong route_latency[METRICS_MAX_ROUTES][METRICS_LATENCY_BUCKETS + 1];
+    atomic_ullong status[METRICS_STATUS_SPAN];
+    bool shared;
+    /* Worker id of the owning thread. */
+    int worker;
+} metrics_shard_t;
+
+static metrics_shard_t g_shared_shard;
+static metrics_shard_t *_Atomic g_shards[METRICS_MAX_SHARDS];
+static atomic_uint g_shard_count;
+static atomic_ullong g_start_ms;
+static const char *g_route_names[METRICS_MAX_ROUTES];
 
-static metrics_state_t g_metrics;
+static _Thread_local metrics_shard_t *t_shard;
 
 static unsigned long long now_monotonic_ms(void) {
     struct timespec ts;
@@ -20,52 +69,178 @@ static unsigned long long now_monotonic_ms(void) {
     return (unsigned long long)ts.tv_sec * 1000ULL + (unsigned long long)(ts.tv_nsec / 1000000ULL);
 }
 
+static metrics_shard_t *local_shard(void) {
+    return t_shard != NULL ? t_shard : &g_shared_shard;
+}
+
+static void shard_add(metrics_shard_t *shard, atomic_ullong *counter, unsigned long long n) {
+    if (shard->shared) {
+        atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+        return;
+    }
+    /* Single writer: a relaxed load/store pair avoids a locked RMW on the hot path. */
+    unsigned long long v = atomic_load_explicit(counter, memory_order_relaxed);
+    atomic_store_explicit(counter, v + n, memory_order_relaxed);
+}
+
+/* Visit the shared shard and every registered thread shard. */
+#define FOR_EACH_SHARD(var)                                                                          \
+    for (unsigned shard_i_ = 0, shard_n_ = atomic_load_explicit(&g_shard_count, memory_order_acquire); \
+         shard_i_ <= shard_n_; ++shard_i_)                                                           \
+        for (metrics_shard_t *var = shard_i_ == 0                                                    \
+                 ? &g_shared_shard                                                                   \
+                 : atomic_load_explicit(&g_shards[shard_i_ - 1], memory_order_acquire);              \
+             var != NULL; var = NULL)
+
+static unsigned long long sum_counter(size_t offset) {
+    unsigned long long total = 0;
+    FOR_EACH_SHARD(shard) {
+        total += atomic_load_explicit((atomic_ullong *)((char *)shard + offset), memory_order_relaxed);
+    }
+    return total;
+}
+
+#define SUM_FIELD(field) sum_counter(offsetof(metrics_shard_t, field))
+
 void metrics_init(void) {
-    atomic_store_explicit(&g_metrics.requests_total, 0, memory_order_relaxed);
-    atomic_store_explicit(&g_metrics.connections_current, 0, memory_order_relaxed);
-    atomic_store_explicit(&g_metrics.bytes_in, 0, memory_order_relaxed);
-    atomic_store_explicit(&g_metrics.bytes_out, 0, memory_order_relaxed);
-    atomic_store_explicit(&g_metrics.start_ms, now_monotonic_ms(), memory_order_relaxed);
+    memset(&g_shared_shard, 0, sizeof(g_shared_shard));
+    g_shared_shard.shared = true;
+    atomic_store_explicit(&g_start_ms, now_monotonic_ms(), memory_order_relaxed);
+}
+
+void metrics_register_thread(int worker) {
+    if (t_shard != NULL) {
+        return;
+    }
+    unsigned idx = atomic_load_explicit(&g_shard_count, memory_order_relaxed);
+    if (idx >= METRICS_MAX_SHARDS) {
+        return;
+    }
+    metrics_shard_t *shard = aligned_alloc(_Alignof(metrics_shard_t), sizeof(metrics_shard_t));
+    if (shard == NULL) {
+        return;
+    }
+    memset(shard, 0, sizeof(*shard));
+    shard->worker = worker;
+
+    /* Claim a slot; shards are never freed so readers may hold pointers across renders. */
+    idx = atomic_fetch_add_explicit(&g_shard_count, 1, memory_order_acq_rel);
+    if (idx >= METRICS_MAX_SHARDS) {
+        atomic_fetch_sub_explicit(&g_shard_count, 1, memory_order_relaxed);
+        free(shard);
+        return;
+    }
+    atomic_store_explicit(&g_shards[idx], shard, memory_order_release);
+    t_shard = shard;
+}
+
+void metrics_set_route_name(unsigned route, const char *name) {
+    if (route < METRICS_MAX_ROUTES) {
+        g_route_names[route] = name;
+    }
 }
 
 void metrics_inc_requests(void) {
-    atomic_fetch_add_explicit(&g_metrics.requests_total, 1, memory_order_relaxed);
+    metrics_shard_t *shard = local_shard();
+    shard_add(shard, &shard->requests_total, 1);
 }
 
 void metrics_add_bytes_in(size_t n) {
-    atomic_fetch_add_explicit(&g_metrics.bytes_in, (unsigned long long)n, memory_order_relaxed);
+    metrics_shard_t *shard = local_shard();
+    shard_add(shard, &shard->bytes_in, (unsigned long long)n);
 }
 
 void metrics_add_bytes_out(size_t n) {
-    atomic_fetch_add_explicit(&g_metrics.bytes_out, (unsigned long long)n, memory_order_relaxed);
+    metrics_shard_t *shard = local_shard();
+    shard_add(shard, &shard->bytes_out, (unsigned long long)n);
 }
 
 void metrics_inc_connections(void) {
-    atomic_fetch_add_explicit(&g_metrics.connections_current, 1, memory_order_relaxed);
+    metrics_shard_t *shard = local_shard();
+    shard_add(shard, &shard->connections_opened, 1);
 }
 
 void metrics_dec_connections(void) {
-    atomic_fetch_sub_explicit(&g_metrics.connections_current, 1, memory_order_relaxed);
+    metrics_shard_t *shard = local_shard();
+    shard_add(shard, &shard->connections_closed, 1);
+}
+
+void metrics_inc_rebalanced_connections(void) {
+    metrics_shard_t *shard = local_shard();
+    shard_add(shard, &shard->connections_rebalanced, 1);
+}
+
+void metrics_inc_accept_errors(void) {
+    metrics_shard_t *shard = local_shard();
+    shard_add(shard, &shard->accept_errors, 1);
+}
+
+void metrics_add_tx(
+    unsigned long long responses,
+    unsigned long long syscalls,
+    unsigned long long packets,
+    unsigned long long closed_responses
+) {
+    metrics_shard_t *shard = local_shard();
+    shard_add(shard, &shard->tx_responses, responses);
+    shard_add(shard, &shard->tx_syscalls, syscalls);
+    shard_add(shard, &shard->tx_packets, packets);
+    shard_add(shard, &shard->tx_closed_responses, closed_responses);
+}
+
+void metrics_observe_tls_handshake(bool resumed, bool kernel_tx) {
+    metrics_shard_t *shard = local_shard();
+    shard_add(shard, &shard->tls_handshakes, 1);
+    if (resumed) {
+        shard_add(shard, &shard->tls_resumed, 1);
+    }
+    if (kernel_tx) {
+        shard_add(shard, &shard->tls_kernel_tx, 1);
+    }
+}
+
+void metrics_observe_response(unsigned route, int status, uint64_t latency_ns) {
+    metrics_shard_t *shard = local_shard();
+    if (route >= METRICS_MAX_ROUTES) {
+        route = 0;
+    }
+    if (status >= METRICS_STATUS_MIN && status <= METRICS_STATUS_MAX) {
+        shard_add(shard, &shard->status[status - METRICS_STATUS_MIN], 1);
+    }
+
+    unsigned bucket = 0;
+    while (bucket < METRICS_LATENCY_BUCKETS && latency_ns > k_latency_bounds_ns[bucket]) {
+        ++bucket;
+    }
+    shard_add(shard, &shard->route_responses[route], 1);
+    shard_add(shard, &shard->route_latency_sum_ns[route], latency_ns);
+    shard_add(shard, &shard->route_latency[route][bucket], 1);
+}
+
+static double ratio(unsigned long long num, unsigned long long den) {
+    return den == 0 ? 0.0 : (double)num / (double)den;
 }
 
 unsigned long long metrics_requests_total(void) {
-    return atomic_load_explicit(&g_metrics.requests_total, memory_order_relaxed);
+    return SUM_FIELD(requests_total);
 }
 
 unsigned long long metrics_connections_current(void) {
-    return atomic_load_explicit(&g_metrics.connections_current, memory_order_relaxed);
+    unsigned long long opened = SUM_FIELD(connections_opened);
+    unsigned long long closed = SUM_FIELD(connections_closed);
+    return opened > closed ? opened - closed : 0;
 }
 
 unsigned long long metrics_bytes_in(void) {
-    return atomic_load_explicit(&g_metrics.bytes_in, memory_order_relaxed);
+    return SUM_FIELD(bytes_in);
 }
 
 unsigned long long metrics_bytes_out(void) {
-    return atomic_load_explicit(&g_metrics.bytes_out, memory_order_relaxed);
+    return SUM_FIELD(bytes_out);
 }
 
 double metrics_requests_per_sec(void) {
-    unsigned long long start_ms = atomic_load_explicit(&g_metrics.start_ms, memory_order_relaxed);
+    unsigned long long start_ms = atomic_load_explicit(&g_start_ms, memory_order_relaxed);
     unsigned long long now_ms = now_monotonic_ms();
     if (now_ms <= start_ms) {
         return 0.0;
@@ -77,31 +252,167 @@ double metrics_requests_per_sec(void) {
     return (double)metrics_requests_total() / elapsed_sec;
 }
 
-void metrics_render_plain(char *buf, size_t cap, size_t *out_len) {
-    int n = snprintf(
-        buf,
-        cap,
-        "requests_total %llu\n"
-        "requests_per_sec %.2f\n"
-        "connections_current %llu\n"
-        "bytes_in %llu\n"
-        "bytes_out %llu\n",
-        metrics_requests_total(),
-        metrics_requests_per_sec(),
-        metrics_connections_current(),
-        metrics_bytes_in(),
-        metrics_bytes_out()
+typedef struct {
+    char *buf;
+    size_t cap;
+    size_t len;
+} render_buf_t;
+
+static void render(render_buf_t *out, const char *fmt, ...) {
+    if (out->len >= out->cap) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(out->buf + out->len, out->cap - out->len, fmt, ap);
+    va_end(ap);
+    if (n > 0) {
+        out->len += (size_t)n;
+    }
+}
+
+static void render_meta(render_buf_t *out, const char *name, const char *type, const char *help) {
+    render(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void render_routes_and_latency(render_buf_t *out) {
+    unsigned long long responses[METRICS_MAX_ROUTES] = {0};
+    unsigned long long sum_ns[METRICS_MAX_ROUTES] = {0};
+    unsigned long long buckets[METRICS_MAX_ROUTES][METRICS_LATENCY_BUCKETS + 1];
+    memset(buckets, 0, sizeof(buckets));
+
+    FOR_EACH_SHARD(shard) {
+        for (unsigned r = 0; r < METRICS_MAX_ROUTES; ++r) {
+            responses[r] += atomic_load_explicit(&shard->route_responses[r], memory_order_relaxed);
+            sum_ns[r] += atomic_load_explicit(&shard->route_latency_sum_ns[r], memory_order_relaxed);
+            for (unsigned b = 0; b <= METRICS_LATENCY_BUCKETS; ++b) {
+                buckets[r][b] += atomic_load_explicit(&shard->route_latency[r][b], memory_order_relaxed);
+            }
+        }
+    }
+
+    render_meta(out, "http_responses_by_route_total", "counter", "Completed responses by route.");
+    for (unsigned r = 0; r < METRICS_MAX_ROUTES; ++r) {
+        if (g_route_names[r] != NULL) {
+            render(out, "http_responses_by_route_total{route=\"%s\"} %llu\n", g_route_names[r], responses[r]);
+        }
+    }
+
+    render_meta(
+        out,
+        "http_request_duration_seconds",
+        "histogram",
+        "Time from the first request byte to the last response byte handed to the kernel."
     );
+    for (unsigned r = 0; r < METRICS_MAX_ROUTES; ++r) {
+        if (g_route_names[r] == NULL) {
+            continue;
+        }
+        unsigned long long cumulative = 0;
+        for (unsigned b = 0; b < METRICS_LATENCY_BUCKETS; ++b) {
+            cumulative += buckets[r][b];
+            render(
+                out,
+                "http_request_duration_seconds_bucket{route=\"%s\",le=\"%s\"} %llu\n",
+                g_route_names[r],
+                k_latency_bounds_text[b],
+                cumulative
+            );
+        }
+        cumulative += buckets[r][METRICS_LATENCY_BUCKETS];
+        render(out, "http_request_duration_seconds_bucket{route=\"%s\",le=\"+Inf\"} %llu\n", g_route_names[r], cumulative);
+        render(out, "http_request_duration_seconds_sum{route=\"%s\"} %.6f\n", g_route_names[r], (double)sum_ns[r] / 1e9);
+        render(out, "http_request_duration_seconds_count{route=\"%s\"} %llu\n", g_route_names[r], cumulative);
+    }
+}
 
-    if (n < 0) {
-        if (out_len != NULL) {
-            *out_len = 0;
+/* A worker's connections_opened counts the sockets it accepted, or adopted fresh from the acceptor thread. */
+static void render_accepts(render_buf_t *out) {
+    unsigned long long accepted[METRICS_MAX_SHARDS] = {0};
+    bool seen[METRICS_MAX_SHARDS] = {false};
+    FOR_EACH_SHARD(shard) {
+        if (!shard->shared && shard->worker >= 0 && shard->worker < METRICS_MAX_SHARDS) {
+            accepted[shard->worker] += atomic_load_explicit(&shard->connections_opened, memory_order_relaxed);
+            seen[shard->worker] = true;
         }
-        return;
+    }
+    render_meta(out, "connections_accepted_total", "counter", "Client connections accepted, by worker.");
+    for (int w = 0; w < METRICS_MAX_SHARDS; ++w) {
+        if (seen[w]) {
+            render(out, "connections_accepted_total{worker=\"%d\"} %llu\n", w, accepted[w]);
+        }
+    }
+}
+
+static void render_status(render_buf_t *out) {
+    render_meta(out, "http_responses_by_status_total", "counter", "Completed responses by status code.");
+    for (int code = METRICS_STATUS_MIN; code <= METRICS_STATUS_MAX; ++code) {
+        unsigned long long total = 0;
+        FOR_EACH_SHARD(shard) {
+            total += atomic_load_explicit(&shard->status[code - METRICS_STATUS_MIN], memory_order_relaxed);
+        }
+        if (total > 0) {
+            render(out, "http_responses_by_status_total{code=\"%d\"} %llu\n", code, total);
+        }
+    }
+}
+
+void metrics_render_plain(char *buf, size_t cap, size_t *out_len) {
+    render_buf_t out = {buf, cap, 0};
+    unsigned long long tx_responses = SUM_FIELD(tx_responses);
+    unsigned long long tx_syscalls = SUM_FIELD(tx_syscalls);
+    unsigned long long tx_packets = SUM_FIELD(tx_packets);
+    unsigned long long tx_closed = SUM_FIELD(tx_closed_responses);
+
+    render_meta(&out, "requests_total", "counter", "Requests parsed, including malformed ones.");
+    render(&out, "requests_total %llu\n", metrics_requests_total());
+    render_meta(&out, "requests_per_sec", "gauge", "Average request rate since startup.");
+    render(&out, "requests_per_sec %.2f\n", metrics_requests_per_sec());
+    render_meta(&out, "connections_current", "gauge", "Open client connections.");
+    render(&out, "connections_current %llu\n", metrics_connections_current());
+    render_meta(&out, "connections_rebalanced_total", "counter", "Idle connections moved to a less loaded worker.");
+    render(&out, "connections_rebalanced_total %llu\n", SUM_FIELD(connections_rebalanced));
+    render_accepts(&out);
+    render_meta(&out, "accept_errors_total", "counter", "Failed accepts other than an empty queue, such as running out of descriptors.");
+    render(&out, "accept_errors_total %llu\n", SUM_FIELD(accept_errors));
+    render_meta(&out, "bytes_in", "counter", "Bytes read from client sockets.");
+    render(&out, "bytes_in %llu\n", metrics_bytes_in());
+    render_meta(&out, "bytes_out", "counter", "Bytes written to client sockets.");
+    render(&out, "bytes_out %llu\n", metrics_bytes_out());
+    render_meta(&out, "tx_responses_total", "counter", "Responses fully sent.");
+    render(&out, "tx_responses_total %llu\n", tx_responses);
+    render_meta(&out, "tx_syscalls_total", "counter", "Transmit system calls (or io_uring transmit chains).");
+    render(&out, "tx_syscalls_total %llu\n", tx_syscalls);
+    render_meta(&out, "tx_packets_total", "counter", "TCP data segments sent on closed connections.");
+    render(&out, "tx_packets_total %llu\n", tx_packets);
+    render_meta(&out, "tx_syscalls_per_response", "gauge", "Transmit system calls per response.");
+    render(&out, "tx_syscalls_per_response %.3f\n", ratio(tx_syscalls, tx_responses));
+    render_meta(&out, "tx_packets_per_response", "gauge", "TCP data segments per response on closed connections.");
+    render(&out, "tx_packets_per_response %.3f\n", ratio(tx_packets, tx_closed));
+    render_meta(&out, "tls_handshakes_total", "counter", "Completed TLS handshakes.");
+    render(&out, "tls_handshakes_total %llu\n", SUM_FIELD(tls_handshakes));
+    render_meta(&out, "tls_resumed_total", "counter", "TLS handshakes that resumed a session from a ticket.");
+    render(&out, "tls_resumed_total %llu\n", SUM_FIELD(tls_resumed));
+    render_meta(&out, "tls_ktls_tx_total", "counter", "TLS connections whose records the kernel seals (kTLS).");
+    render(&out, "tls_ktls_tx_total %llu\n", SUM_FIELD(tls_kernel_tx));
+
+    render_routes_and_latency(&out);
+    render_status(&out);
+
+    pool_stat_t pools[POOL_STATS_MAX];
+    size_t pool_count = pool_stats_snapshot(pools, POOL_STATS_MAX);
+    for (size_t i = 0; i < pool_count; ++i) {
+        char name[POOL_NAME_CAP + 32];
+        snprintf(name, sizeof(name), "pool_%s_in_use", pools[i].name);
+        render_meta(&out, name, "gauge", "Objects handed out from the pool and not yet returned.");
+        render(&out, "%s %llu\n", name, pools[i].in_use);
+        snprintf(name, sizeof(name), "pool_%s_high_water", pools[i].name);
+        render_meta(&out, name, "gauge", "Sum of each worker's peak objects in use from the pool.");
+        render(&out, "%s %llu\n", name, pools[i].high_water);
     }
 
     if (out_len != NULL) {
-        size_t written = (size_t)n;
+        size_t written = out.len;
         if (written >= cap) {
             written = (cap == 0) ? 0 : cap - 1;
         }
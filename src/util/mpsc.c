@@ -0,0 +1,33 @@
+#include "mpsc.h"
+
+#include <stddef.h>
+
+void mpsc_init(mpsc_queue_t *q) {
+    atomic_init(&q->head, NULL);
+}
+
+bool mpsc_push(mpsc_queue_t *q, mpsc_node_t *node) {
+    mpsc_node_t *old = atomic_load_explicit(&q->head, memory_order_relaxed);
+    do {
+        node->next = old;
+    } while (!atomic_compare_exchange_weak_explicit(
+        &q->head,
+        &old,
+        node,
+        memory_order_release,
+        memory_order_relaxed
+    ));
+    return old == NULL;
+}
+
+mpsc_node_t *mpsc_take_all(mpsc_queue_t *q) {
+    mpsc_node_t *node = atomic_exchange_explicit(&q->head, NULL, memory_order_acquire);
+    mpsc_node_t *ordered = NULL;
+    while (node != NULL) {
+        mpsc_node_t *next = node->next;
+        node->next = ordered;
+        ordered = node;
+        node = next;
+    }
+    return ordered;
+}
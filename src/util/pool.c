@@ -0,0 +1,263 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Every initialised pool's counter, in registration order. Walked only when metrics are rendered. */
+static pool_counter_t *g_counters_head;
+static pool_counter_t *g_counters_tail;
+static pthread_mutex_t g_counters_mu = PTHREAD_MUTEX_INITIALIZER;
+
+static void pool_counter_register(pool_counter_t *counter, const char *name) {
+    snprintf(counter->name, sizeof(counter->name), "%s", name);
+    atomic_init(&counter->in_use, 0);
+    atomic_init(&counter->high_water, 0);
+    counter->next = NULL;
+
+    pthread_mutex_lock(&g_counters_mu);
+    counter->prev = g_counters_tail;
+    if (g_counters_tail != NULL) {
+        g_counters_tail->next = counter;
+    } else {
+        g_counters_head = counter;
+    }
+    g_counters_tail = counter;
+    pthread_mutex_unlock(&g_counters_mu);
+}
+
+static void pool_counter_unregister(pool_counter_t *counter) {
+    pthread_mutex_lock(&g_counters_mu);
+    if (counter->prev != NULL) {
+        counter->prev->next = counter->next;
+    } else if (g_counters_head == counter) {
+        g_counters_head = counter->next;
+    }
+    if (counter->next != NULL) {
+        counter->next->prev = counter->prev;
+    } else if (g_counters_tail == counter) {
+        g_counters_tail = counter->prev;
+    }
+    counter->prev = NULL;
+    counter->next = NULL;
+    pthread_mutex_unlock(&g_counters_mu);
+}
+
+/* Single writer: a relaxed load/store pair avoids a locked RMW on the hot path. */
+static void pool_counter_acquire(pool_counter_t *counter) {
+    size_t now = atomic_load_explicit(&counter->in_use, memory_order_relaxed) + 1;
+    atomic_store_explicit(&counter->in_use, now, memory_order_relaxed);
+    if (now > atomic_load_explicit(&counter->high_water, memory_order_relaxed)) {
+        atomic_store_explicit(&counter->high_water, now, memory_order_relaxed);
+    }
+}
+
+static void pool_counter_release(pool_counter_t *counter) {
+    size_t now = atomic_load_explicit(&counter->in_use, memory_order_relaxed);
+    atomic_store_explicit(&counter->in_use, now - 1, memory_order_relaxed);
+}
+
+size_t pool_stats_snapshot(pool_stat_t *out, size_t cap) {
+    size_t len = 0;
+    pthread_mutex_lock(&g_counters_mu);
+    for (pool_counter_t *counter = g_counters_head; counter != NULL; counter = counter->next) {
+        size_t i = 0;
+        while (i < len && strcmp(out[i].name, counter->name) != 0) {
+            ++i;
+        }
+        if (i == len) {
+            if (len == cap) {
+                continue;
+            }
+            snprintf(out[i].name, sizeof(out[i].name), "%s", counter->name);
+            out[i].in_use = 0;
+            out[i].high_water = 0;
+            ++len;
+        }
+        out[i].in_use += atomic_load_explicit(&counter->in_use, memory_order_relaxed);
+        out[i].high_water += atomic_load_explicit(&counter->high_water, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&g_counters_mu);
+    return len;
+}
+
+int slab_pool_init(slab_pool_t *pool, const char *name, size_t obj_size, size_t objs_per_slab) {
+    if (pool == NULL || obj_size == 0 || objs_per_slab == 0) {
+        return -1;
+    }
+
+    memset(pool, 0, sizeof(*pool));
+
+    size_t align = alignof(max_align_t);
+    if (obj_size < sizeof(void *)) {
+        obj_size = sizeof(void *);
+    }
+    obj_size = (obj_size + align - 1) & ~(align - 1);
+    if (obj_size > SIZE_MAX / objs_per_slab) {
+        return -1;
+    }
+
+    pool->obj_size = obj_size;
+    pool->objs_per_slab = objs_per_slab;
+    pool_counter_register(&pool->stat, name);
+    return 0;
+}
+
+static int slab_pool_grow(slab_pool_t *pool) {
+    if (pool->slabs_len == pool->slabs_cap) {
+        size_t new_cap = pool->slabs_cap == 0 ? 16 : pool->slabs_cap * 2;
+        void **next = realloc(pool->slabs, new_cap * sizeof(*pool->slabs));
+        if (next == NULL) {
+            return -1;
+        }
+        pool->slabs = next;
+        pool->slabs_cap = new_cap;
+    }
+
+    char *slab = malloc(pool->obj_size * pool->objs_per_slab);
+    if (slab == NULL) {
+        return -1;
+    }
+    pool->slabs[pool->slabs_len++] = slab;
+
+    for (size_t i = pool->objs_per_slab; i > 0; --i) {
+        void *obj = slab + (i - 1) * pool->obj_size;
+        *(void **)obj = pool->free_list;
+        pool->free_list = obj;
+    }
+    return 0;
+}
+
+void *slab_pool_alloc(slab_pool_t *pool) {
+    if (pool->free_list == NULL && slab_pool_grow(pool) != 0) {
+        return NULL;
+    }
+
+    void *obj = pool->free_list;
+    pool->free_list = *(void **)obj;
+    memset(obj, 0, pool->obj_size);
+    pool_counter_acquire(&pool->stat);
+    return obj;
+}
+
+void slab_pool_free(slab_pool_t *pool, void *obj) {
+    if (obj == NULL) {
+        return;
+    }
+    *(void **)obj = pool->free_list;
+    pool->free_list = obj;
+    pool_counter_release(&pool->stat);
+}
+
+void slab_pool_destroy(slab_pool_t *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    pool_counter_unregister(&pool->stat);
+    for (size_t i = 0; i < pool->slabs_len; ++i) {
+        free(pool->slabs[i]);
+    }
+    free(pool->slabs);
+    memset(pool, 0, sizeof(*pool));
+}
+
+void slab_pool_abandon(slab_pool_t *pool) {
+    if (pool != NULL) {
+        pool_counter_unregister(&pool->stat);
+    }
+}
+
+static int buf_class_index(size_t size) {
+    int idx = 0;
+    size_t class_size = BUF_POOL_MIN_SIZE;
+    while (class_size < size) {
+        class_size <<= 1;
+        ++idx;
+    }
+    return idx;
+}
+
+int buf_pool_init(buf_pool_t *pool) {
+    if (pool == NULL) {
+        return -1;
+    }
+
+    memset(pool, 0, sizeof(*pool));
+    for (int i = 0; i < BUF_POOL_CLASSES; ++i) {
+        size_t class_size = BUF_POOL_MIN_SIZE << i;
+        char name[POOL_NAME_CAP + 1];
+        snprintf(name, sizeof(name), "buf_%zuk", class_size / 1024);
+
+        buf_class_t *cls = &pool->classes[i];
+        cls->cached_max = BUF_POOL_CACHE_BYTES / class_size;
+        if (cls->cached_max < 4) {
+            cls->cached_max = 4;
+        }
+        pool_counter_register(&cls->stat, name);
+    }
+    return 0;
+}
+
+char *buf_pool_acquire(buf_pool_t *pool, size_t min_size, size_t *out_cap) {
+    if (pool == NULL || min_size > BUF_POOL_MAX_SIZE) {
+        return NULL;
+    }
+
+    int idx = buf_class_index(min_size);
+    buf_class_t *cls = &pool->classes[idx];
+    size_t class_size = BUF_POOL_MIN_SIZE << idx;
+
+    char *buf = cls->free_list;
+    if (buf != NULL) {
+        cls->free_list = *(void **)buf;
+        --cls->cached;
+    } else {
+        buf = malloc(class_size);
+        if (buf == NULL) {
+            return NULL;
+        }
+    }
+
+    pool_counter_acquire(&cls->stat);
+    if (out_cap != NULL) {
+        *out_cap = class_size;
+    }
+    return buf;
+}
+
+void buf_pool_release(buf_pool_t *pool, char *buf, size_t cap) {
+    if (pool == NULL || buf == NULL) {
+        return;
+    }
+
+    int idx = buf_class_index(cap);
+    buf_class_t *cls = &pool->classes[idx];
+    pool_counter_release(&cls->stat);
+
+    if (cls->cached >= cls->cached_max) {
+        free(buf);
+        return;
+    }
+    *(void **)buf = cls->free_list;
+    cls->free_list = buf;
+    ++cls->cached;
+}
+
+void buf_pool_destroy(buf_pool_t *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    for (int i = 0; i < BUF_POOL_CLASSES; ++i) {
+        buf_class_t *cls = &pool->classes[i];
+        while (cls->free_list != NULL) {
+            void *next = *(void **)cls->free_list;
+            free(cls->free_list);
+            cls->free_list = next;
+        }
+        cls->cached = 0;
+        pool_counter_unregister(&cls->stat);
+    }
+}
@@ -0,0 +1,137 @@
+#include "timer_wheel.h"
+
+#include <string.h>
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1U)
+#define TIMER_WHEEL_SPAN ((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+static void list_init(timer_node_t *head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static bool list_empty(const timer_node_t *head) {
+    return head->next == head;
+}
+
+static void list_push(timer_node_t *head, timer_node_t *node) {
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+static void list_unlink(timer_node_t *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = NULL;
+    node->prev = NULL;
+}
+
+static void wheel_place(timer_wheel_t *wheel, timer_node_t *node) {
+    /* Already due: fire on the next tick rather than in the slot being processed. */
+    if (node->expires <= wheel->now) {
+        node->expires = wheel->now + 1;
+    }
+    uint64_t delta = node->expires - wheel->now;
+    if (delta >= TIMER_WHEEL_SPAN) {
+        node->expires = wheel->now + TIMER_WHEEL_SPAN - 1;
+        delta = TIMER_WHEEL_SPAN - 1;
+    }
+
+    unsigned level = 0;
+    while (level + 1 < TIMER_WHEEL_LEVELS && delta >= ((uint64_t)1 << (TIMER_WHEEL_BITS * (level + 1)))) {
+        ++level;
+    }
+    unsigned slot = (unsigned)(node->expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    list_push(&wheel->slots[level][slot], node);
+}
+
+void timer_wheel_init(timer_wheel_t *wheel, unsigned tick_ms, uint64_t now_ms) {
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->tick_ms = tick_ms == 0 ? 1 : tick_ms;
+    wheel->now = now_ms / wheel->tick_ms;
+    for (unsigned l = 0; l < TIMER_WHEEL_LEVELS; ++l) {
+        for (unsigned s = 0; s < TIMER_WHEEL_SLOTS; ++s) {
+            list_init(&wheel->slots[l][s]);
+        }
+    }
+}
+
+bool timer_node_armed(const timer_node_t *node) {
+    return node->next != NULL;
+}
+
+void timer_wheel_arm(timer_wheel_t *wheel, timer_node_t *node, uint64_t expires_ms) {
+    /* Round up so a timer never fires before its deadline. */
+    uint64_t expires = (expires_ms + wheel->tick_ms - 1) / wheel->tick_ms;
+    if (timer_node_armed(node)) {
+        if (node->expires == expires) {
+            return;
+        }
+        list_unlink(node);
+    } else {
+        ++wheel->armed;
+    }
+    node->expires = expires;
+    wheel_place(wheel, node);
+}
+
+void timer_wheel_cancel(timer_wheel_t *wheel, timer_node_t *node) {
+    if (!timer_node_armed(node)) {
+        return;
+    }
+    list_unlink(node);
+    --wheel->armed;
+}
+
+static void wheel_cascade(timer_wheel_t *wheel, unsigned level, unsigned slot) {
+    timer_node_t *head = &wheel->slots[level][slot];
+    if (list_empty(head)) {
+        return;
+    }
+    timer_node_t pending;
+    pending.next = head->next;
+    pending.prev = head->prev;
+    pending.next->prev = &pending;
+    pending.prev->next = &pending;
+    list_init(head);
+
+    while (!list_empty(&pending)) {
+        timer_node_t *node = pending.next;
+        list_unlink(node);
+        wheel_place(wheel, node);
+    }
+}
+
+size_t timer_wheel_advance(timer_wheel_t *wheel, uint64_t now_ms, timer_fire_fn fire, void *arg) {
+    uint64_t target = now_ms / wheel->tick_ms;
+    size_t fired = 0;
+
+    while (wheel->now < target) {
+        if (wheel->armed == 0) {
+            wheel->now = target;
+            break;
+        }
+        uint64_t t = ++wheel->now;
+
+        for (unsigned level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+            uint64_t low_mask = ((uint64_t)1 << (TIMER_WHEEL_BITS * level)) - 1;
+            if ((t & low_mask) != 0) {
+                break;
+            }
+            wheel_cascade(wheel, level, (unsigned)(t >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+        }
+
+        /* Pop one at a time: fire may cancel or re-arm other nodes in this slot. */
+        timer_node_t *head = &wheel->slots[0][t & TIMER_WHEEL_MASK];
+        while (!list_empty(head)) {
+            timer_node_t *node = head->next;
+            list_unlink(node);
+            --wheel->armed;
+            ++fired;
+            fire(node, arg);
+        }
+    }
+    return fired;
+}
@@ -1,35 +1,49 @@
 #include "util.h"
 
-#include <ctype.h>
 #include <string.h>
 #include <time.h>
 
+static const char k_days[7][4] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char k_months[12][4] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static int ascii_lower(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? (c | 0x20) : c;
+}
+
 uint64_t util_now_ms(void) {
     struct timespec ts;
     clock_gettime(CLOCK_MONOTONIC, &ts);
     return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)(ts.tv_nsec / 1000000ULL);
 }
 
+uint64_t util_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
 int util_ascii_casecmp(const char *a, const char *b) {
     while (*a != '\0' && *b != '\0') {
-        int ca = tolower((unsigned char)*a);
-        int cb = tolower((unsigned char)*b);
+        int ca = ascii_lower((unsigned char)*a);
+        int cb = ascii_lower((unsigned char)*b);
         if (ca != cb) {
             return ca - cb;
         }
         ++a;
         ++b;
     }
-    return tolower((unsigned char)*a) - tolower((unsigned char)*b);
+    return ascii_lower((unsigned char)*a) - ascii_lower((unsigned char)*b);
 }
 
 int util_ascii_ncasecmp(const char *a, const char *b, size_t n) {
     for (size_t i = 0; i < n; ++i) {
         if (a[i] == '\0' || b[i] == '\0') {
-            return tolower((unsigned char)a[i]) - tolower((unsigned char)b[i]);
+            return ascii_lower((unsigned char)a[i]) - ascii_lower((unsigned char)b[i]);
         }
-        int ca = tolower((unsigned char)a[i]);
-        int cb = tolower((unsigned char)b[i]);
+        int ca = ascii_lower((unsigned char)a[i]);
+        int cb = ascii_lower((unsigned char)b[i]);
         if (ca != cb) {
             return ca - cb;
         }
@@ -89,3 +103,83 @@ bool util_static_path_is_safe(const char *path) {
 
     return true;
 }
+
+static char *put_digits(char *p, int v, int n) {
+    for (int i = n - 1; i >= 0; --i) {
+        p[i] = (char)('0' + v % 10);
+        v /= 10;
+    }
+    return p + n;
+}
+
+void util_http_date_format(time_t t, char *out) {
+    struct tm tm;
+    if (gmtime_r(&t, &tm) == NULL || tm.tm_year + 1900 > 9999 || tm.tm_year + 1900 < 0) {
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_mday = 1;
+        tm.tm_year = 70;
+        tm.tm_wday = 4;
+    }
+    /* Fixed layout, independent of the C locale. */
+    char *p = out;
+    memcpy(p, k_days[tm.tm_wday], 3);
+    p += 3;
+    *p++ = ',';
+    *p++ = ' ';
+    p = put_digits(p, tm.tm_mday, 2);
+    *p++ = ' ';
+    memcpy(p, k_months[tm.tm_mon], 3);
+    p += 3;
+    *p++ = ' ';
+    p = put_digits(p, tm.tm_year + 1900, 4);
+    *p++ = ' ';
+    p = put_digits(p, tm.tm_hour, 2);
+    *p++ = ':';
+    p = put_digits(p, tm.tm_min, 2);
+    *p++ = ':';
+    p = put_digits(p, tm.tm_sec, 2);
+    memcpy(p, " GMT", 5);
+}
+
+static int parse_digits(const char *s, int n, int *out) {
+    int v = 0;
+    for (int i = 0; i < n; ++i) {
+        if (s[i] < '0' || s[i] > '9') {
+            return -1;
+        }
+        v = v * 10 + (s[i] - '0');
+    }
+    *out = v;
+    return 0;
+}
+
+int util_http_date_parse(const char *s, size_t len, time_t *out) {
+    /* "Sun, 06 Nov 1994 08:49:37 GMT" */
+    if (len != UTIL_HTTP_DATE_LEN || s[3] != ',' || s[4] != ' ' || s[7] != ' ' || s[11] != ' ' ||
+        s[16] != ' ' || s[19] != ':' || s[22] != ':' || memcmp(s + 25, " GMT", 4) != 0) {
+        return -1;
+    }
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_mon = -1;
+    for (int m = 0; m < 12; ++m) {
+        if (memcmp(s + 8, k_months[m], 3) == 0) {
+            tm.tm_mon = m;
+        }
+    }
+    int year;
+    if (tm.tm_mon < 0 ||
+        parse_digits(s + 5, 2, &tm.tm_mday) != 0 ||
+        parse_digits(s + 12, 4, &year) != 0 ||
+        parse_digits(s + 17, 2, &tm.tm_hour) != 0 ||
+        parse_digits(s + 20, 2, &tm.tm_min) != 0 ||
+        parse_digits(s + 23, 2, &tm.tm_sec) != 0) {
+        return -1;
+    }
+    if (tm.tm_mday < 1 || tm.tm_mday > 31 || tm.tm_hour > 23 || tm.tm_min > 59 || tm.tm_sec > 60) {
+        return -1;
+    }
+    tm.tm_year = year - 1900;
+    *out = timegm(&tm);
+    return 0;
+}
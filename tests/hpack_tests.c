@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hpack.h"
+
+static int g_failures = 0;
+
+#define CHECK(expr)                                                                                 \
+    do {                                                                                            \
+        if (!(expr)) {                                                                              \
+            fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #expr);                      \
+            ++g_failures;                                                                           \
+        }                                                                                           \
+    } while (0)
+
+/* Decoded fields flattened to "name: value\n" lines. */
+typedef struct {
+    char text[4096];
+    size_t len;
+} fields_t;
+
+static void collect(void *arg, const char *name, size_t name_len, const char *value, size_t value_len) {
+    fields_t *f = arg;
+    int n = snprintf(
+        f->text + f->len,
+        sizeof(f->text) - f->len,
+        "%.*s: %.*s\n",
+        (int)name_len,
+        name,
+        (int)value_len,
+        value
+    );
+    if (n > 0) {
+        f->len += (size_t)n;
+    }
+}
+
+static size_t from_hex(const char *hex, uint8_t *out) {
+    size_t n = 0;
+    for (const char *p = hex; p[0] != '\0';) {
+        if (p[0] == ' ') {
+            ++p;
+            continue;
+        }
+        unsigned v;
+        sscanf(p, "%2x", &v);
+        out[n++] = (uint8_t)v;
+        p += 2;
+    }
+    return n;
+}
+
+static int decode_hex(hpack_decoder_t *dec, const char *hex, fields_t *f) {
+    uint8_t block[512];
+    size_t len = from_hex(hex, block);
+    f->len = 0;
+    f->text[0] = '\0';
+    return hpack_decode(dec, block, len, collect, f);
+}
+
+/* RFC 7541 C.3: requests without Huffman coding sharing one dynamic table. */
+static void test_requests_plain(void) {
+    hpack_decoder_t dec;
+    hpack_decoder_init(&dec);
+    fields_t f;
+
+    CHECK(decode_hex(&dec, "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d", &f) == 0);
+    CHECK(strcmp(f.text, ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n") == 0);
+    CHECK(dec.size == 57);
+
+    CHECK(decode_hex(&dec, "8286 84be 5808 6e6f 2d63 6163 6865", &f) == 0);
+    CHECK(strcmp(f.text, ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\ncache-control: no-cache\n") ==
+        0);
+    CHECK(dec.size == 110);
+
+    CHECK(decode_hex(
+        &dec,
+        "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65",
+        &f
+    ) == 0);
+    CHECK(strcmp(
+        f.text,
+        ":method: GET\n:scheme: https\n:path: /index.html\n:authority: www.example.com\ncustom-key: custom-value\n"
+    ) == 0);
+    CHECK(dec.size == 164);
+}
+
+/* RFC 7541 C.4: the same requests with Huffman-coded strings. */
+static void test_requests_huffman(void) {
+    hpack_decoder_t dec;
+    hpack_decoder_init(&dec);
+    fields_t f;
+
+    CHECK(decode_hex(&dec, "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff", &f) == 0);
+    CHECK(strcmp(f.text, ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n") == 0);
+
+    CHECK(decode_hex(&dec, "8286 84be 5886 a8eb 1064 9cbf", &f) == 0);
+    CHECK(strcmp(f.text, ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\ncache-control: no-cache\n") ==
+        0);
+
+    CHECK(decode_hex(&dec, "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf", &f) == 0);
+    CHECK(strcmp(
+        f.text,
+        ":method: GET\n:scheme: https\n:path: /index.html\n:authority: www.example.com\ncustom-key: custom-value\n"
+    ) == 0);
+    CHECK(dec.size == 164);
+}
+
+/* RFC 7541 C.6: responses through a 256-byte table, so entries get evicted. */
+static void test_responses_eviction(void) {
+    hpack_decoder_t dec;
+    hpack_decoder_init(&dec);
+    dec.max_size = 256;
+    fields_t f;
+
+    CHECK(decode_hex(
+        &dec,
+        "4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504 0b81 66e0 82a6 "
+        "2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8 e9ae 82ae 43d3",
+        &f
+    ) == 0);
+    CHECK(strcmp(
+        f.text,
+        ":status: 302\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:21 GMT\n"
+        "location: https://www.example.com\n"
+    ) == 0);
+    CHECK(dec.size == 222);
+
+    CHECK(decode_hex(&dec, "4883 640e ff c1 c0 bf", &f) == 0);
+    CHECK(strcmp(
+        f.text,
+        ":status: 307\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:21 GMT\n"
+        "location: https://www.example.com\n"
+    ) == 0);
+    CHECK(dec.size == 222);
+    CHECK(dec.count == 4);
+}
+
+static void test_decode_errors(void) {
+    hpack_decoder_t dec;
+    fields_t f;
+
+    hpack_decoder_init(&dec);
+    CHECK(decode_hex(&dec, "80", &f) == -1);            /* index 0 */
+    hpack_decoder_init(&dec);
+    CHECK(decode_hex(&dec, "be", &f) == -1);            /* empty dynamic table */
+    hpack_decoder_init(&dec);
+    CHECK(decode_hex(&dec, "82 3f e1 1f", &f) == -1);   /* size update after a field */
+    hpack_decoder_init(&dec);
+    CHECK(decode_hex(&dec, "3f e2 1f", &f) == -1);      /* size update over our limit */
+    hpack_decoder_init(&dec);
+    CHECK(decode_hex(&dec, "0085 f2b2 4a87", &f) == -1); /* string past the end */
+    hpack_decoder_init(&dec);
+    CHECK(decode_hex(&dec, "0081 00", &f) == -1);       /* Huffman padding that is not EOS */
+    hpack_decoder_init(&dec);
+    CHECK(decode_hex(&dec, "ff ff ff ff ff 0f", &f) == -1);
+}
+
+static void test_encode_roundtrip(void) {
+    uint8_t block[256];
+    size_t len = 0;
+    ssize_t n = hpack_encode_status(200, block, sizeof(block));
+    CHECK(n == 1 && block[0] == 0x88);
+    len += (size_t)n;
+    n = hpack_encode_status(302, block + len, sizeof(block) - len);
+    CHECK(n == 5);
+    len += (size_t)n;
+    n = hpack_encode_field("Content-Type", 12, "text/plain", 10, block + len, sizeof(block) - len);
+    CHECK(n == 13);
+    len += (size_t)n;
+    n = hpack_encode_field("X-Worker-Served", 15, "3", 1, block + len, sizeof(block) - len);
+    CHECK(n == 19);
+    len += (size_t)n;
+    uint8_t small[8];
+    CHECK(hpack_encode_field("X-Long", 6, "abcdef", 6, small, sizeof(small)) == -1);
+
+    hpack_decoder_t dec;
+    hpack_decoder_init(&dec);
+    fields_t f = {{0}, 0};
+    CHECK(hpack_decode(&dec, block, len, collect, &f) == 0);
+    CHECK(strcmp(f.text, ":status: 200\n:status: 302\ncontent-type: text/plain\nx-worker-served: 3\n") == 0);
+    CHECK(dec.count == 0);
+}
+
+int main(void) {
+    hpack_init();
+    test_requests_plain();
+    test_requests_huffman();
+    test_responses_eviction();
+    test_decode_errors();
+    test_encode_roundtrip();
+
+    if (g_failures == 0) {
+        printf("hpack tests passed\n");
+        return 0;
+    }
+
+    fprintf(stderr, "hpack tests failed: %d failure(s)\n", g_failures);
+    return 1;
+}
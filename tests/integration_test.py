@@ -1,11 +1,17 @@
 #!/usr/bin/env python3
 import argparse
+import base64
 import concurrent.futures
+import gzip
+import os
 import random
+import shutil
 import socket
+import ssl
 import subprocess
+import tempfile
 import time
-from typing import Dict, Tuple
+from typing import Dict, Optional, Tuple
 
 
 def read_response(
@@ -104,6 +110,1006 @@ def connection_close_test(host: str, port: int) -> None:
             raise AssertionError("expected server to close socket")
 
 
+def trickled_request_test(host: str, port: int) -> None:
+    with socket.create_connection((host, port), timeout=2.0) as sock:
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        raw = (
+            b"POST /echo HTTP/1.1\r\n"
+            b"Host: localhost\r\n"
+            + b"".join(f"X-Pad-{i}: {'v' * 32}\r\n".encode("ascii") for i in range(16))
+            + b"Content-Length: 7\r\n\r\ntrickle"
+        )
+        for i in range(0, len(raw), 37):
+            sock.sendall(raw[i:i + 37])
+            time.sleep(0.002)
+        pending = bytearray()
+        status, _, body, _ = read_response(sock, pending)
+        if status != 200 or body != b"trickle":
+            raise AssertionError(f"unexpected trickled response: {status} {body!r}")
+
+
+def chunked_request_test(host: str, port: int) -> None:
+    # One-byte chunks: the framing alone is larger than the connection's input buffer.
+    payload = bytes(random.Random(16).randrange(256) for _ in range(60000))
+    raw = (
+        b"POST /echo HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n"
+        + b"".join(b"1\r\n" + payload[i:i + 1] + b"\r\n" for i in range(len(payload)))
+        + b"0\r\nX-Checksum: none\r\n\r\n"
+        + b"GET /healthz HTTP/1.1\r\nHost: localhost\r\n\r\n"
+    )
+    with socket.create_connection((host, port), timeout=5.0) as sock:
+        for i in range(0, len(raw), 8192):
+            sock.sendall(raw[i:i + 8192])
+        pending = bytearray()
+        status, _, body, pending = read_response(sock, pending)
+        if status != 200 or body != payload:
+            raise AssertionError(f"unexpected chunked echo: {status} len={len(body)}")
+        status, _, body, _ = read_response(sock, pending)
+        if status != 200 or body != b"ok":
+            raise AssertionError(f"unexpected response after chunked body: {status} {body!r}")
+
+    # Split mid-size-line and mid-data across reads.
+    with socket.create_connection((host, port), timeout=2.0) as sock:
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        raw = (
+            b"POST /echo HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n"
+            b"7;ext=1\r\ntrickle\r\n1A\r\nabcdefghijklmnopqrstuvwxyz\r\n0\r\n\r\n"
+        )
+        for i in range(0, len(raw), 5):
+            sock.sendall(raw[i:i + 5])
+            time.sleep(0.002)
+        pending = bytearray()
+        status, _, body, _ = read_response(sock, pending)
+        if status != 200 or body != b"trickleabcdefghijklmnopqrstuvwxyz":
+            raise AssertionError(f"unexpected trickled chunked echo: {status} {body!r}")
+
+    smuggle = (
+        b"POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 4\r\n"
+        b"Transfer-Encoding: chunked\r\n\r\n0\r\n\r\n"
+    )
+    status, headers, _ = request_once(host, port, smuggle)
+    if status != 400 or headers.get("connection", "").lower() != "close":
+        raise AssertionError(f"expected 400 for Content-Length with Transfer-Encoding, got {status}")
+
+    status, _, _ = request_once(
+        host,
+        port,
+        b"POST /echo HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: gzip\r\n\r\n",
+    )
+    if status != 501:
+        raise AssertionError(f"expected 501 for unknown transfer coding, got {status}")
+
+
+def fnv1a64(data: bytes) -> int:
+    h = 0xCBF29CE484222325
+    for b in data:
+        h = ((h ^ b) * 0x100000001B3) & 0xFFFFFFFFFFFFFFFF
+    return h
+
+
+def read_interim(sock: socket.socket, pending: bytearray) -> int:
+    while b"\r\n\r\n" not in pending:
+        chunk = sock.recv(4096)
+        if not chunk:
+            raise RuntimeError("socket closed before interim response")
+        pending.extend(chunk)
+    end = pending.index(b"\r\n\r\n") + 4
+    status = int(bytes(pending[:end]).split(b" ", 2)[1])
+    del pending[:end]
+    return status
+
+
+def streamed_upload_test(host: str, port: int) -> None:
+    # Far larger than the input buffer: only a byte count and digest are kept.
+    block = bytes(random.Random(17).randrange(256) for _ in range(65536))
+    blocks = 64
+    expected_hash = 0xCBF29CE484222325
+    for _ in range(blocks):
+        for b in block:
+            expected_hash = ((expected_hash ^ b) * 0x100000001B3) & 0xFFFFFFFFFFFFFFFF
+    expected = f"{len(block) * blocks} {expected_hash:016x}\n".encode("ascii")
+
+    with socket.create_connection((host, port), timeout=5.0) as sock:
+        sock.sendall(
+            b"PUT /upload HTTP/1.1\r\nHost: localhost\r\n"
+            + f"Content-Length: {len(block) * blocks}\r\n".encode("ascii")
+            + b"Expect: 100-continue\r\n\r\n"
+        )
+        pending = bytearray()
+        if read_interim(sock, pending) != 100:
+            raise AssertionError("expected 100 Continue before the upload")
+        for _ in range(blocks):
+            sock.sendall(block)
+        sock.sendall(b"GET /healthz HTTP/1.1\r\nHost: localhost\r\n\r\n")
+        status, _, body, pending = read_response(sock, pending)
+        if status != 200 or body != expected:
+            raise AssertionError(f"unexpected upload response: {status} {body!r} (want {expected!r})")
+        status, _, body, _ = read_response(sock, pending)
+        if status != 200 or body != b"ok":
+            raise AssertionError(f"unexpected response after upload: {status} {body!r}")
+
+    payload = block[:5000]
+    with socket.create_connection((host, port), timeout=5.0) as sock:
+        raw = (
+            b"POST /upload HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n"
+            + b"".join(b"%x\r\n" % 7 + payload[i:i + 7] + b"\r\n" for i in range(0, 4998, 7))
+            + b"2\r\n" + payload[4998:] + b"\r\n0\r\n\r\n"
+        )
+        for i in range(0, len(raw), 1000):
+            sock.sendall(raw[i:i + 1000])
+        pending = bytearray()
+        status, _, body, _ = read_response(sock, pending)
+        if status != 200 or body != f"5000 {fnv1a64(payload):016x}\n".encode("ascii"):
+            raise AssertionError(f"unexpected chunked upload response: {status} {body!r}")
+
+    # A body sent along with the head gets no 100.
+    status, _, body = request_once(
+        host,
+        port,
+        b"POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 3\r\nExpect: 100-continue\r\n\r\nabc",
+    )
+    if status != 200 or body != b"abc":
+        raise AssertionError(f"unexpected echo with early body: {status} {body!r}")
+
+    # Requests the route refuses are answered before any body is sent.
+    refusals = [
+        (b"POST /nowhere HTTP/1.1\r\nContent-Length: 10\r\nExpect: 100-continue\r\n\r\n", 404),
+        (b"GET /upload HTTP/1.1\r\nContent-Length: 10\r\nExpect: 100-continue\r\n\r\n", 405),
+        (b"POST /echo HTTP/1.1\r\nContent-Length: 10000000\r\nExpect: 100-continue\r\n\r\n", 413),
+        (b"POST /echo HTTP/1.1\r\nContent-Length: 10000000\r\n\r\n", 413),
+        (b"POST /echo HTTP/1.1\r\nContent-Length: 1\r\nExpect: later\r\n\r\n", 417),
+    ]
+    for raw, want in refusals:
+        with socket.create_connection((host, port), timeout=2.0) as sock:
+            sock.sendall(raw)
+            pending = bytearray()
+            status, headers, _, _ = read_response(sock, pending)
+            if status != want or headers.get("connection", "").lower() != "close":
+                raise AssertionError(f"expected {want} and close for {raw!r}, got {status}")
+
+    with socket.create_connection((host, port), timeout=2.0) as sock:
+        sock.sendall(b"POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 4\r\nExpect: 100-continue\r\n\r\n")
+        pending = bytearray()
+        if read_interim(sock, pending) != 100:
+            raise AssertionError("expected 100 Continue for echo")
+        sock.sendall(b"ping")
+        status, _, body, _ = read_response(sock, pending)
+        if status != 200 or body != b"ping":
+            raise AssertionError(f"unexpected echo after 100: {status} {body!r}")
+
+
+def wait_for_close(sock: socket.socket, deadline: float) -> float:
+    start = time.time()
+    while time.time() < deadline:
+        try:
+            if sock.recv(4096) == b"":
+                return time.time() - start
+        except socket.timeout:
+            continue
+        except ConnectionResetError:
+            return time.time() - start
+    raise AssertionError("server did not close the connection before the deadline")
+
+
+def slow_client_timeout_test(host: str, port: int) -> None:
+    # Server runs with a 1s header and body timeout and a 10s idle timeout.
+    # A client that keeps trickling header lines must still be cut off by the
+    # header deadline, and a stalled body by the body deadline.
+    with socket.create_connection((host, port), timeout=0.2) as sock:
+        sock.sendall(b"GET /healthz HTTP/1.1\r\nHost: localhost\r\n")
+        start = time.time()
+        closed = False
+        for i in range(20):
+            try:
+                sock.sendall(f"X-Slow-{i}: x\r\n".encode("ascii"))
+            except (BrokenPipeError, ConnectionResetError):
+                closed = True
+                break
+            try:
+                if sock.recv(4096) == b"":
+                    closed = True
+                    break
+            except socket.timeout:
+                pass
+        if not closed:
+            wait_for_close(sock, start + 4.0)
+        if time.time() - start > 3.0:
+            raise AssertionError("slow header client outlived the header timeout")
+
+    with socket.create_connection((host, port), timeout=0.2) as sock:
+        sock.sendall(b"POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 10\r\n\r\nabc")
+        elapsed = wait_for_close(sock, time.time() + 4.0)
+        if elapsed < 0.5:
+            raise AssertionError("stalled body closed before the body timeout")
+
+
+def pipelining_test(host: str, port: int, n: int = 40) -> None:
+    expected = []
+    raw = bytearray()
+    for i in range(n):
+        kind = i % 3
+        if kind == 0:
+            raw += b"GET /healthz HTTP/1.1\r\nHost: localhost\r\n\r\n"
+            expected.append(b"ok")
+        elif kind == 1:
+            raw += b"GET /static/hello.txt HTTP/1.1\r\nHost: localhost\r\n\r\n"
+            expected.append(b"hello static\n")
+        else:
+            msg = f"pipelined-{i}".encode("ascii")
+            raw += (
+                b"POST /echo HTTP/1.1\r\nHost: localhost\r\n"
+                + f"Content-Length: {len(msg)}\r\n\r\n".encode("ascii")
+                + msg
+            )
+            expected.append(msg)
+
+    with socket.create_connection((host, port), timeout=2.0) as sock:
+        sock.sendall(bytes(raw))
+        pending = bytearray()
+        for i, want in enumerate(expected):
+            status, _, body, pending = read_response(sock, pending)
+            if status != 200 or body != want:
+                raise AssertionError(f"pipelined response #{i} mismatch: {status} {body!r} != {want!r}")
+
+
+def large_static_test(host: str, port: int, payload: bytes) -> None:
+    # Larger than the socket and pipe buffers so the file is sent in several
+    # rounds, then checked for ordering against a pipelined request behind it.
+    with socket.create_connection((host, port), timeout=5.0) as sock:
+        sock.sendall(
+            b"GET /static/large.bin HTTP/1.1\r\nHost: localhost\r\n\r\n"
+            b"GET /healthz HTTP/1.1\r\nHost: localhost\r\n\r\n"
+        )
+        pending = bytearray()
+        status, _, body, pending = read_response(sock, pending)
+        if status != 200 or body != payload:
+            raise AssertionError(f"large static mismatch: status={status} len={len(body)}")
+        status, _, body, _ = read_response(sock, pending)
+        if status != 200 or body != b"ok":
+            raise AssertionError("response after large static file mismatch")
+
+
+def wait_for_static_body(host: str, port: int, name: str, expected: bytes, timeout_sec: float) -> None:
+    deadline = time.time() + timeout_sec
+    body = b""
+    while time.time() < deadline:
+        try:
+            status, _, body = request_once(
+                host,
+                port,
+                f"GET /static/{name} HTTP/1.1\r\nHost: localhost\r\n\r\n".encode("ascii"),
+            )
+        except RuntimeError:
+            # A stale cached length outruns a truncated file until the entry is dropped.
+            status = 0
+        if status == 200 and body == expected:
+            return
+        time.sleep(0.05)
+    raise AssertionError(f"/static/{name} still served {body!r}, expected {expected!r}")
+
+
+def cache_invalidation_test(host: str, port: int, static_root: str, timeout_sec: float) -> None:
+    path = os.path.join(static_root, "deploy.txt")
+    with open(path, "wb") as f:
+        f.write(b"version one, a longer body\n")
+    wait_for_static_body(host, port, "deploy.txt", b"version one, a longer body\n", timeout_sec)
+
+    # Shorter rewrite of the same inode: a stale Content-Length would hang or truncate.
+    with open(path, "wb") as f:
+        f.write(b"v2\n")
+    wait_for_static_body(host, port, "deploy.txt", b"v2\n", timeout_sec)
+
+    # Atomic replace with a new inode, as a deploy would do.
+    tmp = path + ".tmp"
+    with open(tmp, "wb") as f:
+        f.write(b"version three\n")
+    os.rename(tmp, path)
+    wait_for_static_body(host, port, "deploy.txt", b"version three\n", timeout_sec)
+
+    os.unlink(path)
+    deadline = time.time() + timeout_sec
+    while True:
+        status, _, _ = request_once(host, port, b"GET /static/deploy.txt HTTP/1.1\r\nHost: localhost\r\n\r\n")
+        if status == 404:
+            break
+        if time.time() >= deadline:
+            raise AssertionError(f"deleted file still served with status {status}")
+        time.sleep(0.05)
+
+
+def get_encoded(host: str, port: int, name: str, accept: str) -> Tuple[int, Dict[str, str], bytes]:
+    accept_line = f"Accept-Encoding: {accept}\r\n" if accept else ""
+    return request_once(
+        host,
+        port,
+        f"GET /static/{name} HTTP/1.1\r\nHost: localhost\r\n{accept_line}\r\n".encode("ascii"),
+    )
+
+
+def content_encoding_test(host: str, port: int, static_root: str, timeout_sec: float) -> None:
+    notes = b"precompressed notes\n" * 20
+    with open(os.path.join(static_root, "notes.txt"), "wb") as f:
+        f.write(notes)
+    with open(os.path.join(static_root, "notes.txt.gz"), "wb") as f:
+        f.write(gzip.compress(notes))
+
+    # Sidecar served as-is; plain clients get identity, and both carry Vary.
+    status, headers, body = get_encoded(host, port, "notes.txt", "br;q=0, gzip")
+    if status != 200 or headers.get("content-encoding") != "gzip" or gzip.decompress(body) != notes:
+        raise AssertionError(f"gzip sidecar mismatch: status={status} headers={headers}")
+    if headers.get("vary") != "Accept-Encoding":
+        raise AssertionError("encoded response missing Vary")
+    status, headers, body = get_encoded(host, port, "notes.txt", "")
+    if status != 200 or "content-encoding" in headers or body != notes or headers.get("vary") != "Accept-Encoding":
+        raise AssertionError(f"identity response mismatch: headers={headers}")
+    status, headers, body = get_encoded(host, port, "notes.txt", "gzip;q=0")
+    if status != 200 or "content-encoding" in headers or body != notes:
+        raise AssertionError("gzip;q=0 still got an encoded response")
+
+    # Replacing the sidecar drops the cached variant.
+    updated = b"updated notes\n" * 20
+    with open(os.path.join(static_root, "notes.txt.gz"), "wb") as f:
+        f.write(gzip.compress(updated))
+    deadline = time.time() + timeout_sec
+    while True:
+        status, headers, body = get_encoded(host, port, "notes.txt", "gzip")
+        if status == 200 and headers.get("content-encoding") == "gzip" and gzip.decompress(body) == updated:
+            break
+        if time.time() >= deadline:
+            raise AssertionError("stale gzip sidecar still served")
+        time.sleep(0.05)
+
+    # Without a sidecar the first response is identity and a gzip variant follows.
+    script = b"function add(a, b) { return a + b; }\n" * 1500
+    with open(os.path.join(static_root, "app.js"), "wb") as f:
+        f.write(script)
+    deadline = time.time() + 3.0
+    while True:
+        status, headers, body = get_encoded(host, port, "app.js", "gzip, deflate")
+        if status != 200:
+            raise AssertionError(f"app.js status {status}")
+        if headers.get("content-encoding") == "gzip":
+            if gzip.decompress(body) != script or len(body) >= len(script):
+                raise AssertionError("generated gzip variant mismatch")
+            break
+        if body != script:
+            raise AssertionError("identity app.js mismatch")
+        if time.time() >= deadline:
+            raise AssertionError("gzip variant of app.js was never generated")
+        time.sleep(0.05)
+
+    # Non-text types are never negotiated.
+    status, headers, _ = get_encoded(host, port, "large.bin", "gzip")
+    if status != 200 or "content-encoding" in headers or "vary" in headers:
+        raise AssertionError(f"binary file negotiated an encoding: {headers}")
+
+
+def conditional_get_test(host: str, port: int, static_root: str, timeout_sec: float) -> None:
+    def get(name: str, extra: str = "") -> Tuple[int, Dict[str, str], bytes]:
+        return request_once(
+            host,
+            port,
+            f"GET /static/{name} HTTP/1.1\r\nHost: localhost\r\n{extra}\r\n".encode("ascii"),
+        )
+
+    status, headers, body = get("hello.txt")
+    etag = headers.get("etag", "")
+    last_modified = headers.get("last-modified", "")
+    if status != 200 or not etag.startswith('"') or not last_modified.endswith(" GMT"):
+        raise AssertionError(f"missing validators: {headers}")
+    if headers.get("cache-control") != "no-cache":
+        raise AssertionError(f"default cache rule not applied: {headers}")
+
+    # A pipelined 304 carries no body, so the next response must parse cleanly behind it.
+    with socket.create_connection((host, port), timeout=2.0) as sock:
+        sock.sendall(
+            f"GET /static/hello.txt HTTP/1.1\r\nHost: localhost\r\nIf-None-Match: \"x\", W/{etag}\r\n\r\n"
+            "GET /healthz HTTP/1.1\r\nHost: localhost\r\n\r\n".encode("ascii")
+        )
+        pending = bytearray()
+        status, headers, body, pending = read_response(sock, pending)
+        if status != 304 or body or "content-length" in headers or headers.get("etag") != etag:
+            raise AssertionError(f"If-None-Match not honoured: status={status} headers={headers}")
+        status, _, body, _ = read_response(sock, pending)
+        if status != 200 or body != b"ok":
+            raise AssertionError("response after 304 mismatch")
+
+    status, _, _ = get("hello.txt", f"If-Modified-Since: {last_modified}\r\n")
+    if status != 304:
+        raise AssertionError(f"If-Modified-Since not honoured: {status}")
+    # If-None-Match wins over If-Modified-Since.
+    status, _, body = get("hello.txt", f"If-None-Match: \"stale\"\r\nIf-Modified-Since: {last_modified}\r\n")
+    if status != 200 or not body:
+        raise AssertionError(f"mismatched If-None-Match answered {status}")
+    status, _, _ = get("hello.txt", "If-Modified-Since: Thu, 01 Jan 1970 00:00:00 GMT\r\n")
+    if status != 200:
+        raise AssertionError("old If-Modified-Since answered 304")
+
+    status, headers, _ = get("large.bin")
+    if status != 200 or headers.get("cache-control") != "max-age=3600":
+        raise AssertionError(f"prefix cache rule not applied: {headers}")
+
+    # A changed file gets a new ETag, so the old validator no longer matches.
+    path = os.path.join(static_root, "etag.txt")
+    with open(path, "wb") as f:
+        f.write(b"first\n")
+    status, headers, _ = get("etag.txt")
+    old_etag = headers.get("etag", "")
+    with open(path, "wb") as f:
+        f.write(b"second version\n")
+    deadline = time.time() + timeout_sec
+    while True:
+        status, headers, body = get("etag.txt", f"If-None-Match: {old_etag}\r\n")
+        if status == 200 and body == b"second version\n" and headers.get("etag") != old_etag:
+            break
+        if time.time() >= deadline:
+            raise AssertionError(f"stale ETag still matched: status={status}")
+        time.sleep(0.05)
+
+
+def parse_multipart(content_type: str, body: bytes) -> list:
+    boundary = content_type.split("boundary=", 1)[1].encode("ascii")
+    parts = []
+    for chunk in body.split(b"--" + boundary)[1:]:
+        if chunk.startswith(b"--"):
+            break
+        head, data = chunk.split(b"\r\n\r\n", 1)
+        content_range = [line for line in head.split(b"\r\n") if line.lower().startswith(b"content-range:")]
+        parts.append((content_range[0].split(b":", 1)[1].strip().decode("ascii"), data[:-2] if data.endswith(b"\r\n") else data))
+    return parts
+
+
+def range_test(host: str, port: int, static_root: str, payload: bytes) -> None:
+    def get(name: str, extra: str) -> Tuple[int, Dict[str, str], bytes]:
+        return request_once(
+            host,
+            port,
+            f"GET /static/{name} HTTP/1.1\r\nHost: localhost\r\n{extra}\r\n".encode("ascii"),
+        )
+
+    size = len(payload)
+    status, headers, body = get("large.bin", "Range: bytes=1000-1999\r\n")
+    if status != 206 or body != payload[1000:2000] or headers.get("content-range") != f"bytes 1000-1999/{size}":
+        raise AssertionError(f"single range mismatch: status={status} headers={headers}")
+    status, _, body = get("large.bin", "Range: bytes=-10\r\n")
+    if status != 206 or body != payload[-10:]:
+        raise AssertionError("suffix range mismatch")
+
+    # Pre-rendered small file: ranges are cut from the cached bytes.
+    _, _, hello = get("hello.txt", "")
+    status, _, body = get("hello.txt", "Range: bytes=1-3\r\n")
+    if status != 206 or body != hello[1:4]:
+        raise AssertionError(f"range of cached small file mismatch: {body!r}")
+
+    # Multipart from the file, pipelined with a request behind it.
+    with socket.create_connection((host, port), timeout=5.0) as sock:
+        sock.sendall(
+            b"GET /static/large.bin HTTP/1.1\r\nHost: localhost\r\nRange: bytes=0-9, 500000-599999, -4\r\n\r\n"
+            b"GET /healthz HTTP/1.1\r\nHost: localhost\r\n\r\n"
+        )
+        pending = bytearray()
+        status, headers, body, pending = read_response(sock, pending)
+        if status != 206 or not headers.get("content-type", "").startswith("multipart/byteranges; boundary="):
+            raise AssertionError(f"multipart head mismatch: status={status} headers={headers}")
+        parts = parse_multipart(headers["content-type"], body)
+        expected = [
+            (f"bytes 0-9/{size}", payload[:10]),
+            (f"bytes 500000-599999/{size}", payload[500000:600000]),
+            (f"bytes {size - 4}-{size - 1}/{size}", payload[-4:]),
+        ]
+        if parts != expected:
+            raise AssertionError(f"multipart body mismatch: {[(r, len(d)) for r, d in parts]}")
+        status, _, body, _ = read_response(sock, pending)
+        if status != 200 or body != b"ok":
+            raise AssertionError("response after multipart mismatch")
+
+    status, headers, body = get("large.bin", f"Range: bytes={size}-\r\n")
+    if status != 416 or body or headers.get("content-range") != f"bytes */{size}":
+        raise AssertionError(f"unsatisfiable range answered {status} {headers}")
+
+    # If-Range: the current validator keeps the range, a stale one gets the whole body.
+    _, headers, _ = get("large.bin", "Range: bytes=0-0\r\n")
+    etag = headers["etag"]
+    status, _, body = get("large.bin", f"Range: bytes=0-0\r\nIf-Range: {etag}\r\n")
+    if status != 206 or body != payload[:1]:
+        raise AssertionError("matching If-Range did not get a range")
+    status, _, body = get("large.bin", "Range: bytes=0-0\r\nIf-Range: \"stale\"\r\n")
+    if status != 200 or body != payload:
+        raise AssertionError("stale If-Range did not get the whole body")
+
+    # The date form, on a Wednesday so its leading 'W' is not taken for a weak tag.
+    path = os.path.join(static_root, "wednesday.txt")
+    with open(path, "wb") as f:
+        f.write(b"wednesday\n")
+    os.utime(path, (1704283200, 1704283200))
+    status, _, body = get("wednesday.txt", "Range: bytes=0-1\r\nIf-Range: Wed, 03 Jan 2024 12:00:00 GMT\r\n")
+    if status != 206 or body != b"we":
+        raise AssertionError(f"If-Range date on a Wednesday did not get a range: status={status}")
+    status, _, body = get("wednesday.txt", "Range: bytes=0-1\r\nIf-Range: Wed, 03 Jan 2024 11:00:00 GMT\r\n")
+    if status != 200 or body != b"wednesday\n":
+        raise AssertionError("stale If-Range date did not get the whole body")
+
+
+def read_chunked_body(sock: socket.socket, pending: bytearray) -> Tuple[bytes, bytearray]:
+    body = bytearray()
+    while True:
+        while b"\r\n" not in pending:
+            chunk = sock.recv(65536)
+            if not chunk:
+                raise RuntimeError("socket closed inside chunked body")
+            pending.extend(chunk)
+        line_end = pending.index(b"\r\n")
+        size = int(bytes(pending[:line_end]), 16)
+        del pending[:line_end + 2]
+        while len(pending) < size + 2:
+            chunk = sock.recv(65536)
+            if not chunk:
+                raise RuntimeError("socket closed inside chunk")
+            pending.extend(chunk)
+        if pending[size:size + 2] != b"\r\n":
+            raise AssertionError("chunk not terminated by CRLF")
+        body.extend(pending[:size])
+        del pending[:size + 2]
+        if size == 0:
+            return bytes(body), pending
+
+
+def generated_body_test(host: str, port: int) -> None:
+    pattern = b"abcdefghijklmnopqrstuvwxyz0123456789\n"
+    size = 5 * 1024 * 1024 + 3
+
+    def expected(n: int) -> bytes:
+        return (pattern * (n // len(pattern) + 1))[:n]
+
+    with socket.create_connection((host, port), timeout=5.0) as sock:
+        sock.sendall(
+            f"GET /bytes/{size} HTTP/1.1\r\nHost: localhost\r\n\r\n".encode("ascii")
+            + f"GET /bytes/{size}?chunked HTTP/1.1\r\nHost: localhost\r\n\r\n".encode("ascii")
+            + b"GET /bytes/0?chunked HTTP/1.1\r\nHost: localhost\r\n\r\n"
+            + b"GET /healthz HTTP/1.1\r\nHost: localhost\r\n\r\n"
+        )
+        pending = bytearray()
+        status, headers, body, pending = read_response(sock, pending)
+        if status != 200 or int(headers.get("content-length", "-1")) != size or body != expected(size):
+            raise AssertionError(f"unexpected generated body: {status} len={len(body)}")
+
+        for n in (size, 0):
+            status, headers, _, pending = read_response(sock, pending)
+            if status != 200 or headers.get("transfer-encoding") != "chunked" or "content-length" in headers:
+                raise AssertionError(f"expected a chunked response, got {status} {headers}")
+            body, pending = read_chunked_body(sock, pending)
+            if body != expected(n):
+                raise AssertionError(f"unexpected chunked generated body: len={len(body)} want {n}")
+
+        status, _, body, _ = read_response(sock, pending)
+        if status != 200 or body != b"ok":
+            raise AssertionError(f"unexpected response after generated bodies: {status} {body!r}")
+
+    # A sized generated body ends without a final piece; the next request, sent only after it, is still served.
+    with socket.create_connection((host, port), timeout=5.0) as sock:
+        pending = bytearray()
+        sock.sendall(b"GET /bytes/100 HTTP/1.1\r\nHost: localhost\r\n\r\n")
+        status, _, body, pending = read_response(sock, pending)
+        if status != 200 or body != expected(100):
+            raise AssertionError(f"unexpected sized generated body: {status} len={len(body)}")
+        sock.sendall(b"GET /healthz HTTP/1.1\r\nHost: localhost\r\n\r\n")
+        status, _, body, _ = read_response(sock, pending)
+        if status != 200 or body != b"ok":
+            raise AssertionError(f"keep-alive lost after a sized generated body: {status} {body!r}")
+
+    # A reader that stalls holds the producer back instead of buffering the body.
+    with socket.create_connection((host, port), timeout=5.0) as sock:
+        sock.sendall(b"GET /bytes/20000000?chunked HTTP/1.1\r\nHost: localhost\r\n\r\n")
+        time.sleep(0.3)
+        pending = bytearray()
+        status, _, _, pending = read_response(sock, pending)
+        body, _ = read_chunked_body(sock, pending)
+        if status != 200 or len(body) != 20000000 or body[:len(pattern)] != pattern:
+            raise AssertionError(f"unexpected stalled generated body: {status} len={len(body)}")
+
+    status, _, _ = request_once(host, port, b"GET /bytes/12x HTTP/1.1\r\nHost: localhost\r\n\r\n")
+    if status != 400:
+        raise AssertionError(f"expected 400 for a bad byte count, got {status}")
+
+
+def routing_test(host: str, port: int) -> None:
+    cases = [
+        (b"get /healthz HTTP/1.1\r\nHost: localhost\r\n\r\n", 200),
+        (b"GET /healthz?probe=1 HTTP/1.1\r\nHost: localhost\r\n\r\n", 200),
+        (b"HEAD /healthz HTTP/1.1\r\nHost: localhost\r\n\r\n", 405),
+        (b"DELETE /static/hello.txt HTTP/1.1\r\nHost: localhost\r\n\r\n", 405),
+        (b"GET /healthz/ HTTP/1.1\r\nHost: localhost\r\n\r\n", 404),
+        (b"GET /bytes/ HTTP/1.1\r\nHost: localhost\r\n\r\n", 404),
+        (b"GET /bytes/1/2 HTTP/1.1\r\nHost: localhost\r\n\r\n", 404),
+        (b"GET /static HTTP/1.1\r\nHost: localhost\r\n\r\n", 404),
+    ]
+    for raw, expected in cases:
+        status, _, _ = request_once(host, port, raw)
+        if status != expected:
+            raise AssertionError(f"expected {expected} for {raw.split(b' HTTP')[0]!r}, got {status}")
+
+    # A streaming route reached without a body still answers.
+    status, _, body = request_once(host, port, b"POST /upload HTTP/1.1\r\nHost: localhost\r\n\r\n")
+    if status != 200 or body != f"0 {fnv1a64(b''):016x}\n".encode("ascii"):
+        raise AssertionError(f"unexpected empty upload: {status} {body!r}")
+
+
+def module_test(host: str, port: int) -> None:
+    status, _, body = request_once(host, port, b"GET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n")
+    if status != 200 or body != b"hello module\n":
+        raise AssertionError(f"unexpected module index: {status} {body!r}")
+
+    # One connection stays on one worker, so its per-worker count goes up by one per request.
+    with socket.create_connection((host, port), timeout=2.0) as sock:
+        pending = bytearray()
+        served = []
+        for name in (b"world", b"again"):
+            sock.sendall(b"GET /hello/" + name + b"?x=1 HTTP/1.1\r\nHost: localhost\r\n\r\n")
+            status, headers, body, pending = read_response(sock, pending)
+            if status != 200 or body != b"hi, " + name + b"\n":
+                raise AssertionError(f"unexpected module response: {status} {body!r}")
+            served.append(int(headers.get("x-worker-served", "0")))
+        if served[0] < 1 or served[1] != served[0] + 1:
+            raise AssertionError(f"per-worker counter did not advance: {served}")
+
+    status, _, _ = request_once(host, port, b"POST /hello/world HTTP/1.1\r\nHost: localhost\r\nContent-Length: 0\r\n\r\n")
+    if status != 405:
+        raise AssertionError(f"expected 405 from a module route, got {status}")
+
+
+def read_head_only(sock: socket.socket, pending: bytearray) -> Tuple[int, Dict[str, str], bytearray]:
+    while b"\r\n\r\n" not in pending:
+        chunk = sock.recv(4096)
+        if not chunk:
+            raise RuntimeError("socket closed before headers")
+        pending.extend(chunk)
+    header_end = pending.index(b"\r\n\r\n") + 4
+    lines = bytes(pending[:header_end]).decode("latin1").split("\r\n")
+    del pending[:header_end]
+    headers = {k.strip().lower(): v.strip() for k, v in (line.split(":", 1) for line in lines[1:] if line)}
+    return int(lines[0].split(" ", 2)[1]), headers, pending
+
+
+def backend_connections(host: str, port: int) -> int:
+    _, _, body = request_once(host, port, b"GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n")
+    for line in body.decode("ascii", errors="replace").splitlines():
+        if line.startswith("connections_current "):
+            return int(line.split()[1])
+    raise AssertionError("backend metrics lack connections_current")
+
+
+def proxy_test(httpd: str, static_root: str, large_payload: bytes) -> None:
+    host = "127.0.0.1"
+    backend_port = pick_port()
+    proxy_port = pick_port()
+    dead_port = pick_port()
+    backend = subprocess.Popen(
+        [httpd, "-p", str(backend_port), "-t", "2", "-s", static_root, "-w", "off"],
+        stdout=subprocess.DEVNULL,
+        stderr=subprocess.DEVNULL,
+    )
+    proxy = subprocess.Popen(
+        [
+            httpd, "-p", str(proxy_port), "-t", "1", "-w", "off",
+            "-P", f"/api=127.0.0.1:{backend_port}/",
+            "-P", f"/raw=127.0.0.1:{backend_port}",
+            "-P", f"/down=127.0.0.1:{dead_port}",
+        ],
+        stdout=subprocess.DEVNULL,
+        stderr=subprocess.DEVNULL,
+    )
+    pattern = b"abcdefghijklmnopqrstuvwxyz0123456789\n"
+    chunked_size = 300001
+
+    try:
+        wait_for_healthz(host, backend_port)
+        wait_for_healthz(host, proxy_port)
+
+        # Pipelined through the proxy: answers keep their order, mixed with local ones.
+        with socket.create_connection((host, proxy_port), timeout=5.0) as sock:
+            sock.sendall(
+                b"GET /api/healthz HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                + b"POST /api/echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 11\r\n\r\nhello proxy"
+                + b"GET /api/static/large.bin HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                + f"GET /api/bytes/{chunked_size}?chunked HTTP/1.1\r\nHost: localhost\r\n\r\n".encode("ascii")
+                + b"GET /healthz HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                + b"HEAD /api/static/hello.txt HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                + b"GET /raw/healthz HTTP/1.1\r\nHost: localhost\r\n\r\n"
+            )
+            pending = bytearray()
+            status, _, body, pending = read_response(sock, pending)
+            if status != 200 or body != b"ok":
+                raise AssertionError(f"unexpected proxied healthz: {status} {body!r}")
+            status, _, body, pending = read_response(sock, pending)
+            if status != 200 or body != b"hello proxy":
+                raise AssertionError(f"unexpected proxied echo: {status} {body!r}")
+            status, _, body, pending = read_response(sock, pending)
+            if status != 200 or body != large_payload:
+                raise AssertionError(f"unexpected proxied static body: {status} len={len(body)}")
+            status, headers, _, pending = read_response(sock, pending)
+            if status != 200 or headers.get("transfer-encoding") != "chunked":
+                raise AssertionError(f"expected a relayed chunked response, got {status} {headers}")
+            body, pending = read_chunked_body(sock, pending)
+            if body != (pattern * (chunked_size // len(pattern) + 1))[:chunked_size]:
+                raise AssertionError(f"unexpected relayed chunked body: len={len(body)}")
+            status, _, body, pending = read_response(sock, pending)
+            if status != 200 or body != b"ok":
+                raise AssertionError(f"unexpected local response after proxied ones: {status} {body!r}")
+            status, headers, pending = read_head_only(sock, pending)
+            if status not in (200, 405) or "connection" not in headers:
+                raise AssertionError(f"unexpected proxied HEAD: {status} {headers}")
+            # The path goes out unchanged without a base, so the backend has no such route.
+            status, _, _, pending = read_response(sock, pending)
+            if status != 404:
+                raise AssertionError(f"expected the backend's 404 for /raw/healthz, got {status}")
+
+        # Sequential requests reuse pooled upstream connections instead of opening new ones.
+        for _ in range(5):
+            request_once(host, proxy_port, b"GET /api/healthz HTTP/1.1\r\nHost: localhost\r\n\r\n")
+        before = backend_connections(host, backend_port)
+        for _ in range(20):
+            status, _, _ = request_once(host, proxy_port, b"GET /api/healthz HTTP/1.1\r\nHost: localhost\r\n\r\n")
+            if status != 200:
+                raise AssertionError(f"unexpected proxied status {status}")
+        after = backend_connections(host, backend_port)
+        if after > before:
+            raise AssertionError(f"upstream connections grew from {before} to {after}")
+
+        status, headers, body = request_once(host, proxy_port, b"GET /down/x HTTP/1.1\r\nHost: localhost\r\n\r\n")
+        if status != 502 or headers.get("connection") != "keep-alive":
+            raise AssertionError(f"expected 502 for a dead upstream, got {status} {headers}")
+
+        # A backend restart leaves the pool stale; the next request goes out on a fresh connection.
+        backend.terminate()
+        backend.wait(timeout=3.0)
+        backend = subprocess.Popen(
+            [httpd, "-p", str(backend_port), "-t", "2", "-s", static_root, "-w", "off"],
+            stdout=subprocess.DEVNULL,
+            stderr=subprocess.DEVNULL,
+        )
+        wait_for_healthz(host, backend_port)
+        status, _, body = request_once(host, proxy_port, b"GET /api/healthz HTTP/1.1\r\nHost: localhost\r\n\r\n")
+        if status != 200 or body != b"ok":
+            raise AssertionError(f"unexpected response after an upstream restart: {status} {body!r}")
+    finally:
+        for proc in (proxy, backend):
+            proc.terminate()
+            try:
+                proc.wait(timeout=3.0)
+            except subprocess.TimeoutExpired:
+                proc.kill()
+                proc.wait(timeout=3.0)
+
+
+def rebalance_test(httpd: str, static_root: str) -> None:
+    host = "127.0.0.1"
+    port = pick_port()
+    proc = subprocess.Popen(
+        [httpd, "-p", str(port), "-t", "2", "-s", static_root, "-w", "off", "-b", "1"],
+        stdout=subprocess.DEVNULL,
+        stderr=subprocess.DEVNULL,
+    )
+    pattern = b"abcdefghijklmnopqrstuvwxyz0123456789\n"
+    expected = (pattern * (20000 // len(pattern) + 1))[:20000]
+
+    # Keep-alive clients issue one request at a time, so each is idle between responses and may move.
+    def client(rounds: int) -> None:
+        with socket.create_connection((host, port), timeout=5.0) as sock:
+            pending = bytearray()
+            for i in range(rounds):
+                path = b"/bytes/20000" if i % 2 == 0 else b"/healthz"
+                sock.sendall(b"GET " + path + b" HTTP/1.1\r\nHost: localhost\r\n\r\n")
+                status, _, body, pending = read_response(sock, pending)
+                if status != 200 or body != (expected if i % 2 == 0 else b"ok"):
+                    raise AssertionError(f"unexpected response on a rebalanced worker: {status} len={len(body)}")
+
+    def rebalanced() -> int:
+        _, _, body = request_once(host, port, b"GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n")
+        for line in body.decode("ascii", errors="replace").splitlines():
+            if line.startswith("connections_rebalanced_total "):
+                return int(line.split()[1])
+        raise AssertionError("metrics lack connections_rebalanced_total")
+
+    try:
+        wait_for_healthz(host, port)
+        deadline = time.time() + 20.0
+        while True:
+            with concurrent.futures.ThreadPoolExecutor(max_workers=8) as pool:
+                for future in [pool.submit(client, 2000) for _ in range(8)]:
+                    future.result()
+            if rebalanced() > 0:
+                break
+            if time.time() > deadline:
+                raise AssertionError("no connection was rebalanced under uneven load")
+        client(10)
+    finally:
+        proc.terminate()
+        try:
+            proc.wait(timeout=3.0)
+        except subprocess.TimeoutExpired:
+            proc.kill()
+            proc.wait(timeout=3.0)
+
+
+def accepted_by_worker(host: str, port: int) -> Dict[str, int]:
+    _, _, body = request_once(host, port, b"GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n")
+    counts: Dict[str, int] = {}
+    for line in body.decode("ascii", errors="replace").splitlines():
+        if line.startswith("connections_accepted_total{"):
+            worker = line.split('worker="', 1)[1].split('"', 1)[0]
+            counts[worker] = int(line.split()[1])
+    return counts
+
+
+def accept_mode_test(httpd: str, static_root: str) -> None:
+    host = "127.0.0.1"
+    for mode in ("reuseport-hash", "reuseport-cpu", "exclusive", "acceptor"):
+        port = pick_port()
+        proc = subprocess.Popen(
+            [httpd, "-p", str(port), "-t", "2", "-s", static_root, "-w", "off", "--accept-mode", mode],
+            stdout=subprocess.DEVNULL,
+            stderr=subprocess.DEVNULL,
+        )
+
+        def client(_: int) -> None:
+            with socket.create_connection((host, port), timeout=5.0) as sock:
+                pending = bytearray()
+                for _ in range(5):
+                    sock.sendall(b"GET /healthz HTTP/1.1\r\nHost: localhost\r\n\r\n")
+                    status, _, body, pending = read_response(sock, pending)
+                    if status != 200 or body != b"ok":
+                        raise AssertionError(f"unexpected response with accept mode {mode}: {status} {body!r}")
+
+        try:
+            wait_for_healthz(host, port)
+            before = accepted_by_worker(host, port)
+            with concurrent.futures.ThreadPoolExecutor(max_workers=8) as pool:
+                for future in [pool.submit(client, i) for i in range(40)]:
+                    future.result()
+            after = accepted_by_worker(host, port)
+            if sorted(after) != ["0", "1"]:
+                raise AssertionError(f"expected accept counters for both workers with {mode}: {after}")
+            # Every connection is counted by exactly one worker, the second metrics request included.
+            delta = {w: after[w] - before.get(w, 0) for w in after}
+            if sum(delta.values()) != 41:
+                raise AssertionError(f"accept counters with {mode} do not add up: {before} -> {after}")
+            if mode == "acceptor" and min(delta.values()) == 0:
+                raise AssertionError(f"the acceptor left a worker without connections: {delta}")
+        finally:
+            proc.terminate()
+            try:
+                proc.wait(timeout=3.0)
+            except subprocess.TimeoutExpired:
+                proc.kill()
+                proc.wait(timeout=3.0)
+
+
+def tls_connect(port: int, ctx: ssl.SSLContext, session: Optional[ssl.SSLSession] = None) -> ssl.SSLSocket:
+    sock = socket.create_connection(("127.0.0.1", port), timeout=5.0)
+    return ctx.wrap_socket(sock, server_hostname="localhost", session=session)
+
+
+def tls_test(httpd: str, static_root: str, large_payload: bytes) -> bool:
+    if shutil.which("openssl") is None:
+        print("integration test skipped (tls: no openssl command)")
+        return False
+    host = "127.0.0.1"
+    backend_port = pick_port()
+    tls_port = pick_port()
+    with tempfile.TemporaryDirectory() as keys:
+        cert = os.path.join(keys, "cert.pem")
+        key = os.path.join(keys, "key.pem")
+        subprocess.run(
+            [
+                "openssl", "req", "-x509", "-newkey", "ec", "-pkeyopt", "ec_paramgen_curve:prime256v1",
+                "-nodes", "-keyout", key, "-out", cert, "-days", "1", "-subj", "/CN=localhost",
+            ],
+            check=True,
+            stdout=subprocess.DEVNULL,
+            stderr=subprocess.DEVNULL,
+        )
+        backend = subprocess.Popen(
+            [httpd, "-p", str(backend_port), "-t", "1", "-s", static_root, "-w", "off"],
+            stdout=subprocess.DEVNULL,
+            stderr=subprocess.DEVNULL,
+        )
+        # io_uring is asked for and must fall back to epoll for TLS.
+        server = subprocess.Popen(
+            [
+                httpd, "-p", str(tls_port), "-t", "2", "-s", static_root, "-w", "off", "-E", "uring",
+                "-c", cert, "-k", key, "-P", f"/api=127.0.0.1:{backend_port}/",
+            ],
+            stdout=subprocess.DEVNULL,
+            stderr=subprocess.DEVNULL,
+        )
+        ctx = ssl.create_default_context(cafile=cert)
+        try:
+            wait_for_healthz(host, backend_port)
+            deadline = time.time() + 5.0
+            while True:
+                if server.poll() is not None:
+                    print("integration test skipped (tls: httpd built without OpenSSL)")
+                    return False
+                try:
+                    tls_connect(tls_port, ctx).close()
+                    break
+                except OSError:
+                    if time.time() > deadline:
+                        raise
+                    time.sleep(0.05)
+
+            # Pipelined HTTP/1.1 over user-space records or kTLS, local and proxied.
+            pattern = b"abcdefghijklmnopqrstuvwxyz0123456789\n"
+            with tls_connect(tls_port, ctx) as sock:
+                sock.sendall(
+                    b"GET /static/large.bin HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                    + b"POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 5\r\n\r\nhello"
+                    + b"GET /bytes/100000?chunked HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                    + b"GET /api/static/large.bin HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                    + b"GET /healthz HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                )
+                time.sleep(0.3)
+                pending = bytearray()
+                status, _, body, pending = read_response(sock, pending)
+                if status != 200 or body != large_payload:
+                    raise AssertionError(f"unexpected TLS static body: {status} len={len(body)}")
+                status, _, body, pending = read_response(sock, pending)
+                if status != 200 or body != b"hello":
+                    raise AssertionError(f"unexpected TLS echo: {status} {body!r}")
+                status, _, pending = read_head_only(sock, pending)
+                body, pending = read_chunked_body(sock, pending)
+                if status != 200 or body != (pattern * (100000 // len(pattern) + 1))[:100000]:
+                    raise AssertionError(f"unexpected TLS chunked body: {status} len={len(body)}")
+                status, _, body, pending = read_response(sock, pending)
+                if status != 200 or body != large_payload:
+                    raise AssertionError(f"unexpected TLS proxied body: {status} len={len(body)}")
+                status, _, body, _ = read_response(sock, pending)
+                if status != 200 or body != b"ok":
+                    raise AssertionError(f"unexpected TLS healthz: {status} {body!r}")
+                session = sock.session
+
+            # The ticket from the first connection resumes on the next one.
+            with tls_connect(tls_port, ctx, session) as sock:
+                sock.sendall(b"GET /healthz HTTP/1.1\r\nHost: localhost\r\n\r\n")
+                status, _, body, _ = read_response(sock, bytearray())
+                if status != 200 or body != b"ok" or not sock.session_reused:
+                    raise AssertionError(f"TLS session was not resumed: {status} reused={sock.session_reused}")
+
+            # ALPN picks h2.
+            h2_ctx = ssl.create_default_context(cafile=cert)
+            h2_ctx.set_alpn_protocols(["h2", "http/1.1"])
+            with tls_connect(tls_port, h2_ctx) as sock:
+                if sock.selected_alpn_protocol() != "h2":
+                    raise AssertionError(f"unexpected ALPN protocol: {sock.selected_alpn_protocol()}")
+                client = H2Client(sock)
+                client.handshake()
+                sock.sendall(
+                    h2_frame(H2_HEADERS, H2_END_HEADERS | H2_END_STREAM, 1, hpack_request("GET", "/static/large.bin"))
+                    + h2_frame(H2_HEADERS, H2_END_HEADERS | H2_END_STREAM, 3, hpack_request("GET", "/healthz"))
+                )
+                client.wait([1, 3])
+                if client.response(1)[2] != large_payload or client.response(3)[2] != b"ok":
+                    raise AssertionError("unexpected h2 responses over TLS")
+
+            with tls_connect(tls_port, ctx) as sock:
+                sock.sendall(b"GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n")
+                _, _, body, _ = read_response(sock, bytearray())
+            values = dict(
+                line.split()[:2] for line in body.decode("ascii").splitlines() if line.startswith("tls_")
+            )
+            if int(values.get("tls_handshakes_total", "0")) < 4 or int(values.get("tls_resumed_total", "0")) < 1:
+                raise AssertionError(f"unexpected TLS metrics: {values}")
+        finally:
+            for proc in (server, backend):
+                proc.terminate()
+                try:
+                    proc.wait(timeout=3.0)
+                except subprocess.TimeoutExpired:
+                    proc.kill()
+                    proc.wait(timeout=3.0)
+    return True
+
+
 def static_and_traversal_test(host: str, port: int) -> None:
     status, _, body = request_once(
         host,
@@ -192,6 +1198,297 @@ def metrics_test(host: str, port: int, min_requests: int) -> None:
     if values["bytes_in"] <= 0 or values["bytes_out"] <= 0:
         raise AssertionError("byte counters were not incremented")
 
+    for key in ("tx_responses_total", "tx_syscalls_total", "tx_packets_total"):
+        if values.get(key, 0) <= 0:
+            raise AssertionError(f"transmit counter {key} missing or zero")
+
+    for key in ("pool_conn_in_use", "pool_conn_high_water", "pool_buf_4k_high_water"):
+        if key not in values:
+            raise AssertionError(f"missing pool metric {key}")
+    if values["pool_conn_high_water"] < values["pool_conn_in_use"] or values["pool_conn_in_use"] < 1:
+        raise AssertionError("connection pool occupancy is inconsistent")
+
+    if "# TYPE requests_total counter" not in text or "# TYPE http_request_duration_seconds histogram" not in text:
+        raise AssertionError("metrics exposition is missing TYPE lines")
+    healthz_count = values.get('http_request_duration_seconds_count{route="healthz"}', 0)
+    healthz_inf = values.get('http_request_duration_seconds_bucket{route="healthz",le="+Inf"}', -1)
+    if healthz_count <= 0 or healthz_inf != healthz_count:
+        raise AssertionError("healthz latency histogram is missing or inconsistent")
+    if values.get('http_responses_by_status_total{code="200"}', 0) <= 0:
+        raise AssertionError("per-status response counter missing")
+
+
+# HPACK static table names (RFC 7541 Appendix A), enough to read our responses.
+HPACK_STATIC_NAMES = [
+    "", ":authority", ":method", ":method", ":path", ":path", ":scheme", ":scheme",
+    ":status", ":status", ":status", ":status", ":status", ":status", ":status",
+    "accept-charset", "accept-encoding", "accept-language", "accept-ranges", "accept",
+    "access-control-allow-origin", "age", "allow", "authorization", "cache-control",
+    "content-disposition", "content-encoding", "content-language", "content-length",
+    "content-location", "content-range", "content-type", "cookie", "date", "etag", "expect",
+    "expires", "from", "host", "if-match", "if-modified-since", "if-none-match", "if-range",
+    "if-unmodified-since", "last-modified", "link", "location", "max-forwards",
+    "proxy-authenticate", "proxy-authorization", "range", "referer", "refresh", "retry-after",
+    "server", "set-cookie", "strict-transport-security", "transfer-encoding", "user-agent",
+    "vary", "via", "www-authenticate",
+]
+HPACK_STATIC_STATUS = {8: "200", 9: "204", 10: "206", 11: "304", 12: "400", 13: "404", 14: "500"}
+
+
+def hpack_int(block: bytes, pos: int, prefix: int) -> Tuple[int, int]:
+    mask = (1 << prefix) - 1
+    value = block[pos] & mask
+    pos += 1
+    if value < mask:
+        return value, pos
+    shift = 0
+    while True:
+        b = block[pos]
+        pos += 1
+        value += (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            return value, pos
+
+
+def hpack_string(block: bytes, pos: int) -> Tuple[str, int]:
+    if block[pos] & 0x80:
+        raise AssertionError("unexpected Huffman-coded string from the server")
+    n, pos = hpack_int(block, pos, 7)
+    return block[pos:pos + n].decode("latin1"), pos + n
+
+
+def hpack_decode_response(block: bytes) -> Dict[str, str]:
+    # The server never indexes, so only static references and literals appear.
+    fields: Dict[str, str] = {}
+    pos = 0
+    while pos < len(block):
+        if block[pos] & 0x80:
+            index, pos = hpack_int(block, pos, 7)
+            if index not in HPACK_STATIC_STATUS:
+                raise AssertionError(f"unexpected indexed field {index}")
+            fields[":status"] = HPACK_STATIC_STATUS[index]
+            continue
+        if block[pos] & 0xE0 not in (0x00, 0x10):
+            raise AssertionError(f"unexpected HPACK representation 0x{block[pos]:02x}")
+        index, pos = hpack_int(block, pos, 4)
+        if index == 0:
+            name, pos = hpack_string(block, pos)
+        else:
+            name = HPACK_STATIC_NAMES[index]
+        value, pos = hpack_string(block, pos)
+        fields[name] = value
+    return fields
+
+
+def hpack_request(method: str, path: str, extra: Optional[Dict[str, str]] = None) -> bytes:
+    # Literal fields without indexing and with literal names.
+    fields = [(":method", method), (":scheme", "http"), (":path", path), (":authority", "localhost")]
+    fields += list((extra or {}).items())
+    out = bytearray()
+    for name, value in fields:
+        out.append(0x00)
+        out.append(len(name))
+        out += name.encode("ascii")
+        out.append(len(value))
+        out += value.encode("ascii")
+    return bytes(out)
+
+
+H2_PREFACE = b"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+H2_DATA = 0x0
+H2_HEADERS = 0x1
+H2_RST_STREAM = 0x3
+H2_SETTINGS = 0x4
+H2_PING = 0x6
+H2_GOAWAY = 0x7
+H2_WINDOW_UPDATE = 0x8
+H2_END_STREAM = 0x1
+H2_ACK = 0x1
+H2_END_HEADERS = 0x4
+
+
+def h2_frame(kind: int, flags: int, stream: int, payload: bytes = b"") -> bytes:
+    return len(payload).to_bytes(3, "big") + bytes([kind, flags]) + stream.to_bytes(4, "big") + payload
+
+
+def h2_settings(pairs: Dict[int, int]) -> bytes:
+    return h2_frame(H2_SETTINGS, 0, 0, b"".join(k.to_bytes(2, "big") + v.to_bytes(4, "big") for k, v in pairs.items()))
+
+
+def h2_window_update(stream: int, increment: int) -> bytes:
+    return h2_frame(H2_WINDOW_UPDATE, 0, stream, increment.to_bytes(4, "big"))
+
+
+def h2_read_frame(sock: socket.socket, pending: bytearray) -> Tuple[int, int, int, bytes]:
+    while len(pending) < 9 or len(pending) < 9 + int.from_bytes(pending[:3], "big"):
+        chunk = sock.recv(65536)
+        if not chunk:
+            raise RuntimeError("socket closed before a full frame")
+        pending.extend(chunk)
+    length = int.from_bytes(pending[:3], "big")
+    kind, flags = pending[3], pending[4]
+    stream = int.from_bytes(pending[5:9], "big") & 0x7FFFFFFF
+    payload = bytes(pending[9:9 + length])
+    del pending[:9 + length]
+    return kind, flags, stream, payload
+
+
+class H2Client:
+    """A bare HTTP/2 client that reads whole responses, one frame at a time."""
+
+    def __init__(self, sock: socket.socket, pending: Optional[bytearray] = None) -> None:
+        self.sock = sock
+        self.pending = pending if pending is not None else bytearray()
+        self.server_settings: Dict[int, int] = {}
+        self.headers: Dict[int, Dict[str, str]] = {}
+        self.bodies: Dict[int, bytearray] = {}
+        self.closed: list = []
+        self.resets: Dict[int, int] = {}
+        self.goaway: Optional[int] = None
+        self.pings: list = []
+        self.credit = True
+
+    def handshake(self, settings: Optional[Dict[int, int]] = None) -> None:
+        self.sock.sendall(H2_PREFACE + h2_settings(settings or {}))
+
+    def next_frame(self) -> Tuple[int, int, int, bytes]:
+        kind, flags, stream, payload = h2_read_frame(self.sock, self.pending)
+        if kind == H2_SETTINGS and not flags & H2_ACK:
+            for i in range(0, len(payload), 6):
+                self.server_settings[int.from_bytes(payload[i:i + 2], "big")] = int.from_bytes(payload[i + 2:i + 6], "big")
+            self.sock.sendall(h2_frame(H2_SETTINGS, H2_ACK, 0))
+        elif kind == H2_HEADERS:
+            if not flags & H2_END_HEADERS:
+                raise AssertionError("server split a header block")
+            self.headers[stream] = hpack_decode_response(payload)
+        elif kind == H2_DATA:
+            self.bodies.setdefault(stream, bytearray()).extend(payload)
+            if payload and self.credit:
+                self.sock.sendall(h2_window_update(0, len(payload)) + h2_window_update(stream, len(payload)))
+        elif kind == H2_RST_STREAM:
+            self.resets[stream] = int.from_bytes(payload, "big")
+        elif kind == H2_GOAWAY:
+            self.goaway = int.from_bytes(payload[4:8], "big")
+        elif kind == H2_PING and flags & H2_ACK:
+            self.pings.append(payload)
+        if kind in (H2_HEADERS, H2_DATA) and flags & H2_END_STREAM:
+            self.closed.append(stream)
+        return kind, flags, stream, payload
+
+    def wait(self, streams: list) -> None:
+        while not all(s in self.closed or s in self.resets for s in streams):
+            self.next_frame()
+
+    def response(self, stream: int) -> Tuple[int, Dict[str, str], bytes]:
+        headers = self.headers.get(stream, {})
+        return int(headers.get(":status", "0")), headers, bytes(self.bodies.get(stream, b""))
+
+
+
+def h2_test(host: str, port: int, large_payload: bytes) -> None:
+    # Prior knowledge, several streams in flight on one connection.
+    with socket.create_connection((host, port), timeout=5.0) as sock:
+        client = H2Client(sock)
+        client.handshake()
+        sock.sendall(
+            h2_frame(H2_HEADERS, H2_END_HEADERS | H2_END_STREAM, 1, hpack_request("GET", "/static/large.bin"))
+            + h2_frame(H2_HEADERS, H2_END_HEADERS | H2_END_STREAM, 3, hpack_request("GET", "/healthz"))
+            + h2_frame(H2_HEADERS, H2_END_HEADERS, 5, hpack_request("POST", "/echo", {"content-length": "5"}))
+            + h2_frame(H2_DATA, H2_END_STREAM, 5, b"hello")
+            + h2_frame(H2_HEADERS, H2_END_HEADERS | H2_END_STREAM, 7, hpack_request("GET", "/static/missing.txt"))
+            + h2_frame(H2_PING, 0, 0, b"12345678")
+        )
+        client.wait([1, 3, 5, 7])
+        if client.server_settings.get(0x3) != 100:
+            raise AssertionError(f"unexpected server settings: {client.server_settings}")
+        status, headers, body = client.response(1)
+        if status != 200 or body != large_payload or int(headers.get("content-length", "-1")) != len(large_payload):
+            raise AssertionError(f"unexpected h2 large static: {status} len={len(body)}")
+        if "connection" in headers or "keep-alive" in headers:
+            raise AssertionError(f"connection-specific fields over h2: {headers}")
+        status, _, body = client.response(3)
+        if status != 200 or body != b"ok":
+            raise AssertionError(f"unexpected h2 healthz: {status} {body!r}")
+        if client.closed.index(3) > client.closed.index(1):
+            raise AssertionError("a small response waited behind a large one")
+        status, _, body = client.response(5)
+        if status != 200 or body != b"hello":
+            raise AssertionError(f"unexpected h2 echo: {status} {body!r}")
+        if client.response(7)[0] != 404:
+            raise AssertionError(f"expected 404 over h2, got {client.response(7)[0]}")
+        if client.pings != [b"12345678"]:
+            raise AssertionError(f"unexpected PING acks: {client.pings}")
+
+        # A streamed upload larger than one frame, then the connection stays usable.
+        payload = random.Random(23).randbytes(300000)
+        sock.sendall(h2_frame(H2_HEADERS, H2_END_HEADERS, 9, hpack_request("PUT", "/upload")))
+        for i in range(0, len(payload), 16384):
+            last = i + 16384 >= len(payload)
+            sock.sendall(h2_frame(H2_DATA, H2_END_STREAM if last else 0, 9, payload[i:i + 16384]))
+        client.wait([9])
+        status, _, body = client.response(9)
+        if status != 200 or body != f"{len(payload)} {fnv1a64(payload):016x}\n".encode("ascii"):
+            raise AssertionError(f"unexpected h2 upload: {status} {body!r}")
+
+    # The stream window holds a large body back until the client credits it.
+    with socket.create_connection((host, port), timeout=5.0) as sock:
+        client = H2Client(sock)
+        client.credit = False
+        client.handshake({0x4: 16384})
+        sock.sendall(h2_frame(H2_HEADERS, H2_END_HEADERS | H2_END_STREAM, 1, hpack_request("GET", "/static/large.bin")))
+        while len(client.bodies.get(1, b"")) < 16384:
+            client.next_frame()
+        sock.settimeout(0.3)
+        try:
+            while True:
+                kind, _, stream, _ = client.next_frame()
+                if kind == H2_DATA and stream == 1:
+                    raise AssertionError("DATA sent past the stream window")
+        except socket.timeout:
+            pass
+        sock.settimeout(5.0)
+        client.credit = True
+        sock.sendall(h2_window_update(0, len(large_payload)) + h2_window_update(1, len(large_payload)))
+        client.wait([1])
+        if client.response(1)[2] != large_payload:
+            raise AssertionError("unexpected h2 body after window updates")
+
+    # Upgrade from HTTP/1.1: the upgraded request is answered as stream 1.
+    with socket.create_connection((host, port), timeout=5.0) as sock:
+        settings = base64.urlsafe_b64encode(bytes.fromhex("000300000064")).rstrip(b"=")
+        sock.sendall(
+            b"GET /healthz HTTP/1.1\r\nHost: localhost\r\nConnection: Upgrade, HTTP2-Settings\r\n"
+            b"Upgrade: h2c\r\nHTTP2-Settings: " + settings + b"\r\n\r\n"
+        )
+        pending = bytearray()
+        if read_interim(sock, pending) != 101:
+            raise AssertionError("expected 101 Switching Protocols for h2c")
+        client = H2Client(sock, pending)
+        client.handshake()
+        sock.sendall(h2_frame(H2_HEADERS, H2_END_HEADERS | H2_END_STREAM, 3, hpack_request("GET", "/bytes/100000")))
+        client.wait([1, 3])
+        status, _, body = client.response(1)
+        if status != 200 or body != b"ok":
+            raise AssertionError(f"unexpected upgraded response: {status} {body!r}")
+        status, _, body = client.response(3)
+        if status != 200 or len(body) != 100000:
+            raise AssertionError(f"unexpected h2 generated body: {status} len={len(body)}")
+
+    # DATA on stream 0 is a connection error.
+    with socket.create_connection((host, port), timeout=5.0) as sock:
+        client = H2Client(sock)
+        client.handshake()
+        sock.sendall(h2_frame(H2_DATA, 0, 0, b"x"))
+        try:
+            while client.goaway is None:
+                client.next_frame()
+        except RuntimeError:
+            pass
+        if client.goaway != 0x1:
+            raise AssertionError(f"expected GOAWAY(PROTOCOL_ERROR), got {client.goaway}")
+        wait_for_close(sock, time.time() + 2.0)
+
 
 def pick_port() -> int:
     with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
@@ -199,16 +1496,26 @@ def pick_port() -> int:
         return int(s.getsockname()[1])
 
 
-def main() -> int:
-    parser = argparse.ArgumentParser()
-    parser.add_argument("--httpd", default="./httpd-debug")
-    args = parser.parse_args()
-
+def run_suite(
+    httpd: str,
+    engine: str,
+    watch: str,
+    static_root: str,
+    large_payload: bytes,
+    module: Optional[str],
+) -> None:
     host = "127.0.0.1"
     port = pick_port()
 
+    argv = [
+        httpd, "-p", str(port), "-t", "4", "-s", static_root,
+        "-i", "10", "-R", "1", "-B", "1", "-W", "10", "-E", engine,
+        "-w", watch, "-V", "1", "-A", "=0", "-A", "large=3600",
+    ]
+    if module is not None:
+        argv += ["-m", f"{module}:hi"]
     proc = subprocess.Popen(
-        [args.httpd, "-p", str(port), "-t", "4", "-s", "tests/static", "-i", "10"],
+        argv,
         stdout=subprocess.DEVNULL,
         stderr=subprocess.DEVNULL,
     )
@@ -217,12 +1524,28 @@ def main() -> int:
         wait_for_healthz(host, port)
         keep_alive_test(host, port)
         connection_close_test(host, port)
+        trickled_request_test(host, port)
+        chunked_request_test(host, port)
+        streamed_upload_test(host, port)
+        routing_test(host, port)
+        if module is not None:
+            module_test(host, port)
+        pipelining_test(host, port, n=40)
         static_and_traversal_test(host, port)
+        large_static_test(host, port, large_payload)
+        range_test(host, port, static_root, large_payload)
+        generated_body_test(host, port)
+        h2_test(host, port, large_payload)
+        cache_invalidation_test(host, port, static_root, timeout_sec=3.0 if watch == "stat" else 1.0)
+        content_encoding_test(host, port, static_root, timeout_sec=3.0 if watch == "stat" else 1.0)
+        conditional_get_test(host, port, static_root, timeout_sec=3.0 if watch == "stat" else 1.0)
+        slow_client_timeout_test(host, port)
         concurrent_load_test(host, port, n=300)
         # Deterministic floor:
-        # 1 startup healthz + 2 keep-alive + 1 connection-close +
-        # 2 static/traversal + 300 concurrent + 1 metrics request.
-        metrics_test(host, port, min_requests=307)
+        # 1 startup healthz + 2 keep-alive + 1 connection-close + 1 trickled +
+        # 40 pipelined + 2 static/traversal + 2 large static + 300 concurrent +
+        # 1 metrics request.
+        metrics_test(host, port, min_requests=350)
     finally:
         proc.terminate()
         try:
@@ -231,6 +1554,38 @@ def main() -> int:
             proc.kill()
             proc.wait(timeout=3.0)
 
+
+def main() -> int:
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--httpd", default="./httpd-debug")
+    parser.add_argument("--engine", choices=["epoll", "uring", "all"], default="all")
+    parser.add_argument("--module", default=None, help="examples/hello_module.c built as a shared object")
+    args = parser.parse_args()
+
+    engines = ["epoll", "uring"] if args.engine == "all" else [args.engine]
+    large_payload = random.Random(7).randbytes(1536 * 1024)
+
+    with tempfile.TemporaryDirectory() as static_root:
+        for name in os.listdir("tests/static"):
+            shutil.copy(os.path.join("tests/static", name), static_root)
+        with open(os.path.join(static_root, "large.bin"), "wb") as f:
+            f.write(large_payload)
+
+        # Each engine also exercises a different cache invalidation mode.
+        for engine in engines:
+            watch = "inotify" if engine == "epoll" else "stat"
+            run_suite(args.httpd, engine, watch, static_root, large_payload, args.module)
+            print(f"integration test passed (engine={engine})")
+        if "epoll" in engines:
+            proxy_test(args.httpd, static_root, large_payload)
+            print("integration test passed (proxy)")
+            rebalance_test(args.httpd, static_root)
+            print("integration test passed (rebalance)")
+            accept_mode_test(args.httpd, static_root)
+            print("integration test passed (accept modes)")
+            if tls_test(args.httpd, static_root, large_payload):
+                print("integration test passed (tls)")
+
     print("integration test passed")
     return 0
 
@@ -0,0 +1,126 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpsc.h"
+
+static int g_failures = 0;
+
+#define CHECK(expr)                                                                                 \
+    do {                                                                                            \
+        if (!(expr)) {                                                                              \
+            fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #expr);                      \
+            ++g_failures;                                                                           \
+        }                                                                                           \
+    } while (0)
+
+#define PRODUCERS 4
+#define ITEMS_PER_PRODUCER 100000
+
+typedef struct {
+    mpsc_node_t node;
+    int producer;
+    int seq;
+} item_t;
+
+typedef struct {
+    mpsc_queue_t *queue;
+    item_t *items;
+    int producer;
+    int wakeups;
+} producer_t;
+
+static void test_order_single_thread(void) {
+    mpsc_queue_t q;
+    mpsc_init(&q);
+    CHECK(mpsc_take_all(&q) == NULL);
+
+    item_t items[3];
+    for (int i = 0; i < 3; ++i) {
+        items[i].seq = i;
+        CHECK(mpsc_push(&q, &items[i].node) == (i == 0));
+    }
+    mpsc_node_t *n = mpsc_take_all(&q);
+    for (int i = 0; i < 3; ++i) {
+        CHECK(n == &items[i].node);
+        n = n != NULL ? n->next : NULL;
+    }
+    CHECK(n == NULL);
+    CHECK(mpsc_take_all(&q) == NULL);
+    CHECK(mpsc_push(&q, &items[0].node));
+}
+
+static void *produce(void *arg) {
+    producer_t *p = arg;
+    for (int i = 0; i < ITEMS_PER_PRODUCER; ++i) {
+        item_t *item = &p->items[i];
+        item->producer = p->producer;
+        item->seq = i;
+        if (mpsc_push(p->queue, &item->node)) {
+            ++p->wakeups;
+        }
+    }
+    return NULL;
+}
+
+/* Every item arrives exactly once, and each producer's items in the order pushed. */
+static void test_concurrent_producers(void) {
+    mpsc_queue_t q;
+    mpsc_init(&q);
+    producer_t producers[PRODUCERS];
+    pthread_t threads[PRODUCERS];
+    for (int p = 0; p < PRODUCERS; ++p) {
+        producers[p].queue = &q;
+        producers[p].items = calloc(ITEMS_PER_PRODUCER, sizeof(item_t));
+        producers[p].producer = p;
+        producers[p].wakeups = 0;
+        CHECK(producers[p].items != NULL);
+    }
+    for (int p = 0; p < PRODUCERS; ++p) {
+        CHECK(pthread_create(&threads[p], NULL, produce, &producers[p]) == 0);
+    }
+
+    int next[PRODUCERS];
+    memset(next, 0, sizeof(next));
+    int received = 0;
+    int batches = 0;
+    while (received < PRODUCERS * ITEMS_PER_PRODUCER) {
+        mpsc_node_t *n = mpsc_take_all(&q);
+        if (n != NULL) {
+            ++batches;
+        }
+        for (; n != NULL; n = n->next) {
+            item_t *item = (item_t *)n;
+            CHECK(item->seq == next[item->producer]);
+            next[item->producer] = item->seq + 1;
+            ++received;
+        }
+    }
+    for (int p = 0; p < PRODUCERS; ++p) {
+        pthread_join(threads[p], NULL);
+    }
+    CHECK(mpsc_take_all(&q) == NULL);
+
+    /* A push that found the queue empty started each batch the consumer took. */
+    int wakeups = 0;
+    for (int p = 0; p < PRODUCERS; ++p) {
+        CHECK(next[p] == ITEMS_PER_PRODUCER);
+        wakeups += producers[p].wakeups;
+        free(producers[p].items);
+    }
+    CHECK(wakeups == batches);
+}
+
+int main(void) {
+    test_order_single_thread();
+    test_concurrent_producers();
+
+    if (g_failures == 0) {
+        printf("mpsc tests passed\n");
+        return 0;
+    }
+
+    fprintf(stderr, "mpsc tests failed: %d failure(s)\n", g_failures);
+    return 1;
+}
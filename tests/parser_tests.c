@@ -1,7 +1,10 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "http_parser.h"
+#include "http_scan.h"
+#include "util.h"
 
 static int g_failures = 0;
 
@@ -14,7 +17,7 @@ static int g_failures = 0;
     } while (0)
 
 static void test_basic_get(void) {
-    const char *req =
+    char req[] =
         "GET /healthz HTTP/1.1\r\n"
         "Host: localhost\r\n"
         "\r\n";
@@ -26,14 +29,15 @@ static void test_basic_get(void) {
     http_parse_result_t rc = http_parse_request(req, strlen(req), &parsed, &consumed, &status);
     CHECK(rc == HTTP_PARSE_OK);
     CHECK(consumed == strlen(req));
-    CHECK(strcmp(parsed.method, "GET") == 0);
-    CHECK(strcmp(parsed.path, "/healthz") == 0);
+    CHECK(http_view_eq(&parsed.method, "GET"));
+    CHECK(parsed.method_id == HTTP_METHOD_GET);
+    CHECK(http_view_eq(&parsed.path, "/healthz"));
     CHECK(parsed.content_length == 0);
     CHECK(parsed.connection_close == false);
 }
 
 static void test_partial_headers(void) {
-    const char *full =
+    char full[] =
         "GET /healthz HTTP/1.1\r\n"
         "Host: localhost\r\n"
         "X-Test: abc\r\n"
@@ -53,7 +57,7 @@ static void test_partial_headers(void) {
 }
 
 static void test_partial_body(void) {
-    const char *hdr =
+    char hdr[] =
         "POST /echo HTTP/1.1\r\n"
         "Host: localhost\r\n"
         "Content-Length: 5\r\n"
@@ -80,7 +84,7 @@ static void test_partial_body(void) {
 }
 
 static void test_invalid_header(void) {
-    const char *req =
+    char req[] =
         "GET /healthz HTTP/1.1\r\n"
         "Host localhost\r\n"
         "\r\n";
@@ -94,7 +98,7 @@ static void test_invalid_header(void) {
 }
 
 static void test_duplicate_content_length_mismatch(void) {
-    const char *req =
+    char req[] =
         "POST /echo HTTP/1.1\r\n"
         "Host: localhost\r\n"
         "Content-Length: 4\r\n"
@@ -111,7 +115,7 @@ static void test_duplicate_content_length_mismatch(void) {
 }
 
 static void test_connection_close_header(void) {
-    const char *req =
+    char req[] =
         "GET /healthz HTTP/1.1\r\n"
         "Host: localhost\r\n"
         "Connection: Close\r\n"
@@ -145,7 +149,7 @@ static void test_too_many_headers(void) {
 }
 
 static void test_http_version_not_supported(void) {
-    const char *req =
+    char req[] =
         "GET /healthz HTTP/1.0\r\n"
         "Host: localhost\r\n"
         "\r\n";
@@ -159,7 +163,496 @@ static void test_http_version_not_supported(void) {
     CHECK(status == 505);
 }
 
-int main(void) {
+static void test_incremental_byte_by_byte(void) {
+    char req[] =
+        "POST /echo?x=1 HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "Content-Length: 5\r\n"
+        "Connection: close\r\n"
+        "\r\n"
+        "hello";
+    size_t req_len = strlen(req);
+
+    http_parser_t parser;
+    http_parser_init(&parser);
+
+    http_request_t parsed;
+    size_t consumed = 0;
+    int status = 0;
+    http_parse_result_t rc = HTTP_PARSE_INCOMPLETE;
+    size_t fed = 0;
+    while (fed < req_len) {
+        ++fed;
+        rc = http_parser_execute(&parser, req, fed, &parsed, &consumed, &status);
+        if (rc != HTTP_PARSE_INCOMPLETE) {
+            break;
+        }
+        CHECK(parser.scan_pos <= fed);
+    }
+
+    CHECK(rc == HTTP_PARSE_OK);
+    CHECK(fed == req_len);
+    CHECK(consumed == req_len);
+    CHECK(http_view_eq(&parsed.method, "POST"));
+    CHECK(parsed.method_id == HTTP_METHOD_POST);
+    CHECK(http_view_eq(&parsed.path, "/echo?x=1"));
+    CHECK(parsed.connection_close == true);
+    CHECK(parsed.body_len == 5);
+    CHECK(memcmp(parsed.body, "hello", 5) == 0);
+}
+
+static void test_request_line_too_long_without_crlf(void) {
+    char req[HTTP_MAX_REQUEST_LINE_LEN + 64];
+    memset(req, 'a', sizeof(req));
+    memcpy(req, "GET /", 5);
+
+    http_parser_t parser;
+    http_parser_init(&parser);
+
+    http_request_t parsed;
+    size_t consumed = 0;
+    int status = 0;
+    http_parse_result_t rc = http_parser_execute(&parser, req, sizeof(req), &parsed, &consumed, &status);
+    CHECK(rc == HTTP_PARSE_ERROR);
+    CHECK(status == 414);
+}
+
+static void test_bare_lf_rejected(void) {
+    char req[] =
+        "GET /healthz HTTP/1.1\n"
+        "Host: localhost\r\n"
+        "\r\n";
+
+    http_request_t parsed;
+    size_t consumed = 0;
+    int status = 0;
+    http_parse_result_t rc = http_parse_request(req, strlen(req), &parsed, &consumed, &status);
+    CHECK(rc == HTTP_PARSE_ERROR);
+    CHECK(status == 400);
+}
+
+static void test_invalid_header_name_and_value(void) {
+    char bad_name[] =
+        "GET /healthz HTTP/1.1\r\n"
+        "Bad Name: x\r\n"
+        "\r\n";
+    char bad_value[] =
+        "GET /healthz HTTP/1.1\r\n"
+        "X-Test: a\x01b\r\n"
+        "\r\n";
+
+    http_request_t parsed;
+    size_t consumed = 0;
+    int status = 0;
+    http_parse_result_t rc = http_parse_request(bad_name, strlen(bad_name), &parsed, &consumed, &status);
+    CHECK(rc == HTTP_PARSE_ERROR);
+    CHECK(status == 400);
+
+    rc = http_parse_request(bad_value, strlen(bad_value), &parsed, &consumed, &status);
+    CHECK(rc == HTTP_PARSE_ERROR);
+    CHECK(status == 400);
+}
+
+static void test_header_views(void) {
+    char req[] =
+        "GET /static/app.js HTTP/1.1\r\n"
+        "host:  example.com \r\n"
+        "Accept-Encoding: gzip, br\r\n"
+        "X-Trace-Id: abc123\r\n"
+        "If-None-Match: \"v1\"\r\n"
+        "HOST: second.example\r\n"
+        "\r\n";
+
+    http_request_t parsed;
+    size_t consumed = 0;
+    int status = 0;
+    http_parse_result_t rc = http_parse_request(req, strlen(req), &parsed, &consumed, &status);
+    CHECK(rc == HTTP_PARSE_OK);
+    if (rc != HTTP_PARSE_OK) {
+        return;
+    }
+
+    CHECK(parsed.header_count == 5);
+    CHECK(http_view_eq(&parsed.version, "HTTP/1.1"));
+    CHECK(parsed.method.ptr == req);
+    CHECK(http_view_eq(http_request_header(&parsed, HTTP_HDR_HOST), "example.com"));
+    CHECK(http_view_eq(http_request_header(&parsed, HTTP_HDR_ACCEPT_ENCODING), "gzip, br"));
+    CHECK(http_view_eq(http_request_header(&parsed, HTTP_HDR_IF_NONE_MATCH), "\"v1\""));
+    CHECK(http_request_header(&parsed, HTTP_HDR_RANGE) == NULL);
+    CHECK(http_view_eq(http_request_find_header(&parsed, "x-trace-id"), "abc123"));
+    CHECK(http_request_find_header(&parsed, "X-Missing") == NULL);
+    CHECK(parsed.headers[2].id == HTTP_HDR_OTHER);
+    CHECK(parsed.headers[4].id == HTTP_HDR_HOST);
+}
+
+static void test_scan_kernels_match_scalar(void) {
+    static const char alphabet[] = "abcXYZ-_:!~ \t\r\n\x01\x7f\x80\xff";
+    char buf[200];
+    char lower[200];
+    http_scan_impl_t impl = http_scan_active();
+
+    srand(12345);
+    for (int iter = 0; iter < 2000; ++iter) {
+        size_t len = (size_t)(rand() % (int)sizeof(buf));
+        for (size_t i = 0; i < len; ++i) {
+            buf[i] = alphabet[rand() % (int)(sizeof(alphabet) - 1)];
+        }
+        for (size_t i = 0; i < len; ++i) {
+            char c = buf[i];
+            lower[i] = (c >= 'A' && c <= 'Z') ? (char)(c | 0x20) : c;
+        }
+        if (len > 0 && iter % 2 == 0) {
+            lower[rand() % (int)len] ^= 0x01;
+        }
+
+        size_t find = http_scan_find_char(buf, len, '\n');
+        size_t token = http_scan_token_len(buf, len);
+        size_t value = http_scan_value_invalid(buf, len);
+        bool eq = http_scan_name_eq(buf, lower, len);
+
+        (void)http_scan_select(HTTP_SCAN_SCALAR);
+        CHECK(find == http_scan_find_char(buf, len, '\n'));
+        CHECK(token == http_scan_token_len(buf, len));
+        CHECK(value == http_scan_value_invalid(buf, len));
+        CHECK(eq == http_scan_name_eq(buf, lower, len));
+        (void)http_scan_select(impl);
+    }
+}
+
+static void accept_encoding(const char *value, uint16_t q[HTTP_ENCODING_COUNT]) {
+    http_view_t v = {value, strlen(value)};
+    http_accept_encoding(value != NULL ? &v : NULL, q);
+}
+
+static void test_accept_encoding(void) {
+    uint16_t q[HTTP_ENCODING_COUNT];
+
+    http_accept_encoding(NULL, q);
+    CHECK(q[HTTP_ENCODING_IDENTITY] == HTTP_QVALUE_MAX);
+    CHECK(q[HTTP_ENCODING_GZIP] == 0 && q[HTTP_ENCODING_BR] == 0 && q[HTTP_ENCODING_ZSTD] == 0);
+
+    accept_encoding("gzip, deflate, br", q);
+    CHECK(q[HTTP_ENCODING_GZIP] == 1000 && q[HTTP_ENCODING_BR] == 1000);
+    CHECK(q[HTTP_ENCODING_ZSTD] == 0 && q[HTTP_ENCODING_IDENTITY] == 1000);
+
+    accept_encoding(" BR ; q=0.5 ,x-gzip;Q=0.25, identity;q=0", q);
+    CHECK(q[HTTP_ENCODING_BR] == 500);
+    CHECK(q[HTTP_ENCODING_GZIP] == 250);
+    CHECK(q[HTTP_ENCODING_IDENTITY] == 0);
+
+    accept_encoding("*;q=0.1, gzip;q=0", q);
+    CHECK(q[HTTP_ENCODING_GZIP] == 0);
+    CHECK(q[HTTP_ENCODING_BR] == 100 && q[HTTP_ENCODING_ZSTD] == 100 && q[HTTP_ENCODING_IDENTITY] == 100);
+
+    accept_encoding("gzip;q=1.000, br;q=0.001, zstd;q=1.5", q);
+    CHECK(q[HTTP_ENCODING_GZIP] == 1000 && q[HTTP_ENCODING_BR] == 1 && q[HTTP_ENCODING_ZSTD] == 1000);
+
+    CHECK(strcmp(http_encoding_suffix(HTTP_ENCODING_BR), ".br") == 0);
+    CHECK(strcmp(http_encoding_name(HTTP_ENCODING_GZIP), "gzip") == 0);
+}
+
+static bool etag_match(const char *list, const char *etag) {
+    http_view_t v = {list, strlen(list)};
+    return http_etag_list_match(&v, etag);
+}
+
+static void test_conditional_validators(void) {
+    CHECK(etag_match("\"abc\"", "\"abc\""));
+    CHECK(etag_match("\"x\", W/\"abc\" ,\"y\"", "\"abc\""));
+    CHECK(etag_match("*", "\"abc\""));
+    CHECK(!etag_match("\"abcd\", \"ab\"", "\"abc\""));
+    CHECK(!etag_match("abc", "\"abc\""));
+
+    char date[UTIL_HTTP_DATE_LEN + 1];
+    util_http_date_format(784111777, date);
+    CHECK(strcmp(date, "Sun, 06 Nov 1994 08:49:37 GMT") == 0);
+    time_t t = 0;
+    CHECK(util_http_date_parse(date, strlen(date), &t) == 0 && t == 784111777);
+    util_http_date_format(0, date);
+    CHECK(strcmp(date, "Thu, 01 Jan 1970 00:00:00 GMT") == 0);
+
+    char rfc850[] = "Sunday, 06-Nov-94 08:49:37 GMT";
+    CHECK(util_http_date_parse(rfc850, strlen(rfc850), &t) != 0);
+    char bad_month[] = "Sun, 06 Nox 1994 08:49:37 GMT";
+    CHECK(util_http_date_parse(bad_month, strlen(bad_month), &t) != 0);
+}
+
+static http_range_result_t parse_range(const char *value, off_t size, http_byte_range_t *ranges, size_t *count) {
+    http_view_t v = {value, strlen(value)};
+    return http_parse_range(&v, size, ranges, HTTP_RANGES_MAX, count);
+}
+
+static void test_range(void) {
+    http_byte_range_t r[HTTP_RANGES_MAX];
+    size_t n = 0;
+
+    CHECK(parse_range("bytes=0-99", 1000, r, &n) == HTTP_RANGE_OK);
+    CHECK(n == 1 && r[0].start == 0 && r[0].length == 100);
+
+    /* Open-ended, suffix and clipped ranges. */
+    CHECK(parse_range("bytes=990-, -5,10-2000", 1000, r, &n) == HTTP_RANGE_OK);
+    CHECK(n == 3);
+    CHECK(r[0].start == 990 && r[0].length == 10);
+    CHECK(r[1].start == 995 && r[1].length == 5);
+    CHECK(r[2].start == 10 && r[2].length == 990);
+    CHECK(parse_range("bytes=-5000", 1000, r, &n) == HTTP_RANGE_OK && n == 1 && r[0].start == 0);
+
+    /* Unsatisfiable specs are dropped; with none left the whole request is. */
+    CHECK(parse_range("bytes=1000-, 5-5", 1000, r, &n) == HTTP_RANGE_OK && n == 1 && r[0].start == 5);
+    CHECK(parse_range("bytes=1000-1001", 1000, r, &n) == HTTP_RANGE_UNSATISFIABLE);
+    CHECK(parse_range("bytes=-0", 1000, r, &n) == HTTP_RANGE_UNSATISFIABLE);
+    CHECK(parse_range("bytes=0-", 0, r, &n) == HTTP_RANGE_UNSATISFIABLE);
+
+    /* Malformed or unknown units are ignored rather than rejected. */
+    CHECK(parse_range("items=0-1", 1000, r, &n) == HTTP_RANGE_NONE);
+    CHECK(parse_range("bytes=5-1", 1000, r, &n) == HTTP_RANGE_NONE);
+    CHECK(parse_range("bytes=a-1", 1000, r, &n) == HTTP_RANGE_NONE);
+    CHECK(parse_range("bytes=", 1000, r, &n) == HTTP_RANGE_NONE);
+    CHECK(parse_range("bytes=1", 1000, r, &n) == HTTP_RANGE_NONE);
+    CHECK(parse_range("bytes=0-0,1-1,2-2,3-3,4-4,5-5,6-6,7-7,8-8", 1000, r, &n) == HTTP_RANGE_NONE);
+}
+
+static http_parse_result_t parse_one(const char *text, http_request_t *parsed, size_t *consumed, int *status) {
+    static char buf[4096];
+    size_t len = strlen(text);
+    memcpy(buf, text, len);
+    return http_parse_request(buf, len, parsed, consumed, status);
+}
+
+static void test_method_tokens(void) {
+    static const struct {
+        const char *text;
+        http_method_t id;
+    } cases[] = {
+        {"GET / HTTP/1.1\r\n\r\n", HTTP_METHOD_GET},
+        {"HEAD / HTTP/1.1\r\n\r\n", HTTP_METHOD_HEAD},
+        {"put / HTTP/1.1\r\n\r\n", HTTP_METHOD_PUT},
+        {"Delete / HTTP/1.1\r\n\r\n", HTTP_METHOD_DELETE},
+        {"OPTIONS * HTTP/1.1\r\n\r\n", HTTP_METHOD_OPTIONS},
+        {"PATCH / HTTP/1.1\r\n\r\n", HTTP_METHOD_PATCH},
+        {"GETS / HTTP/1.1\r\n\r\n", HTTP_METHOD_OTHER},
+        {"BREW / HTTP/1.1\r\n\r\n", HTTP_METHOD_OTHER},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        http_request_t parsed;
+        size_t consumed = 0;
+        int status = 0;
+        CHECK(parse_one(cases[i].text, &parsed, &consumed, &status) == HTTP_PARSE_OK);
+        CHECK(parsed.method_id == cases[i].id);
+    }
+}
+
+static void test_chunked_body(void) {
+    static const char src[] =
+        "POST /echo HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "Transfer-Encoding: Chunked\r\n"
+        "\r\n"
+        "5;name=value\r\n"
+        "hello\r\n"
+        "1\r\n"
+        " \r\n"
+        "A \r\n"
+        "0123456789\r\n"
+        "0\r\n"
+        "X-Trailer: ignored\r\n"
+        "\r\n"
+        "GET /healthz HTTP/1.1\r\n\r\n";
+    size_t src_len = strlen(src);
+    size_t first_len = strlen(src) - strlen("GET /healthz HTTP/1.1\r\n\r\n");
+
+    /* Feed a byte at a time, compacting like a connection does between reads. */
+    char buf[sizeof(src)];
+    http_parser_t parser;
+    http_parser_init(&parser);
+    http_request_t parsed;
+    size_t consumed = 0;
+    int status = 0;
+    http_parse_result_t rc = HTTP_PARSE_INCOMPLETE;
+    size_t fed = 0;
+    size_t len = 0;
+    while (fed < src_len) {
+        buf[len++] = src[fed++];
+        rc = http_parser_execute(&parser, buf, len, &parsed, &consumed, &status);
+        if (rc != HTTP_PARSE_INCOMPLETE) {
+            break;
+        }
+        len = http_parser_compact(&parser, buf, len);
+    }
+
+    CHECK(rc == HTTP_PARSE_OK);
+    CHECK(fed == first_len);
+    CHECK(consumed == len);
+    CHECK(parsed.chunked == true);
+    CHECK(parsed.body_len == 16);
+    CHECK(memcmp(parsed.body, "hello 0123456789", 16) == 0);
+
+    /* All at once: the pipelined request after the trailers is left alone. */
+    memcpy(buf, src, src_len);
+    rc = http_parse_request(buf, src_len, &parsed, &consumed, &status);
+    CHECK(rc == HTTP_PARSE_OK);
+    CHECK(consumed == first_len);
+    CHECK(parsed.body_len == 16);
+    CHECK(memcmp(parsed.body, "hello 0123456789", 16) == 0);
+    rc = http_parse_request(buf + consumed, src_len - consumed, &parsed, &consumed, &status);
+    CHECK(rc == HTTP_PARSE_OK);
+    CHECK(http_view_eq(&parsed.path, "/healthz"));
+    CHECK(parsed.chunked == false);
+
+    rc = parse_one("POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n", &parsed, &consumed, &status);
+    CHECK(rc == HTTP_PARSE_OK);
+    CHECK(parsed.body_len == 0);
+}
+
+static void test_chunked_rejects(void) {
+    http_request_t parsed;
+    size_t consumed = 0;
+    int status = 0;
+
+    /* Both framings at once are ambiguous, in either order. */
+    CHECK(parse_one(
+        "POST /echo HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n",
+        &parsed,
+        &consumed,
+        &status
+    ) == HTTP_PARSE_ERROR && status == 400);
+    CHECK(parse_one(
+        "POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n0\r\n\r\n",
+        &parsed,
+        &consumed,
+        &status
+    ) == HTTP_PARSE_ERROR && status == 400);
+    CHECK(parse_one(
+        "POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\nTransfer-Encoding: chunked\r\n\r\n",
+        &parsed,
+        &consumed,
+        &status
+    ) == HTTP_PARSE_ERROR && status == 400);
+    CHECK(parse_one(
+        "POST /echo HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n",
+        &parsed,
+        &consumed,
+        &status
+    ) == HTTP_PARSE_ERROR && status == 501);
+
+    /* Framing errors. */
+    static const char *const bad[] = {
+        "\r\n\r\n",
+        "x\r\n",
+        "5\nhello\r\n0\r\n\r\n",
+        "5\r\nhelloX\r\n0\r\n\r\n",
+        "0\r\n\n",
+        "0\r\nX-Trailer: y\n\r\n",
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+        char req[256];
+        snprintf(req, sizeof(req), "POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n%s", bad[i]);
+        CHECK(parse_one(req, &parsed, &consumed, &status) == HTTP_PARSE_ERROR && status == 400);
+    }
+
+    /* The decoded size is bounded like Content-Length, checked as digits arrive. */
+    char req[256];
+    snprintf(
+        req,
+        sizeof(req),
+        "POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n%zx\r\n",
+        (size_t)HTTP_MAX_CONTENT_LENGTH + 1
+    );
+    CHECK(parse_one(req, &parsed, &consumed, &status) == HTTP_PARSE_ERROR && status == 413);
+    CHECK(parse_one(
+        "POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nffffffffffffffffffff",
+        &parsed,
+        &consumed,
+        &status
+    ) == HTTP_PARSE_ERROR && status == 413);
+}
+
+static void test_streamed_body(void) {
+    http_parser_t parser;
+    http_request_t parsed;
+    size_t consumed = 0;
+    size_t data_len = 0;
+    int status = 0;
+
+    /* The head is reported first; resuming buffers the body as usual. */
+    char small[] = "POST /echo HTTP/1.1\r\nContent-Length: 5\r\nExpect: 100-Continue\r\n\r\nhello";
+    http_parser_init(&parser);
+    parser.report_headers = true;
+    CHECK(http_parser_execute(&parser, small, strlen(small), &parsed, &consumed, &status) == HTTP_PARSE_HEADERS);
+    CHECK(parsed.expect_continue == true);
+    CHECK(parsed.content_length == 5);
+    CHECK(parsed.body_len == 0);
+    CHECK(http_parser_execute(&parser, small, strlen(small), &parsed, &consumed, &status) == HTTP_PARSE_OK);
+    CHECK(parsed.body_len == 5 && memcmp(parsed.body, "hello", 5) == 0);
+    CHECK(consumed == strlen(small));
+
+    /* Requests without a body are not reported early. */
+    char get[] = "GET /healthz HTTP/1.1\r\n\r\n";
+    http_parser_init(&parser);
+    parser.report_headers = true;
+    CHECK(http_parser_execute(&parser, get, strlen(get), &parsed, &consumed, &status) == HTTP_PARSE_OK);
+
+    /* Buffering a body past the limit fails only once the caller resumes. */
+    char big[] = "PUT /upload HTTP/1.1\r\nContent-Length: 1000000\r\n\r\n0123456789";
+    size_t head_len = strlen(big) - 10;
+    http_parser_init(&parser);
+    parser.report_headers = true;
+    CHECK(http_parser_execute(&parser, big, strlen(big), &parsed, &consumed, &status) == HTTP_PARSE_HEADERS);
+    CHECK(parsed.content_length == 1000000);
+    http_parser_t copy = parser;
+    CHECK(http_parser_execute(&copy, big, strlen(big), &parsed, &consumed, &status) == HTTP_PARSE_ERROR);
+    CHECK(status == 413);
+
+    /* Streaming it hands out whatever is buffered, without a limit. */
+    CHECK(http_parser_read_body(&parser, big + head_len, 10, &data_len, &consumed, &status) == HTTP_PARSE_INCOMPLETE);
+    CHECK(data_len == 10 && consumed == 10);
+    char rest[4096];
+    memset(rest, 'x', sizeof(rest));
+    size_t left = 1000000 - 10;
+    http_parse_result_t rc = HTTP_PARSE_INCOMPLETE;
+    while (rc == HTTP_PARSE_INCOMPLETE && left > 0) {
+        rc = http_parser_read_body(&parser, rest, sizeof(rest), &data_len, &consumed, &status);
+        CHECK(data_len == consumed);
+        left -= data_len;
+    }
+    CHECK(rc == HTTP_PARSE_OK);
+    CHECK(left == 0);
+    CHECK(consumed == (1000000 - 10) % sizeof(rest));
+
+    /* Chunked streams decode in place; framing split across calls. */
+    char chunked[] =
+        "POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "4\r\nwiki\r\n5;x=y\r\npedia\r\n0\r\nTrailer: 1\r\n\r\n";
+    head_len = strlen(chunked) - strlen("4\r\nwiki\r\n5;x=y\r\npedia\r\n0\r\nTrailer: 1\r\n\r\n");
+    http_parser_init(&parser);
+    parser.report_headers = true;
+    CHECK(http_parser_execute(&parser, chunked, strlen(chunked), &parsed, &consumed, &status) == HTTP_PARSE_HEADERS);
+    CHECK(parsed.chunked == true);
+    char *body = chunked + head_len;
+    size_t body_len = strlen(body);
+    char decoded[16];
+    size_t decoded_len = 0;
+    rc = HTTP_PARSE_INCOMPLETE;
+    for (size_t pos = 0; pos < body_len && rc == HTTP_PARSE_INCOMPLETE;) {
+        size_t step = body_len - pos < 3 ? body_len - pos : 3;
+        rc = http_parser_read_body(&parser, body + pos, step, &data_len, &consumed, &status);
+        CHECK(rc != HTTP_PARSE_ERROR);
+        CHECK(decoded_len + data_len <= sizeof(decoded));
+        if (decoded_len + data_len <= sizeof(decoded)) {
+            memcpy(decoded + decoded_len, body + pos, data_len);
+            decoded_len += data_len;
+        }
+        pos += consumed;
+    }
+    CHECK(rc == HTTP_PARSE_OK);
+    CHECK(decoded_len == 9 && memcmp(decoded, "wikipedia", 9) == 0);
+
+    /* Only 100-continue is an expectation the server can meet. */
+    CHECK(parse_one("POST /echo HTTP/1.1\r\nExpect: 200-ok\r\n\r\n", &parsed, &consumed, &status) == HTTP_PARSE_ERROR);
+    CHECK(status == 417);
+}
+
+static void run_parser_tests(void) {
     test_basic_get();
     test_partial_headers();
     test_partial_body();
@@ -168,6 +661,30 @@ int main(void) {
     test_connection_close_header();
     test_too_many_headers();
     test_http_version_not_supported();
+    test_incremental_byte_by_byte();
+    test_request_line_too_long_without_crlf();
+    test_bare_lf_rejected();
+    test_invalid_header_name_and_value();
+    test_header_views();
+    test_accept_encoding();
+    test_conditional_validators();
+    test_range();
+    test_chunked_body();
+    test_method_tokens();
+    test_chunked_rejects();
+    test_streamed_body();
+    test_scan_kernels_match_scalar();
+}
+
+int main(void) {
+    static const http_scan_impl_t impls[] = {HTTP_SCAN_SCALAR, HTTP_SCAN_SSE42, HTTP_SCAN_AVX2};
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); ++i) {
+        if (http_scan_select(impls[i]) != 0) {
+            printf("scan kernel %s not supported, skipped\n", http_scan_impl_name(impls[i]));
+            continue;
+        }
+        run_parser_tests();
+    }
 
     if (g_failures == 0) {
         printf("parser tests passed\n");
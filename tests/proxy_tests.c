@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http_proxy.h"
+
+static int g_failures = 0;
+
+#define CHECK(expr)                                                                                 \
+    do {                                                                                            \
+        if (!(expr)) {                                                                              \
+            fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #expr);                      \
+            ++g_failures;                                                                           \
+        }                                                                                           \
+    } while (0)
+
+static http_parse_result_t parse_head(const char *text, bool head_request, http_upstream_head_t *head) {
+    return http_proxy_parse_head(text, strlen(text), head_request, head);
+}
+
+static bool contains(const char *buf, size_t len, const char *needle) {
+    return memmem(buf, len, needle, strlen(needle)) != NULL;
+}
+
+static void test_format_request(void) {
+    char raw[] =
+        "POST /api/items?x=1 HTTP/1.1\r\n"
+        "Host: example.test\r\n"
+        "Connection: keep-alive, X-Trace\r\n"
+        "Keep-Alive: timeout=5\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "X-Trace: abc\r\n"
+        "\r\n"
+        "5\r\nhello\r\n0\r\n\r\n";
+    http_request_t req;
+    size_t consumed = 0;
+    int status = 0;
+    CHECK(http_parse_request(raw, strlen(raw), &req, &consumed, &status) == HTTP_PARSE_OK);
+
+    char out[1024];
+    http_view_t path = {"/v1/items?x=1", strlen("/v1/items?x=1")};
+    ssize_t n = http_proxy_format_request(&req, path, "upstream:8080", out, sizeof(out));
+    CHECK(n > 0);
+    const char *expected =
+        "POST /v1/items?x=1 HTTP/1.1\r\n"
+        "Host: example.test\r\n"
+        "X-Trace: abc\r\n"
+        "Content-Length: 5\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n"
+        "hello";
+    CHECK((size_t)n == strlen(expected));
+    CHECK(n > 0 && memcmp(out, expected, (size_t)n) == 0);
+
+    CHECK(http_proxy_format_request(&req, path, "upstream:8080", out, 20) == -1);
+}
+
+static void test_format_request_adds_host(void) {
+    char raw[] =
+        "GET /healthz HTTP/1.1\r\n"
+        "Accept: */*\r\n"
+        "\r\n";
+    http_request_t req;
+    size_t consumed = 0;
+    int status = 0;
+    CHECK(http_parse_request(raw, strlen(raw), &req, &consumed, &status) == HTTP_PARSE_OK);
+
+    char out[512];
+    ssize_t n = http_proxy_format_request(&req, req.path, "localhost", out, sizeof(out));
+    CHECK(n > 0);
+    CHECK(n > 0 && contains(out, (size_t)n, "GET /healthz HTTP/1.1\r\n"));
+    CHECK(n > 0 && contains(out, (size_t)n, "Host: localhost\r\n"));
+    CHECK(n > 0 && !contains(out, (size_t)n, "Content-Length"));
+}
+
+static void test_parse_head_framing(void) {
+    http_upstream_head_t head;
+    const char *length =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Length: 12\r\n"
+        "\r\n"
+        "hello world\n";
+    CHECK(parse_head(length, false, &head) == HTTP_PARSE_OK);
+    CHECK(head.status == 200);
+    CHECK(head.framing == HTTP_FRAMING_LENGTH);
+    CHECK(head.content_length == 12);
+    CHECK(head.keep_alive);
+    CHECK(head.head_len == strlen(length) - 12);
+
+    CHECK(parse_head(length, true, &head) == HTTP_PARSE_OK);
+    CHECK(head.framing == HTTP_FRAMING_NONE);
+    CHECK(head.keep_alive);
+
+    CHECK(parse_head("HTTP/1.1 200 OK\r\nTransfer-Encoding: gzip, chunked\r\n\r\n", false, &head) == HTTP_PARSE_OK);
+    CHECK(head.framing == HTTP_FRAMING_CHUNKED);
+    CHECK(head.keep_alive);
+
+    CHECK(parse_head("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked, gzip\r\n\r\n", false, &head) == HTTP_PARSE_OK);
+    CHECK(head.framing == HTTP_FRAMING_CLOSE);
+    CHECK(!head.keep_alive);
+
+    CHECK(parse_head("HTTP/1.1 200 OK\r\n\r\n", false, &head) == HTTP_PARSE_OK);
+    CHECK(head.framing == HTTP_FRAMING_CLOSE);
+    CHECK(!head.keep_alive);
+
+    CHECK(parse_head("HTTP/1.1 204 No Content\r\n\r\n", false, &head) == HTTP_PARSE_OK);
+    CHECK(head.framing == HTTP_FRAMING_NONE);
+    CHECK(head.keep_alive);
+
+    CHECK(parse_head("HTTP/1.1 304 Not Modified\r\nContent-Length: 10\r\n\r\n", false, &head) == HTTP_PARSE_OK);
+    CHECK(head.framing == HTTP_FRAMING_NONE);
+
+    /* Both framings: the coding wins and the connection is not reused. */
+    CHECK(parse_head(
+        "HTTP/1.1 200 OK\r\nContent-Length: 3\r\nTransfer-Encoding: chunked\r\n\r\n",
+        false,
+        &head
+    ) == HTTP_PARSE_OK);
+    CHECK(head.framing == HTTP_FRAMING_CHUNKED);
+    CHECK(!head.keep_alive);
+}
+
+static void test_parse_head_connection(void) {
+    http_upstream_head_t head;
+    CHECK(parse_head("HTTP/1.1 200 OK\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", false, &head) ==
+        HTTP_PARSE_OK);
+    CHECK(!head.keep_alive);
+
+    CHECK(parse_head("HTTP/1.0 200 OK\r\nContent-Length: 0\r\n\r\n", false, &head) == HTTP_PARSE_OK);
+    CHECK(!head.keep_alive);
+
+    CHECK(parse_head("HTTP/1.0 200 OK\r\nContent-Length: 0\r\nConnection: Keep-Alive\r\n\r\n", false, &head) ==
+        HTTP_PARSE_OK);
+    CHECK(head.keep_alive);
+}
+
+static void test_parse_head_errors(void) {
+    http_upstream_head_t head;
+    CHECK(parse_head("HTTP/1.1 200 OK\r\nContent-Length: 5\r\n", false, &head) == HTTP_PARSE_INCOMPLETE);
+    CHECK(parse_head("HTTP/1.1 2", false, &head) == HTTP_PARSE_INCOMPLETE);
+    CHECK(parse_head("HTTP/2 200 OK\r\n\r\n", false, &head) == HTTP_PARSE_ERROR);
+    CHECK(parse_head("HTTP/1.1 2x0 OK\r\n\r\n", false, &head) == HTTP_PARSE_ERROR);
+    CHECK(parse_head("HTTP/1.1 200 OK\r\nno colon\r\n\r\n", false, &head) == HTTP_PARSE_ERROR);
+    CHECK(parse_head("HTTP/1.1 200 OK\r\nContent-Length: 1x\r\n\r\n", false, &head) == HTTP_PARSE_ERROR);
+    CHECK(parse_head(
+        "HTTP/1.1 200 OK\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n",
+        false,
+        &head
+    ) == HTTP_PARSE_ERROR);
+
+    size_t big_len = HTTP_PROXY_HEAD_CAP + 64;
+    char *big = malloc(big_len);
+    CHECK(big != NULL);
+    if (big != NULL) {
+        memset(big, 'a', big_len);
+        memcpy(big, "HTTP/1.1 200 OK\r\nX-Big: ", 24);
+        CHECK(http_proxy_parse_head(big, big_len, false, &head) == HTTP_PARSE_ERROR);
+        free(big);
+    }
+}
+
+static void test_format_head(void) {
+    const char *raw =
+        "HTTP/1.0 404 Not Found\r\n"
+        "Content-Length: 4\r\n"
+        "Connection: keep-alive\r\n"
+        "Keep-Alive: timeout=5\r\n"
+        "X-Upstream: a\r\n"
+        "\r\n"
+        "gone";
+    http_upstream_head_t head;
+    CHECK(parse_head(raw, false, &head) == HTTP_PARSE_OK);
+
+    char out[256];
+    ssize_t n = http_proxy_format_head(raw, &head, false, out, sizeof(out));
+    const char *expected =
+        "HTTP/1.1 404 Not Found\r\n"
+        "Content-Length: 4\r\n"
+        "X-Upstream: a\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n";
+    CHECK(n == (ssize_t)strlen(expected));
+    CHECK(n > 0 && memcmp(out, expected, (size_t)n) == 0);
+
+    n = http_proxy_format_head(raw, &head, true, out, sizeof(out));
+    CHECK(n > 0 && contains(out, (size_t)n, "Connection: close\r\n\r\n"));
+    CHECK(http_proxy_format_head(raw, &head, false, out, 16) == -1);
+}
+
+static void test_chunk_scan(void) {
+    const char *body = "5;ext=1\r\nhello\r\n6\r\n world\r\n0\r\nX-Trailer: t\r\n\r\nHTTP/1.1";
+    size_t body_len = strlen(body) - strlen("HTTP/1.1");
+
+    /* Whole, then one byte at a time: the end is found at the same place. */
+    http_chunk_scan_t scan;
+    bool done = false;
+    http_chunk_scan_init(&scan);
+    CHECK(http_chunk_scan(&scan, body, strlen(body), &done) == (ssize_t)body_len);
+    CHECK(done);
+
+    http_chunk_scan_init(&scan);
+    size_t pos = 0;
+    done = false;
+    while (!done && pos < strlen(body)) {
+        ssize_t n = http_chunk_scan(&scan, body + pos, 1, &done);
+        CHECK(n == 1);
+        if (n != 1) {
+            break;
+        }
+        ++pos;
+    }
+    CHECK(done);
+    CHECK(pos == body_len);
+
+    http_chunk_scan_init(&scan);
+    CHECK(http_chunk_scan(&scan, "zz\r\n", 4, &done) == -1);
+    http_chunk_scan_init(&scan);
+    CHECK(http_chunk_scan(&scan, "3\r\nabcX", 7, &done) == -1);
+    http_chunk_scan_init(&scan);
+    CHECK(http_chunk_scan(&scan, "10000000000000000\r\n", 19, &done) == -1);
+}
+
+int main(void) {
+    test_format_request();
+    test_format_request_adds_host();
+    test_parse_head_framing();
+    test_parse_head_connection();
+    test_parse_head_errors();
+    test_format_head();
+    test_chunk_scan();
+
+    if (g_failures == 0) {
+        printf("proxy tests passed\n");
+        return 0;
+    }
+
+    fprintf(stderr, "proxy tests failed: %d failure(s)\n", g_failures);
+    return 1;
+}
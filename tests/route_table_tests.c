@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http_route_table.h"
+
+static int g_failures = 0;
+
+#define CHECK(expr)                                                                                 \
+    do {                                                                                            \
+        if (!(expr)) {                                                                              \
+            fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #expr);                      \
+            ++g_failures;                                                                           \
+        }                                                                                           \
+    } while (0)
+
+#define GET HTTP_METHOD_BIT(HTTP_METHOD_GET)
+#define POST HTTP_METHOD_BIT(HTTP_METHOD_POST)
+#define PUT HTTP_METHOD_BIT(HTTP_METHOD_PUT)
+
+static http_route_lookup_t lookup(
+    const http_route_table_t *table,
+    http_method_t method,
+    const char *path,
+    http_route_match_t *match
+) {
+    return http_route_table_lookup(table, method, path, strlen(path), match);
+}
+
+static void test_exact_and_methods(void) {
+    static const int healthz = 1;
+    static const int upload_post = 2;
+    static const int upload_put = 3;
+    static const int root = 4;
+
+    http_route_table_t table;
+    CHECK(http_route_table_init(&table) == 0);
+    CHECK(http_route_table_add(&table, GET, "/healthz", &healthz) == 0);
+    CHECK(http_route_table_add(&table, POST, "/upload", &upload_post) == 0);
+    CHECK(http_route_table_add(&table, PUT, "/upload", &upload_put) == 0);
+    CHECK(http_route_table_add(&table, GET, "/", &root) == 0);
+
+    http_route_match_t match;
+    CHECK(lookup(&table, HTTP_METHOD_GET, "/healthz", &match) == HTTP_LOOKUP_FOUND);
+    CHECK(match.target == &healthz);
+    CHECK(match.param_count == 0);
+    CHECK(lookup(&table, HTTP_METHOD_POST, "/upload", &match) == HTTP_LOOKUP_FOUND);
+    CHECK(match.target == &upload_post);
+    CHECK(lookup(&table, HTTP_METHOD_PUT, "/upload", &match) == HTTP_LOOKUP_FOUND);
+    CHECK(match.target == &upload_put);
+    CHECK(lookup(&table, HTTP_METHOD_GET, "/", &match) == HTTP_LOOKUP_FOUND);
+    CHECK(match.target == &root);
+
+    CHECK(lookup(&table, HTTP_METHOD_POST, "/healthz", &match) == HTTP_LOOKUP_BAD_METHOD);
+    CHECK(match.target == &healthz);
+    CHECK(lookup(&table, HTTP_METHOD_OTHER, "/upload", &match) == HTTP_LOOKUP_BAD_METHOD);
+    CHECK(match.target == &upload_post);
+
+    CHECK(lookup(&table, HTTP_METHOD_GET, "/healthz/", &match) == HTTP_LOOKUP_NOT_FOUND);
+    CHECK(lookup(&table, HTTP_METHOD_GET, "/health", &match) == HTTP_LOOKUP_NOT_FOUND);
+    CHECK(lookup(&table, HTTP_METHOD_GET, "/healthzz", &match) == HTTP_LOOKUP_NOT_FOUND);
+    CHECK(lookup(&table, HTTP_METHOD_GET, "healthz", &match) == HTTP_LOOKUP_NOT_FOUND);
+    CHECK(lookup(&table, HTTP_METHOD_GET, "", &match) == HTTP_LOOKUP_NOT_FOUND);
+    CHECK(match.target == NULL);
+
+    /* Malformed patterns and a method routed twice for the same pattern. */
+    CHECK(http_route_table_add(&table, GET, "healthz", &healthz) != 0);
+    CHECK(http_route_table_add(&table, GET, "/a/*/b", &healthz) != 0);
+    CHECK(http_route_table_add(&table, GET, "/a/:", &healthz) != 0);
+    CHECK(http_route_table_add(&table, 0, "/a", &healthz) != 0);
+    CHECK(http_route_table_add(&table, GET | PUT, "/upload", &healthz) != 0);
+    CHECK(http_route_table_add(&table, GET, "/upload", &healthz) == 0);
+
+    http_route_table_destroy(&table);
+}
+
+static void test_params_and_prefixes(void) {
+    static const int bytes = 1;
+    static const int item = 2;
+    static const int item_raw = 3;
+    static const int files = 4;
+    static const int files_special = 5;
+    static const int any = 6;
+
+    http_route_table_t table;
+    CHECK(http_route_table_init(&table) == 0);
+    CHECK(http_route_table_add(&table, GET, "/bytes/:count", &bytes) == 0);
+    CHECK(http_route_table_add(&table, GET, "/users/:id/items/:item", &item) == 0);
+    CHECK(http_route_table_add(&table, GET, "/users/:id/items/raw", &item_raw) == 0);
+    CHECK(http_route_table_add(&table, GET, "/static/*", &files) == 0);
+    CHECK(http_route_table_add(&table, GET, "/static/special/*", &files_special) == 0);
+
+    http_route_match_t match;
+    CHECK(lookup(&table, HTTP_METHOD_GET, "/bytes/42", &match) == HTTP_LOOKUP_FOUND);
+    CHECK(match.target == &bytes);
+    CHECK(match.param_count == 1);
+    CHECK(http_view_eq(&match.params[0], "42"));
+    CHECK(lookup(&table, HTTP_METHOD_GET, "/bytes/", &match) == HTTP_LOOKUP_NOT_FOUND);
+    CHECK(lookup(&table, HTTP_METHOD_GET, "/bytes/1/2", &match) == HTTP_LOOKUP_NOT_FOUND);
+
+    CHECK(lookup(&table, HTTP_METHOD_GET, "/users/7/items/99", &match) == HTTP_LOOKUP_FOUND);
+    CHECK(match.target == &item);
+    CHECK(match.param_count == 2);
+    CHECK(http_view_eq(&match.params[0], "7"));
+    CHECK(http_view_eq(&match.params[1], "99"));
+    CHECK(lookup(&table, HTTP_METHOD_GET, "/users/7/items/raw", &match) == HTTP_LOOKUP_FOUND);
+    CHECK(match.target == &item_raw);
+    CHECK(match.param_count == 1);
+
+    CHECK(lookup(&table, HTTP_METHOD_GET, "/static/a/b.txt", &match) == HTTP_LOOKUP_FOUND);
+    CHECK(match.target == &files);
+    CHECK(http_view_eq(&match.rest, "a/b.txt"));
+    CHECK(lookup(&table, HTTP_METHOD_GET, "/static/", &match) == HTTP_LOOKUP_FOUND);
+    CHECK(match.target == &files);
+    CHECK(match.rest.len == 0);
+    CHECK(lookup(&table, HTTP_METHOD_GET, "/static", &match) == HTTP_LOOKUP_NOT_FOUND);
+    CHECK(lookup(&table, HTTP_METHOD_GET, "/static/special/x", &match) == HTTP_LOOKUP_FOUND);
+    CHECK(match.target == &files_special);
+    CHECK(http_view_eq(&match.rest, "x"));
+    /* A dead end below a longer literal falls back to the deepest prefix passed. */
+    CHECK(lookup(&table, HTTP_METHOD_GET, "/static/specialist", &match) == HTTP_LOOKUP_FOUND);
+    CHECK(match.target == &files);
+    CHECK(http_view_eq(&match.rest, "specialist"));
+    CHECK(lookup(&table, HTTP_METHOD_POST, "/static/x", &match) == HTTP_LOOKUP_BAD_METHOD);
+    CHECK(match.target == &files);
+
+    CHECK(lookup(&table, HTTP_METHOD_GET, "/nothing/here", &match) == HTTP_LOOKUP_NOT_FOUND);
+    CHECK(http_route_table_add(&table, GET, "/*", &any) == 0);
+    CHECK(lookup(&table, HTTP_METHOD_GET, "/nothing/here", &match) == HTTP_LOOKUP_FOUND);
+    CHECK(match.target == &any);
+    CHECK(http_view_eq(&match.rest, "nothing/here"));
+    /* Parameters captured past the prefix are dropped with the rest of the walk. */
+    CHECK(lookup(&table, HTTP_METHOD_GET, "/users/7/other", &match) == HTTP_LOOKUP_FOUND);
+    CHECK(match.target == &any);
+    CHECK(match.param_count == 0);
+
+    http_route_table_destroy(&table);
+}
+
+static void test_many_routes(void) {
+    enum { ROUTES = 5000 };
+    static int targets[ROUTES];
+
+    http_route_table_t table;
+    CHECK(http_route_table_init(&table) == 0);
+    char pattern[64];
+    for (int i = 0; i < ROUTES; ++i) {
+        targets[i] = i;
+        snprintf(pattern, sizeof(pattern), "/api/v%d/resource%d/:id", i % 7, i);
+        CHECK(http_route_table_add(&table, GET | POST, pattern, &targets[i]) == 0);
+    }
+    CHECK(table.route_count == ROUTES);
+
+    int misses = 0;
+    for (int i = 0; i < ROUTES; ++i) {
+        char path[64];
+        snprintf(path, sizeof(path), "/api/v%d/resource%d/%d", i % 7, i, i * 3);
+        http_route_match_t match;
+        if (lookup(&table, HTTP_METHOD_POST, path, &match) != HTTP_LOOKUP_FOUND ||
+            match.target != &targets[i] ||
+            match.param_count != 1) {
+            ++misses;
+        }
+    }
+    CHECK(misses == 0);
+
+    http_route_match_t match;
+    CHECK(lookup(&table, HTTP_METHOD_GET, "/api/v1/resource2/1", &match) == HTTP_LOOKUP_NOT_FOUND);
+    http_route_table_destroy(&table);
+}
+
+int main(void) {
+    test_exact_and_methods();
+    test_params_and_prefixes();
+    test_many_routes();
+
+    if (g_failures == 0) {
+        printf("route table tests passed\n");
+        return 0;
+    }
+
+    fprintf(stderr, "route table tests failed: %d failure(s)\n", g_failures);
+    return 1;
+}
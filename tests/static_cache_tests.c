@@ -0,0 +1,347 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "static_cache.h"
+
+static int g_failures = 0;
+
+#define CHECK(expr)                                                                                 \
+    do {                                                                                            \
+        if (!(expr)) {                                                                              \
+            fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #expr);                      \
+            ++g_failures;                                                                           \
+        }                                                                                           \
+    } while (0)
+
+static int open_null(void) {
+    return open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+static bool fd_is_open(int fd) {
+    return fcntl(fd, F_GETFD) != -1;
+}
+
+static struct stat fake_stat(off_t size) {
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_size = size;
+    return st;
+}
+
+static static_cache_file_t fake_file(int fd, const struct stat *st, const static_cache_render_t *render) {
+    static_cache_file_t file = {
+        .fd = fd,
+        .size = st->st_size,
+        .st = st,
+        .content_type = "text/plain",
+        .source = STATIC_CACHE_FILE,
+        .render = render,
+    };
+    return file;
+}
+
+static static_cache_entry_t *insert_file(
+    const char *path,
+    off_t size,
+    const static_cache_render_t *render,
+    unsigned long long generation
+) {
+    int fd = open_null();
+    struct stat st = fake_stat(size);
+    static_cache_file_t file = fake_file(fd, &st, render);
+    static_cache_entry_t *entry = static_cache_insert(path, strlen(path), HTTP_ENCODING_IDENTITY, &file, generation);
+    if (entry == NULL) {
+        close(fd);
+    }
+    return entry;
+}
+
+static static_cache_entry_t *insert_path(const char *path) {
+    return insert_file(path, 42, NULL, static_cache_generation());
+}
+
+static bool cached_as(const char *path, http_encoding_t encoding) {
+    static_cache_entry_t *entry = static_cache_acquire(path, strlen(path), encoding);
+    static_cache_release(entry);
+    return entry != NULL;
+}
+
+static bool cached(const char *path) {
+    return cached_as(path, HTTP_ENCODING_IDENTITY);
+}
+
+static void test_insert_and_lookup(void) {
+    CHECK(static_cache_init(8, 0) == 0);
+    CHECK(static_cache_acquire("a.txt", 5, HTTP_ENCODING_IDENTITY) == NULL);
+
+    static_cache_entry_t *inserted = insert_path("a.txt");
+    CHECK(inserted != NULL);
+    static_cache_entry_t *hit = static_cache_acquire("a.txt", 5, HTTP_ENCODING_IDENTITY);
+    CHECK(hit == inserted);
+    CHECK(hit != NULL && hit->size == 42 && strcmp(hit->content_type, "text/plain") == 0);
+    CHECK(static_cache_acquire("a.tx", 4, HTTP_ENCODING_IDENTITY) == NULL);
+    CHECK(static_cache_acquire("a.txt", 5, HTTP_ENCODING_GZIP) == NULL);
+
+    /* A racing insert for the same path returns the existing entry and closes its fd. */
+    int dup_fd = open_null();
+    struct stat st = fake_stat(7);
+    static_cache_file_t dup = fake_file(dup_fd, &st, NULL);
+    static_cache_entry_t *again = static_cache_insert("a.txt", 5, HTTP_ENCODING_IDENTITY, &dup, static_cache_generation());
+    CHECK(again == inserted);
+    CHECK(!fd_is_open(dup_fd));
+
+    static_cache_release(again);
+    static_cache_release(hit);
+    static_cache_release(inserted);
+    static_cache_destroy();
+}
+
+static void test_clock_eviction(void) {
+    CHECK(static_cache_init(4, 0) == 0);
+    const char *paths[] = {"a", "b", "c", "d"};
+    for (int i = 0; i < 4; ++i) {
+        static_cache_release(insert_path(paths[i]));
+    }
+
+    /* "a" was hit since insertion, so the hand passes it and evicts "b". */
+    CHECK(cached("a"));
+    static_cache_release(insert_path("e"));
+    CHECK(cached("a"));
+    CHECK(!cached("b"));
+    CHECK(cached("c"));
+    CHECK(cached("d"));
+    CHECK(cached("e"));
+    static_cache_destroy();
+}
+
+static void test_pinned_entries_survive_eviction(void) {
+    CHECK(static_cache_init(2, 0) == 0);
+    static_cache_entry_t *a = insert_path("a");
+    static_cache_entry_t *b = insert_path("b");
+    CHECK(a != NULL && b != NULL);
+    int a_fd = a->fd;
+
+    /* Both slots are pinned by in-flight responses: they are unlinked but not reused. */
+    CHECK(insert_path("c") == NULL);
+    CHECK(!cached("a"));
+    CHECK(fd_is_open(a_fd));
+    CHECK(strcmp(a->path, "a") == 0);
+
+    static_cache_release(a);
+    CHECK(!fd_is_open(a_fd));
+    static_cache_entry_t *c = insert_path("c");
+    CHECK(c == a);
+    static_cache_release(c);
+    static_cache_release(b);
+    static_cache_destroy();
+}
+
+static void test_invalidation(void) {
+    CHECK(static_cache_init(8, 0) == 0);
+    const char *paths[] = {"a.txt", "img/a.png", "img/b.png", "imgx/c.png", "img/deep/d.png"};
+    for (int i = 0; i < 5; ++i) {
+        static_cache_release(insert_path(paths[i]));
+    }
+
+    static_cache_invalidate("a.txt", 5);
+    CHECK(!cached("a.txt"));
+    CHECK(cached("img/a.png"));
+
+    static_cache_invalidate_prefix("img", 3);
+    CHECK(!cached("img/a.png"));
+    CHECK(!cached("img/b.png"));
+    CHECK(!cached("img/deep/d.png"));
+    CHECK(cached("imgx/c.png"));
+
+    /* A file opened before an invalidation is served but not published. */
+    unsigned long long generation = static_cache_generation();
+    static_cache_invalidate("late.txt", 8);
+    int fd = open_null();
+    struct stat st = fake_stat(1);
+    static_cache_file_t late = fake_file(fd, &st, NULL);
+    CHECK(static_cache_insert("late.txt", 8, HTTP_ENCODING_IDENTITY, &late, generation) == NULL);
+    CHECK(fd_is_open(fd));
+    close(fd);
+
+    static_cache_invalidate_prefix("", 0);
+    CHECK(!cached("imgx/c.png"));
+    static_cache_destroy();
+}
+
+static bool keep_large(const static_cache_entry_t *entry, void *arg) {
+    (void)arg;
+    return entry->size > 10;
+}
+
+static void test_revalidate(void) {
+    CHECK(static_cache_init(4, 0) == 0);
+    static_cache_release(insert_path("big"));
+    static_cache_release(insert_file("small", 3, NULL, static_cache_generation()));
+
+    CHECK(static_cache_revalidate(keep_large, NULL) == 1);
+    CHECK(cached("big"));
+    CHECK(!cached("small"));
+    static_cache_destroy();
+}
+
+static static_cache_render_t make_render(size_t keep_alive_len, size_t close_len) {
+    static_cache_render_t render;
+    render.data = malloc(keep_alive_len + close_len);
+    memset(render.data, 'r', keep_alive_len + close_len);
+    render.len[STATIC_CACHE_VARIANT_KEEP_ALIVE] = keep_alive_len;
+    render.len[STATIC_CACHE_VARIANT_CLOSE] = close_len;
+    return render;
+}
+
+static void test_render_budget(void) {
+    CHECK(static_cache_init(4, 100) == 0);
+    struct stat st = fake_stat(10);
+
+    /* Accepted: the entry keeps the rendered bytes and no fd. */
+    int fd = open_null();
+    static_cache_render_t render = make_render(30, 30);
+    static_cache_file_t file = fake_file(fd, &st, &render);
+    CHECK(static_cache_render_fits(60));
+    static_cache_entry_t *a = static_cache_insert("a", 1, HTTP_ENCODING_IDENTITY, &file, static_cache_generation());
+    CHECK(a != NULL && a->fd == -1 && a->render.data == render.data);
+    CHECK(!fd_is_open(fd));
+    CHECK(!static_cache_render_fits(60));
+
+    /* Over budget: render is dropped and the entry falls back to the fd. */
+    fd = open_null();
+    render = make_render(30, 30);
+    file = fake_file(fd, &st, &render);
+    static_cache_entry_t *b = static_cache_insert("b", 1, HTTP_ENCODING_IDENTITY, &file, static_cache_generation());
+    CHECK(b != NULL && b->fd == fd && b->render.data == NULL);
+    CHECK(fd_is_open(fd));
+
+    /* Budget is returned once the last reference to an evicted entry goes. */
+    static_cache_invalidate("a", 1);
+    CHECK(!static_cache_render_fits(60));
+    static_cache_release(a);
+    CHECK(static_cache_render_fits(60));
+
+    static_cache_release(b);
+    static_cache_destroy();
+}
+
+static void test_encoding_variants(void) {
+    CHECK(static_cache_init(8, 0) == 0);
+    static_cache_release(insert_path("app.js"));
+
+    /* A sidecar variant is keyed separately and remembers the sidecar's own size. */
+    int fd = open_null();
+    struct stat st = fake_stat(12);
+    static_cache_file_t gz = fake_file(fd, &st, NULL);
+    gz.source = STATIC_CACHE_SIDECAR;
+    static_cache_entry_t *entry = static_cache_insert("app.js", 6, HTTP_ENCODING_GZIP, &gz, static_cache_generation());
+    CHECK(entry != NULL && entry->encoding == HTTP_ENCODING_GZIP && entry->size == 12);
+
+    /* Variants of the same file never share a strong ETag. */
+    static_cache_entry_t *plain = static_cache_acquire("app.js", 6, HTTP_ENCODING_IDENTITY);
+    CHECK(plain != NULL && entry != NULL && plain->etag[0] == '"' && strcmp(plain->etag, entry->etag) != 0);
+    char etag[STATIC_CACHE_ETAG_CAP];
+    static_cache_format_etag(etag, sizeof(etag), &st, HTTP_ENCODING_GZIP);
+    CHECK(entry != NULL && strcmp(etag, entry->etag) == 0);
+    static_cache_release(plain);
+    static_cache_release(entry);
+
+    /* A negative entry holds no fd and tells the caller to skip the coding. */
+    static_cache_file_t absent = {.fd = -1, .content_type = "text/plain", .source = STATIC_CACHE_ABSENT};
+    entry = static_cache_insert("app.js", 6, HTTP_ENCODING_BR, &absent, static_cache_generation());
+    CHECK(entry != NULL && entry->fd == -1 && entry->source == STATIC_CACHE_ABSENT && entry->ino == 0);
+    CHECK(entry != NULL && entry->etag[0] == '\0');
+    static_cache_release(entry);
+
+    CHECK(cached_as("app.js", HTTP_ENCODING_IDENTITY));
+    CHECK(cached_as("app.js", HTTP_ENCODING_GZIP));
+    CHECK(cached_as("app.js", HTTP_ENCODING_BR));
+    CHECK(!cached_as("app.js", HTTP_ENCODING_ZSTD));
+
+    /* Invalidating the path drops every variant of it. */
+    static_cache_invalidate("app.js", 6);
+    for (int e = 0; e < HTTP_ENCODING_COUNT; ++e) {
+        CHECK(!cached_as("app.js", (http_encoding_t)e));
+    }
+    static_cache_destroy();
+}
+
+static void test_disabled(void) {
+    CHECK(static_cache_init(0, 0) == 0);
+    CHECK(insert_path("a") == NULL);
+    CHECK(!cached("a"));
+    static_cache_destroy();
+}
+
+#define STRESS_THREADS 4
+#define STRESS_PATHS 64
+#define STRESS_ITERS 20000
+
+static void *stress_worker(void *arg) {
+    unsigned seed = (unsigned)(size_t)arg;
+    int *bad = calloc(1, sizeof(int));
+    for (int i = 0; i < STRESS_ITERS; ++i) {
+        char path[16];
+        seed = seed * 1103515245u + 12345u;
+        int n = snprintf(path, sizeof(path), "f%u", (seed >> 8) % STRESS_PATHS);
+
+        static_cache_entry_t *entry = static_cache_acquire(path, (size_t)n, HTTP_ENCODING_IDENTITY);
+        if (entry == NULL) {
+            entry = insert_path(path);
+        }
+        if (entry != NULL) {
+            if (strcmp(entry->path, path) != 0 || !fd_is_open(entry->fd)) {
+                ++*bad;
+            }
+            static_cache_release(entry);
+        }
+    }
+    return bad;
+}
+
+static void test_concurrent_readers_and_writers(void) {
+    int probe = open_null();
+    close(probe);
+
+    CHECK(static_cache_init(16, 0) == 0);
+    pthread_t threads[STRESS_THREADS];
+    for (size_t i = 0; i < STRESS_THREADS; ++i) {
+        CHECK(pthread_create(&threads[i], NULL, stress_worker, (void *)(i + 1)) == 0);
+    }
+    for (size_t i = 0; i < STRESS_THREADS; ++i) {
+        void *bad = NULL;
+        pthread_join(threads[i], &bad);
+        CHECK(bad != NULL && *(int *)bad == 0);
+        free(bad);
+    }
+    static_cache_destroy();
+
+    /* Every cached fd was closed: the lowest free descriptor is unchanged. */
+    int after = open_null();
+    CHECK(after == probe);
+    close(after);
+}
+
+int main(void) {
+    test_insert_and_lookup();
+    test_clock_eviction();
+    test_pinned_entries_survive_eviction();
+    test_invalidation();
+    test_revalidate();
+    test_render_budget();
+    test_encoding_variants();
+    test_disabled();
+    test_concurrent_readers_and_writers();
+
+    if (g_failures == 0) {
+        printf("static cache tests passed\n");
+        return 0;
+    }
+
+    fprintf(stderr, "static cache tests failed: %d failure(s)\n", g_failures);
+    return 1;
+}
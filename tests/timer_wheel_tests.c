@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timer_wheel.h"
+
+static int g_failures = 0;
+
+#define CHECK(expr)                                                                                 \
+    do {                                                                                            \
+        if (!(expr)) {                                                                              \
+            fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #expr);                      \
+            ++g_failures;                                                                           \
+        }                                                                                           \
+    } while (0)
+
+typedef struct {
+    timer_node_t node;
+    uint64_t deadline_ms;
+    uint64_t fired_at_ms;
+    int fired;
+} test_timer_t;
+
+typedef struct {
+    uint64_t now_ms;
+    timer_wheel_t *wheel;
+    test_timer_t *cancel_on_fire;
+    test_timer_t *rearm_on_fire;
+} fire_ctx_t;
+
+static void on_fire(timer_node_t *node, void *arg) {
+    fire_ctx_t *fc = arg;
+    test_timer_t *t = (test_timer_t *)node;
+    ++t->fired;
+    t->fired_at_ms = fc->now_ms;
+    if (fc->cancel_on_fire != NULL && fc->cancel_on_fire != t) {
+        timer_wheel_cancel(fc->wheel, &fc->cancel_on_fire->node);
+    }
+    if (fc->rearm_on_fire == t) {
+        fc->rearm_on_fire = NULL;
+        timer_wheel_arm(fc->wheel, node, fc->now_ms + 50);
+    }
+}
+
+static void run_until(timer_wheel_t *wheel, fire_ctx_t *fc, uint64_t from_ms, uint64_t to_ms, uint64_t step_ms) {
+    for (uint64_t now = from_ms; now <= to_ms; now += step_ms) {
+        fc->now_ms = now;
+        timer_wheel_advance(wheel, now, on_fire, fc);
+    }
+}
+
+static void test_fires_at_deadline_across_levels(void) {
+    timer_wheel_t wheel;
+    const uint64_t start = 1000003;
+    timer_wheel_init(&wheel, 10, start);
+
+    /* Deadlines land on every level, including the clamp at the top. */
+    static const uint64_t offsets[] = {0, 5, 10, 639, 640, 655, 5000, 40950, 41000, 3600000, 2621430};
+    enum { N = sizeof(offsets) / sizeof(offsets[0]) };
+    test_timer_t timers[N];
+    memset(timers, 0, sizeof(timers));
+    for (size_t i = 0; i < N; ++i) {
+        timers[i].deadline_ms = start + offsets[i];
+        timer_wheel_arm(&wheel, &timers[i].node, timers[i].deadline_ms);
+    }
+
+    fire_ctx_t fc = {0, &wheel, NULL, NULL};
+    run_until(&wheel, &fc, start, start + 3700000, 7);
+
+    for (size_t i = 0; i < N; ++i) {
+        CHECK(timers[i].fired == 1);
+        CHECK(timers[i].fired_at_ms >= timers[i].deadline_ms);
+        CHECK(timers[i].fired_at_ms < timers[i].deadline_ms + 10 + 7);
+    }
+    CHECK(wheel.armed == 0);
+}
+
+static void test_rearm_and_cancel(void) {
+    timer_wheel_t wheel;
+    timer_wheel_init(&wheel, 10, 0);
+
+    test_timer_t moved;
+    test_timer_t cancelled;
+    memset(&moved, 0, sizeof(moved));
+    memset(&cancelled, 0, sizeof(cancelled));
+
+    timer_wheel_arm(&wheel, &moved.node, 100);
+    timer_wheel_arm(&wheel, &moved.node, 5000);
+    timer_wheel_arm(&wheel, &cancelled.node, 200);
+    CHECK(wheel.armed == 2);
+    timer_wheel_cancel(&wheel, &cancelled.node);
+    timer_wheel_cancel(&wheel, &cancelled.node);
+    CHECK(!timer_node_armed(&cancelled.node));
+    CHECK(wheel.armed == 1);
+
+    fire_ctx_t fc = {0, &wheel, NULL, NULL};
+    run_until(&wheel, &fc, 0, 4990, 10);
+    CHECK(moved.fired == 0);
+    CHECK(cancelled.fired == 0);
+    run_until(&wheel, &fc, 5000, 5000, 10);
+    CHECK(moved.fired == 1);
+    CHECK(cancelled.fired == 0);
+}
+
+static void test_callback_may_modify_wheel(void) {
+    timer_wheel_t wheel;
+    timer_wheel_init(&wheel, 10, 0);
+
+    test_timer_t a;
+    test_timer_t b;
+    test_timer_t c;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    memset(&c, 0, sizeof(c));
+
+    /* Same slot: whichever fires first cancels b; c re-arms itself once. */
+    timer_wheel_arm(&wheel, &a.node, 100);
+    timer_wheel_arm(&wheel, &b.node, 100);
+    timer_wheel_arm(&wheel, &c.node, 100);
+
+    fire_ctx_t fc = {0, &wheel, &b, &c};
+    run_until(&wheel, &fc, 0, 100, 10);
+    CHECK(a.fired == 1);
+    CHECK(b.fired == 0);
+    CHECK(c.fired == 1);
+    CHECK(timer_node_armed(&c.node));
+
+    fc.cancel_on_fire = NULL;
+    run_until(&wheel, &fc, 110, 200, 10);
+    CHECK(c.fired == 2);
+    CHECK(wheel.armed == 0);
+}
+
+static void test_idle_wheel_jumps(void) {
+    timer_wheel_t wheel;
+    timer_wheel_init(&wheel, 10, 0);
+
+    fire_ctx_t fc = {0, &wheel, NULL, NULL};
+    CHECK(timer_wheel_advance(&wheel, 10000000, on_fire, &fc) == 0);
+
+    test_timer_t t;
+    memset(&t, 0, sizeof(t));
+    timer_wheel_arm(&wheel, &t.node, 10000000 + 30);
+    fc.now_ms = 10000030;
+    CHECK(timer_wheel_advance(&wheel, 10000030, on_fire, &fc) == 1);
+    CHECK(t.fired == 1);
+}
+
+int main(void) {
+    test_fires_at_deadline_across_levels();
+    test_rearm_and_cancel();
+    test_callback_may_modify_wheel();
+    test_idle_wheel_jumps();
+
+    if (g_failures == 0) {
+        printf("timer wheel tests passed\n");
+        return 0;
+    }
+
+    fprintf(stderr, "timer wheel tests failed: %d failure(s)\n", g_failures);
+    return 1;
+}